@@ -0,0 +1,733 @@
+/**
+ * @file ARTIndex.cpp - implementation of ARTIndex and its nodes
+ * ARTNode: base class of the nodes
+ * ARTSortedNode: ARTNode with up to 4 or 16 children, their bytes in order
+ * ARTNode48: ARTNode with up to 48 children and a slot for each of them in a table of all the bytes
+ * ARTNode256: ARTNode with a child for each byte
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include <algorithm>
+#include <cstring>
+#include "ARTIndex.h"
+
+/**
+ * @class ARTNode - a node of an ARTIndex's tree
+ */
+class ARTNode {
+public:
+    NormalizedKey prefix;  // the bytes of the key between the parent's branch and this one's
+    Handles *handles;  // of the rows whose key ends here (nullptr for none)
+    uint count;  // children
+
+    ARTNode() : prefix(), handles(nullptr), count(0) {}
+
+    virtual ~ARTNode() { delete handles; }  // (but not the children: see destroy)
+
+    ARTNode(const ARTNode &other) = delete;
+
+    ARTNode(ARTNode &&temp) = delete;
+
+    ARTNode &operator=(const ARTNode &other) = delete;
+
+    ARTNode &operator=(ARTNode &&temp) = delete;
+
+    virtual uint get_size() const = 0;  // 0, 1, 2, 3 for nodes of up to 4, 16, 48, 256 children
+
+    virtual ARTNode **find(uint8_t byte) = 0;  // where the child for the byte is (nullptr if there isn't one)
+
+    virtual ARTNode *next(uint &byte) const = 0;  // the child with the lowest byte >= byte, setting byte to it
+
+    virtual void add(uint8_t byte, ARTNode *child) = 0;  // (there must be room)
+
+    virtual void remove(uint8_t byte) = 0;
+
+    bool is_full() const { return this->count == CAPACITY[get_size()]; }
+
+    ARTNode *get_child(uint8_t byte) const {
+        ARTNode **child = const_cast<ARTNode *>(this)->find(byte);
+        return child == nullptr ? nullptr : *child;
+    }
+
+    ARTNode *grow();  // a node of the next size up with everything this one has, deleting this one
+
+    ARTNode *shrink();  // ditto the next size down, if this one has gotten small enough (otherwise this one)
+
+    static ARTNode *make(uint size);
+
+    static void destroy(ARTNode *node);  // and all the nodes below it
+
+    static const uint CAPACITY[4];
+    static const uint SHRINK_AT[4];  // shrinks when it gets down to this many children
+
+protected:
+    ARTNode *move_to(ARTNode *other);
+};
+
+const uint ARTNode::CAPACITY[4] = {4, 16, 48, 256};
+const uint ARTNode::SHRINK_AT[4] = {0, 3, 12, 40};
+
+/**
+ * @class ARTSortedNode - node with the bytes of its children kept in order
+ */
+template<uint SIZE>
+class ARTSortedNode : public ARTNode {
+public:
+    ARTSortedNode() : ARTNode() {}
+
+    virtual uint get_size() const { return SIZE; }
+
+    virtual ARTNode **find(uint8_t byte) {
+        for (uint i = 0; i < count && bytes[i] <= byte; i++)
+            if (bytes[i] == byte)
+                return &children[i];
+        return nullptr;
+    }
+
+    virtual ARTNode *next(uint &byte) const {
+        for (uint i = 0; i < count; i++)
+            if (bytes[i] >= byte) {
+                byte = bytes[i];
+                return children[i];
+            }
+        return nullptr;
+    }
+
+    virtual void add(uint8_t byte, ARTNode *child) {
+        uint i = count++;
+        for (; i > 0 && bytes[i - 1] > byte; i--) {
+            bytes[i] = bytes[i - 1];
+            children[i] = children[i - 1];
+        }
+        bytes[i] = byte;
+        children[i] = child;
+    }
+
+    virtual void remove(uint8_t byte) {
+        uint i = 0;
+        while (i < count && bytes[i] != byte)
+            i++;
+        for (count--; i < count; i++) {
+            bytes[i] = bytes[i + 1];
+            children[i] = children[i + 1];
+        }
+    }
+
+protected:
+    uint8_t bytes[SIZE == 0 ? 4 : 16];
+    ARTNode *children[SIZE == 0 ? 4 : 16];
+};
+
+/**
+ * @class ARTNode48 - node with a table of which of its slots (if any) has the child for each byte
+ */
+class ARTNode48 : public ARTNode {
+public:
+    ARTNode48() : ARTNode() {
+        memset(slots, 0, sizeof(slots));
+        memset(children, 0, sizeof(children));
+    }
+
+    virtual uint get_size() const { return 2; }
+
+    virtual ARTNode **find(uint8_t byte) { return slots[byte] == 0 ? nullptr : &children[slots[byte] - 1]; }
+
+    virtual ARTNode *next(uint &byte) const {
+        for (; byte < 256; byte++)
+            if (slots[byte] != 0)
+                return children[slots[byte] - 1];
+        return nullptr;
+    }
+
+    virtual void add(uint8_t byte, ARTNode *child) {
+        uint slot = 0;
+        while (children[slot] != nullptr)
+            slot++;
+        children[slot] = child;
+        slots[byte] = (uint8_t) (slot + 1);
+        count++;
+    }
+
+    virtual void remove(uint8_t byte) {
+        children[slots[byte] - 1] = nullptr;
+        slots[byte] = 0;
+        count--;
+    }
+
+protected:
+    uint8_t slots[256];  // one more than the slot in children for each byte (0 for no child)
+    ARTNode *children[48];
+};
+
+/**
+ * @class ARTNode256 - node with a slot for every byte
+ */
+class ARTNode256 : public ARTNode {
+public:
+    ARTNode256() : ARTNode() {
+        memset(children, 0, sizeof(children));
+    }
+
+    virtual uint get_size() const { return 3; }
+
+    virtual ARTNode **find(uint8_t byte) { return children[byte] == nullptr ? nullptr : &children[byte]; }
+
+    virtual ARTNode *next(uint &byte) const {
+        for (; byte < 256; byte++)
+            if (children[byte] != nullptr)
+                return children[byte];
+        return nullptr;
+    }
+
+    virtual void add(uint8_t byte, ARTNode *child) {
+        children[byte] = child;
+        count++;
+    }
+
+    virtual void remove(uint8_t byte) {
+        children[byte] = nullptr;
+        count--;
+    }
+
+protected:
+    ARTNode *children[256];
+};
+
+ARTNode *ARTNode::make(uint size) {
+    switch (size) {
+        case 0:
+            return new ARTSortedNode<0>();
+        case 1:
+            return new ARTSortedNode<1>();
+        case 2:
+            return new ARTNode48();
+        default:
+            return new ARTNode256();
+    }
+}
+
+ARTNode *ARTNode::grow() {
+    return move_to(make(get_size() + 1));
+}
+
+ARTNode *ARTNode::shrink() {
+    if (get_size() == 0 || count > SHRINK_AT[get_size()])
+        return this;
+    return move_to(make(get_size() - 1));
+}
+
+ARTNode *ARTNode::move_to(ARTNode *other) {
+    ARTNode *child;
+    for (uint byte = 0; (child = next(byte)) != nullptr; byte++)
+        other->add((uint8_t) byte, child);
+    other->prefix.swap(this->prefix);
+    other->handles = this->handles;
+    this->handles = nullptr;
+    delete this;
+    return other;
+}
+
+void ARTNode::destroy(ARTNode *node) {
+    if (node == nullptr)
+        return;
+    ARTNode *child;
+    for (uint byte = 0; (child = node->next(byte)) != nullptr; byte++)
+        destroy(child);
+    delete node;
+}
+
+// A node with nothing but the rest of a key and its handle.
+static ARTNode *make_leaf(const NormalizedKey &key, u_long depth, Handle handle) {
+    ARTNode *leaf = ARTNode::make(0);
+    leaf->prefix = key.substr(depth);
+    leaf->handles = new Handles(1, handle);
+    return leaf;
+}
+
+// Add the handles of the keys below node (path being the key up to node's prefix) that are between min and max (an
+// end of nullptr being open), in key order. False once the keys are past max.
+static bool scan(const ARTNode *node, NormalizedKey &path, const NormalizedKey *min, const NormalizedKey *max,
+                 Handles &found) {
+    u_long mark = path.size();
+    path += node->prefix;
+    bool more = true;
+    u_long n = min == nullptr ? 0 : std::min(path.size(), min->size());
+    int vs_max = max == nullptr ? -1 : path.compare(0, std::min(path.size(), max->size()), *max);
+    if (min != nullptr && path.compare(0, n, *min, 0, n) < 0) {
+        // every key down here is before min
+    } else if (vs_max > 0 || (vs_max == 0 && path.size() > max->size())) {
+        more = false;  // and every key down here is after max
+    } else {
+        if (node->handles != nullptr && (min == nullptr || *min <= path))
+            found.insert(found.end(), node->handles->begin(), node->handles->end());
+        ARTNode *child;
+        for (uint byte = 0; more && (child = node->next(byte)) != nullptr; byte++) {
+            path.push_back((char) byte);
+            more = scan(child, path, min, max, found);
+            path.pop_back();
+        }
+    }
+    path.resize(mark);
+    return more;
+}
+
+static void count_nodes(const ARTNode *node, u_long counts[4]) {
+    counts[node->get_size()]++;
+    ARTNode *child;
+    for (uint byte = 0; (child = node->next(byte)) != nullptr; byte++)
+        count_nodes(child, counts);
+}
+
+
+/************
+ * ARTIndex *
+ ************/
+
+ARTIndex::ARTIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique), latch(), closed(true), key_profile(), root(nullptr),
+          key_count(0) {
+    build_key_profile();
+}
+
+ARTIndex::~ARTIndex() {
+    ARTNode::destroy(root);
+}
+
+// Create the index: there's nothing to it but building the tree from the rows already in the table.
+void ARTIndex::create() {
+    build();
+    closed = false;
+}
+
+// Drop the index.
+void ARTIndex::drop() {
+    close();
+}
+
+// Open existing index by building the tree. Enables: lookup, range, insert, delete, relocate.
+void ARTIndex::open() {
+    if (closed) {
+        build();
+        closed = false;
+    }
+}
+
+// Closes the index, throwing away the tree. Disables: lookup, range, insert, delete, relocate.
+void ARTIndex::close() {
+    BTreeLatch::Exclusive exclusive(this->latch);
+    ARTNode::destroy(root);
+    root = nullptr;
+    key_count = 0;
+    closed = true;
+}
+
+// Find all the rows whose columns are equal to key: compare each node's prefix and go down by the next byte.
+Handles *ARTIndex::lookup(ValueDict *key_dict) const {
+    NormalizedKey *key = this->tkey(key_dict);
+    Handles *found = new Handles;
+    {
+        BTreeLatch::Shared shared(this->latch);
+        const ARTNode *node = root;
+        u_long depth = 0;
+        while (node != nullptr && key->compare(depth, node->prefix.size(), node->prefix) == 0) {
+            depth += node->prefix.size();
+            if (depth == key->size()) {
+                if (node->handles != nullptr)
+                    *found = *node->handles;
+                break;
+            }
+            node = node->get_child((uint8_t) (*key)[depth++]);
+        }
+    }
+    delete key;
+    return found;
+}
+
+// Find all the rows whose keys are between min_key and max_key (inclusive), in key order. Either end can be nullptr
+// for an open end.
+Handles *ARTIndex::range(ValueDict *min_key, ValueDict *max_key) const {
+    NormalizedKey *tmin = min_key == nullptr ? nullptr : this->tkey(min_key);
+    NormalizedKey *tmax = max_key == nullptr ? nullptr : this->tkey(max_key);
+    Handles *found = new Handles;
+    {
+        BTreeLatch::Shared shared(this->latch);
+        NormalizedKey path;
+        if (root != nullptr)
+            scan(root, path, tmin, tmax, *found);
+    }
+    delete tmin;
+    delete tmax;
+    return found;
+}
+
+// Insert a row with the given handle. Row must exist in relation already.
+void ARTIndex::insert(Handle handle) {
+    insert(handle, nullptr);
+}
+
+// Insert a row with the given handle and values (or, with row of nullptr, the values it has in the relation).
+void ARTIndex::insert(Handle handle, const ValueDict *row) {
+    open();
+    NormalizedKey *key = row_key(handle, row);
+    try {
+        BTreeLatch::Exclusive exclusive(this->latch);
+        add(*key, handle);
+    } catch (...) {
+        delete key;
+        throw;
+    }
+    delete key;
+}
+
+// Delete the index entry for the row with the given handle. Row must still be in relation.
+void ARTIndex::del(Handle handle) {
+    del(handle, nullptr);
+}
+
+// Delete the index entry for the row with the given handle and values (or, with row of nullptr, the values it has
+// in the relation).
+void ARTIndex::del(Handle handle, const ValueDict *row) {
+    open();
+    NormalizedKey *key = row_key(handle, row);
+    {
+        BTreeLatch::Exclusive exclusive(this->latch);
+        remove(*key, handle);
+    }
+    delete key;
+}
+
+// The row that used to be at from is now at to.
+void ARTIndex::relocate(Handle from, Handle to) {
+    open();
+    NormalizedKey *key = row_key(to);
+    {
+        BTreeLatch::Exclusive exclusive(this->latch);
+        remove(*key, from);
+        add(*key, to);
+    }
+    delete key;
+}
+
+NormalizedKey *ARTIndex::tkey(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns) {
+        auto column = key->find(column_name);
+        if (column == key->end())
+            throw DbRelationError("missing key column '" + column_name + "'");
+        key_value.push_back(column->second);
+    }
+    return new NormalizedKey(normalize_key(key_value, key_profile));
+}
+
+void ARTIndex::get_node_counts(u_long counts[4]) const {
+    BTreeLatch::Shared shared(this->latch);
+    for (uint size = 0; size < 4; size++)
+        counts[size] = 0;
+    if (root != nullptr)
+        count_nodes(root, counts);
+}
+
+// Figure out the data types of each key component and encode them in key_profile.
+void ARTIndex::build_key_profile() {
+    std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+void ARTIndex::build() {
+    BTreeLatch::Exclusive exclusive(this->latch);
+    ARTNode::destroy(root);
+    root = nullptr;
+    key_count = 0;
+    try {
+        BlockID block_count = relation.get_block_count();
+        for (BlockID block_id = 1; block_id <= block_count; block_id++) {
+            Handles handles;
+            ValueDicts *rows = project_block(block_id, handles);
+            try {
+                for (uint i = 0; i < rows->size(); i++) {
+                    NormalizedKey *key = this->tkey((*rows)[i]);
+                    try {
+                        add(*key, handles[i]);
+                    } catch (...) {
+                        delete key;
+                        throw;
+                    }
+                    delete key;
+                }
+            } catch (...) {
+                for (auto const &row: *rows)
+                    delete row;
+                delete rows;
+                throw;
+            }
+            for (auto const &row: *rows)
+                delete row;
+            delete rows;
+        }
+    } catch (...) {
+        ARTNode::destroy(root);
+        root = nullptr;
+        key_count = 0;
+        throw;
+    }
+}
+
+// The key of the given row, or of the row with the given handle, read from the relation (freed by caller).
+NormalizedKey *ARTIndex::row_key(Handle handle, const ValueDict *row) {
+    if (row != nullptr)
+        return this->tkey(row);
+    ValueDict *projected = relation.project(handle);
+    NormalizedKey *key = this->tkey(projected);
+    delete projected;
+    return key;
+}
+
+// Go down the tree as far as the key matches. Where it stops matching a node's prefix, the prefix is split with a
+// new node that branches between the two; where there's no child for the key's next byte, the rest of the key goes
+// into a new leaf (growing the node first if it's full).
+void ARTIndex::add(const NormalizedKey &key, Handle handle) {
+    ARTNode **ref = &root;
+    u_long depth = 0;
+    while (true) {
+        ARTNode *node = *ref;
+        if (node == nullptr) {
+            *ref = make_leaf(key, depth, handle);
+            key_count++;
+            return;
+        }
+        u_long same = 0;
+        while (same < node->prefix.size() && depth + same < key.size() && node->prefix[same] == key[depth + same])
+            same++;
+        if (same < node->prefix.size()) {
+            ARTNode *split = ARTNode::make(0);
+            split->prefix = node->prefix.substr(0, same);
+            split->add((uint8_t) node->prefix[same], node);
+            node->prefix.erase(0, same + 1);
+            *ref = node = split;
+        }
+        depth += node->prefix.size();
+        if (depth == key.size()) {
+            if (node->handles == nullptr) {
+                node->handles = new Handles;
+                key_count++;
+            } else if (this->unique) {
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+            }
+            node->handles->push_back(handle);
+            return;
+        }
+        uint8_t byte = (uint8_t) key[depth];
+        ARTNode **child = node->find(byte);
+        if (child == nullptr) {
+            if (node->is_full())
+                *ref = node = node->grow();
+            node->add(byte, make_leaf(key, depth + 1, handle));
+            key_count++;
+            return;
+        }
+        ref = child;
+        depth++;
+    }
+}
+
+// Take the handle out of the key's node. A node left with no handles and no children comes out of its parent, and
+// then the node above (if it has no handles of its own and just one child left) is merged into its child, or shrunk
+// if it's gotten small enough.
+void ARTIndex::remove(const NormalizedKey &key, Handle handle) {
+    std::vector<std::pair<ARTNode **, uint8_t>> path;  // where each node is, and the byte it's under in its parent
+    ARTNode **ref = &root;
+    u_long depth = 0;
+    uint8_t byte = 0;
+    while (true) {
+        ARTNode *node = *ref;
+        if (node == nullptr || key.compare(depth, node->prefix.size(), node->prefix) != 0)
+            return;
+        path.push_back(std::make_pair(ref, byte));
+        depth += node->prefix.size();
+        if (depth == key.size())
+            break;
+        byte = (uint8_t) key[depth++];
+        ref = node->find(byte);
+        if (ref == nullptr)
+            return;
+    }
+    ARTNode *node = *path.back().first;
+    if (node->handles == nullptr)
+        return;
+    auto at = std::find(node->handles->begin(), node->handles->end(), handle);
+    if (at == node->handles->end())
+        return;
+    node->handles->erase(at);
+    if (!node->handles->empty())
+        return;
+    delete node->handles;
+    node->handles = nullptr;
+    key_count--;
+    if (node->count == 0) {
+        byte = path.back().second;
+        delete node;
+        *path.back().first = nullptr;
+        path.pop_back();
+        if (path.empty())
+            return;
+        (*path.back().first)->remove(byte);
+    }
+    ref = path.back().first;
+    node = *ref;
+    if (node->handles == nullptr && node->count == 1) {
+        uint only = 0;
+        ARTNode *child = node->next(only);
+        child->prefix = node->prefix + (char) only + child->prefix;
+        node->remove((uint8_t) only);
+        delete node;
+        *ref = child;
+    } else {
+        *ref = node->shrink();
+    }
+}
+
+// The size of node one with count children should be as they're added one at a time (growing only when full), and
+// as they're taken out again (shrinking only once down to 40, 12, or 3, so that it doesn't flip back and forth).
+static uint art_size_growing(uint count) {
+    return count <= 4 ? 0 : count <= 16 ? 1 : count <= 48 ? 2 : 3;
+}
+
+static uint art_size_shrinking(uint count) {
+    return count > 40 ? 3 : count > 12 ? 2 : count > 3 ? 1 : 0;
+}
+
+bool test_art_index() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("name");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_art_index", column_names, column_attributes);
+    table.create();
+    ARTIndex id_index(table, "art_id", ColumnNames(1, "id"), true);
+    id_index.create();
+
+    // keys 0 to 255 share their first three bytes and differ in the last, so the root (with the three bytes as its
+    // prefix) has a child for each, growing from 4 to 16 to 48 to 256 children just as each size fills up
+    const uint KEYS = 256;
+    Handles handles;
+    for (uint i = 0; i < KEYS; i++) {
+        ValueDict row;
+        row["id"] = Value((int) i);
+        row["name"] = Value("row");
+        handles.push_back(table.insert(&row));
+        id_index.insert(handles.back(), &row);
+        const ARTNode *root = id_index.root;
+        if (i > 0 && (root->count != i + 1 || root->prefix.size() != 3 ||
+                      root->get_size() != art_size_growing(i + 1))) {
+            std::cout << "art root with " << i + 1 << " children is size " << root->get_size() << " with "
+                      << root->count << " children" << std::endl;
+            return false;
+        }
+    }
+    u_long counts[4];
+    id_index.get_node_counts(counts);
+    if (counts[0] != KEYS || counts[1] != 0 || counts[2] != 0 || counts[3] != 1) {
+        std::cout << "art tree has the wrong nodes: " << counts[0] << " " << counts[1] << " " << counts[2] << " "
+                  << counts[3] << std::endl;
+        return false;
+    }
+    for (uint i = 0; i < KEYS; i++) {
+        ValueDict lookup;
+        lookup["id"] = Value((int) i);
+        Handles *found = id_index.lookup(&lookup);
+        bool ok = found->size() == 1 && found->front() == handles[i];
+        delete found;
+        if (!ok) {
+            std::cout << "art lookup of " << i << " after growing failed" << std::endl;
+            return false;
+        }
+    }
+
+    // taking them out again, the root shrinks from 256 to 48 at 40 children, to 16 at 12, and to 4 at 3 (and doesn't
+    // grow back at the next insert); with one left, it's merged into its child, a leaf with the whole key
+    for (uint i = KEYS - 1; i >= 1; i--) {
+        ValueDict row;
+        row["id"] = Value((int) i);
+        id_index.del(handles[i], &row);
+        const ARTNode *root = id_index.root;
+        if (i == 1 ? root->count != 0 || root->prefix.size() != 4 :
+            root->count != i || root->get_size() != art_size_shrinking(i)) {
+            std::cout << "art root with " << i << " children left is size " << root->get_size() << " with "
+                      << root->count << " children and a prefix of " << root->prefix.size() << std::endl;
+            return false;
+        }
+        if (i == 40) {
+            id_index.insert(handles[i], &row);
+            if (id_index.root->get_size() != 2) {
+                std::cout << "art root grew back as soon as it shrank" << std::endl;
+                return false;
+            }
+            id_index.del(handles[i], &row);
+        }
+    }
+
+    // keys sharing a long prefix hang off one node that has all of it, until a key that parts from them partway
+    // through splits the prefix there; taking that key out again merges the two back together
+    const std::string common = "customer-account-number-";
+    ColumnNames name_column(1, "name");
+    ARTIndex name_index(table, "art_name", name_column, false);
+    name_index.create();  // (all "row")
+    for (auto const &handle: handles)
+        name_index.del(handle);
+    const int NAMES = 10;
+    for (int i = 0; i < NAMES; i++) {
+        ValueDict row;
+        row["id"] = Value(1000 + i);
+        row["name"] = Value(common + std::to_string(i));
+        name_index.insert(table.insert(&row), &row);
+    }
+    const ARTNode *root = name_index.root;
+    if (root == nullptr || root->prefix != common || root->count != NAMES) {
+        std::cout << "art keys with a long shared prefix weren't compressed into one node" << std::endl;
+        return false;
+    }
+    ValueDict parting;
+    parting["id"] = Value(2000);
+    parting["name"] = Value("customer-zzz");
+    Handle parting_handle = table.insert(&parting);
+    name_index.insert(parting_handle, &parting);
+    root = name_index.root;
+    const ARTNode *below = root->get_child((uint8_t) 'a');
+    if (root->prefix != "customer-" || root->count != 2 || below == nullptr ||
+        below->prefix != common.substr(10) || below->count != NAMES) {
+        std::cout << "art prefix wasn't split where a key parted from it" << std::endl;
+        return false;
+    }
+    for (auto const &name: {common.substr(0, 16), common, common + "5", std::string("customer-zzz")}) {
+        ValueDict lookup;
+        lookup["name"] = Value(name);
+        Handles *found = name_index.lookup(&lookup);
+        u_long count = found->size();
+        delete found;
+        if (count != (name.size() > common.size() || name == "customer-zzz" ? 1U : 0U)) {
+            std::cout << "art lookup of '" << name << "' found " << count << std::endl;
+            return false;
+        }
+    }
+    name_index.del(parting_handle, &parting);
+    root = name_index.root;
+    if (root->prefix != common || root->count != NAMES || name_index.get_key_count() != NAMES) {
+        std::cout << "art prefix wasn't merged back after the key that split it was deleted" << std::endl;
+        return false;
+    }
+
+    id_index.drop();
+    name_index.drop();
+    table.drop();
+    return true;
+}
@@ -0,0 +1,79 @@
+/**
+ * @file ARTIndex.h - ARTIndex, an in-memory adaptive radix tree index
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include "BTreeNode.h"
+
+class ARTNode;
+
+/**
+ * @class ARTIndex - in-memory adaptive radix tree over the normalized key, for small tables that are looked up a lot
+ *
+ * Nothing is kept on disk: the tree is built from the rows in the relation when the index is created or opened,
+ * and changes to it are lost when it's closed (it's just built again the next time). Each node branches on one
+ * byte of the key and comes in four sizes (up to 4, 16, 48, or 256 children), growing and shrinking into the next
+ * size as children come and go. A node also has the bytes that all the keys below it share before the byte it
+ * branches on (path compression), and the handles of the rows whose key ends right there. Since the children are in
+ * byte order and normalized keys sort the way their values do, range lookups walk the tree in order.
+ */
+class ARTIndex : public DbIndex {
+public:
+    ARTIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~ARTIndex();
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key) const;
+
+    virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    virtual void del(Handle handle);
+
+    virtual void del(Handle handle, const ValueDict *row);
+
+    virtual void relocate(Handle from, Handle to);
+
+    // pull out the key values from the ValueDict in order, normalized (freed by caller)
+    virtual NormalizedKey *tkey(const ValueDict *key) const;
+
+    u_long get_key_count() const { return this->key_count; }
+
+    void get_node_counts(u_long counts[4]) const;  // how many nodes of each size: 4, 16, 48, 256
+
+protected:
+    mutable BTreeLatch latch;  // shared for lookups, exclusive for changes
+    bool closed;
+    KeyProfile key_profile;
+    ARTNode *root;
+    u_long key_count;
+
+    void build_key_profile();
+
+    void build();  // from the rows in the relation
+
+    // tkey of row, or of the row in the relation with the given handle if row is nullptr (freed by caller)
+    NormalizedKey *row_key(Handle handle, const ValueDict *row = nullptr);
+
+    void add(const NormalizedKey &key, Handle handle);  // (with the latch held exclusively)
+
+    void remove(const NormalizedKey &key, Handle handle);  // (ditto)
+
+    friend bool test_art_index();
+};
+
+bool test_art_index();
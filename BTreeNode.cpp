@@ -4,7 +4,9 @@
  * @see "Seattle University, CPSC5300, Spring 2021"
  */
 
+#include <algorithm>
 #include <cstring>
+#include <string>
 #include "BTreeNode.h"
 
 using namespace std;
@@ -17,22 +19,36 @@ BTreeNode::BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
                                                                                                      file(file),
                                                                                                      id(block_id),
                                                                                                      key_profile(
-                                                                                                             key_profile) {
-    if (create) {
-        this->block = file.get_new();
-        this->id = this->block->get_block_id();
-    } else {
-        this->block = file.get(block_id);
-    }
+                                                                                                             key_profile),
+                                                                                                     cache(nullptr),
+                                                                                                     appended(0) {
+    SlottedPage *page = create && block_id == 0 ? file.get_new() : file.get(block_id);
+    this->id = page->get_block_id();
+
+    // copy the block out of the file's buffer, which its next read reuses
+    char *bytes = new char[DbBlock::BLOCK_SZ];
+    memcpy(bytes, page->get_data(), DbBlock::BLOCK_SZ);
+    delete page;
+    Dbt data(bytes, DbBlock::BLOCK_SZ);
+    this->block = new SlottedPage(data, this->id, false);
+    if (create && block_id != 0)
+        this->block->clear();
 }
 
 BTreeNode::~BTreeNode() {
+    char *bytes = (char *) this->block->get_data();
     delete this->block;
+    delete[] bytes;
     this->block = nullptr;
 }
 
 void BTreeNode::save() {
-    this->file.put(this->block);
+    if (this->cache == nullptr) {
+        this->file.put(this->block);
+    } else {
+        std::lock_guard<std::mutex> guard(this->cache->get_latch());
+        this->file.put(this->block);
+    }
 }
 
 // Get the record and turn it into a block ID.
@@ -52,36 +68,20 @@ Handle BTreeNode::get_handle(RecordID record_id) const {
     return Handle(handle_block_id, handle_record_id);
 }
 
-// Get the record and turn it into a KeyValue.
-KeyValue *BTreeNode::get_key(RecordID record_id) const {
+// Get the record and turn it into a NormalizedKey.
+NormalizedKey BTreeNode::get_key(RecordID record_id) const {
     Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char *) dbt->get_data();
-    KeyValue *key_value = new KeyValue();
-    Value value;
-    uint offset = 0;
-    for (auto const &data_type: this->key_profile) {
-        value.data_type = data_type;
-        if (data_type == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t *) (bytes + offset);
-            offset += sizeof(int32_t);
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            uint16_t size = *(uint16_t *) (bytes + offset);
-            offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t *) (bytes + offset);
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
-        }
-        key_value->push_back(value);
-    }
+    NormalizedKey key((char *) dbt->get_data(), dbt->get_size());
     delete dbt;
-    return key_value;
+    return key;
+}
+
+// Compare the key in the given record with key right in the block.
+int BTreeNode::compare_key(RecordID record_id, const NormalizedKey *key) const {
+    Dbt *dbt = this->block->get(record_id);
+    int cmp = -key->compare(0, NormalizedKey::npos, (char *) dbt->get_data(), dbt->get_size());
+    delete dbt;
+    return cmp;
 }
 
 // Convert block_id into bytes.
@@ -92,6 +92,18 @@ Dbt *BTreeNode::marshal_block_id(BlockID block_id) {
     return dbt;
 }
 
+void BTreeNode::add_record(Dbt *dbt) {
+    try {
+        this->block->add(dbt);
+    } catch (...) {
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+        throw;
+    }
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+}
+
 // Convert handle into bytes.
 Dbt *BTreeNode::marshal_handle(Handle handle) {
     char *bytes = new char[sizeof(BlockID) + sizeof(RecordID)];
@@ -101,49 +113,103 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
     return dbt;
 }
 
-// Convert KeyValue into bytes.
-Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const &data_type: this->key_profile) {
-        Value value = (*key)[col_num];
-
-        if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("index key too big to marshal");
+// Convert key into bytes (without the first skip of them, which the node has in its common prefix).
+Dbt *BTreeNode::marshal_key(const NormalizedKey *key, u_long skip) {
+    if (key->size() > DbBlock::BLOCK_SZ / 4)
+        throw DbRelationError("index key too big to marshal");
+    u_long size = key->size() - skip;
+    char *bytes = new char[size];
+    memcpy(bytes, key->data() + skip, size);
+    return new Dbt(bytes, (u_int32_t) size);
+}
 
-            *(int32_t *) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
+// Order-preserving encoding of key (see NormalizedKey). The key may leave off the profile's last columns.
+NormalizedKey normalize_key(const KeyValue &key, const KeyProfile &key_profile) {
+    if (key.size() > key_profile.size())
+        throw DbRelationError("key has more values than its index has columns");
+    NormalizedKey ret;
+    for (uint i = 0; i < key.size(); i++) {
+        const Value &value = key[i];
+        if (value.data_type != key_profile[i])
+            throw DbRelationError("key value doesn't match the type of its index column");
+        if (value.data_type == ColumnAttribute::DataType::INT) {
+            uint32_t n = (uint32_t) value.n ^ 0x80000000U;
+            for (int shift = 24; shift >= 0; shift -= 8)
+                ret.push_back((char) (n >> shift));
+        } else if (value.data_type == ColumnAttribute::DataType::TEXT) {
+            for (char c: value.s) {
+                ret.push_back(c);
+                if (c == '\0')
+                    ret.push_back('\xff');
+            }
+            ret.push_back('\0');
+            ret.push_back('\0');
+        } else if (value.data_type == ColumnAttribute::DataType::BOOLEAN) {
+            ret.push_back((char) (value.n != 0));
+        } else {
+            throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
+        }
+    }
+    return ret;
+}
 
+// Decode a normalized key. A separator may have been cut short, in which case what's missing comes out as zeros.
+KeyValue *denormalize_key(const NormalizedKey &key, const KeyProfile &key_profile) {
+    NormalizedKey padded = key + NormalizedKey(sizeof(int32_t) + 2, '\0');
+    KeyValue *ret = new KeyValue();
+    uint offset = 0;
+    for (auto const &data_type: key_profile) {
+        Value value;
+        value.data_type = data_type;
+        if (offset >= key.size()) {
+            // cut off
+        } else if (data_type == ColumnAttribute::DataType::INT) {
+            uint32_t n = 0;
+            for (int i = 0; i < 4; i++)
+                n = (n << 8) | (uint8_t) padded[offset++];
+            value.n = (int32_t) (n ^ 0x80000000U);
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            u_long size = (uint16_t) value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("index key too big to marshal");
-
-            *(uint16_t *) (bytes + offset) = (uint16_t) size;
-            offset += sizeof(uint16_t);
-            memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("index key too big to marshal");
-
-            *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
-            offset += sizeof(uint8_t);
+            while (offset < key.size() && (padded[offset] != '\0' || padded[offset + 1] != '\0')) {
+                value.s.push_back(padded[offset]);
+                offset += padded[offset] == '\0' ? 2 : 1;  // skip the escape
+            }
+            offset += 2;
+        } else {
+            value.n = (uint8_t) padded[offset++];
+        }
+        ret->push_back(value);
+    }
+    return ret;
+}
 
+// Bytes taken up by the first columns of a normalized key.
+u_long normalized_size(const NormalizedKey &key, const KeyProfile &key_profile, uint columns) {
+    u_long offset = 0;
+    for (uint i = 0; i < columns && offset < key.size(); i++) {
+        if (key_profile[i] == ColumnAttribute::DataType::INT) {
+            offset += sizeof(int32_t);
+        } else if (key_profile[i] == ColumnAttribute::DataType::TEXT) {
+            while (offset + 1 < key.size() && (key[offset] != '\0' || key[offset + 1] != '\0'))
+                offset += key[offset] == '\0' ? 2 : 1;  // skip the escape
+            offset += 2;
         } else {
-            throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
+            offset++;
         }
     }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+    return std::min(offset, (u_long) key.size());
+}
+
+u_long common_prefix(const NormalizedKey &a, const NormalizedKey &b) {
+    u_long i = 0;
+    while (i < a.size() && i < b.size() && a[i] == b[i])
+        i++;
+    return i;
+}
+
+// Suffix truncation: all a parent needs to tell left's entries from right's is right up to its first byte that
+// differs from left.
+NormalizedKey shortest_separator(const NormalizedKey &left, const NormalizedKey &right) {
+    return right.substr(0, common_prefix(left, right) + 1);
 }
 
 
@@ -156,37 +222,69 @@ BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const Ke
                                                                                                                    key_profile,
                                                                                                                    false),
                                                                                                          root_id(new_root),
-                                                                                                         height(1) {
+                                                                                                         height(1),
+                                                                                                         free_list(0) {
     save();
 }
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile &key_profile) : BTreeNode(file, stat_id,
                                                                                                  key_profile, false),
                                                                                        root_id(get_block_id(ROOT)),
-                                                                                       height(get_block_id(HEIGHT)) {
+                                                                                       height(get_block_id(HEIGHT)),
+                                                                                       free_list(0) {
+    uint version = this->block->size() >= VERSION ? get_block_id(VERSION) : 1;  // (1 was never stamped)
+    if (version != FORMAT_VERSION)
+        throw DbRelationError("index file is in format " + std::to_string(version) + ", not " +
+                              std::to_string(FORMAT_VERSION) + " -- REINDEX the table to rebuild it");
+    this->free_list = get_block_id(FREE);
 }
 
+// Rewrite the whole block.
 void BTreeStat::save() {
+    this->block->clear();
     Dbt *dbt = marshal_block_id(this->root_id);
-    bool is_new = (this->block->size() == 0);
-    if (is_new)
-        this->block->add(dbt);
-    else
-        this->block->put(ROOT, *dbt);
-    delete[] (char *) dbt->get_data();
-    delete dbt;
+    add_record(dbt);
 
     dbt = marshal_block_id(this->height);  // not really a block ID but it fits
-    if (is_new)
-        this->block->add(dbt);
-    else
-        this->block->put(HEIGHT, *dbt);
-    delete[] (char *) dbt->get_data();
-    delete dbt;
+    add_record(dbt);
+
+    dbt = marshal_block_id(this->free_list);
+    add_record(dbt);
+
+    dbt = marshal_block_id(FORMAT_VERSION);
+    add_record(dbt);
 
     BTreeNode::save();
 }
 
+// Pop the first block off the free list.
+BlockID BTreeStat::allocate() {
+    BlockID block_id = this->free_list;
+    if (block_id != 0) {
+        SlottedPage *page = this->file.get(block_id);
+        Dbt *dbt = page->get(1);
+        this->free_list = *(BlockID *) dbt->get_data();
+        delete dbt;
+        delete page;
+        save();
+    }
+    return block_id;
+}
+
+// Push a block onto the free list.
+void BTreeStat::release(BlockID block_id) {
+    SlottedPage *page = this->file.get(block_id);
+    page->clear();
+    Dbt *dbt = marshal_block_id(this->free_list);
+    page->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    this->file.put(page);
+    delete page;
+    this->free_list = block_id;
+    save();
+}
+
 
 /*****************
  * BTreeInterior *
@@ -195,129 +293,164 @@ void BTreeStat::save() {
 BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(
         file, block_id, key_profile, create), first(0), pointers(), boundaries() {
     if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == 1) {
-                // first pointer
-                this->first = get_block_id(i);
-            } else if (i % 2 != 0) {
-                // pointer
-                this->pointers.push_back(get_block_id(i));
-            } else {
-                // key
-                KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
-            }
-            i++;
+        // prefix common to all the boundaries, first pointer, then the rest of each boundary and its pointer
+        RecordID count = this->block->size();
+        NormalizedKey prefix = get_key(1);
+        this->first = get_block_id(2);
+        for (RecordID i = 3; i < count; i += 2) {
+            this->boundaries.push_back(prefix + get_key(i));
+            this->pointers.push_back(get_block_id(i + 1));
         }
-        delete record_id_list;
     }
 }
 
 BTreeInterior::~BTreeInterior() {
-    for (auto key_value: this->boundaries)
-        delete key_value;
-    this->boundaries.clear();
 }
 
 // Get next block down in tree where key must be.
-BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
-            else
-                down = this->first;
-            break;
-        }
+BTreeNode *BTreeInterior::find(const NormalizedKey *key, uint depth) const {
+    return get_child(key == nullptr ? 0 : find_index(key), depth);
+}
+
+// Index of the child where key must be: 0 for first, i for pointers[i - 1]. That's the first boundary greater
+// than key (binary search), or the last pointer if there isn't one.
+uint BTreeInterior::find_index(const NormalizedKey *key) const {
+    auto after = upper_bound(this->boundaries.begin(), this->boundaries.end(), *key);
+    return (uint) (after - this->boundaries.begin());
+}
+
+// The given child (depth is our height, so 2 means the children are leaves).
+BTreeNode *BTreeInterior::get_child(uint index, uint depth) const {
+    return this->cache->get(get_child_id(index), depth == 2);
+}
+
+// Bulk load: add a boundary and the child after it (boundary must be greater than any here, and first must
+// already be set). Returns false, adding nothing, if that would use more than max_bytes of the block.
+bool BTreeInterior::append(const NormalizedKey *boundary, BlockID block_id, u_long max_bytes) {
+    if (this->boundaries.empty())
+        this->appended = sizeof(BlockID) + 4 + 4;  // first pointer (and its record header) and the block header
+    u_long needed = boundary->size() + sizeof(BlockID) + 8;  // and a record header each
+    bool fits = true;
+    if (!this->boundaries.empty()) {
+        // the boundaries are in order, so the prefix they all share is the one the first has in common with this
+        u_long n = this->boundaries.size() + 1;
+        u_long prefix = common_prefix(this->boundaries.front(), *boundary);
+        fits = this->appended + needed - n * prefix + prefix + 4 <= max_bytes;
     }
-    if (depth == 2)
-        return new BTreeLeaf(this->file, down, this->key_profile, false);
-    else
-        return new BTreeInterior(this->file, down, this->key_profile, false);
+    if (fits) {
+        this->appended += needed;
+        this->boundaries.push_back(*boundary);
+        this->pointers.push_back(block_id);
+    }
+    return fits;
+}
+
+// Child at index has underflowed, so merge it with a neighbor if the two fit in one block or else even them
+// out. The block of a merged-away child goes on the free list.
+bool BTreeInterior::rebalance(uint index, uint depth, BTreeStat *stat) {
+    if (this->boundaries.empty())
+        return false;  // no neighbor
+    uint left = index > 0 ? index - 1 : 0;  // rebalance children left and left + 1, which boundaries[left] separates
+    BlockID right_id = get_child_id(left + 1);
+    NormalizedKey boundary;
+    bool merged;
+    if (depth == 2) {
+        auto *lnode = dynamic_cast<BTreeLeaf *>(get_child(left, depth));
+        auto *rnode = dynamic_cast<BTreeLeaf *>(get_child(left + 1, depth));
+        merged = lnode->merge_or_even_out(rnode, boundary);
+    } else {
+        auto *lnode = dynamic_cast<BTreeInterior *>(get_child(left, depth));
+        auto *rnode = dynamic_cast<BTreeInterior *>(get_child(left + 1, depth));
+        merged = lnode->merge_or_even_out(rnode, &this->boundaries[left], boundary);
+    }
+    if (merged) {
+        this->boundaries.erase(this->boundaries.begin() + left);
+        this->pointers.erase(this->pointers.begin() + left);
+        this->cache->forget(right_id);
+        stat->release(right_id);
+    } else {
+        this->boundaries[left] = boundary;
+    }
+    save();
+    return merged;
+}
+
+// Take in all of right's entries (with separator between them) if they fit, otherwise split the combined
+// entries evenly between us. Returns true if merged, else false with the new separator in boundary.
+bool BTreeInterior::merge_or_even_out(BTreeInterior *right, const NormalizedKey *separator, NormalizedKey &boundary) {
+    this->boundaries.push_back(*separator);
+    this->pointers.push_back(right->first);
+    this->boundaries.insert(this->boundaries.end(), right->boundaries.begin(), right->boundaries.end());
+    this->pointers.insert(this->pointers.end(), right->pointers.begin(), right->pointers.end());
+    right->boundaries.clear();
+    right->pointers.clear();
+    try {
+        save();
+        return true;
+    } catch (DbBlockNoRoomError &e) {
+        // too much for one block, so move the second half back to right
+    }
+    u_long split = this->boundaries.size() / 2;
+    boundary = this->boundaries[split];
+    right->first = this->pointers[split];
+    for (u_long i = split + 1; i < this->boundaries.size(); i++) {
+        right->boundaries.push_back(this->boundaries[i]);
+        right->pointers.push_back(this->pointers[i]);
+    }
+    this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
+    this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
+    save();
+    right->save();
+    return false;
 }
 
-// Save the pointers and boundaries in the correct order
+// Save the pointers and boundaries in the correct order, with the prefix all the boundaries have in common
+// stored just once, first.
 void BTreeInterior::save() {
     Dbt *dbt;
     this->block->clear();
+    u_long prefix = this->boundaries.empty() ? 0 : common_prefix(this->boundaries.front(), this->boundaries.back());
+    NormalizedKey common = this->boundaries.empty() ? NormalizedKey() : this->boundaries.front().substr(0, prefix);
+    dbt = marshal_key(&common);
+    add_record(dbt);
     dbt = marshal_block_id(this->first);
-    this->block->add(dbt);
-    delete[] (char *) dbt->get_data();
-    delete dbt;
+    add_record(dbt);
     for (uint i = 0; i < this->boundaries.size(); i++) {
         // key
-        dbt = marshal_key(this->boundaries[i]);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+        dbt = marshal_key(&this->boundaries[i], prefix);
+        add_record(dbt);
 
         // boundary
         dbt = marshal_block_id(this->pointers[i]);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+        add_record(dbt);
     }
     BTreeNode::save();
 }
 
 // Insert boundary, block_id pair into block.
-Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
-    // cout << "inserting (" << block_id << ", " << (*boundary)[0] << ") into interior node " << id; // DEBUG
+Insertion BTreeInterior::insert(const NormalizedKey *boundary, BlockID block_id, BTreeStat *stat) {
+    // cout << "inserting (" << block_id << ") into interior node " << id; // DEBUG
     // cout << " (pointers:" << boundaries.size() << ", unused:" << block->unused_bytes() << ") " << endl; // DEBUG
 
-    Dbt *dbt;
-
-    bool inserted = false;
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
-            this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
-            this->pointers.insert(this->pointers.begin() + i, block_id);
-            inserted = true;
-            break;
-        }
-    }
-    if (!inserted) {
-        // must go at the end
-        this->boundaries.push_back(new KeyValue(*boundary));
-        this->pointers.push_back(block_id);
-    }
-    dbt = marshal_block_id(block_id);
+    // goes before the first boundary greater than it (or at the end)
+    uint i = find_index(boundary);
+    this->boundaries.insert(this->boundaries.begin() + i, *boundary);
+    this->pointers.insert(this->pointers.begin() + i, block_id);
     try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(boundary);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
         save();
         return BTreeNode::insertion_none();
 
     } catch (DbBlockNoRoomError &e) {
-        cout << "splitting " << *this << endl; // DEBUG
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
         // too big, so split
 
         // create the sister
-        BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
+        BTreeInterior *nnode = this->cache->new_interior(stat->allocate());
 
         // only the pointer of the middle entry goes into the sister (as it's first pointer)
         // the corresponding boundary is moved up to be inserted into the parent node
         u_long split = this->boundaries.size() / 2;
         nnode->first = this->pointers[split];
-        KeyValue *nboundary = this->boundaries[split];
-        Insertion ret(nnode->id, *nboundary);
-        delete nboundary;
+        Insertion ret(nnode->id, this->boundaries[split]);
 
         // move half of the entries to the sister
         for (u_long i = split + 1; i < this->boundaries.size(); i++) {
@@ -342,8 +475,11 @@ ostream &operator<<(ostream &out, const BTreeInterior &node) {
     if (node.boundaries.size() != node.pointers.size()) {
         out << " MISMATCH boundaries: " << node.boundaries.size() << ", pointers: " << node.pointers.size();
     } else {
-        for (unsigned int i = 0; i < node.boundaries.size(); i++)
-            out << '|' << (*node.boundaries[i])[0] << '|' << node.pointers[i];
+        for (unsigned int i = 0; i < node.boundaries.size(); i++) {
+            KeyValue *boundary = denormalize_key(node.boundaries[i], node.key_profile);
+            out << '|' << (*boundary)[0] << '|' << node.pointers[i];
+            delete boundary;
+        }
     }
     return out;
 }
@@ -353,106 +489,602 @@ ostream &operator<<(ostream &out, const BTreeInterior &node) {
  * BTreeLeaf *
  *************/
 
-BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(file,
-                                                                                                               block_id,
-                                                                                                               key_profile,
-                                                                                                               create),
-                                                                                                     next_leaf(0),
-                                                                                                     key_map() {
-    if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == record_id_list->size()) {
-                // next leaf block
-                this->next_leaf = get_block_id(i);
-            } else if (i % 2 == 0) {
-                // record i-1: handle, record i: key
-                KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i - 1);
+// Posting lists are delta-encoded: the first handle whole, then for each of the others the difference in block
+// id from the one before and either the difference in record id (same block) or the record id (new block), all
+// as unsigned LEB128 varints.
+
+static void put_varint(string &bytes, u_int32_t n) {
+    while (n >= 0x80) {
+        bytes += (char) ((n & 0x7F) | 0x80);
+        n >>= 7;
+    }
+    bytes += (char) n;
+}
+
+static u_int32_t get_varint(const char *bytes, u_long &offset) {
+    u_int32_t n = 0;
+    for (uint shift = 0;; shift += 7) {
+        uint8_t byte = (uint8_t) bytes[offset++];
+        n |= (u_int32_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return n;
+    }
+}
+
+// Append handle to an encoded list (previous is nullptr for the first one).
+static void put_handle(string &bytes, Handle handle, const Handle *previous) {
+    if (previous == nullptr) {
+        bytes.append((char *) &handle.first, sizeof(BlockID));
+        bytes.append((char *) &handle.second, sizeof(RecordID));
+    } else if (handle.first == previous->first) {
+        put_varint(bytes, 0);
+        put_varint(bytes, handle.second - previous->second);
+    } else {
+        put_varint(bytes, handle.first - previous->first);
+        put_varint(bytes, handle.second);
+    }
+}
+
+static string encode_handles(const Handles &handles) {
+    string bytes;
+    for (u_long i = 0; i < handles.size(); i++)
+        put_handle(bytes, handles[i], i == 0 ? nullptr : &handles[i - 1]);
+    return bytes;
+}
+
+static void decode_handles(const char *bytes, u_long size, Handles &handles) {
+    u_long offset = 0;
+    Handle handle;
+    while (offset < size) {
+        if (offset == 0) {
+            handle.first = *(BlockID *) bytes;
+            handle.second = *(RecordID *) (bytes + sizeof(BlockID));
+            offset = sizeof(BlockID) + sizeof(RecordID);
+        } else {
+            u_int32_t delta = get_varint(bytes, offset);
+            if (delta == 0) {
+                handle.second += (RecordID) get_varint(bytes, offset);
+            } else {
+                handle.first += delta;
+                handle.second = (RecordID) get_varint(bytes, offset);
             }
-            i++;
         }
-        delete record_id_list;
+        handles.push_back(handle);
+    }
+}
+
+BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create, bool decode)
+        : BTreeNode(file, block_id, key_profile, create), next_leaf(0), key_map(), latch() {
+    if (!create && decode) {
+        // prefix common to all the keys, then each posting and the rest of its key, then the next leaf block
+        RecordID count = this->block->size();
+        NormalizedKey prefix = get_key(1);
+        for (RecordID i = 2; i + 1 < count; i += 2)
+            unmarshal_posting(i, this->key_map[prefix + get_key(i + 1)]);
+        this->next_leaf = get_block_id(count);
     }
 }
 
 BTreeLeaf::~BTreeLeaf() {
 }
 
-// Find the handle for a given key
-Handle BTreeLeaf::find_eq(const KeyValue *key) const {
-    return this->key_map.at(*key);
+// Find the handles for a given key
+Handles *BTreeLeaf::find_eq(const NormalizedKey *key) const {
+    auto entry = this->key_map.find(*key);
+    if (entry == this->key_map.end())
+        return new Handles;
+    return get_handles(entry->second);
+}
+
+// Binary search of the leaf's block itself for key, decoding nothing but its posting. The keys are every other
+// record (each after its posting) in key order and the next leaf pointer is last, as save leaves them.
+Handles *BTreeLeaf::search_block(const NormalizedKey *key) const {
+    NormalizedKey prefix = get_key(1);
+    if (key->compare(0, prefix.size(), prefix) != 0)
+        return new Handles;  // every key in this leaf starts with the prefix
+    NormalizedKey suffix = key->substr(prefix.size());
+    int low = 1;
+    int high = (this->block->size() - 2) / 2;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = compare_key((RecordID) (2 * mid + 1), &suffix);
+        if (cmp == 0) {
+            Posting posting;
+            unmarshal_posting((RecordID) (2 * mid), posting);
+            return get_handles(posting);
+        }
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return new Handles;
+}
+
+// Since the keys are in order, the leaf's prefix and record count are only looked at once and each binary search
+// starts where the last one ended.
+void BTreeLeaf::search_block(const std::vector<const NormalizedKey *> &keys, HandleLists &found) const {
+    NormalizedKey prefix = get_key(1);
+    int low = 1;
+    int last = (this->block->size() - 2) / 2;
+    for (auto const &key: keys) {
+        Handles *handles = nullptr;
+        if (key->compare(0, prefix.size(), prefix) == 0) {
+            NormalizedKey suffix = key->substr(prefix.size());
+            int high = last;
+            while (low <= high) {
+                int mid = (low + high) / 2;
+                int cmp = compare_key((RecordID) (2 * mid + 1), &suffix);
+                if (cmp == 0) {
+                    Posting posting;
+                    unmarshal_posting((RecordID) (2 * mid), posting);
+                    handles = get_handles(posting);
+                    low = mid;
+                    break;
+                }
+                if (cmp < 0)
+                    low = mid + 1;
+                else
+                    high = mid - 1;
+            }
+        }
+        found.push_back(handles == nullptr ? new Handles : handles);
+    }
+}
+
+// All the handles in a posting, from the overflow blocks if that's where they are.
+Handles *BTreeLeaf::get_handles(const Posting &posting) const {
+    if (posting.overflow == 0)
+        return new Handles(posting.handles);
+    Handles *handles = new Handles;
+    std::unique_lock<std::mutex> guard;
+    if (this->cache != nullptr)
+        guard = std::unique_lock<std::mutex>(this->cache->get_latch());
+    BlockID block_id = posting.overflow;
+    while (block_id != 0) {
+        SlottedPage *page = this->file.get(block_id);
+        Dbt *dbt = page->get(1);
+        block_id = *(BlockID *) dbt->get_data();
+        delete dbt;
+        dbt = page->get(2);
+        decode_handles((char *) dbt->get_data(), dbt->get_size(), *handles);
+        delete dbt;
+        delete page;
+    }
+    return handles;
 }
 
 // Save the key_map and next_leaf data in the correct order
 void BTreeLeaf::save() {
     Dbt *dbt;
     this->block->clear();
+    // prefix common to all the keys (they're in order, so it's the one the first and last have in common)
+    u_long prefix = 0;
+    if (!this->key_map.empty())
+        prefix = common_prefix(this->key_map.begin()->first, this->key_map.rbegin()->first);
+    NormalizedKey common = this->key_map.empty() ? NormalizedKey() : this->key_map.begin()->first.substr(0, prefix);
+    dbt = marshal_key(&common);
+    add_record(dbt);
     for (auto const &item: this->key_map) {
-        // handle
-        dbt = marshal_handle(item.second);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+        // handle(s)
+        dbt = marshal_posting(item.second);
+        add_record(dbt);
 
         // key
-        dbt = marshal_key(&item.first);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+        dbt = marshal_key(&item.first, prefix);
+        add_record(dbt);
     }
     // next leaf pointer is final record
     dbt = marshal_block_id(this->next_leaf);
-    this->block->add(dbt);
-    delete[] (char *) dbt->get_data();
-    delete dbt;
+    add_record(dbt);
 
     BTreeNode::save();
 }
 
+// Convert a posting into bytes. A single handle is stored just as it always was. Otherwise there is a count
+// followed by the encoded handles, or a count of 0 followed by what we keep about the overflow blocks.
+Dbt *BTreeLeaf::marshal_posting(const Posting &posting) const {
+    if (posting.overflow == 0 && posting.handles.size() == 1)
+        return marshal_handle(posting.handles.front());
+    string bytes;
+    uint16_t count = posting.overflow == 0 ? (uint16_t) posting.handles.size() : 0;
+    bytes.append((char *) &count, sizeof(count));
+    if (posting.overflow == 0) {
+        bytes += encode_handles(posting.handles);
+    } else {
+        bytes.append((char *) &posting.overflow, sizeof(BlockID));
+        bytes.append((char *) &posting.tail, sizeof(BlockID));
+        bytes.append((char *) &posting.count, sizeof(u_int32_t));
+        bytes.append((char *) &posting.last.first, sizeof(BlockID));
+        bytes.append((char *) &posting.last.second, sizeof(RecordID));
+    }
+    char *data = new char[bytes.size()];
+    memcpy(data, bytes.data(), bytes.size());
+    return new Dbt(data, (u_int32_t) bytes.size());
+}
+
+// Get the record and turn it into a posting.
+void BTreeLeaf::unmarshal_posting(RecordID record_id, Posting &posting) const {
+    Dbt *dbt = this->block->get(record_id);
+    const char *bytes = (char *) dbt->get_data();
+    if (dbt->get_size() == sizeof(BlockID) + sizeof(RecordID)) {
+        posting.handles.push_back(get_handle(record_id));
+    } else if (*(uint16_t *) bytes != 0) {
+        decode_handles(bytes + sizeof(uint16_t), dbt->get_size() - sizeof(uint16_t), posting.handles);
+    } else {
+        u_long offset = sizeof(uint16_t);
+        posting.overflow = *(BlockID *) (bytes + offset);
+        offset += sizeof(BlockID);
+        posting.tail = *(BlockID *) (bytes + offset);
+        offset += sizeof(BlockID);
+        posting.count = *(u_int32_t *) (bytes + offset);
+        offset += sizeof(u_int32_t);
+        posting.last.first = *(BlockID *) (bytes + offset);
+        offset += sizeof(BlockID);
+        posting.last.second = *(RecordID *) (bytes + offset);
+    }
+    delete dbt;
+}
+
+// Add a handle to a posting, moving it out to overflow blocks if it gets too big for the leaf.
+void BTreeLeaf::add_handle(Posting &posting, Handle handle, BTreeStat *stat) {
+    if (posting.overflow == 0) {
+        auto at = lower_bound(posting.handles.begin(), posting.handles.end(), handle);
+        if (at != posting.handles.end() && *at == handle)
+            return;
+        posting.handles.insert(at, handle);
+        if (posting.handles.size() > 1 && encode_handles(posting.handles).size() > POSTING_LIMIT) {
+            Handles handles = posting.handles;
+            write_overflow(posting, handles, stat);
+        }
+        return;
+    }
+
+    if (!(posting.last < handle)) {
+        Handles *handles = get_handles(posting);
+        auto at = lower_bound(handles->begin(), handles->end(), handle);
+        if (at == handles->end() || *at != handle) {
+            handles->insert(at, handle);
+            write_overflow(posting, *handles, stat);
+        }
+        delete handles;
+        return;
+    }
+
+    // the usual case: tack it onto the end of the last overflow block
+    SlottedPage *page = this->file.get(posting.tail);
+    Dbt *dbt = page->get(2);
+    string bytes((char *) dbt->get_data(), dbt->get_size());
+    delete dbt;
+    put_handle(bytes, handle, &posting.last);
+    Dbt data((void *) bytes.data(), (u_int32_t) bytes.size());
+    try {
+        page->put(2, data);
+        this->file.put(page);
+        delete page;
+    } catch (DbBlockNoRoomError &e) {
+        delete page;
+        bytes.clear();
+        put_handle(bytes, handle, nullptr);
+        BlockID block_id = new_overflow_block(stat);
+        page = this->file.get(block_id);
+        Dbt *next = marshal_block_id(0);
+        page->add(next);
+        delete[] (char *) next->get_data();
+        delete next;
+        Dbt chunk((void *) bytes.data(), (u_int32_t) bytes.size());
+        page->add(&chunk);
+        this->file.put(page);
+        delete page;
+
+        page = this->file.get(posting.tail);  // link it in
+        next = marshal_block_id(block_id);
+        page->put(1, *next);
+        delete[] (char *) next->get_data();
+        delete next;
+        this->file.put(page);
+        delete page;
+        posting.tail = block_id;
+    }
+    posting.count++;
+    posting.last = handle;
+}
+
+// Take a handle out of a posting, bringing the rest back into the leaf if they fit again. Returns false if the
+// handle isn't there.
+bool BTreeLeaf::remove_handle(Posting &posting, Handle handle, BTreeStat *stat) {
+    Handles *handles = get_handles(posting);
+    auto at = lower_bound(handles->begin(), handles->end(), handle);
+    if (at == handles->end() || *at != handle) {
+        delete handles;
+        return false;
+    }
+    handles->erase(at);
+    if (posting.overflow == 0) {
+        posting.handles = *handles;
+    } else if (encode_handles(*handles).size() <= POSTING_LIMIT / 2) {
+        free_overflow(posting, stat);
+        posting.handles = *handles;
+    } else {
+        write_overflow(posting, *handles, stat);
+    }
+    delete handles;
+    return true;
+}
+
+// Rewrite the overflow blocks of a posting to hold the given (sorted) handles, reusing the blocks it already has.
+void BTreeLeaf::write_overflow(Posting &posting, const Handles &handles, BTreeStat *stat) {
+    const u_long chunk_limit = DbBlock::BLOCK_SZ - 32;  // room for the slotted page headers and next pointer
+    vector<string> chunks;
+    string chunk;
+    for (u_long i = 0; i < handles.size(); i++) {
+        u_long size = chunk.size();
+        put_handle(chunk, handles[i], size == 0 ? nullptr : &handles[i - 1]);
+        if (chunk.size() > chunk_limit) {
+            chunk.resize(size);
+            chunks.push_back(chunk);
+            chunk.clear();
+            put_handle(chunk, handles[i], nullptr);
+        }
+    }
+    chunks.push_back(chunk);
+
+    BlockIDs block_ids;
+    if (posting.overflow != 0) {
+        for (BlockID block_id = posting.overflow; block_id != 0;) {
+            block_ids.push_back(block_id);
+            SlottedPage *page = this->file.get(block_id);
+            Dbt *dbt = page->get(1);
+            block_id = *(BlockID *) dbt->get_data();
+            delete dbt;
+            delete page;
+        }
+    }
+    while (block_ids.size() < chunks.size())
+        block_ids.push_back(new_overflow_block(stat));
+    while (block_ids.size() > chunks.size()) {
+        stat->release(block_ids.back());
+        block_ids.pop_back();
+    }
+    for (u_long i = 0; i < chunks.size(); i++) {
+        SlottedPage *page = this->file.get(block_ids[i]);
+        page->clear();
+        Dbt *next = marshal_block_id(i + 1 < chunks.size() ? block_ids[i + 1] : 0);
+        page->add(next);
+        delete[] (char *) next->get_data();
+        delete next;
+        Dbt data((void *) chunks[i].data(), (u_int32_t) chunks[i].size());
+        page->add(&data);
+        this->file.put(page);
+        delete page;
+    }
+    posting.handles.clear();
+    posting.overflow = block_ids.front();
+    posting.tail = block_ids.back();
+    posting.count = (u_int32_t) handles.size();
+    posting.last = handles.back();
+}
+
+// Put a posting's overflow blocks on the free list.
+void BTreeLeaf::free_overflow(Posting &posting, BTreeStat *stat) {
+    BlockID block_id = posting.overflow;
+    while (block_id != 0) {
+        SlottedPage *page = this->file.get(block_id);
+        Dbt *dbt = page->get(1);
+        BlockID next = *(BlockID *) dbt->get_data();
+        delete dbt;
+        delete page;
+        stat->release(block_id);
+        block_id = next;
+    }
+    posting.overflow = posting.tail = 0;
+    posting.count = 0;
+}
+
+// An empty block for overflow, off the free list if there is one.
+BlockID BTreeLeaf::new_overflow_block(BTreeStat *stat) {
+    BlockID block_id = stat->allocate();
+    SlottedPage *page = block_id == 0 ? this->file.get_new() : this->file.get(block_id);
+    block_id = page->get_block_id();
+    page->clear();
+    this->file.put(page);
+    delete page;
+    return block_id;
+}
+
+// Bulk load: add a key (greater than any here) with its (sorted) handles. Returns false, adding nothing, if that
+// would use more than max_bytes of the block (counting the next leaf pointer, which goes in at save).
+bool BTreeLeaf::append(const NormalizedKey *key, const Handles &handles, BTreeStat *stat, u_long max_bytes) {
+    Posting posting;
+    posting.handles = handles;
+    bool overflow = handles.size() > 1 && encode_handles(handles).size() > POSTING_LIMIT;
+    if (overflow) {
+        posting.overflow = posting.tail = 1;  // stand-ins, just to get the size of the record
+        posting.count = (u_int32_t) handles.size();
+    }
+    Dbt *posting_dbt = marshal_posting(posting);
+    u_long needed = posting_dbt->get_size() + key->size() + 8;  // and a record header each
+    delete[] (char *) posting_dbt->get_data();
+    delete posting_dbt;
+    if (this->key_map.empty()) {
+        this->appended = sizeof(BlockID) + 4 + 4;  // next leaf pointer (and its record header) and the block header
+    } else {
+        // keys come in order, so the prefix they all share is the one the first has in common with this
+        u_long n = this->key_map.size() + 1;
+        u_long prefix = common_prefix(this->key_map.begin()->first, *key);
+        if (this->appended + needed - n * prefix + prefix + 4 > max_bytes)
+            return false;
+    }
+    this->appended += needed;
+    if (overflow) {
+        posting.overflow = posting.tail = 0;  // no chain yet
+        write_overflow(posting, handles, stat);
+    }
+    this->key_map[*key] = posting;
+    return true;
+}
+
+// Point key's entry for the old handle at the new one.
+bool BTreeLeaf::relocate(const NormalizedKey *key, Handle from, Handle to, BTreeStat *stat) {
+    auto entry = this->key_map.find(*key);
+    if (entry == this->key_map.end() || !remove_handle(entry->second, from, stat))
+        return false;
+    add_handle(entry->second, to, stat);
+    save();
+    return true;
+}
+
+// Remove key's entry for the given handle. Returns false if there was no such entry.
+bool BTreeLeaf::del(const NormalizedKey *key, Handle handle, BTreeStat *stat) {
+    auto entry = this->key_map.find(*key);
+    if (entry == this->key_map.end() || !remove_handle(entry->second, handle, stat))
+        return false;
+    if (entry->second.size() == 0)
+        this->key_map.erase(entry);
+    save();
+    return true;
+}
+
+// Take in all of right's entries if they fit, otherwise split the combined entries evenly between us.
+// Returns true if merged (right is then out of the leaf chain), else false with right's new first key in boundary.
+bool BTreeLeaf::merge_or_even_out(BTreeLeaf *right, NormalizedKey &boundary) {
+    BlockID next_leaf = this->next_leaf;
+    this->key_map.insert(right->key_map.begin(), right->key_map.end());
+    this->next_leaf = right->next_leaf;
+    try {
+        save();
+        return true;
+    } catch (DbBlockNoRoomError &e) {
+        // too much for one block, so move the second half back to right
+    }
+    this->next_leaf = next_leaf;
+    auto key_list = this->key_map;
+    u_long split = key_list.size() / 2;
+    this->key_map.clear();
+    right->key_map.clear();
+    u_long i = 0;
+    for (auto const &item: key_list)
+        (i++ < split ? this : right)->key_map[item.first] = item.second;
+    boundary = shortest_separator(this->key_map.rbegin()->first, right->key_map.begin()->first);
+    save();
+    right->save();
+    return false;
+}
+
+// Insert key, handle pair into the leaf unless it would have to split or the key's handles are (or would have
+// to go) in overflow blocks.
+bool BTreeLeaf::insert_in_place(const NormalizedKey *key, Handle handle, bool unique) {
+    auto entry = this->key_map.find(*key);
+    bool existed = entry != this->key_map.end();
+    if (existed && unique)
+        throw DbRelationError("Duplicate keys are not allowed in unique index");
+    if (existed && entry->second.overflow != 0)
+        return false;
+    Posting &posting = this->key_map[*key];
+    auto at = lower_bound(posting.handles.begin(), posting.handles.end(), handle);
+    if (at != posting.handles.end() && *at == handle)
+        return true;  // already there
+    posting.handles.insert(at, handle);
+    bool fits = posting.handles.size() == 1 || encode_handles(posting.handles).size() <= POSTING_LIMIT;
+    if (fits) {
+        try {
+            save();
+            return true;
+        } catch (DbBlockNoRoomError &e) {
+            // no room, so put it back the way it was
+        }
+    }
+    if (existed)
+        posting.handles.erase(lower_bound(posting.handles.begin(), posting.handles.end(), handle));
+    else
+        this->key_map.erase(*key);
+    if (fits)
+        save();
+    return false;
+}
+
+// Remove key's entry for the given handle unless that would leave the leaf underflowing (and may_underflow
+// isn't set) or the key's handles are in overflow blocks. No such entry is nothing to do.
+bool BTreeLeaf::del_in_place(const NormalizedKey *key, Handle handle, bool may_underflow) {
+    auto entry = this->key_map.find(*key);
+    if (entry == this->key_map.end())
+        return true;
+    if (entry->second.overflow != 0)
+        return false;
+    Posting before = entry->second;
+    Handles &handles = entry->second.handles;
+    auto at = lower_bound(handles.begin(), handles.end(), handle);
+    if (at == handles.end() || *at != handle)
+        return true;
+    handles.erase(at);
+    if (handles.empty())
+        this->key_map.erase(entry);
+    save();
+    if (may_underflow || !underflows())
+        return true;
+    this->key_map[*key] = before;
+    save();
+    return false;
+}
+
+// Point key's entry for the old handle at the new one, unless the key's handles are in overflow blocks. No such
+// entry is nothing to do.
+bool BTreeLeaf::relocate_in_place(const NormalizedKey *key, Handle from, Handle to) {
+    auto entry = this->key_map.find(*key);
+    if (entry == this->key_map.end())
+        return true;
+    if (entry->second.overflow != 0)
+        return false;
+    Posting before = entry->second;
+    Handles &handles = entry->second.handles;
+    auto at = lower_bound(handles.begin(), handles.end(), from);
+    if (at == handles.end() || *at != from)
+        return true;
+    handles.erase(at);
+    at = lower_bound(handles.begin(), handles.end(), to);
+    if (at == handles.end() || *at != to)
+        handles.insert(at, to);
+    bool fits = handles.size() == 1 || encode_handles(handles).size() <= POSTING_LIMIT;
+    if (fits) {
+        try {
+            save();
+            return true;
+        } catch (DbBlockNoRoomError &e) {
+            // handles can take more room delta-encoded than they did
+        }
+    }
+    entry->second = before;
+    if (fits)
+        save();
+    return false;
+}
+
 // Insert key, handle pair into block.
-Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
+Insertion BTreeLeaf::insert(const NormalizedKey *key, Handle handle, BTreeStat *stat, bool unique) {
     // cout << "inserting " << (*key)[0] << " into leaf " << id << endl; // DEBUG
     // check unique
-    if (this->key_map.find(*key) != this->key_map.end())
+    if (unique && this->key_map.find(*key) != this->key_map.end())
         throw DbRelationError("Duplicate keys are not allowed in unique index");
 
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
+    add_handle(this->key_map[*key], handle, stat);
     try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
-        this->key_map[*key] = handle;
         save();
         return BTreeNode::insertion_none();
 
     } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
         // too big, so split
 
         // create the sister and put her to the right
-        BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
+        BTreeLeaf *nleaf = this->cache->new_leaf(stat->allocate());
         nleaf->next_leaf = this->next_leaf;
         this->next_leaf = nleaf->id;
 
         // move half of the entries to the sister
         auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
         u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
         this->key_map.clear();               // empty my list
         u_long i = 0;
-        KeyValue boundary;
+        NormalizedKey boundary;
         for (auto const &item: key_list) {
             if (i < split) {
                 this->key_map[item.first] = item.second;
@@ -464,8 +1096,7 @@ Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
             }
             i++;
         }
-        cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
-        cout << " starting at value " << boundary[0] << endl; // DEBUG
+        boundary = shortest_separator(this->key_map.rbegin()->first, boundary);
 
         nleaf->save();
         this->save();
@@ -473,3 +1104,155 @@ Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
     }
 }
 
+
+/*****************
+ * BTreeSortBlock
+ *****************/
+
+BTreeSortBlock::BTreeSortBlock(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create)
+        : BTreeNode(file, block_id, key_profile, create) {
+}
+
+// Add an entry to the end of the block (the caller saves it). Returns false if there's no room.
+bool BTreeSortBlock::add(const KeyHandle &entry) {
+    Dbt *handle = marshal_handle(entry.second);
+    Dbt *key = marshal_key(&entry.first);
+    bool fits = this->block->unused_bytes() >= handle->get_size() + key->get_size() + 8;  // and a record header each
+    if (fits) {
+        this->block->add(handle);
+        this->block->add(key);
+    }
+    delete[] (char *) handle->get_data();
+    delete handle;
+    delete[] (char *) key->get_data();
+    delete key;
+    return fits;
+}
+
+void BTreeSortBlock::get_entries(KeyHandles &entries) const {
+    RecordIDs *record_ids = this->block->ids();
+    for (uint i = 0; i + 1 < record_ids->size(); i += 2) {
+        entries.push_back(KeyHandle(get_key((*record_ids)[i + 1]), get_handle((*record_ids)[i])));
+    }
+    delete record_ids;
+}
+
+
+/******************
+ * BTreeNodeCache *
+ ******************/
+
+BTreeNodeCache::BTreeNodeCache(HeapFile &file, const KeyProfile &key_profile) : file(file), key_profile(key_profile),
+                                                                                 capacity(DEFAULT_CAPACITY), nodes(),
+                                                                                 recency(), hits(0), misses(0) {
+}
+
+BTreeNodeCache::~BTreeNodeCache() {
+    clear();
+}
+
+// The node in the given block, read in and decoded only if it isn't already here.
+BTreeNode *BTreeNodeCache::get(BlockID block_id, bool leaf) {
+    std::lock_guard<std::mutex> guard(this->latch);
+    auto entry = this->nodes.find(block_id);
+    if (entry != this->nodes.end()) {
+        this->recency.splice(this->recency.begin(), this->recency, entry->second.second);
+        this->hits++;
+        return entry->second.first;
+    }
+    this->misses++;
+    if (leaf)
+        return adopt(new BTreeLeaf(this->file, block_id, this->key_profile, false));
+    return adopt(new BTreeInterior(this->file, block_id, this->key_profile, false));
+}
+
+// Point lookup in a leaf. One that isn't cached is searched right in its block rather than decoded (and isn't
+// cached by this, since a lookup only needs one of its entries). The cache's latch is let go before waiting on
+// the leaf's, which a writer may hold while it waits on the cache's to save the leaf.
+Handles *BTreeNodeCache::find_eq(BlockID leaf_id, const NormalizedKey *key) {
+    std::unique_lock<std::mutex> guard(this->latch);
+    auto entry = this->nodes.find(leaf_id);
+    if (entry != this->nodes.end()) {
+        this->recency.splice(this->recency.begin(), this->recency, entry->second.second);
+        this->hits++;
+        auto *leaf = dynamic_cast<BTreeLeaf *>(entry->second.first);
+        guard.unlock();
+        BTreeLatch::Shared shared(leaf->get_latch());
+        return leaf->find_eq(key);
+    }
+    this->misses++;
+    BTreeLeaf leaf(this->file, leaf_id, this->key_profile, false, false);
+    leaf.cache = this;  // not adopted, just so it reads any overflow blocks under the latch
+    guard.unlock();
+    return leaf.search_block(key);
+}
+
+void BTreeNodeCache::find_eq(BlockID leaf_id, const std::vector<const NormalizedKey *> &keys, HandleLists &found) {
+    std::unique_lock<std::mutex> guard(this->latch);
+    auto entry = this->nodes.find(leaf_id);
+    if (entry != this->nodes.end()) {
+        this->recency.splice(this->recency.begin(), this->recency, entry->second.second);
+        this->hits++;
+        auto *leaf = dynamic_cast<BTreeLeaf *>(entry->second.first);
+        guard.unlock();
+        BTreeLatch::Shared shared(leaf->get_latch());
+        for (auto const &key: keys)
+            found.push_back(leaf->find_eq(key));
+        return;
+    }
+    this->misses++;
+    BTreeLeaf leaf(this->file, leaf_id, this->key_profile, false, false);
+    leaf.cache = this;
+    guard.unlock();
+    leaf.search_block(keys, found);
+}
+
+BTreeLeaf *BTreeNodeCache::new_leaf(BlockID block_id) {
+    std::lock_guard<std::mutex> guard(this->latch);
+    evict(block_id);
+    return dynamic_cast<BTreeLeaf *>(adopt(new BTreeLeaf(this->file, block_id, this->key_profile, true)));
+}
+
+BTreeInterior *BTreeNodeCache::new_interior(BlockID block_id) {
+    std::lock_guard<std::mutex> guard(this->latch);
+    evict(block_id);
+    return dynamic_cast<BTreeInterior *>(adopt(new BTreeInterior(this->file, block_id, this->key_profile, true)));
+}
+
+// Drop the node for a block that is no longer in the tree.
+void BTreeNodeCache::forget(BlockID block_id) {
+    std::lock_guard<std::mutex> guard(this->latch);
+    evict(block_id);
+}
+
+void BTreeNodeCache::trim() {
+    std::lock_guard<std::mutex> guard(this->latch);
+    while (this->nodes.size() > this->capacity) {
+        BlockID block_id = this->recency.back();
+        evict(block_id);
+    }
+}
+
+void BTreeNodeCache::clear() {
+    std::lock_guard<std::mutex> guard(this->latch);
+    for (auto const &entry: this->nodes)
+        delete entry.second.first;
+    this->nodes.clear();
+    this->recency.clear();
+}
+
+BTreeNode *BTreeNodeCache::adopt(BTreeNode *node) {
+    node->cache = this;
+    this->recency.push_front(node->id);
+    this->nodes[node->id] = std::make_pair(node, this->recency.begin());
+    return node;
+}
+
+void BTreeNodeCache::evict(BlockID block_id) {
+    auto entry = this->nodes.find(block_id);
+    if (entry == this->nodes.end())
+        return;
+    delete entry->second.first;
+    this->recency.erase(entry->second.second);
+    this->nodes.erase(entry);
+}
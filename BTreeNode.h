@@ -1,60 +1,187 @@
 /**
- * @file BTreeNode.h - BTreeNode class and its subclasses: BTreeStat, BTreeInterior, BTreeLeaf
+ * @file BTreeNode.h - BTreeNode class and its subclasses: BTreeStat, BTreeInterior, BTreeLeaf, BTreeSortBlock,
+ *                      and BTreeNodeCache and BTreeLatch
  *
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2021"
  */
 #pragma once
 
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <pthread.h>
 #include "storage_engine.h"
 #include "heap_storage.h"
 
 typedef std::vector<ColumnAttribute::DataType> KeyProfile;
 typedef std::vector<Value> KeyValue;
-typedef std::vector<KeyValue *> KeyValues;
+
+/**
+ * A key in the order-preserving binary form the tree keeps (and compares) its keys in: any two keys of an
+ * index compare correctly with memcmp, as std::string's < does, whatever their column types. Each INT is
+ * big-endian with its sign bit flipped, each BOOLEAN is a byte, and each TEXT is its bytes, with any 0 escaped
+ * as 0 0xff, ended by 0 0.
+ */
+typedef std::string NormalizedKey;
+
+NormalizedKey normalize_key(const KeyValue &key, const KeyProfile &key_profile);
+
+KeyValue *denormalize_key(const NormalizedKey &key, const KeyProfile &key_profile);  // (freed by caller)
+
+u_long normalized_size(const NormalizedKey &key, const KeyProfile &key_profile, uint columns);  // of first columns
+
+// shortest key that is greater than left and no greater than right (which must be greater than left)
+NormalizedKey shortest_separator(const NormalizedKey &left, const NormalizedKey &right);
+
+u_long common_prefix(const NormalizedKey &a, const NormalizedKey &b);  // length of
+
+typedef std::vector<NormalizedKey> NormalizedKeys;
 typedef std::vector<BlockID> BlockPointers;
-typedef std::pair<BlockID, KeyValue> Insertion;
+typedef std::pair<BlockID, NormalizedKey> Insertion;
+typedef std::pair<NormalizedKey, Handle> KeyHandle;
+typedef std::vector<KeyHandle> KeyHandles;
+
+/**
+ * @class Posting - handles of the rows with a given key
+ *
+ * A unique index has just one. Otherwise they are kept sorted and delta-encoded in the leaf unless there
+ * are too many to fit in POSTING_LIMIT bytes, in which case they move out to a chain of overflow blocks and
+ * the leaf only keeps track of the ends of the chain, the count, and the last handle (so that the usual
+ * insert, of a row appended to the end of the table, only touches the last overflow block).
+ */
+class Posting {
+public:
+    Posting() : handles(), overflow(0), tail(0), count(0), last(0, 0) {}
+
+    u_long size() const { return this->overflow == 0 ? this->handles.size() : this->count; }
+
+    Handles handles;   // sorted, if they are in the leaf
+    BlockID overflow;  // first overflow block, 0 if the handles are in the leaf
+    BlockID tail;      // last overflow block
+    u_int32_t count;   // number of handles in the overflow blocks
+    Handle last;       // greatest handle in the overflow blocks
+};
+
+typedef std::map<NormalizedKey, Posting> Postings;
+
+/**
+ * @class BTreeLatch - readers-writer latch on a B-tree index or one of its leaves
+ *
+ * Held in shared mode by any number of threads at once, or exclusively by one. It isn't reentrant, so a
+ * thread mustn't take it again while holding it. The Shared and Exclusive guards hold it for their scope.
+ */
+class BTreeLatch {
+public:
+    BTreeLatch() { pthread_rwlock_init(&this->rwlock, nullptr); }
+
+    virtual ~BTreeLatch() { pthread_rwlock_destroy(&this->rwlock); }
+
+    BTreeLatch(const BTreeLatch &other) = delete;
+
+    BTreeLatch(BTreeLatch &&temp) = delete;
+
+    BTreeLatch &operator=(const BTreeLatch &other) = delete;
+
+    BTreeLatch &operator=(BTreeLatch &&temp) = delete;
+
+    void lock_shared() { pthread_rwlock_rdlock(&this->rwlock); }
+
+    void lock() { pthread_rwlock_wrlock(&this->rwlock); }
+
+    bool try_lock() { return pthread_rwlock_trywrlock(&this->rwlock) == 0; }
+
+    void unlock() { pthread_rwlock_unlock(&this->rwlock); }  // either mode
+
+    class Shared {
+    public:
+        explicit Shared(BTreeLatch &latch) : latch(latch) { latch.lock_shared(); }
+
+        ~Shared() { latch.unlock(); }
+
+    private:
+        BTreeLatch &latch;
+    };
+
+    class Exclusive {
+    public:
+        explicit Exclusive(BTreeLatch &latch) : latch(latch) { latch.lock(); }
+
+        ~Exclusive() { latch.unlock(); }
+
+    private:
+        BTreeLatch &latch;
+    };
+
+protected:
+    pthread_rwlock_t rwlock;
+};
+
+class BTreeStat;
+
+class BTreeNodeCache;
 
 class BTreeNode {
 public:
+    // with create, block_id is a free block to reuse (0 for a brand new block at the end of the file)
     BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
     virtual ~BTreeNode();
 
     static bool insertion_is_none(Insertion insertion) { return insertion.first == 0; }
 
-    static Insertion insertion_none() { return Insertion(0, KeyValue()); }
+    static Insertion insertion_none() { return Insertion(0, NormalizedKey()); }
 
     virtual void save();
 
     BlockID get_id() const { return this->id; }
 
+    // is the node (as of its last save) so empty that it should be merged with or borrow from a sibling?
+    bool underflows() const { return this->block->unused_bytes() > DbBlock::BLOCK_SZ * 2 / 3; }
+
+    u_long get_used_bytes() const { return DbBlock::BLOCK_SZ - this->block->unused_bytes(); }  // as of its last save
+
 protected:
     SlottedPage *block;
     HeapFile &file;
     BlockID id;
     const KeyProfile &key_profile;
+    BTreeNodeCache *cache;  // the cache this node belongs to (nullptr if it's on its own, e.g., while bulk loading)
+    u_long appended;  // bytes append() has put in the node so far, not counting prefix compression
 
     static Dbt *marshal_block_id(BlockID block_id);
 
     static Dbt *marshal_handle(Handle handle);
 
-    virtual Dbt *marshal_key(const KeyValue *key);
+    static Dbt *marshal_key(const NormalizedKey *key, u_long skip = 0);  // leaving off the first skip bytes
+
+    void add_record(Dbt *dbt);  // append dbt (freed here, even if it doesn't fit) as the block's next record
 
     virtual BlockID get_block_id(RecordID record_id) const;
 
     virtual Handle get_handle(RecordID record_id) const;
 
-    virtual KeyValue *get_key(RecordID record_id) const;
+    virtual NormalizedKey get_key(RecordID record_id) const;
+
+    int compare_key(RecordID record_id, const NormalizedKey *key) const;  // <0, 0, >0 like memcmp, in the block
+
+    friend class BTreeNodeCache;
 };
 
 class BTreeStat : public BTreeNode {
 public:
     static const RecordID ROOT = 1;  // where we store the root id in the stat block
     static const RecordID HEIGHT = ROOT + 1;  // where we store the height in the stat block
+    static const RecordID FREE = HEIGHT + 1;  // where we store the first block of the free list
+    static const RecordID VERSION = FREE + 1;  // where we store the format the index file was written in
+
+    // layout of keys and nodes this code writes: 2 is normalized keys with prefix-compressed nodes (an index in any
+    // other format has to be rebuilt with REINDEX)
+    static const uint FORMAT_VERSION = 2;
 
     BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile &key_profile);
 
+    // throws DbRelationError if the index file isn't in FORMAT_VERSION
     BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile &key_profile);
 
     virtual ~BTreeStat() {}
@@ -69,9 +196,14 @@ public:
 
     void set_height(uint height) { this->height = height; }
 
+    BlockID allocate();  // take a block off the free list (0 if it's empty)
+
+    void release(BlockID block_id);  // put a block that is no longer in the tree on the free list
+
 protected:
     BlockID root_id;
     uint height;
+    BlockID free_list;  // each free block holds the id of the next one
 
 };
 
@@ -81,9 +213,30 @@ public:
 
     virtual ~BTreeInterior();
 
-    BTreeNode *find(const KeyValue *key, uint depth) const;
+    BTreeNode *find(const NormalizedKey *key, uint depth) const;  // key of nullptr finds the leftmost child (cached)
+
+    uint find_index(const NormalizedKey *key) const;  // which child key belongs in (0 is first)
+
+    BTreeNode *get_child(uint index, uint depth) const;  // (cached)
+
+    BlockID get_child_id(uint index) const { return index == 0 ? this->first : this->pointers[index - 1]; }
+
+    // the boundary the keys of the given child are all less than (nullptr for the last child)
+    const NormalizedKey *get_bound(uint index) const {
+        return index < this->boundaries.size() ? &this->boundaries[index] : nullptr;
+    }
 
-    Insertion insert(const KeyValue *boundary, BlockID block_id);
+    bool is_empty() const { return this->boundaries.empty(); }  // just the one child left?
+
+    uint get_child_count() const { return (uint) this->boundaries.size() + 1; }
+
+    Insertion insert(const NormalizedKey *boundary, BlockID block_id, BTreeStat *stat);
+
+    bool append(const NormalizedKey *boundary, BlockID block_id, u_long max_bytes);
+
+    bool rebalance(uint index, uint depth, BTreeStat *stat);  // true if it merged the child with a neighbor
+
+    bool merge_or_even_out(BTreeInterior *right, const NormalizedKey *separator, NormalizedKey &boundary);
 
     virtual void save();
 
@@ -94,22 +247,157 @@ public:
 protected:
     BlockID first;
     BlockPointers pointers;
-    KeyValues boundaries;
+    NormalizedKeys boundaries;
 };
 
 class BTreeLeaf : public BTreeNode {
 public:
-    BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
+    // without decode, the entries are left in the block (just for search_block)
+    BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create, bool decode = true);
 
     virtual ~BTreeLeaf();
 
-    Handle find_eq(const KeyValue *key) const;  // throws if not found
-    Insertion insert(const KeyValue *key, Handle handle);
+    static const u_long POSTING_LIMIT = DbBlock::BLOCK_SZ / 8;  // most bytes of handles for one key in a leaf
+
+    Handles *find_eq(const NormalizedKey *key) const;  // empty if not found (freed by caller)
+
+    Handles *search_block(const NormalizedKey *key) const;  // find_eq without decoding the leaf (freed by caller)
+
+    // search_block of each of keys (in order), appended to found in the same order
+    void search_block(const std::vector<const NormalizedKey *> &keys, HandleLists &found) const;
+
+    Handles *get_handles(const Posting &posting) const;  // (freed by caller)
+
+    Insertion insert(const NormalizedKey *key, Handle handle, BTreeStat *stat, bool unique);
+
+    bool append(const NormalizedKey *key, const Handles &handles, BTreeStat *stat, u_long max_bytes);
+
+    void set_next_leaf(BlockID next_leaf) { this->next_leaf = next_leaf; }
+
+    bool del(const NormalizedKey *key, Handle handle, BTreeStat *stat);
+
+    bool merge_or_even_out(BTreeLeaf *right, NormalizedKey &boundary);
+
+    bool relocate(const NormalizedKey *key, Handle from, Handle to, BTreeStat *stat);
+
+    // The in_place versions only change the leaf itself, never splitting it, leaving it to be rebalanced, or
+    // touching overflow blocks. They return false, with the leaf as it was, if that isn't enough.
+    bool insert_in_place(const NormalizedKey *key, Handle handle, bool unique);
+
+    bool del_in_place(const NormalizedKey *key, Handle handle, bool may_underflow);
+
+    bool relocate_in_place(const NormalizedKey *key, Handle from, Handle to);
 
     virtual void save();
 
+    BlockID get_next_leaf() const { return this->next_leaf; }
+
+    const Postings &get_key_map() const { return this->key_map; }
+
+    BTreeLatch &get_latch() const { return this->latch; }
+
 protected:
     BlockID next_leaf;
-    std::map<KeyValue, Handle> key_map;
+    Postings key_map;
+    mutable BTreeLatch latch;  // for changing the leaf while others may be reading it (see BTreeIndex)
+
+    Dbt *marshal_posting(const Posting &posting) const;
+
+    void unmarshal_posting(RecordID record_id, Posting &posting) const;
+
+    void add_handle(Posting &posting, Handle handle, BTreeStat *stat);
+
+    bool remove_handle(Posting &posting, Handle handle, BTreeStat *stat);
+
+    void write_overflow(Posting &posting, const Handles &handles, BTreeStat *stat);
+
+    void free_overflow(Posting &posting, BTreeStat *stat);
+
+    BlockID new_overflow_block(BTreeStat *stat);
+};
+
+/**
+ * @class BTreeSortBlock - one block of a sorted run spilled to a scratch file while bulk loading an index
+ *
+ * Records alternate handle and key, in key order, like a leaf with a single handle per entry.
+ */
+class BTreeSortBlock : public BTreeNode {
+public:
+    BTreeSortBlock(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
+
+    virtual ~BTreeSortBlock() {}
+
+    bool add(const KeyHandle &entry);  // false if the block is full
+
+    void get_entries(KeyHandles &entries) const;  // appended to entries
+};
+
+/**
+ * @class BTreeNodeCache - the decoded nodes of one index, by block id
+ *
+ * Nodes handed out by the cache belong to it (callers don't delete them) and stay decoded from one
+ * operation to the next, so a descent only reads and decodes blocks it hasn't seen lately; the root and upper
+ * levels, touched by every descent, effectively stay resident. A node's save() writes through from the cached
+ * object itself, so a cached node is never stale. Blocks given back to the free list must be forgotten.
+ * Nothing is evicted until trim(), which the index calls between operations when no one is holding a node.
+ * The cache's own latch is held while it is looked at or changed and for every read or write of the file (the
+ * file's Db handle reads into the same buffer each time), so a node copies its block out as it's read in.
+ */
+class BTreeNodeCache {
+public:
+    static const u_long DEFAULT_CAPACITY = 1000;  // nodes kept after a trim
+
+    BTreeNodeCache(HeapFile &file, const KeyProfile &key_profile);
+
+    virtual ~BTreeNodeCache();
+
+    BTreeNodeCache(const BTreeNodeCache &other) = delete;
+
+    BTreeNodeCache(BTreeNodeCache &&temp) = delete;
+
+    BTreeNodeCache &operator=(const BTreeNodeCache &other) = delete;
+
+    BTreeNodeCache &operator=(BTreeNodeCache &&temp) = delete;
+
+    BTreeNode *get(BlockID block_id, bool leaf);
+
+    Handles *find_eq(BlockID leaf_id, const NormalizedKey *key);  // searches the block if the leaf isn't cached
+
+    // find_eq of each of keys in the same leaf, appended to found in the same order (reading the block just once)
+    void find_eq(BlockID leaf_id, const std::vector<const NormalizedKey *> &keys, HandleLists &found);
+
+    BTreeLeaf *new_leaf(BlockID block_id);  // block_id is a free block to reuse, or 0 for a new one
+
+    BTreeInterior *new_interior(BlockID block_id);  // ditto
+
+    void forget(BlockID block_id);
+
+    void trim();  // evict the least recently used nodes beyond capacity
+
+    void clear();
+
+    void set_capacity(u_long capacity) { this->capacity = capacity; }
+
+    std::mutex &get_latch() { return this->latch; }
+
+    u_long get_hits() const { return this->hits; }  // times a node was asked for and already decoded
+
+    u_long get_misses() const { return this->misses; }  // times its block had to be read instead
+
+protected:
+    typedef std::list<BlockID> Recency;  // most recently used first
+
+    HeapFile &file;
+    const KeyProfile &key_profile;
+    u_long capacity;
+    std::map<BlockID, std::pair<BTreeNode *, Recency::iterator> > nodes;
+    Recency recency;
+    std::mutex latch;
+    std::atomic<u_long> hits;
+    std::atomic<u_long> misses;
+
+    BTreeNode *adopt(BTreeNode *node);
+
+    void evict(BlockID block_id);  // forget, with the latch already held
 };
 
@@ -0,0 +1,698 @@
+/**
+ * @file BitmapIndex.cpp - implementation of RoaringBitmap and BitmapIndex
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "BitmapIndex.h"
+
+using namespace std;
+
+/*****************************
+ * RoaringBitmap::Container *
+ *****************************/
+
+void RoaringBitmap::Container::add(uint16_t low) {
+    if (is_bitset()) {
+        uint64_t bit = 1ULL << (low % 64);
+        if ((this->bits[low / 64] & bit) == 0) {
+            this->bits[low / 64] |= bit;
+            this->cardinality++;
+        }
+        return;
+    }
+    auto it = lower_bound(this->array.begin(), this->array.end(), low);
+    if (it != this->array.end() && *it == low)
+        return;
+    this->array.insert(it, low);
+    this->cardinality++;
+    if (this->cardinality > ARRAY_MAX) {
+        vector<uint16_t> lows;
+        lows.swap(this->array);
+        set(lows);
+    }
+}
+
+bool RoaringBitmap::Container::remove(uint16_t low) {
+    if (is_bitset()) {
+        uint64_t bit = 1ULL << (low % 64);
+        if ((this->bits[low / 64] & bit) == 0)
+            return false;
+        this->bits[low / 64] &= ~bit;
+        if (--this->cardinality <= ARRAY_MAX) {
+            vector<uint16_t> lows;
+            get_lows(lows);
+            set(lows);
+        }
+        return true;
+    }
+    auto it = lower_bound(this->array.begin(), this->array.end(), low);
+    if (it == this->array.end() || *it != low)
+        return false;
+    this->array.erase(it);
+    this->cardinality--;
+    return true;
+}
+
+bool RoaringBitmap::Container::contains(uint16_t low) const {
+    if (is_bitset())
+        return (this->bits[low / 64] & (1ULL << (low % 64))) != 0;
+    return binary_search(this->array.begin(), this->array.end(), low);
+}
+
+void RoaringBitmap::Container::intersect(const Container &other) {
+    if (is_bitset() && other.is_bitset()) {
+        this->cardinality = 0;
+        for (uint i = 0; i < this->bits.size(); i++) {
+            this->bits[i] &= other.bits[i];
+            this->cardinality += __builtin_popcountll(this->bits[i]);
+        }
+        if (this->cardinality <= ARRAY_MAX) {
+            vector<uint16_t> lows;
+            get_lows(lows);
+            set(lows);
+        }
+        return;
+    }
+    // at least one is an array: keep the array's values that are in the other one
+    const Container &small = is_bitset() ? other : *this;
+    const Container &large = is_bitset() ? *this : other;
+    vector<uint16_t> lows;
+    for (auto const &low: small.array)
+        if (large.contains(low))
+            lows.push_back(low);
+    set(lows);
+}
+
+void RoaringBitmap::Container::unite(const Container &other) {
+    if (!is_bitset() && !other.is_bitset()) {
+        vector<uint16_t> lows;
+        set_union(this->array.begin(), this->array.end(), other.array.begin(), other.array.end(),
+                  back_inserter(lows));
+        set(lows);
+        return;
+    }
+    if (!is_bitset()) {
+        this->bits.assign(CONTAINER_SIZE / 64, 0);
+        for (auto const &low: this->array)
+            this->bits[low / 64] |= 1ULL << (low % 64);
+        this->array.clear();
+    }
+    if (other.is_bitset()) {
+        for (uint i = 0; i < this->bits.size(); i++)
+            this->bits[i] |= other.bits[i];
+    } else {
+        for (auto const &low: other.array)
+            this->bits[low / 64] |= 1ULL << (low % 64);
+    }
+    this->cardinality = 0;
+    for (auto const &word: this->bits)
+        this->cardinality += __builtin_popcountll(word);
+}
+
+void RoaringBitmap::Container::get_lows(vector<uint16_t> &lows) const {
+    if (!is_bitset()) {
+        lows.insert(lows.end(), this->array.begin(), this->array.end());
+        return;
+    }
+    for (uint i = 0; i < this->bits.size(); i++)
+        for (uint64_t word = this->bits[i]; word != 0; word &= word - 1)
+            lows.push_back((uint16_t) (i * 64 + __builtin_ctzll(word)));
+}
+
+// Cardinality, whether it's a bitset, and then the array or the bitset.
+string RoaringBitmap::Container::marshal() const {
+    string bytes;
+    uint16_t count = (uint16_t) this->cardinality;
+    char bitset = is_bitset();
+    bytes.append((char *) &count, sizeof(count));
+    bytes.append(&bitset, 1);
+    if (is_bitset())
+        bytes.append((char *) this->bits.data(), this->bits.size() * sizeof(uint64_t));
+    else
+        bytes.append((char *) this->array.data(), this->array.size() * sizeof(uint16_t));
+    return bytes;
+}
+
+void RoaringBitmap::Container::unmarshal(const char *bytes, uint size) {
+    this->cardinality = *(uint16_t *) bytes;
+    bool bitset = bytes[sizeof(uint16_t)] != 0;
+    const char *payload = bytes + sizeof(uint16_t) + 1;
+    uint payload_size = size - sizeof(uint16_t) - 1;
+    this->array.clear();
+    this->bits.clear();
+    if (bitset)
+        this->bits.assign((uint64_t *) payload, (uint64_t *) (payload + payload_size));
+    else
+        this->array.assign((uint16_t *) payload, (uint16_t *) (payload + payload_size));
+}
+
+// Make the container hold just the given (sorted) values, as an array or a bitset, whichever is smaller.
+void RoaringBitmap::Container::set(const vector<uint16_t> &lows) {
+    this->cardinality = (uint) lows.size();
+    if (lows.size() <= ARRAY_MAX) {
+        this->array = lows;
+        this->bits.clear();
+    } else {
+        this->array.clear();
+        this->bits.assign(CONTAINER_SIZE / 64, 0);
+        for (auto const &low: lows)
+            this->bits[low / 64] |= 1ULL << (low % 64);
+    }
+}
+
+
+/*****************
+ * RoaringBitmap *
+ *****************/
+
+void RoaringBitmap::add(uint32_t position) {
+    this->containers[container_key(position)].add(low_bits(position));
+}
+
+bool RoaringBitmap::remove(uint32_t position) {
+    auto it = this->containers.find(container_key(position));
+    if (it == this->containers.end() || !it->second.remove(low_bits(position)))
+        return false;
+    if (it->second.get_cardinality() == 0)
+        this->containers.erase(it);
+    return true;
+}
+
+bool RoaringBitmap::contains(uint32_t position) const {
+    auto it = this->containers.find(container_key(position));
+    return it != this->containers.end() && it->second.contains(low_bits(position));
+}
+
+u_long RoaringBitmap::cardinality() const {
+    u_long ret = 0;
+    for (auto const &container: this->containers)
+        ret += container.second.get_cardinality();
+    return ret;
+}
+
+void RoaringBitmap::intersect(const RoaringBitmap &other) {
+    for (auto it = this->containers.begin(); it != this->containers.end();) {
+        auto found = other.containers.find(it->first);
+        if (found != other.containers.end())
+            it->second.intersect(found->second);
+        if (found == other.containers.end() || it->second.get_cardinality() == 0)
+            it = this->containers.erase(it);
+        else
+            it++;
+    }
+}
+
+void RoaringBitmap::unite(const RoaringBitmap &other) {
+    for (auto const &container: other.containers)
+        this->containers[container.first].unite(container.second);
+}
+
+void RoaringBitmap::get_positions(vector<uint32_t> &positions) const {
+    vector<uint16_t> lows;
+    for (auto const &container: this->containers) {
+        lows.clear();
+        container.second.get_lows(lows);
+        for (auto const &low: lows)
+            positions.push_back(container.first << CONTAINER_BITS | low);
+    }
+}
+
+
+/***************
+ * BitmapIndex *
+ ***************/
+
+BitmapIndex::BitmapIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique), closed(true), file(relation.get_table_name() + "-" + name),
+          key_profile(), bitmaps(), locations() {
+    build_key_profile();
+}
+
+// Create the index: a bitmap for each distinct key in the table, built in memory and then written out.
+void BitmapIndex::create() {
+    file.create();
+    closed = false;
+    bitmaps.clear();
+    locations.clear();
+    try {
+        BlockID block_count = relation.get_block_count();
+        for (BlockID block_id = 1; block_id <= block_count; block_id++) {
+            Handles handles;
+            ValueDicts *rows = project_block(block_id, handles);
+            for (uint i = 0; i < rows->size(); i++) {
+                NormalizedKey *key = this->tkey((*rows)[i]);
+                RoaringBitmap &bitmap = bitmaps[*key];
+                delete key;
+                if (this->unique && !bitmap.empty()) {
+                    for (auto const &row: *rows)
+                        delete row;
+                    delete rows;
+                    throw DbRelationError("Duplicate keys are not allowed in unique index");
+                }
+                bitmap.add(position(handles[i]));
+            }
+            for (auto const &row: *rows)
+                delete row;
+            delete rows;
+        }
+        for (auto const &bitmap: bitmaps)
+            for (auto const &container: bitmap.second.get_containers())
+                save(bitmap.first, container.first);
+    } catch (...) {
+        drop();
+        throw;
+    }
+}
+
+// Drop the index.
+void BitmapIndex::drop() {
+    file.drop();
+    bitmaps.clear();
+    locations.clear();
+    closed = true;
+}
+
+// Open existing index, reading in all its bitmaps. Enables: lookup, insert, delete, relocate.
+void BitmapIndex::open() {
+    if (!closed)
+        return;
+    file.open();
+    closed = false;
+    BlockIDs *block_ids = file.block_ids();
+    for (auto const &block_id: *block_ids) {
+        SlottedPage *page = file.get(block_id);
+        RecordIDs *record_ids = page->ids();
+        for (auto const &record_id: *record_ids) {
+            Dbt *dbt = page->get(record_id);
+            const char *bytes = (const char *) dbt->get_data();
+            uint16_t key_size = *(uint16_t *) bytes;
+            NormalizedKey key(bytes + sizeof(uint16_t), key_size);
+            uint offset = sizeof(uint16_t) + key_size;
+            uint32_t container_key = *(uint32_t *) (bytes + offset);
+            offset += sizeof(uint32_t);
+            bitmaps[key].get_containers()[container_key].unmarshal(bytes + offset, dbt->get_size() - offset);
+            locations[ContainerID(key, container_key)] = Handle(block_id, record_id);
+            delete dbt;
+        }
+        delete record_ids;
+        delete page;
+    }
+    delete block_ids;
+}
+
+// Closes the index. Disables: lookup, insert, delete, relocate.
+void BitmapIndex::close() {
+    if (!closed) {
+        file.close();
+        bitmaps.clear();
+        locations.clear();
+        closed = true;
+    }
+}
+
+// Find all the rows whose columns are equal to key, in handle order.
+Handles *BitmapIndex::lookup(ValueDict *key_dict) const {
+    RoaringBitmap *bitmap = lookup_bitmap(key_dict);
+    vector<uint32_t> positions;
+    bitmap->get_positions(positions);
+    delete bitmap;
+    Handles *handles = new Handles;
+    for (auto const &position: positions)
+        handles->push_back(handle(position));
+    return handles;
+}
+
+RoaringBitmap *BitmapIndex::lookup_bitmap(ValueDict *key_dict) const {
+    NormalizedKey *key = this->tkey(key_dict);
+    auto it = bitmaps.find(*key);
+    delete key;
+    return it == bitmaps.end() ? new RoaringBitmap() : new RoaringBitmap(it->second);
+}
+
+// AND the bitmaps of each of the indices together, smallest first, and only then turn them into handles.
+Handles *BitmapIndex::lookup_all(const DbIndexes &indices, ValueDict *key) {
+    vector<RoaringBitmap *> found;
+    for (auto const &index: indices) {
+        auto *bitmap_index = dynamic_cast<BitmapIndex *>(index);
+        if (bitmap_index == nullptr)
+            throw DbRelationError("can only combine bitmap indices");
+        found.push_back(bitmap_index->lookup_bitmap(key));
+    }
+    sort(found.begin(), found.end(), [](const RoaringBitmap *a, const RoaringBitmap *b) {
+        return a->cardinality() < b->cardinality();
+    });
+    Handles *handles = new Handles;
+    if (found.empty())
+        return handles;
+    for (uint i = 1; i < found.size(); i++) {
+        found.front()->intersect(*found[i]);
+        delete found[i];
+    }
+    vector<uint32_t> positions;
+    found.front()->get_positions(positions);
+    delete found.front();
+    for (auto const &position: positions)
+        handles->push_back(handle(position));
+    return handles;
+}
+
+// Insert a row with the given handle. Row must exist in relation already.
+void BitmapIndex::insert(Handle handle) {
+    insert(handle, nullptr);
+}
+
+// Insert a row with the given handle and values (or, with row of nullptr, the values it has in the relation).
+void BitmapIndex::insert(Handle handle, const ValueDict *row) {
+    open();
+    NormalizedKey *key = row_key(handle, row);
+    RoaringBitmap &bitmap = bitmaps[*key];
+    if (this->unique && !bitmap.empty()) {
+        delete key;
+        throw DbRelationError("Duplicate keys are not allowed in unique index");
+    }
+    uint32_t pos = position(handle);
+    bitmap.add(pos);
+    save(*key, RoaringBitmap::container_key(pos));
+    delete key;
+}
+
+// Delete the index entry for the row with the given handle. Row must still be in relation.
+void BitmapIndex::del(Handle handle) {
+    del(handle, nullptr);
+}
+
+// Delete the index entry for the row with the given handle and values (or, with row of nullptr, the values it has
+// in the relation).
+void BitmapIndex::del(Handle handle, const ValueDict *row) {
+    open();
+    NormalizedKey *key = row_key(handle, row);
+    auto it = bitmaps.find(*key);
+    uint32_t pos = position(handle);
+    if (it != bitmaps.end() && it->second.remove(pos)) {
+        save(*key, RoaringBitmap::container_key(pos));
+        if (it->second.empty())
+            bitmaps.erase(it);
+    }
+    delete key;
+}
+
+// The row that used to be at from is now at to: move its bit.
+void BitmapIndex::relocate(Handle from, Handle to) {
+    open();
+    NormalizedKey *key = row_key(to);
+    RoaringBitmap &bitmap = bitmaps[*key];
+    uint32_t old_pos = position(from), new_pos = position(to);
+    if (bitmap.remove(old_pos))
+        save(*key, RoaringBitmap::container_key(old_pos));
+    bitmap.add(new_pos);
+    save(*key, RoaringBitmap::container_key(new_pos));
+    delete key;
+}
+
+// The key values in order, normalized. A key value given as an INT for a BOOLEAN column (which is how a WHERE
+// clause has it) is taken as the BOOLEAN.
+NormalizedKey *BitmapIndex::tkey(const ValueDict *key) const {
+    KeyValue key_value;
+    uint i = 0;
+    for (auto const &column_name: key_columns) {
+        auto column = key->find(column_name);
+        if (column == key->end())
+            throw DbRelationError("missing key column '" + column_name + "'");
+        Value value = column->second;
+        if (key_profile[i++] == ColumnAttribute::BOOLEAN)
+            value.data_type = ColumnAttribute::BOOLEAN;
+        key_value.push_back(value);
+    }
+    return new NormalizedKey(normalize_key(key_value, key_profile));
+}
+
+// Block id in the high bits and record id in the low RECORD_BITS.
+uint32_t BitmapIndex::position(Handle handle) {
+    if (handle.first >= (1U << (32 - RECORD_BITS)) || handle.second >= (1U << RECORD_BITS))
+        throw DbRelationError("row is past where a bitmap index can reach");
+    return handle.first << RECORD_BITS | handle.second;
+}
+
+Handle BitmapIndex::handle(uint32_t position) {
+    return Handle(position >> RECORD_BITS, (RecordID) (position & ((1U << RECORD_BITS) - 1)));
+}
+
+// Figure out the data types of each key component and encode them in key_profile.
+void BitmapIndex::build_key_profile() {
+    map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+// The key of the given row, or of the row with the given handle, read from the relation (freed by caller).
+NormalizedKey *BitmapIndex::row_key(Handle handle, const ValueDict *row) {
+    if (row != nullptr)
+        return this->tkey(row);
+    ValueDict *projected = relation.project(handle);
+    NormalizedKey *key = this->tkey(projected);
+    delete projected;
+    return key;
+}
+
+// Rewrite the record of one container of a key's bitmap where it is, or move it to the end of the file if it has
+// outgrown its block. A container that's gone empty loses its record.
+void BitmapIndex::save(const NormalizedKey &key, uint32_t container_key) {
+    ContainerID id(key, container_key);
+    auto location = locations.find(id);
+    const RoaringBitmap::Container *container = nullptr;
+    auto bitmap = bitmaps.find(key);
+    if (bitmap != bitmaps.end()) {
+        auto found = bitmap->second.get_containers().find(container_key);
+        if (found != bitmap->second.get_containers().end())
+            container = &found->second;
+    }
+
+    if (container == nullptr) {
+        if (location != locations.end()) {
+            SlottedPage *page = file.get(location->second.first);
+            page->del(location->second.second);
+            file.put(page);
+            delete page;
+            locations.erase(location);
+        }
+        return;
+    }
+
+    string bytes;
+    uint16_t key_size = (uint16_t) key.size();
+    bytes.append((char *) &key_size, sizeof(uint16_t));
+    bytes += key;
+    bytes.append((char *) &container_key, sizeof(uint32_t));
+    bytes += container->marshal();
+    Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+    if (location != locations.end()) {
+        SlottedPage *page = file.get(location->second.first);
+        try {
+            page->put(location->second.second, dbt);
+            file.put(page);
+            delete page;
+            return;
+        } catch (DbBlockNoRoomError &e) {
+            page->del(location->second.second);
+            file.put(page);
+            delete page;
+        }
+    }
+    SlottedPage *page = file.get(file.get_last_block_id());
+    RecordID record_id;
+    try {
+        record_id = page->add(&dbt);
+    } catch (DbBlockNoRoomError &e) {
+        delete page;
+        page = file.get_new();
+        record_id = page->add(&dbt);
+    }
+    file.put(page);
+    locations[id] = Handle(page->get_block_id(), record_id);
+    delete page;
+}
+
+// The container of key 0 of the bitmap, in the form it should be in and with exactly the given values.
+static bool check_container(const RoaringBitmap &bitmap, bool bitset, const std::vector<uint16_t> &expected,
+                            const std::string &what) {
+    auto it = bitmap.get_containers().find(0);
+    std::vector<uint16_t> lows;
+    if (it != bitmap.get_containers().end())
+        it->second.get_lows(lows);
+    if (it == bitmap.get_containers().end() || it->second.is_bitset() != bitset ||
+        it->second.get_cardinality() != expected.size() || lows != expected) {
+        std::cout << "bitmap container " << what << " should be " << (bitset ? "a bitset" : "an array") << " of "
+                  << expected.size() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool test_bitmap_index() {
+    // a container is an array up to ARRAY_MAX values (where its array is no bigger than a bitset) and a bitset past
+    // that, whichever way it gets there
+    RoaringBitmap bitmap;
+    std::vector<uint16_t> values;
+    for (uint i = 0; i < RoaringBitmap::ARRAY_MAX; i++)
+        values.push_back((uint16_t) (i * 7));
+    for (auto it = values.rbegin(); it != values.rend(); it++)
+        bitmap.add(*it);
+    bitmap.add(0);  // (already there)
+    if (!check_container(bitmap, false, values, "at ARRAY_MAX"))
+        return false;
+    if (bitmap.get_containers().at(0).marshal().size() > 3 + RoaringBitmap::CONTAINER_SIZE / 8) {
+        std::cout << "bitmap array container at ARRAY_MAX is bigger than a bitset" << std::endl;
+        return false;
+    }
+    bitmap.add(RoaringBitmap::CONTAINER_SIZE - 1);
+    values.push_back(RoaringBitmap::CONTAINER_SIZE - 1);
+    if (!check_container(bitmap, true, values, "past ARRAY_MAX"))
+        return false;
+    RoaringBitmap::Container copy;
+    std::string bytes = bitmap.get_containers().at(0).marshal();
+    copy.unmarshal(bytes.data(), (uint) bytes.size());
+    if (!copy.is_bitset() || copy.get_cardinality() != values.size() || !copy.contains(7) || copy.contains(8)) {
+        std::cout << "bitmap bitset container didn't unmarshal" << std::endl;
+        return false;
+    }
+    bitmap.remove(RoaringBitmap::CONTAINER_SIZE - 1);
+    values.pop_back();
+    if (!check_container(bitmap, false, values, "removed back to ARRAY_MAX"))
+        return false;
+
+    // AND and OR give whichever form fits what's left
+    RoaringBitmap evens, odds, low_evens;
+    std::vector<uint16_t> all_evens, few;
+    for (uint i = 0; i < RoaringBitmap::CONTAINER_SIZE; i += 2) {
+        evens.add(i);
+        odds.add(i + 1);
+        all_evens.push_back((uint16_t) i);
+    }
+    for (uint i = 0; i < 100; i += 2) {
+        low_evens.add(i);
+        few.push_back((uint16_t) i);
+    }
+    RoaringBitmap both(evens);
+    both.intersect(low_evens);  // bitset AND array
+    if (!check_container(both, false, few, "bitset AND array"))
+        return false;
+    both = evens;
+    RoaringBitmap mostly_evens(evens);
+    mostly_evens.remove(2);
+    mostly_evens.add(3);
+    both.intersect(mostly_evens);  // bitset AND bitset, most of it left
+    std::vector<uint16_t> expected(all_evens);
+    expected.erase(expected.begin() + 1);
+    if (!check_container(both, true, expected, "bitset AND bitset"))
+        return false;
+    both = evens;
+    RoaringBitmap odds_and_some(odds);
+    odds_and_some.add(0);
+    odds_and_some.add(2);
+    both.intersect(odds_and_some);  // bitset AND bitset, a few left
+    if (!check_container(both, false, std::vector<uint16_t>(all_evens.begin(), all_evens.begin() + 2),
+                         "bitset AND bitset with little in common"))
+        return false;
+    both = evens;
+    both.intersect(odds);  // bitset AND bitset, nothing left
+    if (!both.empty()) {
+        std::cout << "bitmap AND left an empty container" << std::endl;
+        return false;
+    }
+    RoaringBitmap half_a, half_b;
+    std::vector<uint16_t> halves;
+    for (uint i = 0; i < RoaringBitmap::ARRAY_MAX; i++) {
+        (i % 2 ? half_b : half_a).add(i);
+        halves.push_back((uint16_t) i);
+    }
+    half_a.unite(half_b);  // array OR array, up to ARRAY_MAX
+    if (!check_container(half_a, false, halves, "array OR array"))
+        return false;
+    half_b.add(RoaringBitmap::ARRAY_MAX);
+    half_a.unite(half_b);  // ... and one more
+    halves.push_back(RoaringBitmap::ARRAY_MAX);
+    if (!check_container(half_a, true, halves, "array OR array past ARRAY_MAX"))
+        return false;
+    for (auto const &value: halves)
+        half_a.remove(value);
+    if (!half_a.empty()) {
+        std::cout << "bitmap kept an emptied container" << std::endl;
+        return false;
+    }
+
+    // in an index, each container is a record that is rewritten as the container changes form and is removed
+    // when it empties out
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("color");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_bitmap_index", column_names, column_attributes);
+    table.create();
+    Handles reds, blues;
+    for (uint i = 0; i < RoaringBitmap::ARRAY_MAX + 100; i++) {
+        ValueDict row;
+        row["id"] = Value((int32_t) i);
+        row["color"] = Value(i % 100 == 0 ? "blue" : "red");
+        (i % 100 == 0 ? blues : reds).push_back(table.insert(&row));
+    }
+    if (BitmapIndex::position(reds.back()) >= RoaringBitmap::CONTAINER_SIZE) {  // (the last row inserted)
+        std::cout << "bitmap test rows don't fit in one container" << std::endl;
+        return false;
+    }
+    BitmapIndex index(table, "bitmap_color", ColumnNames(1, "color"), false);
+    index.create();
+    index.close();
+    index.open();
+    ValueDict red, blue;
+    red["color"] = Value("red");
+    blue["color"] = Value("blue");
+    NormalizedKey *red_key = index.tkey(&red), *blue_key = index.tkey(&blue);
+    std::vector<uint16_t> red_lows, blue_lows;
+    for (auto const &handle: reds)
+        red_lows.push_back((uint16_t) BitmapIndex::position(handle));
+    for (auto const &handle: blues)
+        blue_lows.push_back((uint16_t) BitmapIndex::position(handle));
+    if (!check_container(index.bitmaps[*red_key], true, red_lows, "of red rows") ||
+        !check_container(index.bitmaps[*blue_key], false, blue_lows, "of blue rows") || index.locations.size() != 2)
+        return false;
+    while (red_lows.size() > RoaringBitmap::ARRAY_MAX) {
+        index.del(reds.back());
+        table.del(reds.back());
+        reds.pop_back();
+        red_lows.pop_back();
+    }
+    for (auto const &handle: blues) {
+        index.del(handle);
+        table.del(handle);
+    }
+    index.close();
+    index.open();
+    if (!check_container(index.bitmaps[*red_key], false, red_lows, "of red rows after deletes") ||
+        index.bitmaps.count(*blue_key) != 0 || index.locations.size() != 1) {
+        std::cout << "bitmap index has " << index.locations.size() << " container records" << std::endl;
+        return false;
+    }
+    Handles *handles = index.lookup(&red);
+    bool ok = *handles == reds;
+    delete handles;
+    if (!ok) {
+        std::cout << "bitmap lookup failed" << std::endl;
+        return false;
+    }
+    delete red_key;
+    delete blue_key;
+    index.drop();
+    table.drop();
+    return true;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file BitmapIndex.h - compressed bitmaps and the bitmap index built from them.
+ * RoaringBitmap
+ * BitmapIndex
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include "BTreeNode.h"
+
+/**
+ * @class RoaringBitmap - compressed set of 32-bit positions
+ *
+ * Positions are split into a container key (the high bits) and the position within the container (the low
+ * CONTAINER_BITS bits). A container with a few positions keeps them as a sorted array of 16-bit values; once it has
+ * more than ARRAY_MAX of them it becomes a plain bitset, which is then the smaller of the two. Containers without
+ * any positions aren't kept at all.
+ */
+class RoaringBitmap {
+public:
+    static const uint CONTAINER_BITS = 14;  // so that a bitset container fits in a block with room to spare
+    static const uint CONTAINER_SIZE = 1U << CONTAINER_BITS;
+    static const uint ARRAY_MAX = CONTAINER_SIZE / 16;  // where an array of uint16_t gets as big as a bitset
+
+    /**
+     * @class Container - the positions of a bitmap that share a container key
+     */
+    class Container {
+    public:
+        Container() : cardinality(0), array(), bits() {}
+
+        void add(uint16_t low);
+
+        bool remove(uint16_t low);  // false if it wasn't there
+
+        bool contains(uint16_t low) const;
+
+        void intersect(const Container &other);
+
+        void unite(const Container &other);
+
+        uint get_cardinality() const { return this->cardinality; }
+
+        bool is_bitset() const { return !this->bits.empty(); }
+
+        void get_lows(std::vector<uint16_t> &lows) const;  // in order
+
+        std::string marshal() const;
+
+        void unmarshal(const char *bytes, uint size);
+
+    protected:
+        uint cardinality;
+        std::vector<uint16_t> array;  // sorted, if this is an array container
+        std::vector<uint64_t> bits;  // CONTAINER_SIZE bits, if this is a bitset container
+
+        void set(const std::vector<uint16_t> &lows);  // as an array or a bitset, whichever is smaller
+    };
+
+    typedef std::map<uint32_t, Container> Containers;
+
+    RoaringBitmap() : containers() {}
+
+    virtual ~RoaringBitmap() {}
+
+    void add(uint32_t position);
+
+    bool remove(uint32_t position);  // false if it wasn't there
+
+    bool contains(uint32_t position) const;
+
+    bool empty() const { return this->containers.empty(); }
+
+    u_long cardinality() const;
+
+    void intersect(const RoaringBitmap &other);  // AND
+
+    void unite(const RoaringBitmap &other);  // OR
+
+    void get_positions(std::vector<uint32_t> &positions) const;  // in order
+
+    const Containers &get_containers() const { return this->containers; }
+
+    Containers &get_containers() { return this->containers; }
+
+    static uint32_t container_key(uint32_t position) { return position >> CONTAINER_BITS; }
+
+    static uint16_t low_bits(uint32_t position) { return (uint16_t) (position & (CONTAINER_SIZE - 1)); }
+
+protected:
+    Containers containers;
+};
+
+
+/**
+ * @class BitmapIndex - one compressed bitmap of row positions for each distinct key, for low-cardinality columns
+ *
+ * A row's position is its block id and record id packed into 32 bits, so a bitmap is in handle order. Each
+ * container of each key's bitmap is one record in the index file: the key's length and bytes, the container key,
+ * and the container. All the bitmaps are read in when the index is opened; a change rewrites just the record of the
+ * container it's in. Lookups that fix several columns with bitmap indices can AND the bitmaps before ever turning
+ * them into handles (see lookup_all).
+ */
+class BitmapIndex : public DbIndex {
+public:
+    static const uint RECORD_BITS = 10;  // bits of a position for the record id (a block can't hold more rows)
+
+    BitmapIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~BitmapIndex() {}
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    virtual void del(Handle handle);
+
+    virtual void del(Handle handle, const ValueDict *row);
+
+    virtual void relocate(Handle from, Handle to);
+
+    // pull out the key values from the ValueDict in order, normalized (freed by caller)
+    virtual NormalizedKey *tkey(const ValueDict *key) const;
+
+    /**
+     * The bitmap of the rows with the given key.
+     * @param key  dictionary of values for the search key (other columns are ignored)
+     * @returns    the rows' positions (freed by caller)
+     */
+    RoaringBitmap *lookup_bitmap(ValueDict *key) const;
+
+    /**
+     * The rows that match in every one of the given bitmap indices: their bitmaps ANDed together.
+     * @param indices  bitmap indices on the table
+     * @param key      dictionary of values for the search key of each of them
+     * @returns        list of handles in handle order (freed by caller)
+     */
+    static Handles *lookup_all(const DbIndexes &indices, ValueDict *key);
+
+    static uint32_t position(Handle handle);
+
+    static Handle handle(uint32_t position);
+
+    u_long get_key_count() const { return this->bitmaps.size(); }
+
+protected:
+    typedef std::pair<NormalizedKey, uint32_t> ContainerID;  // key and container key
+
+    bool closed;
+    HeapFile file;
+    KeyProfile key_profile;
+    std::map<NormalizedKey, RoaringBitmap> bitmaps;
+    std::map<ContainerID, Handle> locations;  // where each container's record is in the file
+
+    void build_key_profile();
+
+    // tkey of row, or of the row in the relation with the given handle if row is nullptr (freed by caller)
+    NormalizedKey *row_key(Handle handle, const ValueDict *row = nullptr);
+
+    void save(const NormalizedKey &key, uint32_t container_key);  // write out (or remove) a container's record
+
+    friend bool test_bitmap_index();
+};
+
+bool test_bitmap_index();
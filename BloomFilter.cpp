@@ -0,0 +1,395 @@
+/**
+ * @file BloomFilter.cpp - implementation of BloomFilter and BlockBloomFilters
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "BloomFilter.h"
+
+using namespace std;
+typedef uint16_t u16;
+
+/****************
+ * BloomFilter  *
+ ****************/
+
+const uint BloomFilter::MAX_BITS;
+
+/**
+ * Construct an empty filter.
+ * @param num_bits    size of the filter (rounded up to a whole number of bytes)
+ * @param num_hashes  number of hash functions
+ */
+BloomFilter::BloomFilter(uint num_bits, uint num_hashes) : num_hashes(num_hashes), bits((num_bits + 7) / 8, 0) {
+}
+
+/**
+ * Construct a filter from its stored bits.
+ * @param bytes       the bits
+ * @param num_bytes   size of bytes
+ * @param num_hashes  number of hash functions
+ */
+BloomFilter::BloomFilter(const void *bytes, uint num_bytes, uint num_hashes) : num_hashes(num_hashes),
+                                                                               bits((const uint8_t *) bytes,
+                                                                                    (const uint8_t *) bytes +
+                                                                                    num_bytes) {
+}
+
+// -ln(p) / ln(2)^2
+double BloomFilter::bits_per_key(double false_positive_rate) {
+    if (false_positive_rate <= 0.0 || false_positive_rate >= 1.0)
+        throw DbRelationError("false positive rate must be between 0 and 1");
+    return -log(false_positive_rate) / (log(2.0) * log(2.0));
+}
+
+// bits_per_key * ln(2), at least one
+uint BloomFilter::optimal_hashes(double bits_per_key) {
+    uint k = (uint) lround(bits_per_key * log(2.0));
+    return max(1U, min(k, 16U));
+}
+
+// FNV-1a over the data type and contents, finished with the splitmix64 mixer to spread the bits.
+uint64_t BloomFilter::hash(const Value &value) {
+    uint64_t h = 14695981039346656037ULL;
+    const uint64_t prime = 1099511628211ULL;
+    h = (h ^ (uint8_t) value.data_type) * prime;
+    if (value.data_type == ColumnAttribute::TEXT) {
+        for (auto const &c: value.s)
+            h = (h ^ (uint8_t) c) * prime;
+    } else {
+        uint32_t n = (uint32_t) value.n;
+        for (int i = 0; i < 4; i++, n >>= 8)
+            h = (h ^ (n & 0xFF)) * prime;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// Set the bits for a hash: bit i is (h1 + i * h2) mod m.
+void BloomFilter::add_hash(uint64_t h) {
+    uint64_t m = get_num_bits();
+    if (m == 0)
+        return;
+    uint64_t h1 = h & 0xFFFFFFFF, h2 = (h >> 32) | 1;
+    for (uint i = 0; i < this->num_hashes; i++) {
+        uint64_t bit = (h1 + i * h2) % m;
+        this->bits[bit / 8] |= (uint8_t) (1 << (bit % 8));
+    }
+}
+
+// Check the bits for a hash.
+bool BloomFilter::may_contain_hash(uint64_t h) const {
+    uint64_t m = get_num_bits();
+    if (m == 0)
+        return true;
+    uint64_t h1 = h & 0xFFFFFFFF, h2 = (h >> 32) | 1;
+    for (uint i = 0; i < this->num_hashes; i++) {
+        uint64_t bit = (h1 + i * h2) % m;
+        if ((this->bits[bit / 8] & (1 << (bit % 8))) == 0)
+            return false;
+    }
+    return true;
+}
+
+// Forget everything.
+void BloomFilter::clear() {
+    fill(this->bits.begin(), this->bits.end(), 0);
+}
+
+
+/*********************
+ * BlockBloomFilters *
+ *********************/
+
+/**
+ * Constructor
+ * @param table_name         heap table
+ * @param column_names       its columns
+ * @param column_attributes  and their attributes
+ */
+BlockBloomFilters::BlockBloomFilters(const Identifier &table_name, const ColumnNames &column_names,
+                                     const ColumnAttributes &column_attributes) : table_name(table_name),
+                                                                                  column_names(column_names),
+                                                                                  column_attributes(column_attributes),
+                                                                                  file(new HeapFile(table_name + ".bloom")),
+                                                                                  loaded(false), declarations(),
+                                                                                  filters() {
+}
+
+BlockBloomFilters::~BlockBloomFilters() {
+    delete file;
+}
+
+/**
+ * Take on the table's columns. If they have changed (the table was dropped and created again with others), what
+ * is in memory is for the old table, so it is read in again from the new one's file when next needed.
+ * @param column_names
+ * @param column_attributes
+ */
+void BlockBloomFilters::set_schema(const ColumnNames &column_names, const ColumnAttributes &column_attributes) {
+    std::vector<ColumnAttribute::DataType> types, old_types;
+    for (auto const &ca: column_attributes)
+        types.push_back(ColumnAttribute(ca).get_data_type());
+    for (auto const &ca: this->column_attributes)
+        old_types.push_back(ColumnAttribute(ca).get_data_type());
+    if (column_names == this->column_names && types == old_types)
+        return;
+    this->column_names = column_names;
+    this->column_attributes = column_attributes;
+    this->declarations.clear();
+    this->filters.clear();
+    this->loaded = false;
+}
+
+/**
+ * Declare filters on the given columns (any already declared on other columns are kept).
+ * @param column_names
+ * @param false_positive_rate
+ */
+void BlockBloomFilters::declare(const ColumnNames &column_names, double false_positive_rate) {
+    load();
+    double bits_per_key = BloomFilter::bits_per_key(false_positive_rate);
+    uint rows = rows_per_block();
+    for (auto const &column_name: column_names) {
+        auto it = find(this->column_names.begin(), this->column_names.end(), column_name);
+        if (it == this->column_names.end())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        ColumnAttribute ca = this->column_attributes[it - this->column_names.begin()];
+        Declaration declaration;
+        declaration.column_name = column_name;
+        declaration.data_type = ca.get_data_type();
+        declaration.num_bits = min((uint) ceil(rows * bits_per_key), BloomFilter::MAX_BITS);
+        declaration.num_hashes = BloomFilter::optimal_hashes(bits_per_key);
+        bool replaced = false;
+        for (auto &other: this->declarations)
+            if (other.column_name == column_name) {
+                other = declaration;
+                replaced = true;
+            }
+        if (!replaced)
+            this->declarations.push_back(declaration);
+    }
+
+    // all of a block's filters have to fit into one block of the filter file, so shrink them if need be
+    uint available = DbBlock::BLOCK_SZ - 8 - 4 * (uint) this->declarations.size();
+    uint wanted = 0;
+    for (auto const &declaration: this->declarations)
+        wanted += (declaration.num_bits + 7) / 8;
+    if (wanted > available)
+        for (auto &declaration: this->declarations)
+            declaration.num_bits = (uint) ((uint64_t) (declaration.num_bits / 8) * available / wanted) * 8;
+
+    // start the filter file over
+    drop_file();
+    this->file->create();
+    this->filters.clear();
+    save_declarations();
+}
+
+/**
+ * Remove all the declarations and the filter file.
+ */
+void BlockBloomFilters::drop() {
+    drop_file();
+    this->declarations.clear();
+    this->filters.clear();
+    this->loaded = true;
+}
+
+/**
+ * Are there any filters?
+ * @return true if no columns have filters
+ */
+bool BlockBloomFilters::empty() {
+    load();
+    return this->declarations.empty();
+}
+
+/**
+ * Columns with filters.
+ * @return column names in declaration order
+ */
+ColumnNames BlockBloomFilters::get_column_names() {
+    load();
+    ColumnNames ret;
+    for (auto const &declaration: this->declarations)
+        ret.push_back(declaration.column_name);
+    return ret;
+}
+
+/**
+ * Empty a block's filters.
+ * @param block_id
+ */
+void BlockBloomFilters::reset(BlockID block_id) {
+    for (auto &filter: block_filters(block_id))
+        filter.clear();
+}
+
+/**
+ * Add a row's values to its block's filters.
+ * @param block_id
+ * @param row
+ */
+void BlockBloomFilters::add(BlockID block_id, const ValueDict *row) {
+    if (empty())
+        return;
+    vector<BloomFilter> &block = block_filters(block_id);
+    for (uint i = 0; i < this->declarations.size(); i++) {
+        ValueDict::const_iterator column = row->find(this->declarations[i].column_name);
+        if (column == row->end())
+            continue;
+        Value value = column->second;
+        value.data_type = this->declarations[i].data_type;  // hash it the way it is stored
+        block[i].add(value);
+    }
+}
+
+/**
+ * Write a block's filters into the filter file (at block_id + 1).
+ * @param block_id
+ */
+void BlockBloomFilters::save(BlockID block_id) {
+    if (empty())
+        return;
+    while (this->file->get_last_block_id() < block_id + 1)
+        delete this->file->get_new();
+    SlottedPage *page = this->file->get(block_id + 1);
+    page->clear();
+    for (auto const &filter: block_filters(block_id)) {
+        const vector<uint8_t> &bytes = filter.get_bytes();
+        Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+        page->add(&dbt);
+    }
+    this->file->put(page);
+    delete page;
+}
+
+/**
+ * Use the filters to see if a block might have a row equal to all the given values.
+ * @param block_id
+ * @param where
+ * @return false if the block definitely has no such row
+ */
+bool BlockBloomFilters::may_match(BlockID block_id, const ValueDict *where) {
+    if (where == nullptr || empty())
+        return true;
+    if (block_id >= this->filters.size() || this->filters[block_id].empty())
+        return true;  // no filters have been built for this block
+    const vector<BloomFilter> &block = this->filters[block_id];
+    for (uint i = 0; i < this->declarations.size(); i++) {
+        ValueDict::const_iterator column = where->find(this->declarations[i].column_name);
+        if (column != where->end() && column->second.data_type == this->declarations[i].data_type &&
+            !block[i].may_contain(column->second))
+            return false;
+    }
+    return true;
+}
+
+// Read the declarations and all the filters into memory (if there is a filter file).
+void BlockBloomFilters::load() {
+    if (this->loaded)
+        return;
+    this->loaded = true;
+    try {
+        this->file->open();
+    } catch (DbException &e) {
+        // no filter file, so no filters
+        delete this->file;
+        this->file = new HeapFile(this->table_name + ".bloom");
+        return;
+    }
+
+    SlottedPage *page = this->file->get(1);
+    RecordIDs *record_ids = page->ids();
+    for (auto const &record_id: *record_ids) {
+        Dbt *dbt = page->get(record_id);
+        char *bytes = (char *) dbt->get_data();
+        Declaration declaration;
+        declaration.num_bits = *(uint32_t *) bytes;
+        declaration.num_hashes = *(uint8_t *) (bytes + 4);
+        declaration.data_type = (ColumnAttribute::DataType) *(uint8_t *) (bytes + 5);
+        u16 size = *(u16 *) (bytes + 6);
+        declaration.column_name = string(bytes + 8, size);
+        this->declarations.push_back(declaration);
+        delete dbt;
+    }
+    delete record_ids;
+    delete page;
+
+    for (BlockID block_id = 1; block_id < this->file->get_last_block_id(); block_id++) {
+        page = this->file->get(block_id + 1);
+        vector<BloomFilter> &block = block_filters(block_id);
+        for (uint i = 0; i < this->declarations.size() && i < page->size(); i++) {
+            Dbt *dbt = page->get((RecordID) (i + 1));
+            block[i] = BloomFilter(dbt->get_data(), dbt->get_size(), this->declarations[i].num_hashes);
+            delete dbt;
+        }
+        delete page;
+    }
+}
+
+// Rewrite block 1 of the filter file with the declarations.
+void BlockBloomFilters::save_declarations() {
+    SlottedPage *page = this->file->get(1);
+    page->clear();
+    for (auto const &declaration: this->declarations) {
+        u16 size = (u16) declaration.column_name.length();
+        char *bytes = new char[8 + size];
+        *(uint32_t *) bytes = declaration.num_bits;
+        *(uint8_t *) (bytes + 4) = (uint8_t) declaration.num_hashes;
+        *(uint8_t *) (bytes + 5) = (uint8_t) declaration.data_type;
+        *(u16 *) (bytes + 6) = size;
+        memcpy(bytes + 8, declaration.column_name.c_str(), size);
+        Dbt dbt(bytes, 8U + size);
+        page->add(&dbt);
+        delete[] bytes;
+    }
+    this->file->put(page);
+    delete page;
+}
+
+// Remove the filter file, if there is one, and get a fresh HeapFile object for it.
+void BlockBloomFilters::drop_file() {
+    try {
+        this->file->drop();
+    } catch (DbException &e) {
+        // wasn't there
+    }
+    delete this->file;
+    this->file = new HeapFile(this->table_name + ".bloom");
+}
+
+// Get the filters for a block (creating empty ones if this block doesn't have any yet).
+vector<BloomFilter> &BlockBloomFilters::block_filters(BlockID block_id) {
+    if (block_id >= this->filters.size())
+        this->filters.resize(block_id + 1);
+    vector<BloomFilter> &block = this->filters[block_id];
+    if (block.size() != this->declarations.size()) {
+        block.clear();
+        for (auto const &declaration: this->declarations)
+            block.push_back(BloomFilter(declaration.num_bits, declaration.num_hashes));
+    }
+    return block;
+}
+
+// The most rows that could fit in a data block (if every TEXT value were empty).
+uint BlockBloomFilters::rows_per_block() const {
+    uint row_size = 0;
+    for (auto const &ca: this->column_attributes) {
+        ColumnAttribute attribute = ca;
+        if (attribute.get_data_type() == ColumnAttribute::INT)
+            row_size += 4;
+        else if (attribute.get_data_type() == ColumnAttribute::TEXT)
+            row_size += 2;
+        else
+            row_size += 1;
+    }
+    return max(1U, (DbBlock::BLOCK_SZ - 4) / (row_size + 4));  // each record also needs a 4-byte header
+}
@@ -0,0 +1,184 @@
+/**
+ * @file BloomFilter.h - Bloom filters and the per-block Bloom filters of a heap table.
+ * BloomFilter
+ * BlockBloomFilters
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include "storage_engine.h"
+#include "HeapFile.h"
+
+/**
+ * @class BloomFilter - fixed-size bit vector answering "definitely not present" or "maybe present"
+ *
+ * Uses double hashing (Kirsch and Mitzenmacher) of one 64-bit hash of the value, so adding or probing
+ * a value costs a single hash computation no matter how many hash functions the filter uses.
+ */
+class BloomFilter {
+public:
+    /**
+     * Largest filter we build (so that it always fits in a block).
+     */
+    static const uint MAX_BITS = (DbBlock::BLOCK_SZ - 16) * 8;
+
+    BloomFilter() : num_hashes(1), bits() {}
+
+    BloomFilter(uint num_bits, uint num_hashes);
+
+    BloomFilter(const void *bytes, uint num_bytes, uint num_hashes);
+
+    virtual ~BloomFilter() {}
+
+    /**
+     * Number of bits per key needed to get the given false-positive rate.
+     * @param false_positive_rate  wanted probability of "maybe present" for an absent key
+     * @returns                    bits per key
+     */
+    static double bits_per_key(double false_positive_rate);
+
+    /**
+     * Best number of hash functions for a filter of the given density.
+     * @param bits_per_key  bits in the filter divided by number of keys it is sized for
+     * @returns             number of hash functions
+     */
+    static uint optimal_hashes(double bits_per_key);
+
+    /**
+     * 64-bit hash of a value (depends on both the data type and the contents).
+     * @param value  value to hash
+     * @returns      hash
+     */
+    static uint64_t hash(const Value &value);
+
+    void add(const Value &value) { add_hash(hash(value)); }
+
+    void add_hash(uint64_t h);
+
+    bool may_contain(const Value &value) const { return may_contain_hash(hash(value)); }
+
+    bool may_contain_hash(uint64_t h) const;
+
+    void clear();
+
+    uint get_num_bits() const { return (uint) bits.size() * 8; }
+
+    uint get_num_hashes() const { return num_hashes; }
+
+    const std::vector<uint8_t> &get_bytes() const { return bits; }
+
+protected:
+    uint num_hashes;
+    std::vector<uint8_t> bits;
+};
+
+
+/**
+ * @class BlockBloomFilters - one Bloom filter per block per declared column of a heap table
+ *
+ * The filters are stored alongside the heap file in a second HeapFile, "<table>.bloom". Block 1 of that
+ * file holds the declarations (one record per column with its filter size and number of hashes). The
+ * filters for data block b are the records of block b + 1, in declaration order. All the filters are
+ * also cached in memory so that they can be checked without fetching anything. There is one of these per table, in
+ * TableRegistry, so the file is loaded once and a filter added through one HeapTable object is checked by the rest.
+ */
+class BlockBloomFilters {
+public:
+    BlockBloomFilters(const Identifier &table_name, const ColumnNames &column_names,
+                      const ColumnAttributes &column_attributes);
+
+    virtual ~BlockBloomFilters();
+
+    BlockBloomFilters(const BlockBloomFilters &other) = delete;
+
+    BlockBloomFilters(BlockBloomFilters &&temp) = delete;
+
+    BlockBloomFilters &operator=(const BlockBloomFilters &other) = delete;
+
+    BlockBloomFilters &operator=(BlockBloomFilters &&temp) = delete;
+
+    /**
+     * Make sure the filters are for the table's current columns, reloading them from the file if they aren't.
+     * @param column_names       columns of the table, in order
+     * @param column_attributes  corresponding attributes
+     */
+    void set_schema(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    /**
+     * Declare (or redeclare) Bloom filters on some columns. The caller must then rebuild every block's
+     * filters with reset() and add().
+     * @param column_names         columns to filter on
+     * @param false_positive_rate  wanted false-positive rate of each block's filter
+     */
+    void declare(const ColumnNames &column_names, double false_positive_rate);
+
+    /**
+     * Remove all the filters and their file.
+     */
+    void drop();
+
+    /**
+     * Are there any filters declared on this table?
+     */
+    bool empty();
+
+    /**
+     * Get the declared columns.
+     */
+    ColumnNames get_column_names();
+
+    /**
+     * Empty all the filters for a block (in memory only, follow with save()).
+     * @param block_id  data block
+     */
+    void reset(BlockID block_id);
+
+    /**
+     * Add a row to the filters for its block (in memory only, follow with save()).
+     * @param block_id  data block the row was put in
+     * @param row       full row
+     */
+    void add(BlockID block_id, const ValueDict *row);
+
+    /**
+     * Write the filters for a block to disk.
+     * @param block_id  data block
+     */
+    void save(BlockID block_id);
+
+    /**
+     * Could any row in the block satisfy the given equality conjunction?
+     * @param block_id  data block
+     * @param where     column/value pairs that must all be equal
+     * @returns         false only if some filter proves there is no qualifying row
+     */
+    bool may_match(BlockID block_id, const ValueDict *where);
+
+protected:
+    struct Declaration {
+        Identifier column_name;
+        ColumnAttribute::DataType data_type;
+        uint num_bits;
+        uint num_hashes;
+    };
+
+    Identifier table_name;
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    HeapFile *file;
+    bool loaded;
+    std::vector<Declaration> declarations;
+    std::vector<std::vector<BloomFilter> > filters;  // filters[block_id][declaration]
+
+    void load();
+
+    void save_declarations();
+
+    void drop_file();
+
+    std::vector<BloomFilter> &block_filters(BlockID block_id);
+
+    uint rows_per_block() const;
+};
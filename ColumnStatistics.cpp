@@ -0,0 +1,354 @@
+/**
+ * @file ColumnStatistics.cpp - implementation of HyperLogLog, ColumnSample, and ColumnStatistics
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include "ColumnStatistics.h"
+#include "BloomFilter.h"
+
+using namespace std;
+
+/*
+ * ******************************
+ * HyperLogLog class implementation
+ * ******************************
+ */
+
+// The first PRECISION bits of the hash pick the register, the position of the first 1 bit after them is the rank.
+void HyperLogLog::add(const Value &value) {
+    uint64_t h = BloomFilter::hash(value);
+    uint index = (uint) (h >> (64 - PRECISION));
+    uint64_t rest = h << PRECISION;
+    uint8_t rank = rest == 0 ? (uint8_t) (64 - PRECISION + 1) : (uint8_t) (__builtin_clzll(rest) + 1);
+    if (rank > this->registers[index])
+        this->registers[index] = rank;
+}
+
+void HyperLogLog::merge(const HyperLogLog &other) {
+    for (uint i = 0; i < REGISTERS; i++)
+        this->registers[i] = max(this->registers[i], other.registers[i]);
+}
+
+// Harmonic mean of the registers with the usual linear-counting correction for small cardinalities.
+double HyperLogLog::estimate() const {
+    const double m = REGISTERS;
+    double sum = 0.0;
+    uint zeros = 0;
+    for (auto const &r: this->registers) {
+        sum += ldexp(1.0, -(int) r);
+        if (r == 0)
+            zeros++;
+    }
+    double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0)
+        estimate = m * log(m / zeros);
+    return estimate;
+}
+
+string HyperLogLog::to_string() const {
+    string s(REGISTERS, '0');
+    for (uint i = 0; i < REGISTERS; i++)
+        s[i] = (char) ('0' + this->registers[i]);
+    return s;
+}
+
+// Anything malformed comes back as an empty sketch.
+HyperLogLog HyperLogLog::from_string(const string &s) {
+    HyperLogLog hll;
+    if (s.length() == REGISTERS)
+        for (uint i = 0; i < REGISTERS; i++)
+            hll.registers[i] = (uint8_t) max(0, s[i] - '0');
+    return hll;
+}
+
+
+/*
+ * ******************************
+ * ColumnSample class implementation
+ * ******************************
+ */
+
+void ColumnSample::add(const Value &value) {
+    this->rows++;
+    this->hll.add(value);
+    this->counts[value]++;
+}
+
+
+// Escape the characters we use as separators in the encodings.
+static string escape(const string &s) {
+    string ret;
+    for (auto const &c: s) {
+        if (c == '\\' || c == ',' || c == ':')
+            ret += '\\';
+        ret += c;
+    }
+    return ret;
+}
+
+// Split on an unescaped separator and unescape the pieces.
+static vector<string> split(const string &s, char separator) {
+    vector<string> ret;
+    string piece;
+    for (uint i = 0; i < s.length(); i++) {
+        if (s[i] == '\\' && i + 1 < s.length()) {
+            piece += s[++i];
+        } else if (s[i] == separator) {
+            ret.push_back(piece);
+            piece.clear();
+        } else {
+            piece += s[i];
+        }
+    }
+    if (!s.empty())
+        ret.push_back(piece);
+    return ret;
+}
+
+/*
+ * **********************************
+ * ColumnStatistics class implementation
+ * **********************************
+ */
+
+// If base_rows is zero, everything previously known is thrown away. Otherwise the old histogram and most
+// common values stand in for the rows that weren't looked at and are merged with what was sampled.
+void ColumnStatistics::refresh(const ColumnSample &sample, double scale, u_long base_rows, u_long sampled_rows,
+                               u_long tail_rows, BlockID blocks) {
+    bool incremental = base_rows > 0;
+    if (!incremental) {
+        this->histogram.clear();
+        this->mcv.clear();
+        this->hll = HyperLogLog();
+    }
+    u_long old_ndv = this->ndv;
+    u_long old_rows = this->row_count;
+    this->row_count = base_rows + sampled_rows;
+    this->analyzed_blocks = blocks;
+    this->tail_rows = tail_rows;
+
+    // distinct values in the scanned blocks: exact if we read them all, otherwise scaled up from the
+    // sample with the Haas-Stokes Duj1 estimator (values seen once hint at many more never seen)
+    double d = sample.counts.size();
+    double n = sample.rows;
+    double sampled_ndv = d;
+    if (scale > 1.0 && n > 0) {
+        double f1 = 0;
+        for (auto const &count: sample.counts)
+            if (count.second == 1)
+                f1++;
+        double N = max((double) sampled_rows, n);
+        sampled_ndv = min(N, max(d, n * d / (n - f1 + f1 * n / N)));
+    }
+    this->hll.merge(sample.hll);
+    if (incremental)
+        this->ndv = (u_long) max((double) old_ndv, this->hll.estimate() + (sampled_ndv - d));
+    else
+        this->ndv = (u_long) llround(sampled_ndv);
+    this->ndv = min(this->ndv, this->row_count);
+
+    // weighted points: each bucket of the old histogram contributes an equal share of the old rows at its
+    // upper bound, each sampled value contributes its count times the scale
+    if (this->data_type == ColumnAttribute::INT) {
+        map<int32_t, double> points;
+        if (incremental && this->histogram.size() > 1) {
+            double share = (double) base_rows / (double) (this->histogram.size() - 1);
+            points[this->histogram[0].n] += 0.0;
+            for (uint i = 1; i < this->histogram.size(); i++)
+                points[this->histogram[i].n] += share;
+        }
+        for (auto const &count: sample.counts)
+            points[count.first.n] += (double) count.second * scale;
+        double total = 0.0;
+        for (auto const &point: points)
+            total += point.second;
+        this->histogram.clear();
+        if (!points.empty()) {
+            this->histogram.push_back(Value(points.begin()->first));
+            double cumulative = 0.0;
+            uint bucket = 1;
+            for (auto const &point: points) {
+                cumulative += point.second;
+                if (cumulative >= total * bucket / BUCKETS || point.first == points.rbegin()->first) {
+                    if (point.first != this->histogram.back().n || this->histogram.size() == 1)
+                        this->histogram.push_back(Value(point.first));
+                    while (bucket < BUCKETS && cumulative >= total * bucket / BUCKETS)
+                        bucket++;
+                }
+            }
+        }
+    }
+
+    // most common values: old ones carry their old counts (less the share from the re-read last block),
+    // sampled ones their scaled counts
+    map<Value, double> frequent;
+    if (incremental && old_rows > 0)
+        for (auto const &entry: this->mcv)
+            frequent[entry.first] += (double) entry.second * base_rows / old_rows;
+    for (auto const &count: sample.counts)
+        if (count.second > 1)
+            frequent[count.first] += (double) count.second * scale;
+    vector<pair<double, Value> > ranked;
+    for (auto const &entry: frequent)
+        ranked.push_back(make_pair(entry.second, entry.first));
+    sort(ranked.begin(), ranked.end(), [](const pair<double, Value> &a, const pair<double, Value> &b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+    this->mcv.clear();
+    uint text_length = 0;
+    for (auto const &entry: ranked) {
+        if (this->mcv.size() >= MCV_SIZE || entry.first < 2.0)
+            break;
+        text_length += escape(escape(entry.second.s)).length() + 16;
+        if (text_length > MCV_TEXT_LIMIT)
+            break;
+        this->mcv.push_back(make_pair(entry.second, (u_long) llround(entry.first)));
+    }
+}
+
+double ColumnStatistics::selectivity(const Value &value) const {
+    if (this->row_count == 0)
+        return 0.0;
+    u_long mcv_rows = 0;
+    for (auto const &entry: this->mcv) {
+        if (entry.first == value)
+            return min(1.0, (double) entry.second / this->row_count);
+        mcv_rows += entry.second;
+    }
+    if (this->data_type == ColumnAttribute::INT && this->histogram.size() > 1 &&
+        (value.n < this->histogram.front().n || this->histogram.back().n < value.n))
+        return 0.0;
+    double rest_rows = this->row_count > mcv_rows ? (double) (this->row_count - mcv_rows) : 0.0;
+    double rest_ndv = this->ndv > this->mcv.size() ? (double) (this->ndv - this->mcv.size()) : 1.0;
+    return rest_rows / this->row_count / rest_ndv;
+}
+
+static string value_to_string(const Value &value) {
+    return value.data_type == ColumnAttribute::TEXT ? value.s : std::to_string(value.n);
+}
+
+static Value value_from_string(const string &s, ColumnAttribute::DataType data_type) {
+    Value value;
+    if (data_type == ColumnAttribute::TEXT) {
+        value = Value(s);
+    } else {
+        value = Value((int32_t) atol(s.c_str()));
+        value.data_type = data_type;
+    }
+    return value;
+}
+
+string ColumnStatistics::histogram_to_string() const {
+    stringstream out;
+    for (uint i = 0; i < this->histogram.size(); i++)
+        out << (i > 0 ? "," : "") << escape(value_to_string(this->histogram[i]));
+    return out.str();
+}
+
+string ColumnStatistics::mcv_to_string() const {
+    stringstream out;
+    for (uint i = 0; i < this->mcv.size(); i++)
+        out << (i > 0 ? "," : "") << escape(escape(value_to_string(this->mcv[i].first))) << ":" << this->mcv[i].second;
+    return out.str();
+}
+
+void ColumnStatistics::histogram_from_string(const string &s) {
+    this->histogram.clear();
+    for (auto const &bound: split(s, ','))
+        this->histogram.push_back(value_from_string(bound, this->data_type));
+}
+
+// Each entry was escaped twice (once as a value, once as an entry), so it is split twice.
+void ColumnStatistics::mcv_from_string(const string &s) {
+    this->mcv.clear();
+    for (auto const &entry: split(s, ',')) {
+        vector<string> parts = split(entry, ':');
+        if (parts.size() != 2)
+            continue;
+        this->mcv.push_back(make_pair(value_from_string(parts[0], this->data_type),
+                                      (u_long) atol(parts[1].c_str())));
+    }
+}
+
+/**
+ * Test helper. Build the statistics for one run of ANALYZE over the given values.
+ */
+static ColumnSample test_sample(const vector<int32_t> &values) {
+    ColumnSample sample;
+    for (auto const &n: values)
+        sample.add(Value(n));
+    return sample;
+}
+
+/**
+ * Testing function for column statistics.
+ * @return true if the tests all succeeded
+ */
+bool test_column_statistics() {
+    // HyperLogLog should be within a few percent (standard error is about 3% with 1024 registers)
+    HyperLogLog hll, evens;
+    for (int32_t i = 0; i < 100000; i++) {
+        hll.add(Value(i));
+        if (i % 2 == 0)
+            evens.add(Value(i));
+    }
+    double e = hll.estimate();
+    if (e < 90000 || e > 110000) {
+        cout << "hyperloglog estimate " << e << " for 100000" << endl;
+        return false;
+    }
+    HyperLogLog copy = HyperLogLog::from_string(hll.to_string());
+    copy.merge(evens);  // evens are already in there
+    if (copy.estimate() != e) {
+        cout << "hyperloglog round trip/merge " << copy.estimate() << " vs " << e << endl;
+        return false;
+    }
+
+    // 1000 rows: 0..899 once each and 7 a hundred extra times
+    vector<int32_t> values;
+    for (int32_t i = 0; i < 900; i++)
+        values.push_back(i);
+    for (int32_t i = 0; i < 100; i++)
+        values.push_back(7);
+    ColumnStatistics stats;
+    stats.refresh(test_sample(values), 1.0, 0, values.size(), 100, 4);
+    if (stats.row_count != 1000 || stats.ndv != 900 || stats.mcv.empty() || stats.mcv[0].first != Value(7) ||
+        stats.mcv[0].second != 101 || stats.histogram.front() != Value(0) || stats.histogram.back() != Value(899)) {
+        cout << "refresh " << stats.row_count << " " << stats.ndv << " " << stats.mcv_to_string() << endl;
+        return false;
+    }
+    if (stats.selectivity(Value(7)) < 0.1 || stats.selectivity(Value(5000)) != 0.0 ||
+        stats.selectivity(Value(8)) > 0.002) {
+        cout << "selectivity " << stats.selectivity(Value(7)) << " " << stats.selectivity(Value(8)) << endl;
+        return false;
+    }
+
+    // incremental: 1000 more rows of new values should roughly double the distinct count
+    values.clear();
+    for (int32_t i = 1000; i < 2000; i++)
+        values.push_back(i);
+    stats.refresh(test_sample(values), 1.0, stats.row_count - stats.tail_rows, values.size(), 250, 8);
+    if (stats.row_count != 1900 || stats.ndv < 1800 || stats.ndv > 2000 || stats.histogram.back() != Value(1999)) {
+        cout << "incremental refresh " << stats.row_count << " " << stats.ndv << endl;
+        return false;
+    }
+
+    // encodings survive a round trip, including text with separators in it
+    ColumnStatistics text;
+    text.data_type = ColumnAttribute::TEXT;
+    text.mcv.push_back(make_pair(Value("a,b:c\\d"), 42));
+    ColumnStatistics decoded;
+    decoded.data_type = ColumnAttribute::TEXT;
+    decoded.mcv_from_string(text.mcv_to_string());
+    stats.histogram_from_string(stats.histogram_to_string());
+    if (decoded.mcv.size() != 1 || decoded.mcv[0].first != Value("a,b:c\\d") || decoded.mcv[0].second != 42 ||
+        stats.histogram.back() != Value(1999)) {
+        cout << "encoding round trip " << text.mcv_to_string() << endl;
+        return false;
+    }
+    return true;
+}
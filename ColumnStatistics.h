@@ -0,0 +1,148 @@
+/**
+ * @file ColumnStatistics.h - optimizer statistics for a column of a table
+ * HyperLogLog
+ * ColumnSample
+ * ColumnStatistics
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class HyperLogLog - sketch for estimating the number of distinct values (Flajolet et al., 2007)
+ *
+ * 2^PRECISION one-byte registers. Sketches of two sets union exactly by taking the register-wise
+ * maximum, which is what lets ANALYZE refresh incrementally.
+ */
+class HyperLogLog {
+public:
+    static const uint PRECISION = 10;
+    static const uint REGISTERS = 1U << PRECISION;
+
+    HyperLogLog() : registers(REGISTERS, 0) {}
+
+    virtual ~HyperLogLog() {}
+
+    void add(const Value &value);
+
+    void merge(const HyperLogLog &other);
+
+    /**
+     * Estimated number of distinct values added so far.
+     */
+    double estimate() const;
+
+    /**
+     * Printable form of the registers (one character each), so it can be stored in a TEXT column.
+     */
+    std::string to_string() const;
+
+    static HyperLogLog from_string(const std::string &s);
+
+protected:
+    std::vector<uint8_t> registers;
+};
+
+
+/**
+ * @class ColumnSample - the values of one column seen by one run of ANALYZE
+ */
+class ColumnSample {
+public:
+    ColumnSample() : rows(0), hll(), counts() {}
+
+    virtual ~ColumnSample() {}
+
+    void add(const Value &value);
+
+    u_long rows;
+    HyperLogLog hll;
+    std::map<Value, u_long> counts;
+};
+
+
+/**
+ * @class ColumnStatistics - what we know about the values in a column
+ *
+ *      row_count        number of rows in the table
+ *      analyzed_blocks  number of blocks in the table when it was analyzed (the last one may have grown
+ *                       since, so an incremental ANALYZE reads it again along with any new blocks)
+ *      tail_rows        how many of row_count were in that last block
+ *      ndv              estimated number of distinct values
+ *      histogram        equi-depth histogram bounds for INT columns: bucket i holds the values in
+ *                       (histogram[i], histogram[i+1]] (the first bucket includes histogram[0])
+ *      mcv              most common values with their estimated number of rows
+ *      hll              HyperLogLog sketch of every value analyzed so far
+ */
+class ColumnStatistics {
+public:
+    /**
+     * Number of equi-depth histogram buckets.
+     */
+    static const uint BUCKETS = 20;
+
+    /**
+     * Most common values kept.
+     */
+    static const uint MCV_SIZE = 10;
+
+    /**
+     * Most characters of text used for the most-common-value list (so the whole row fits in a block).
+     */
+    static const uint MCV_TEXT_LIMIT = 1024;
+
+    ColumnStatistics() : column_name(), data_type(ColumnAttribute::INT), row_count(0), analyzed_blocks(0),
+                         tail_rows(0), ndv(0), histogram(), mcv(), hll() {}
+
+    virtual ~ColumnStatistics() {}
+
+    /**
+     * Fold one run of ANALYZE into these statistics.
+     * @param sample          values read by this run
+     * @param scale           how many rows each sampled row stands for (1 if every block was read)
+     * @param base_rows       rows in the blocks this run didn't look at (analyzed by an earlier run)
+     * @param sampled_rows    rows estimated to be in the blocks this run looked at (already scaled)
+     * @param tail_rows       rows in the table's last block
+     * @param blocks          number of blocks in the table
+     */
+    void refresh(const ColumnSample &sample, double scale, u_long base_rows, u_long sampled_rows, u_long tail_rows,
+                 BlockID blocks);
+
+    /**
+     * Estimated fraction of rows whose value is equal to the given one.
+     * @param value  value to look for
+     * @returns      selectivity between 0 and 1
+     */
+    double selectivity(const Value &value) const;
+
+    /**
+     * Encode/decode the histogram and most-common-value list to/from the TEXT columns of _statistics.
+     */
+    std::string histogram_to_string() const;
+
+    std::string mcv_to_string() const;
+
+    void histogram_from_string(const std::string &s);
+
+    void mcv_from_string(const std::string &s);
+
+    Identifier column_name;
+    ColumnAttribute::DataType data_type;
+    u_long row_count;
+    BlockID analyzed_blocks;
+    u_long tail_rows;
+    u_long ndv;
+    std::vector<Value> histogram;
+    std::vector<std::pair<Value, u_long> > mcv;
+    HyperLogLog hll;
+};
+
+typedef std::vector<ColumnStatistics> ColumnStatisticsList;
+
+bool test_column_statistics();
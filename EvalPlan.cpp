@@ -4,7 +4,10 @@
  * @see "Seattle University, CPSC5300, Spring 2021"
  */
 
+#include <algorithm>
 #include "EvalPlan.h"
+#include "BitmapIndex.h"
+#include "btree.h"
 
 
 class Dummy : public DbRelation {
@@ -44,23 +47,39 @@ public:
 };
 
 EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), projection(nullptr),
-                                                        select_conjunction(nullptr), table(Dummy::one()) {
+                                                        select_conjunction(nullptr), table(Dummy::one()),
+                                                        index(nullptr), index_key(nullptr) {
 }
 
 EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation),
                                                                   projection(projection), select_conjunction(nullptr),
-                                                                  table(Dummy::one()) {
+                                                                  table(Dummy::one()), index(nullptr),
+                                                                  index_key(nullptr) {
 }
 
 EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), projection(nullptr),
-                                                                 select_conjunction(conjunction), table(Dummy::one()) {
+                                                                 select_conjunction(conjunction), table(Dummy::one()),
+                                                                 index(nullptr), index_key(nullptr) {
 }
 
 EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), projection(nullptr),
-                                        select_conjunction(nullptr), table(table) {
+                                        select_conjunction(nullptr), table(table), index(nullptr),
+                                        index_key(nullptr) {
 }
 
-EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table) {
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *key, bool index_only, ValueDict *conjunction)
+        : type(index_only ? IndexOnlyLookup : IndexLookup), relation(nullptr), projection(nullptr),
+          select_conjunction(conjunction), table(index.get_relation()), index(&index), index_key(key) {
+}
+
+EvalPlan::EvalPlan(const DbIndexes &bitmap_indexes, ValueDict *key)
+        : type(BitmapLookup), relation(nullptr), projection(nullptr), select_conjunction(nullptr),
+          table(bitmap_indexes.front()->get_relation()), index(nullptr), bitmap_indexes(bitmap_indexes),
+          index_key(key) {
+}
+
+EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table), index(other->index),
+                                            bitmap_indexes(other->bitmap_indexes) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
@@ -73,23 +92,154 @@ EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->tabl
         select_conjunction = new ValueDict(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    if (other->index_key != nullptr)
+        index_key = new ValueDict(*other->index_key);
+    else
+        index_key = nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
     delete projection;
     delete select_conjunction;
+    delete index_key;
+}
+
+// Estimated fraction of the table's rows that have the conjunction's values in all the given columns (1 for a
+// column that hasn't been analyzed).
+static double estimate(const ColumnNames &column_names, const ValueDict *conjunction,
+                       const ColumnStatisticsList &statistics) {
+    double fraction = 1.0;
+    for (auto const &column_name: column_names)
+        for (auto const &column_statistics: statistics)
+            if (column_statistics.column_name == column_name)
+                fraction *= column_statistics.selectivity(conjunction->at(column_name));
+    return fraction;
 }
 
+// Whether the conjunction's values for the index's key columns are of the columns' types, so the index can look them
+// up. (A WHERE clause gives a BOOLEAN as an INT, which a bitmap index takes as the BOOLEAN.)
+static bool fits(const DbIndex *index, const ValueDict *conjunction, DbRelation &table) {
+    const ColumnNames &column_names = table.get_column_names();
+    ColumnAttributes column_attributes = table.get_column_attributes();
+    bool bitmap = dynamic_cast<const BitmapIndex *>(index) != nullptr;
+    for (auto const &column_name: index->get_key_columns()) {
+        auto column = std::find(column_names.begin(), column_names.end(), column_name);
+        if (column == column_names.end())
+            return false;
+        ColumnAttribute::DataType data_type = column_attributes[column - column_names.begin()].get_data_type();
+        ColumnAttribute::DataType value_type = conjunction->at(column_name).data_type;
+        if (value_type != data_type &&
+            !(bitmap && data_type == ColumnAttribute::BOOLEAN && value_type == ColumnAttribute::INT))
+            return false;
+    }
+    return true;
+}
+
+// A select on a table scan whose conjunction fixes every key column of one of the indexes (with values of the
+// columns' types) becomes a lookup in that index, with the rest of the conjunction applied to the rows it finds. The index chosen is the one the
+// statistics say will find the fewest rows, or failing that the one with the most key columns. If the index also
+// has every column the projection above it needs (and the rest of the conjunction needs), the rows come right out
+// of the index without going to the table at all. When bitmap indexes are the only ones that fit, or the
+// statistics say ANDing together the bitmaps of all that fit finds fewer rows, that is done instead.
+EvalPlan *EvalPlan::optimize(const DbIndexes &indexes, const ColumnStatisticsList &statistics) {
+    EvalPlan *select = this->type == Project || this->type == ProjectAll ? this->relation : this;
+    if (select->type != Select || select->relation->type != TableScan)
+        return new EvalPlan(this);
+    const ValueDict *conjunction = select->select_conjunction;
+    DbIndex *best = nullptr;
+    double best_estimate = 1.0;
+    DbIndexes bitmaps;
+    ColumnNames bitmap_columns;
+    for (auto const &index: indexes) {
+        bool fixed = true;
+        for (auto const &column_name: index->get_key_columns())
+            if (conjunction->find(column_name) == conjunction->end())
+                fixed = false;
+        if (!fixed || !index->implied_by(conjunction))  // a partial index may not have every row the query wants
+            continue;
+        if (!fits(index, conjunction, select->relation->table))  // (no row can match, which the table scan finds out)
+            continue;
+        if (dynamic_cast<BitmapIndex *>(index) != nullptr) {
+            bitmaps.push_back(index);
+            bitmap_columns.insert(bitmap_columns.end(), index->get_key_columns().begin(),
+                                  index->get_key_columns().end());
+            continue;
+        }
+        double index_estimate = estimate(index->get_key_columns(), conjunction, statistics);
+        if (best == nullptr || index_estimate < best_estimate ||
+            (index_estimate == best_estimate && index->get_key_columns().size() > best->get_key_columns().size())) {
+            best = index;
+            best_estimate = index_estimate;
+        }
+    }
+    if (best != nullptr && !bitmaps.empty() && estimate(bitmap_columns, conjunction, statistics) < best_estimate)
+        best = nullptr;
+    if (best == nullptr && bitmaps.size() == 1)
+        best = bitmaps.front();
+    if (best == nullptr && bitmaps.empty())
+        return new EvalPlan(this);
+
+    ValueDict *key = new ValueDict;
+    ValueDict *rest = new ValueDict;
+    ColumnNames key_columns;
+    if (best != nullptr)
+        key_columns = best->get_key_columns();
+    else
+        for (auto const &bitmap: bitmaps)
+            key_columns.insert(key_columns.end(), bitmap->get_key_columns().begin(), bitmap->get_key_columns().end());
+    for (auto const &column: *conjunction) {
+        if (std::find(key_columns.begin(), key_columns.end(), column.first) != key_columns.end())
+            (*key)[column.first] = column.second;
+        else if (best == nullptr || best->get_predicate().find(column.first) == best->get_predicate().end())
+            (*rest)[column.first] = column.second;  // (every row in a partial index already matches its predicate)
+    }
+    if (best == nullptr) {
+        EvalPlan *plan = new EvalPlan(bitmaps, key);
+        if (rest->empty())
+            delete rest;
+        else
+            plan = new EvalPlan(rest, plan);
+        if (this->type == Project)
+            return new EvalPlan(new ColumnNames(*this->projection), plan);
+        if (this->type == ProjectAll)
+            return new EvalPlan(ProjectAll, plan);
+        return plan;
+    }
+
+    ColumnNames needed;
+    if (this->type == Project)
+        needed = *this->projection;
+    else if (this->type == ProjectAll)
+        needed = select->relation->table.get_column_names();
+    for (auto const &column: *rest)
+        needed.push_back(column.first);
+    bool index_only = this->type != Select && best->covers(needed);
 
-EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+    EvalPlan *plan;
+    if (index_only) {
+        plan = new EvalPlan(*best, key, true, rest);
+    } else {
+        plan = new EvalPlan(*best, key, false);
+        if (rest->empty())
+            delete rest;
+        else
+            plan = new EvalPlan(rest, plan);
+    }
+    if (this->type == Project)
+        return new EvalPlan(new ColumnNames(*this->projection), plan);
+    if (this->type == ProjectAll)
+        return new EvalPlan(ProjectAll, plan);
+    return plan;
 }
 
 ValueDicts *EvalPlan::evaluate() {
     ValueDicts *ret = nullptr;
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
+    if (this->relation->type == IndexOnlyLookup)
+        return this->relation->lookup_values(this->type == ProjectAll ? this->relation->table.get_column_names()
+                                                                      : *this->projection);
 
     EvalPipeline pipeline = this->relation->pipeline();
     DbRelation *temp_table = pipeline.first;
@@ -106,6 +256,10 @@ EvalPipeline EvalPlan::pipeline() {
     // base cases
     if (this->type == TableScan)
         return EvalPipeline(&this->table, this->table.select());
+    if (this->type == IndexLookup)
+        return EvalPipeline(&this->table, this->index->lookup(this->index_key));
+    if (this->type == BitmapLookup)
+        return EvalPipeline(&this->table, BitmapIndex::lookup_all(this->bitmap_indexes, this->index_key));
     if (this->type == Select && this->relation->type == TableScan)
         return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
 
@@ -122,3 +276,113 @@ EvalPipeline EvalPlan::pipeline() {
     throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
 }
 
+
+// The given columns of the rows the index finds that also match the rest of the conjunction, right from the index.
+ValueDicts *EvalPlan::lookup_values(const ColumnNames &column_names) {
+    ColumnNames needed = column_names;
+    if (this->select_conjunction != nullptr)
+        for (auto const &column: *this->select_conjunction)
+            if (std::find(needed.begin(), needed.end(), column.first) == needed.end())
+                needed.push_back(column.first);
+    ValueDicts *found = this->index->lookup_values(this->index_key, &needed);
+    ValueDicts *ret = new ValueDicts;
+    for (auto const &row: *found) {
+        bool match = true;
+        if (this->select_conjunction != nullptr)
+            for (auto const &column: *this->select_conjunction)
+                if (row->at(column.first) != column.second)
+                    match = false;
+        if (!match) {
+            delete row;
+            continue;
+        }
+        for (uint i = column_names.size(); i < needed.size(); i++)
+            row->erase(needed[i]);
+        ret->push_back(row);
+    }
+    delete found;
+    return ret;
+}
+
+bool test_eval_plan() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_eval_plan", column_names, column_attributes);
+    table.create();
+    for (int i = 0; i < 100; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(std::to_string(i % 10));
+        table.insert(&row);
+    }
+    BTreeIndex index_a(table, "evala", ColumnNames(1, "a"), true);
+    BTreeIndex index_b(table, "evalb", ColumnNames(1, "b"), false);
+    index_a.create();
+    index_b.create();
+    DbIndexes indexes;
+    indexes.push_back(&index_a);
+    indexes.push_back(&index_b);
+
+    // plan a SELECT * with the given conjunction, and check what the plan starts from (a table scan or an index
+    // lookup) and how many rows it finds
+    auto test_plan = [&table, &indexes](const ValueDict &conjunction, EvalPlan::PlanType expected_type,
+                                        u_long expected_rows) {
+        EvalPlan *plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(new ValueDict(conjunction),
+                                                                         new EvalPlan(table)));
+        EvalPlan *optimized = plan->optimize(indexes);
+        delete plan;
+        EvalPlan *bottom = optimized;
+        while (bottom->relation != nullptr)
+            bottom = bottom->relation;
+        EvalPlan::PlanType type = bottom->type;
+        ValueDicts *rows = nullptr;
+        try {
+            rows = optimized->evaluate();
+        } catch (DbRelationError &e) {
+            std::cout << "eval plan failed: " << e.what() << std::endl;
+        }
+        delete optimized;
+        bool ok = rows != nullptr && type == expected_type && rows->size() == expected_rows;
+        if (rows != nullptr) {
+            if (!ok)
+                std::cout << "eval plan of type " << type << " found " << rows->size() << " rows" << std::endl;
+            for (auto const &row: *rows)
+                delete row;
+            delete rows;
+        }
+        return ok;
+    };
+
+    // a value of the column's type is looked up in its index
+    ValueDict conjunction;
+    conjunction["a"] = Value(42);
+    if (!test_plan(conjunction, EvalPlan::IndexLookup, 1))
+        return false;
+
+    // one of another type can't be, so the table is scanned (and no row matches)
+    conjunction["a"] = Value("42");
+    if (!test_plan(conjunction, EvalPlan::TableScan, 0))
+        return false;
+    conjunction.clear();
+    conjunction["b"] = Value(4);
+    if (!test_plan(conjunction, EvalPlan::TableScan, 0))
+        return false;
+
+    // and an index whose value fits is still used when another's doesn't
+    conjunction["a"] = Value(4);
+    conjunction["b"] = Value("4");
+    if (!test_plan(conjunction, EvalPlan::IndexLookup, 1))
+        return false;
+    conjunction["b"] = Value(4);
+    if (!test_plan(conjunction, EvalPlan::IndexLookup, 0))
+        return false;
+
+    index_a.drop();
+    index_b.drop();
+    table.drop();
+    return true;
+}
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "ColumnStatistics.h"
 
 
 typedef std::pair<DbRelation *, Handles *> EvalPipeline;
@@ -14,18 +15,23 @@ typedef std::pair<DbRelation *, Handles *> EvalPipeline;
 class EvalPlan {
 public:
     enum PlanType {
-        ProjectAll, Project, Select, TableScan
+        ProjectAll, Project, Select, TableScan, IndexLookup, IndexOnlyLookup, BitmapLookup
     };
 
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
     EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select
     EvalPlan(DbRelation &table);  // use for TableScan
+    // use for IndexLookup, or IndexOnlyLookup (which applies conjunction itself and has to be right under a projection)
+    EvalPlan(DbIndex &index, ValueDict *key, bool index_only, ValueDict *conjunction = nullptr);
+    EvalPlan(const DbIndexes &bitmap_indexes, ValueDict *key);  // use for BitmapLookup (ANDs them all)
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
-    // Attempt to get the best equivalent evaluation plan
-    EvalPlan *optimize();
+    // Attempt to get the best equivalent evaluation plan, using any of the given indices on the table (and what
+    // ANALYZE found out about its columns, if anything, to choose between them)
+    EvalPlan *optimize(const DbIndexes &indexes = DbIndexes(),
+                       const ColumnStatisticsList &statistics = ColumnStatisticsList());
 
     // Evaluate the plan: evaluate gets values, pipeline gets handles
     ValueDicts *evaluate();
@@ -38,6 +44,15 @@ protected:
     EvalPlan *relation;  // for everything except TableScan
     ColumnNames *projection;  // for Project
     ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
+    DbRelation &table;  // for TableScan, IndexLookup, IndexOnlyLookup, and BitmapLookup
+    DbIndex *index;  // for IndexLookup and IndexOnlyLookup
+    DbIndexes bitmap_indexes;  // for BitmapLookup
+    ValueDict *index_key;  // for IndexLookup, IndexOnlyLookup, and BitmapLookup
+
+    ValueDicts *lookup_values(const ColumnNames &column_names);  // for IndexOnlyLookup
+
+    friend bool test_eval_plan();
 };
 
+bool test_eval_plan();
+
@@ -0,0 +1,418 @@
+/**
+ * @file ExtendedSQL.cpp - tokenizer and recursive-descent parser for our extended statements
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+#include "ExtendedSQL.h"
+
+using namespace std;
+
+const double ExtendedStatement::DEFAULT_FPR = 0.01;
+
+/**
+ * @class ExtendedParser - splits a query into tokens and gives the parse functions a cursor over them
+ */
+class ExtendedParser {
+public:
+    enum TokenType {
+        WORD, NUMBER, STRING, SYMBOL, END
+    };
+
+    struct Token {
+        TokenType type;
+        std::string text;
+    };
+
+    explicit ExtendedParser(const string &query) : tokens(), pos(0) {
+        tokenize(query);
+    }
+
+    // Is the next token the given keyword (case-insensitive)?
+    bool peek_keyword(const string &keyword, uint ahead = 0) const {
+        const Token &token = peek(ahead);
+        return token.type == WORD && upper(token.text) == keyword;
+    }
+
+    bool accept_keyword(const string &keyword) {
+        if (!peek_keyword(keyword))
+            return false;
+        pos++;
+        return true;
+    }
+
+    void expect_keyword(const string &keyword) {
+        if (!accept_keyword(keyword))
+            error("expected " + keyword);
+    }
+
+    bool accept_symbol(char symbol) {
+        const Token &token = peek();
+        if (token.type != SYMBOL || token.text[0] != symbol)
+            return false;
+        pos++;
+        return true;
+    }
+
+    void expect_symbol(char symbol) {
+        if (!accept_symbol(symbol))
+            error(string("expected '") + symbol + "'");
+    }
+
+    Identifier identifier() {
+        const Token &token = peek();
+        if (token.type != WORD)
+            error("expected an identifier");
+        pos++;
+        return token.text;
+    }
+
+    // ( <identifier>, ... )
+    ColumnNames identifier_list() {
+        ColumnNames ret;
+        expect_symbol('(');
+        do {
+            ret.push_back(identifier());
+        } while (accept_symbol(','));
+        expect_symbol(')');
+        return ret;
+    }
+
+    // <column> = <literal> [AND <column> = <literal> ...], where a literal is an integer or a quoted string
+    ValueDict conjunction() {
+        ValueDict ret;
+        do {
+            Identifier column_name = identifier();
+            expect_symbol('=');
+            const Token &token = peek();
+            if (token.type == STRING)
+                ret[column_name] = Value(token.text);
+            else if (token.type == NUMBER && token.text.find('.') == string::npos)
+                ret[column_name] = Value((int32_t) strtol(token.text.c_str(), nullptr, 10));
+            else
+                error("expected an integer or a string");
+            pos++;
+        } while (accept_keyword("AND"));
+        return ret;
+    }
+
+    double number() {
+        const Token &token = peek();
+        if (token.type != NUMBER)
+            error("expected a number");
+        pos++;
+        return strtod(token.text.c_str(), nullptr);
+    }
+
+    // Is the keyword anywhere in the statement?
+    bool has_keyword(const string &keyword) const {
+        for (auto const &token: tokens)
+            if (token.type == WORD && upper(token.text) == keyword)
+                return true;
+        return false;
+    }
+
+    void expect_end() {
+        accept_symbol(';');
+        if (peek().type != END)
+            error("unexpected '" + peek().text + "'");
+    }
+
+    const Token &peek(uint ahead = 0) const {
+        return tokens[min(pos + ahead, (uint) tokens.size() - 1)];
+    }
+
+    void error(const string &message) const {
+        throw ExtendedSQLError(message + (peek().type == END ? " at end of statement" : " near '" + peek().text + "'"));
+    }
+
+    static string upper(string s) {
+        for (auto &c: s)
+            c = (char) toupper(c);
+        return s;
+    }
+
+private:
+    vector<Token> tokens;
+    uint pos;
+
+    void tokenize(const string &query) {
+        uint i = 0;
+        while (i < query.length()) {
+            char c = query[i];
+            Token token;
+            if (isspace(c)) {
+                i++;
+                continue;
+            } else if (isalpha(c) || c == '_') {
+                uint start = i;
+                while (i < query.length() && (isalnum(query[i]) || query[i] == '_' || query[i] == '$'))
+                    i++;
+                token.type = WORD;
+                token.text = query.substr(start, i - start);
+            } else if (isdigit(c) || ((c == '-' || c == '.') && i + 1 < query.length() && isdigit(query[i + 1]))) {
+                uint start = i++;
+                while (i < query.length() && (isdigit(query[i]) || query[i] == '.'))
+                    i++;
+                token.type = NUMBER;
+                token.text = query.substr(start, i - start);
+            } else if (c == '\'' || c == '"') {
+                uint start = ++i;
+                while (i < query.length() && query[i] != c)
+                    i++;
+                if (i == query.length())
+                    throw ExtendedSQLError("unterminated string");
+                token.type = STRING;
+                token.text = query.substr(start, i++ - start);
+            } else {
+                token.type = SYMBOL;
+                token.text = string(1, c);
+                i++;
+            }
+            tokens.push_back(token);
+        }
+        Token end;
+        end.type = END;
+        tokens.push_back(end);
+    }
+};
+
+// ALTER TABLE <table> ADD BLOOM FILTER (<column>, ...) [FPR <rate>]
+static ExtendedStatement *parse_alter(ExtendedParser &parser) {
+    parser.expect_keyword("ALTER");
+    parser.expect_keyword("TABLE");
+    Identifier table_name = parser.identifier();
+    parser.expect_keyword("ADD");
+    parser.expect_keyword("BLOOM");
+    parser.expect_keyword("FILTER");
+    ExtendedStatement *statement = new ExtendedStatement(ExtendedStatement::kAddBloomFilter);
+    statement->table_name = table_name;
+    try {
+        statement->column_names = parser.identifier_list();
+        if (parser.accept_keyword("FPR"))
+            statement->false_positive_rate = parser.number();
+        if (statement->false_positive_rate <= 0.0 || statement->false_positive_rate >= 1.0)
+            throw ExtendedSQLError("FPR must be between 0 and 1");
+        parser.expect_end();
+    } catch (...) {
+        delete statement;
+        throw;
+    }
+    return statement;
+}
+
+// CREATE [UNIQUE] INDEX <index> ON <table> [USING BTREE|HASH|BITMAP|LSM|LEARNED|ART] (<column>, ...)
+//     [INCLUDE (<column>, ...)] [WHERE <column> = <literal> [AND ...]]
+static ExtendedStatement *parse_create_index(ExtendedParser &parser) {
+    parser.expect_keyword("CREATE");
+    bool unique = parser.accept_keyword("UNIQUE");
+    parser.expect_keyword("INDEX");
+    ExtendedStatement *statement = new ExtendedStatement(ExtendedStatement::kCreateIndex);
+    statement->unique = unique;
+    try {
+        statement->index_name = parser.identifier();
+        parser.expect_keyword("ON");
+        statement->table_name = parser.identifier();
+        if (parser.accept_keyword("USING")) {
+            if (parser.accept_keyword("BTREE"))
+                statement->index_type = "BTREE";
+            else if (parser.accept_keyword("HASH"))
+                statement->index_type = "HASH";
+            else if (parser.accept_keyword("BITMAP"))
+                statement->index_type = "BITMAP";
+            else if (parser.accept_keyword("LSM"))
+                statement->index_type = "LSM";
+            else if (parser.accept_keyword("LEARNED"))
+                statement->index_type = "LEARNED";
+            else if (parser.accept_keyword("ART"))
+                statement->index_type = "ART";
+            else
+                parser.error("expected BTREE, HASH, BITMAP, LSM, LEARNED, or ART");
+        }
+        statement->column_names = parser.identifier_list();
+        if (parser.accept_keyword("INCLUDE"))
+            statement->include_names = parser.identifier_list();
+        if (parser.accept_keyword("WHERE"))
+            statement->predicate = parser.conjunction();
+        parser.expect_end();
+    } catch (...) {
+        delete statement;
+        throw;
+    }
+    return statement;
+}
+
+// ANALYZE <table> [FULL]
+static ExtendedStatement *parse_analyze(ExtendedParser &parser) {
+    parser.expect_keyword("ANALYZE");
+    ExtendedStatement *statement = new ExtendedStatement(ExtendedStatement::kAnalyze);
+    try {
+        statement->table_name = parser.identifier();
+        statement->full = parser.accept_keyword("FULL");
+        parser.expect_end();
+    } catch (...) {
+        delete statement;
+        throw;
+    }
+    return statement;
+}
+
+// VACUUM <table>
+static ExtendedStatement *parse_vacuum(ExtendedParser &parser) {
+    parser.expect_keyword("VACUUM");
+    ExtendedStatement *statement = new ExtendedStatement(ExtendedStatement::kVacuum);
+    try {
+        statement->table_name = parser.identifier();
+        parser.expect_end();
+    } catch (...) {
+        delete statement;
+        throw;
+    }
+    return statement;
+}
+
+// REINDEX <table>
+static ExtendedStatement *parse_reindex(ExtendedParser &parser) {
+    parser.expect_keyword("REINDEX");
+    ExtendedStatement *statement = new ExtendedStatement(ExtendedStatement::kReindex);
+    try {
+        statement->table_name = parser.identifier();
+        parser.expect_end();
+    } catch (...) {
+        delete statement;
+        throw;
+    }
+    return statement;
+}
+
+// SHOW INDEX STATS FROM <table> [JSON]
+static ExtendedStatement *parse_show_index_stats(ExtendedParser &parser) {
+    parser.expect_keyword("SHOW");
+    parser.expect_keyword("INDEX");
+    parser.expect_keyword("STATS");
+    ExtendedStatement *statement = new ExtendedStatement(ExtendedStatement::kShowIndexStats);
+    try {
+        parser.expect_keyword("FROM");
+        statement->table_name = parser.identifier();
+        statement->json = parser.accept_keyword("JSON");
+        parser.expect_end();
+    } catch (...) {
+        delete statement;
+        throw;
+    }
+    return statement;
+}
+
+// Returns nullptr for anything that doesn't start with one of our keywords so the Hyrise parser can have it.
+ExtendedStatement *ExtendedStatement::parse(const string &query) {
+    ExtendedParser parser(query);
+    if (parser.peek_keyword("ALTER"))
+        return parse_alter(parser);
+    if (parser.peek_keyword("CREATE") && parser.peek_keyword("UNIQUE", 1))
+        return parse_create_index(parser);
+    if (parser.peek_keyword("CREATE") && parser.peek_keyword("INDEX", 1)
+        && (parser.has_keyword("INCLUDE") || parser.has_keyword("BITMAP") || parser.has_keyword("LSM")
+            || parser.has_keyword("LEARNED") || parser.has_keyword("ART") || parser.has_keyword("WHERE")))
+        return parse_create_index(parser);  // the Hyrise parser has the rest of CREATE INDEX
+    if (parser.peek_keyword("ANALYZE"))
+        return parse_analyze(parser);
+    if (parser.peek_keyword("VACUUM"))
+        return parse_vacuum(parser);
+    if (parser.peek_keyword("REINDEX"))
+        return parse_reindex(parser);
+    if (parser.peek_keyword("SHOW") && parser.peek_keyword("INDEX", 1) && parser.peek_keyword("STATS", 2))
+        return parse_show_index_stats(parser);  // the Hyrise parser has plain SHOW INDEX
+    return nullptr;
+}
+
+string ExtendedStatement::to_string() const {
+    stringstream out;
+    switch (this->type) {
+        case kAddBloomFilter: {
+            out << "ALTER TABLE " << this->table_name << " ADD BLOOM FILTER (";
+            bool doComma = false;
+            for (auto const &column_name: this->column_names) {
+                if (doComma)
+                    out << ", ";
+                out << column_name;
+                doComma = true;
+            }
+            out << ") FPR " << this->false_positive_rate;
+            break;
+        }
+        case kCreateIndex: {
+            out << "CREATE " << (this->unique ? "UNIQUE " : "") << "INDEX " << this->index_name << " ON "
+                << this->table_name << " USING " << this->index_type << " (";
+            bool doComma = false;
+            for (auto const &column_name: this->column_names) {
+                if (doComma)
+                    out << ", ";
+                out << column_name;
+                doComma = true;
+            }
+            out << ")";
+            if (!this->include_names.empty()) {
+                out << " INCLUDE (";
+                doComma = false;
+                for (auto const &column_name: this->include_names) {
+                    if (doComma)
+                        out << ", ";
+                    out << column_name;
+                    doComma = true;
+                }
+                out << ")";
+            }
+            if (!this->predicate.empty())
+                out << " WHERE " << predicate_to_string(this->predicate);
+            break;
+        }
+        case kAnalyze:
+            out << "ANALYZE " << this->table_name << (this->full ? " FULL" : "");
+            break;
+        case kVacuum:
+            out << "VACUUM " << this->table_name;
+            break;
+        case kReindex:
+            out << "REINDEX " << this->table_name;
+            break;
+        case kShowIndexStats:
+            out << "SHOW INDEX STATS FROM " << this->table_name << (this->json ? " JSON" : "");
+            break;
+        default:
+            out << "???";
+    }
+    return out.str();
+}
+
+// Strings in whichever quotes they don't have in them (the tokenizer has no escapes).
+string ExtendedStatement::predicate_to_string(const ValueDict &predicate) {
+    stringstream out;
+    bool doAnd = false;
+    for (auto const &term: predicate) {
+        if (doAnd)
+            out << " AND ";
+        out << term.first << " = ";
+        if (term.second.data_type == ColumnAttribute::TEXT) {
+            char quote = term.second.s.find('\'') == string::npos ? '\'' : '"';
+            if (term.second.s.find(quote) != string::npos)
+                throw ExtendedSQLError("can't quote " + term.second.s);
+            out << quote << term.second.s << quote;
+        } else {
+            out << term.second.n;
+        }
+        doAnd = true;
+    }
+    return out.str();
+}
+
+ValueDict ExtendedStatement::predicate_from_string(const string &text) {
+    ValueDict predicate;
+    if (text.empty())
+        return predicate;
+    ExtendedParser parser(text);
+    predicate = parser.conjunction();
+    parser.expect_end();
+    return predicate;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file ExtendedSQL.h - statements in our SQL dialect that the Hyrise parser doesn't know about
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class ExtendedSQLError - exception for a statement that starts like one of ours but is malformed
+ */
+class ExtendedSQLError : public std::runtime_error {
+public:
+    explicit ExtendedSQLError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class ExtendedStatement - parsed form of one of our extended statements:
+ *
+ *      ALTER TABLE <table> ADD BLOOM FILTER (<column>, ...) [FPR <rate>]
+ *      CREATE UNIQUE INDEX <index> ON <table> [USING BTREE|HASH|BITMAP|LSM|LEARNED|ART] (<column>, ...)
+ *          [INCLUDE (<column>, ...)] [WHERE <column> = <literal> [AND ...]]
+ *      CREATE INDEX <index> ON <table> [USING BTREE] (<column>, ...) INCLUDE (<column>, ...) [WHERE ...]
+ *      CREATE INDEX <index> ON <table> USING BITMAP|LSM|LEARNED|ART (<column>, ...) [WHERE ...]
+ *      CREATE INDEX <index> ON <table> [USING BTREE|HASH] (<column>, ...) WHERE ...
+ *      ANALYZE <table> [FULL]
+ *      VACUUM <table>
+ *      REINDEX <table>
+ *      SHOW INDEX STATS FROM <table> [JSON]
+ */
+class ExtendedStatement {
+public:
+    enum StatementType {
+        kAddBloomFilter,
+        kCreateIndex,
+        kAnalyze,
+        kVacuum,
+        kReindex,
+        kShowIndexStats
+    };
+
+    /**
+     * Default false-positive rate for Bloom filters.
+     */
+    static const double DEFAULT_FPR;
+
+    explicit ExtendedStatement(StatementType type) : type(type), table_name(), column_names(),
+                                                     false_positive_rate(DEFAULT_FPR), full(false), index_name(),
+                                                     index_type("BTREE"), unique(false), include_names(),
+                                                     predicate(), json(false) {}
+
+    virtual ~ExtendedStatement() {}
+
+    /**
+     * Parse a query if it is one of our extended statements.
+     * @param query  SQL text
+     * @returns      the statement (freed by caller) or nullptr if it isn't an extended statement
+     * @throws       ExtendedSQLError if it is one of ours but doesn't parse
+     */
+    static ExtendedStatement *parse(const std::string &query);
+
+    /**
+     * Unparse back into SQL.
+     * @returns  the equivalent SQL text
+     */
+    std::string to_string() const;
+
+    /**
+     * The SQL for an equality conjunction, like the WHERE of a partial index: <column> = <literal> AND ...
+     * @param predicate  the column each literal is for
+     * @returns          the SQL text (empty for an empty conjunction)
+     */
+    static std::string predicate_to_string(const ValueDict &predicate);
+
+    /**
+     * Parse what predicate_to_string makes back into the conjunction.
+     * @param text  SQL text
+     * @returns     the column each literal is for
+     * @throws      ExtendedSQLError if it isn't an equality conjunction
+     */
+    static ValueDict predicate_from_string(const std::string &text);
+
+    StatementType type;
+    Identifier table_name;
+    ColumnNames column_names;
+    double false_positive_rate;
+    bool full;
+    Identifier index_name;
+    std::string index_type;
+    bool unique;
+    ColumnNames include_names;  // non-key columns for the index to keep, too
+    ValueDict predicate;  // the WHERE of a partial index: the value each column has to have for a row to be in it
+    bool json;  // SHOW INDEX STATS as a JSON object per index rather than a table
+};
@@ -0,0 +1,758 @@
+/**
+ * @file HashIndex.cpp - implementation of HashIndex and HashBucket
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "HashIndex.h"
+#include "btree.h"
+
+const double HashIndex::DEFAULT_FILL_FACTOR = 0.7;
+
+/**************
+ * HashBucket *
+ **************/
+
+HashBucket::HashBucket(HeapFile &file, BlockID block_id, bool create) : file(file), id(block_id), local_depth(0),
+                                                                        overflow(0), entries() {
+    if (create && block_id == 0) {
+        SlottedPage *page = file.get_new();
+        this->id = page->get_block_id();
+        delete page;
+    } else if (!create) {
+        SlottedPage *page = file.get(block_id);
+        Dbt *dbt = page->get(HEADER);
+        this->local_depth = *(uint32_t *) dbt->get_data();
+        this->overflow = *(BlockID *) ((char *) dbt->get_data() + sizeof(uint32_t));
+        delete dbt;
+        dbt = page->get(ENTRIES);
+        this->entries.assign((char *) dbt->get_data(), dbt->get_size());
+        delete dbt;
+        delete page;
+    }
+}
+
+// Rewrite the whole block.
+void HashBucket::save() {
+    char header[sizeof(uint32_t) + sizeof(BlockID)];
+    *(uint32_t *) header = this->local_depth;
+    *(BlockID *) (header + sizeof(uint32_t)) = this->overflow;
+    SlottedPage *page = this->file.get(this->id);
+    page->clear();
+    Dbt dbt(header, sizeof(header));
+    page->add(&dbt);
+    Dbt entries_dbt((void *) this->entries.data(), (u_int32_t) this->entries.size());
+    page->add(&entries_dbt);
+    this->file.put(page);
+    delete page;
+}
+
+bool HashBucket::add(const NormalizedKey &key, Handle handle) {
+    std::string entry = marshal_entry(key, handle);
+    if (this->entries.size() + entry.size() > CAPACITY)
+        return false;
+    this->entries += entry;
+    return true;
+}
+
+void HashBucket::find(const NormalizedKey &key, Handles &handles) const {
+    const char *bytes = this->entries.data();
+    const u_long handle_size = sizeof(BlockID) + sizeof(RecordID);
+    for (u_long offset = 0; offset < this->entries.size();) {
+        uint16_t size = *(uint16_t *) (bytes + offset + handle_size);
+        if (size == key.size() && memcmp(bytes + offset + handle_size + sizeof(uint16_t), key.data(), size) == 0)
+            handles.push_back(Handle(*(BlockID *) (bytes + offset), *(RecordID *) (bytes + offset + sizeof(BlockID))));
+        offset += handle_size + sizeof(uint16_t) + size;
+    }
+}
+
+bool HashBucket::del(const NormalizedKey &key, Handle handle) {
+    u_long offset = find_entry(key, handle);
+    if (offset == std::string::npos)
+        return false;
+    this->entries.erase(offset, marshal_entry(key, handle).size());
+    return true;
+}
+
+bool HashBucket::relocate(const NormalizedKey &key, Handle from, Handle to) {
+    u_long offset = find_entry(key, from);
+    if (offset == std::string::npos)
+        return false;
+    std::string entry = marshal_entry(key, to);
+    this->entries.replace(offset, entry.size(), entry);
+    return true;
+}
+
+void HashBucket::get_entries(KeyHandles &entries) const {
+    const char *bytes = this->entries.data();
+    const u_long handle_size = sizeof(BlockID) + sizeof(RecordID);
+    for (u_long offset = 0; offset < this->entries.size();) {
+        uint16_t size = *(uint16_t *) (bytes + offset + handle_size);
+        entries.push_back(KeyHandle(NormalizedKey(bytes + offset + handle_size + sizeof(uint16_t), size),
+                                    Handle(*(BlockID *) (bytes + offset),
+                                           *(RecordID *) (bytes + offset + sizeof(BlockID)))));
+        offset += handle_size + sizeof(uint16_t) + size;
+    }
+}
+
+u_long HashBucket::find_entry(const NormalizedKey &key, Handle handle) const {
+    std::string entry = marshal_entry(key, handle);
+    const char *bytes = this->entries.data();
+    const u_long handle_size = sizeof(BlockID) + sizeof(RecordID);
+    for (u_long offset = 0; offset < this->entries.size();) {
+        uint16_t size = *(uint16_t *) (bytes + offset + handle_size);
+        if (size == key.size() && memcmp(bytes + offset, entry.data(), entry.size()) == 0)
+            return offset;
+        offset += handle_size + sizeof(uint16_t) + size;
+    }
+    return std::string::npos;
+}
+
+// The handle, then the key's length and bytes.
+std::string HashBucket::marshal_entry(const NormalizedKey &key, Handle handle) {
+    if (key.size() > CAPACITY / 2)
+        throw DbRelationError("index key too big for a hash bucket");
+    uint16_t size = (uint16_t) key.size();
+    std::string entry;
+    entry.append((char *) &handle.first, sizeof(BlockID));
+    entry.append((char *) &handle.second, sizeof(RecordID));
+    entry.append((char *) &size, sizeof(uint16_t));
+    entry += key;
+    return entry;
+}
+
+
+/*************
+ * HashIndex *
+ *************/
+
+HashIndex::HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique), closed(true), file(relation.get_table_name() + "-" + name),
+          key_profile(), global_depth(0), free_list(0), directory(), directory_blocks(), dirty() {
+    build_key_profile();
+}
+
+// Create the index with enough buckets for the rows already in the table, then add their entries.
+void HashIndex::create() {
+    file.create();
+    closed = false;
+    try {
+        u_long entry_size = sizeof(BlockID) + sizeof(RecordID) + sizeof(uint16_t);  // handle and key length
+        for (auto const &data_type: key_profile)
+            entry_size += data_type == ColumnAttribute::INT ? 4 : data_type == ColumnAttribute::TEXT ? 16 : 1;
+        u_long per_bucket = (u_long) (DEFAULT_FILL_FACTOR * HashBucket::CAPACITY / entry_size);
+        u_long row_count = relation.count();
+        global_depth = 0;
+        while (global_depth < MAX_GLOBAL_DEPTH && (1UL << global_depth) * per_bucket < row_count)
+            global_depth++;
+        free_list = 0;
+        directory.clear();
+        directory_blocks.clear();
+        dirty.clear();
+        for (uint i = 0; i < (1U << global_depth); i++) {
+            HashBucket bucket(file, 0, true);
+            bucket.set_local_depth(global_depth);
+            bucket.save();
+            directory.push_back(bucket.get_id());
+        }
+        save_directory();
+
+        BlockID block_count = relation.get_block_count();
+        for (BlockID block_id = 1; block_id <= block_count; block_id++) {
+            Handles handles;
+            ValueDicts *rows = project_block(block_id, handles);
+            for (uint i = 0; i < rows->size(); i++) {
+                NormalizedKey *key = this->tkey((*rows)[i]);
+                delete (*rows)[i];
+                (*rows)[i] = nullptr;
+                try {
+                    _insert(*key, handles[i]);
+                } catch (...) {
+                    delete key;
+                    for (auto const &row: *rows)
+                        delete row;
+                    delete rows;
+                    throw;
+                }
+                delete key;
+            }
+            delete rows;
+        }
+    } catch (...) {
+        drop();
+        throw;
+    }
+}
+
+// Drop the index.
+void HashIndex::drop() {
+    file.drop();
+    directory.clear();
+    directory_blocks.clear();
+    dirty.clear();
+    closed = true;
+}
+
+// Open existing index. Enables: lookup, insert, delete, relocate.
+void HashIndex::open() {
+    if (closed) {
+        file.open();
+        load_header();
+        closed = false;
+    }
+}
+
+// Closes the index. Disables: lookup, insert, delete, relocate.
+void HashIndex::close() {
+    if (!closed) {
+        file.close();
+        directory.clear();
+        directory_blocks.clear();
+        dirty.clear();
+        closed = true;
+    }
+}
+
+// Find all the rows whose columns are equal to key: one bucket (and any overflow blocks it has).
+Handles *HashIndex::lookup(ValueDict *key_dict) const {
+    NormalizedKey *key = this->tkey(key_dict);
+    Handles *handles = new Handles;
+    for (BlockID block_id = directory[slot(hash(*key))]; block_id != 0;) {
+        HashBucket bucket(file, block_id, false);
+        bucket.find(*key, *handles);
+        block_id = bucket.get_overflow();
+    }
+    delete key;
+    return handles;
+}
+
+// Insert a row with the given handle. Row must exist in relation already.
+void HashIndex::insert(Handle handle) {
+    insert(handle, nullptr);
+}
+
+// Insert a row with the given handle and values (or, with row of nullptr, the values it has in the relation).
+void HashIndex::insert(Handle handle, const ValueDict *row) {
+    open();
+    NormalizedKey *key = row_key(handle, row);
+    try {
+        _insert(*key, handle);
+    } catch (...) {
+        delete key;
+        throw;
+    }
+    delete key;
+}
+
+// Add the entry to the first block of its bucket with room, splitting the bucket (or, if that can't help, adding
+// an overflow block to it) when they're all full.
+void HashIndex::_insert(const NormalizedKey &key, Handle handle) {
+    uint64_t h = hash(key);
+    if (this->unique) {
+        Handles handles;
+        for (BlockID block_id = directory[slot(h)]; block_id != 0;) {
+            HashBucket bucket(file, block_id, false);
+            bucket.find(key, handles);
+            block_id = bucket.get_overflow();
+        }
+        if (!handles.empty())
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+    }
+    while (true) {
+        BlockID last = 0;
+        for (BlockID block_id = directory[slot(h)]; block_id != 0;) {
+            HashBucket bucket(file, block_id, false);
+            if (bucket.add(key, handle)) {
+                bucket.save();
+                return;
+            }
+            last = block_id;
+            block_id = bucket.get_overflow();
+        }
+        if (split(slot(h), h))
+            continue;
+        HashBucket tail(file, last, false);
+        HashBucket extra(file, allocate(), true);
+        extra.set_local_depth(tail.get_local_depth());
+        extra.add(key, handle);  // always fits in an empty block
+        extra.save();
+        tail.set_overflow(extra.get_id());
+        tail.save();
+        return;
+    }
+}
+
+// Split the bucket in the given slot on its next hash bit. Returns false if that wouldn't separate anything from
+// the new entry (whose hash is h): every entry has the same hash, or the bucket can't get any deeper.
+bool HashIndex::split(uint slot, uint64_t h) {
+    KeyHandles entries;
+    BlockIDs blocks;
+    uint local_depth = 0;
+    for (BlockID block_id = directory[slot]; block_id != 0;) {
+        HashBucket bucket(file, block_id, false);
+        if (blocks.empty())
+            local_depth = bucket.get_local_depth();
+        bucket.get_entries(entries);
+        blocks.push_back(block_id);
+        block_id = bucket.get_overflow();
+    }
+    if (local_depth == MAX_GLOBAL_DEPTH)
+        return false;
+    bool separable = false;
+    std::vector<uint64_t> hashes;
+    for (auto const &entry: entries) {
+        hashes.push_back(hash(entry.first));
+        if (hashes.back() != h)
+            separable = true;
+    }
+    if (!separable)
+        return false;
+
+    if (local_depth == global_depth)
+        double_directory();
+    uint64_t bit = 1ULL << local_depth;
+    KeyHandles stay, go;
+    for (uint i = 0; i < entries.size(); i++)
+        (hashes[i] & bit ? go : stay).push_back(entries[i]);
+    write_chain(blocks, local_depth + 1, stay);
+    BlockID new_bucket = write_chain(BlockIDs(), local_depth + 1, go);
+    for (uint i = (uint) (slot & (bit - 1)); i < directory.size(); i += (uint) bit)
+        if (i & bit)
+            set_slot(i, new_bucket);
+    save_directory();
+    return true;
+}
+
+// Twice as many slots, the new ones pointing to the same buckets as the slots they're split from.
+void HashIndex::double_directory() {
+    uint size = (uint) directory.size();
+    for (uint i = 0; i < size; i++)
+        directory.push_back(directory[i]);
+    global_depth++;
+    dirty.assign(dirty.size(), true);
+}
+
+// Write a bucket's entries into the given blocks (first block first), adding more blocks as needed and freeing any
+// not needed. Returns the id of the bucket's first block.
+BlockID HashIndex::write_chain(const BlockIDs &blocks, uint local_depth, const KeyHandles &entries) {
+    uint used = 0;
+    auto *bucket = new HashBucket(file, used < blocks.size() ? blocks[used] : allocate(), true);
+    used++;
+    bucket->set_local_depth(local_depth);
+    BlockID first = bucket->get_id();
+    for (auto const &entry: entries) {
+        if (bucket->add(entry.first, entry.second))
+            continue;
+        auto *next = new HashBucket(file, used < blocks.size() ? blocks[used] : allocate(), true);
+        used++;
+        next->set_local_depth(local_depth);
+        next->add(entry.first, entry.second);  // always fits in an empty block
+        bucket->set_overflow(next->get_id());
+        bucket->save();
+        delete bucket;
+        bucket = next;
+    }
+    bucket->save();
+    delete bucket;
+    for (; used < blocks.size(); used++)
+        release(blocks[used]);
+    return first;
+}
+
+// Delete the index entry for the row with the given handle. Row must still be in relation.
+void HashIndex::del(Handle handle) {
+    del(handle, nullptr);
+}
+
+// Delete the index entry for the row with the given handle and values (or, with row of nullptr, the values it has
+// in the relation).
+void HashIndex::del(Handle handle, const ValueDict *row) {
+    open();
+    NormalizedKey *key = row_key(handle, row);
+    BlockID previous = 0;
+    for (BlockID block_id = directory[slot(hash(*key))]; block_id != 0;) {
+        HashBucket bucket(file, block_id, false);
+        if (bucket.del(*key, handle)) {
+            if (previous != 0 && bucket.is_empty()) {
+                // take the empty overflow block out of the chain
+                HashBucket before(file, previous, false);
+                before.set_overflow(bucket.get_overflow());
+                before.save();
+                release(block_id);
+            } else {
+                bucket.save();
+            }
+            break;
+        }
+        previous = block_id;
+        block_id = bucket.get_overflow();
+    }
+    delete key;
+}
+
+// The row that used to be at from is now at to: find its entry (by the row's key) and repoint it.
+void HashIndex::relocate(Handle from, Handle to) {
+    open();
+    NormalizedKey *key = row_key(to);
+    for (BlockID block_id = directory[slot(hash(*key))]; block_id != 0;) {
+        HashBucket bucket(file, block_id, false);
+        if (bucket.relocate(*key, from, to)) {
+            bucket.save();
+            break;
+        }
+        block_id = bucket.get_overflow();
+    }
+    delete key;
+}
+
+NormalizedKey *HashIndex::tkey(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns) {
+        auto column = key->find(column_name);
+        if (column == key->end())
+            throw DbRelationError("missing key column '" + column_name + "'");
+        key_value.push_back(column->second);
+    }
+    return new NormalizedKey(normalize_key(key_value, key_profile));
+}
+
+// 64-bit FNV-1a of the key's bytes, finished with the same mixing as BloomFilter::hash so the low bits (which pick
+// the directory slot) depend on all of them.
+uint64_t HashIndex::hash(const NormalizedKey &key) {
+    uint64_t h = 14695981039346656037ULL;
+    const uint64_t prime = 1099511628211ULL;
+    for (auto const &c: key)
+        h = (h ^ (uint8_t) c) * prime;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// Figure out the data types of each key component and encode them in key_profile.
+void HashIndex::build_key_profile() {
+    std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+// The key of the given row, or of the row with the given handle, read from the relation (freed by caller).
+NormalizedKey *HashIndex::row_key(Handle handle, const ValueDict *row) {
+    if (row != nullptr)
+        return this->tkey(row);
+    ValueDict *projected = relation.project(handle);
+    NormalizedKey *key = this->tkey(projected);
+    delete projected;
+    return key;
+}
+
+void HashIndex::set_slot(uint slot, BlockID bucket_id) {
+    directory[slot] = bucket_id;
+    dirty[slot / SLOTS_PER_BLOCK] = true;
+}
+
+// Take a block off the free list (0 if it's empty).
+BlockID HashIndex::allocate() {
+    if (free_list == 0)
+        return 0;
+    BlockID block_id = free_list;
+    HashBucket bucket(file, block_id, false);
+    free_list = bucket.get_overflow();
+    save_header();
+    return block_id;
+}
+
+// Put a block on the free list.
+void HashIndex::release(BlockID block_id) {
+    HashBucket bucket(file, block_id, true);
+    bucket.set_overflow(free_list);
+    bucket.save();
+    free_list = block_id;
+    save_header();
+}
+
+// Read the header from block 1 and then the directory from the blocks it lists.
+void HashIndex::load_header() {
+    SlottedPage *page = file.get(HEADER);
+    Dbt *dbt = page->get(1);
+    char *bytes = (char *) dbt->get_data();
+    global_depth = *(uint32_t *) bytes;
+    free_list = *(BlockID *) (bytes + sizeof(uint32_t));
+    uint32_t count = *(uint32_t *) (bytes + sizeof(uint32_t) + sizeof(BlockID));
+    directory_blocks.clear();
+    for (uint i = 0; i < count; i++)
+        directory_blocks.push_back(*(BlockID *) (bytes + 2 * sizeof(uint32_t) + sizeof(BlockID) + i * sizeof(BlockID)));
+    delete dbt;
+    delete page;
+
+    directory.clear();
+    for (auto const &block_id: directory_blocks) {
+        page = file.get(block_id);
+        dbt = page->get(1);
+        auto *slots = (BlockID *) dbt->get_data();
+        directory.insert(directory.end(), slots, slots + dbt->get_size() / sizeof(BlockID));
+        delete dbt;
+        delete page;
+    }
+    dirty.assign(directory_blocks.size(), false);
+}
+
+// Block 1: global depth, free list, and the number of directory blocks followed by their ids.
+void HashIndex::save_header() {
+    std::string bytes;
+    uint32_t count = (uint32_t) directory_blocks.size();
+    bytes.append((char *) &global_depth, sizeof(uint32_t));
+    bytes.append((char *) &free_list, sizeof(BlockID));
+    bytes.append((char *) &count, sizeof(uint32_t));
+    for (auto const &block_id: directory_blocks)
+        bytes.append((char *) &block_id, sizeof(BlockID));
+    SlottedPage *page = file.get(HEADER);
+    page->clear();
+    Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+    page->add(&dbt);
+    file.put(page);
+    delete page;
+}
+
+// Write out the directory blocks that have changed (adding blocks if the directory has grown), and the header.
+void HashIndex::save_directory() {
+    uint needed = (uint) ((directory.size() + SLOTS_PER_BLOCK - 1) / SLOTS_PER_BLOCK);
+    while (directory_blocks.size() < needed) {
+        SlottedPage *page = file.get_new();
+        directory_blocks.push_back(page->get_block_id());
+        delete page;
+        dirty.push_back(true);
+    }
+    for (uint i = 0; i < directory_blocks.size(); i++) {
+        if (!dirty[i])
+            continue;
+        uint start = i * SLOTS_PER_BLOCK;
+        uint end = std::min((uint) directory.size(), start + SLOTS_PER_BLOCK);
+        SlottedPage *page = file.get(directory_blocks[i]);
+        page->clear();
+        Dbt dbt(&directory[start], (u_int32_t) ((end - start) * sizeof(BlockID)));
+        page->add(&dbt);
+        file.put(page);
+        delete page;
+        dirty[i] = false;
+    }
+    save_header();
+}
+
+// Check the extendible hashing invariants: the directory has 2^global_depth slots; a bucket of local depth d (no
+// more than the global depth) is in exactly the 2^(global_depth - d) slots ending in the same d bits; and every
+// entry in it, overflow blocks and all, has a hash ending in those bits. Returns the number of entries (and sets
+// the number of buckets and of overflow blocks), or -1 after saying what's wrong.
+static long check_hash_index(const BlockIDs &directory, uint global_depth, HeapFile &file, u_long &buckets,
+                             u_long &overflows) {
+    if (directory.size() != (1ULL << global_depth)) {
+        std::cout << "hash directory has " << directory.size() << " slots at depth " << global_depth << std::endl;
+        return -1;
+    }
+    std::map<BlockID, uint> first_slot, slot_count;
+    long entries = 0;
+    buckets = overflows = 0;
+    for (uint i = 0; i < directory.size(); i++) {
+        auto seen = first_slot.find(directory[i]);
+        HashBucket bucket(file, directory[i], false);
+        uint64_t mask = (1ULL << bucket.get_local_depth()) - 1;
+        if (bucket.get_local_depth() > global_depth || (seen != first_slot.end() && (seen->second & mask) != (i & mask))) {
+            std::cout << "hash bucket of depth " << bucket.get_local_depth() << " in the wrong slot: " << i << std::endl;
+            return -1;
+        }
+        slot_count[directory[i]]++;
+        if (seen != first_slot.end())
+            continue;
+        first_slot[directory[i]] = i;
+        buckets++;
+        for (BlockID block_id = directory[i]; block_id != 0;) {
+            HashBucket block(file, block_id, false);
+            KeyHandles block_entries;
+            block.get_entries(block_entries);
+            for (auto const &entry: block_entries)
+                if ((HashIndex::hash(entry.first) & mask) != (i & mask)) {
+                    std::cout << "hash entry in the wrong bucket: slot " << i << std::endl;
+                    return -1;
+                }
+            entries += block_entries.size();
+            overflows += block_id != directory[i];
+            block_id = block.get_overflow();
+        }
+    }
+    for (auto const &count: slot_count) {
+        HashBucket bucket(file, count.first, false);
+        if (count.second != 1U << (global_depth - bucket.get_local_depth())) {
+            std::cout << "hash bucket of depth " << bucket.get_local_depth() << " in " << count.second << " slots"
+                      << std::endl;
+            return -1;
+        }
+    }
+    return entries;
+}
+
+bool test_hash_index() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_hash_index", column_names, column_attributes);
+    table.create();
+    HashIndex index(table, "hash_a", ColumnNames(1, "a"), true);
+    HashIndex index_b(table, "hash_b", ColumnNames(1, "b"), false);
+    index.create();
+    index_b.create();
+    u_long buckets, overflows;
+    if (check_hash_index(index.directory, index.global_depth, index.file, buckets, overflows) != 0 ||
+        buckets != 1) {
+        std::cout << "new hash index on an empty table isn't one empty bucket" << std::endl;
+        return false;
+    }
+
+    // distinct keys: a full bucket is split in two, doubling the directory first only if the bucket is as deep as
+    // it, and never gets an overflow block
+    const int N = 20000, DUPS = 2000;
+    uint depth = 0;
+    u_long splits = 0, doublings = 0;
+    BlockIDs directory;
+    Handles dups;
+    for (int i = 0; i < N; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(7);  // (all the same)
+        Handle handle = table.insert(&row);
+        index.insert(handle, &row);
+        if (i < DUPS) {
+            index_b.insert(handle, &row);
+            dups.push_back(handle);
+        }
+        directory = index.directory;
+        std::sort(directory.begin(), directory.end());
+        u_long now = (u_long) (std::unique(directory.begin(), directory.end()) - directory.begin());
+        if (now != splits + 1) {
+            splits++;
+            if (now != splits + 1 || index.global_depth > depth + 1) {
+                std::cout << "hash insert split more than one bucket: " << i << std::endl;
+                return false;
+            }
+        }
+        if (index.global_depth != depth) {
+            depth = index.global_depth;
+            doublings++;
+            if (check_hash_index(index.directory, index.global_depth, index.file, buckets, overflows) != i + 1)
+                return false;
+        }
+    }
+    if (check_hash_index(index.directory, index.global_depth, index.file, buckets, overflows) != N ||
+        overflows != 0 || doublings != depth || splits <= doublings) {
+        std::cout << "hash splits failed: " << splits << " splits, " << doublings << " doublings, " << overflows
+                  << " overflow blocks" << std::endl;
+        return false;
+    }
+    ValueDict lookup;
+    for (int i = 0; i <= N; i += 7) {
+        lookup["a"] = Value(i);
+        Handles *handles = index.lookup(&lookup);
+        u_long count = handles->size();
+        delete handles;
+        if (count != (i < N ? 1 : 0)) {
+            std::cout << "hash lookup failed: " << i << std::endl;
+            return false;
+        }
+    }
+
+    // one key over and over: splitting can't separate the entries, so the bucket grows overflow blocks instead and
+    // the directory stays as it is; deleting them puts the overflow blocks on the free list for the next ones
+    if (check_hash_index(index_b.directory, index_b.global_depth, index_b.file, buckets, overflows) != DUPS ||
+        index_b.global_depth != 0 || overflows == 0) {
+        std::cout << "hash duplicates didn't go into overflow blocks: " << index_b.global_depth << std::endl;
+        return false;
+    }
+    u_long blocks_before = index_b.file.get_last_block_id();
+    for (auto const &handle: dups)
+        index_b.del(handle);
+    if (check_hash_index(index_b.directory, index_b.global_depth, index_b.file, buckets, overflows) != 0 ||
+        overflows != 0) {
+        std::cout << "hash delete left " << overflows << " overflow blocks" << std::endl;
+        return false;
+    }
+    for (auto const &handle: dups)
+        index_b.insert(handle);
+    if (index_b.file.get_last_block_id() != blocks_before) {
+        std::cout << "hash overflow blocks weren't reused: " << index_b.file.get_last_block_id() << std::endl;
+        return false;
+    }
+
+    // the directory and the buckets are the same when read back from the file
+    index.close();
+    HashIndex reopened(table, "hash_a", ColumnNames(1, "a"), true);
+    reopened.open();
+    if (reopened.global_depth != depth ||
+        check_hash_index(reopened.directory, reopened.global_depth, reopened.file, buckets, overflows) != N
+        || buckets != splits + 1) {
+        std::cout << "hash index changed when reopened" << std::endl;
+        return false;
+    }
+    reopened.drop();
+    index_b.drop();
+    table.drop();
+    return true;
+}
+
+/**
+ * Time unique point lookups on a hash index against a B+tree on the same column, both on an INT and on a TEXT key.
+ * Prints microseconds per lookup.
+ */
+void bench_hash_index() {
+    const int N = 100000;
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__bench_hash_index", column_names, column_attributes);
+    table.create();
+    for (int i = 0; i < N; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value("customer-" + std::to_string(i));
+        table.insert(&row);
+    }
+    for (auto const &column: column_names) {
+        BTreeIndex btree(table, "bench_btree_" + column, ColumnNames(1, column), true);
+        HashIndex hash(table, "bench_hash_" + column, ColumnNames(1, column), true);
+        btree.create();
+        hash.create();
+        for (DbIndex *index: {(DbIndex *) &btree, (DbIndex *) &hash}) {
+            auto start = std::chrono::steady_clock::now();
+            u_long found = 0;
+            for (int i = 0; i < N; i++) {
+                int j = (int) ((i * 7919L) % N);  // (visits every row, out of order)
+                ValueDict key;
+                key[column] = column == "a" ? Value(j) : Value("customer-" + std::to_string(j));
+                Handles *handles = index->lookup(&key);
+                found += handles->size();
+                delete handles;
+            }
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "  " << column << (index == &btree ? " btree: " : " hash:  ") << us / N << " us/lookup ("
+                      << found << " found)" << std::endl;
+        }
+        std::cout << "  " << column << " hash global depth " << hash.get_global_depth() << std::endl;
+        btree.drop();
+        hash.drop();
+    }
+    table.drop();
+}
@@ -0,0 +1,166 @@
+/**
+ * @file HashIndex.h - HashIndex, a disk-based extendible hashing index, and HashBucket, a block of one of its buckets
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include "BTreeNode.h"
+
+/**
+ * @class HashBucket - one block of a bucket in a HashIndex
+ *
+ * Record 1 holds the bucket's local depth and the next block of the bucket's overflow chain (0 at the end of the
+ * chain). Record 2 holds all the entries packed one after another, each the row's handle and then the length and
+ * bytes of its normalized key, so probing the bucket is one read and a scan. Entries are changed in memory and
+ * only written back with save().
+ */
+class HashBucket {
+public:
+    static const RecordID HEADER = 1;
+    static const RecordID ENTRIES = 2;
+    static const u_long CAPACITY = DbBlock::BLOCK_SZ - 24;  // bytes of entries that fit with the header
+
+    // with create, block_id is a free block to reuse (0 for a brand new block at the end of the file)
+    HashBucket(HeapFile &file, BlockID block_id, bool create);
+
+    virtual ~HashBucket() {}
+
+    HashBucket(const HashBucket &other) = delete;
+
+    HashBucket(HashBucket &&temp) = delete;
+
+    HashBucket &operator=(const HashBucket &other) = delete;
+
+    HashBucket &operator=(HashBucket &&temp) = delete;
+
+    void save();
+
+    BlockID get_id() const { return this->id; }
+
+    uint get_local_depth() const { return this->local_depth; }
+
+    void set_local_depth(uint local_depth) { this->local_depth = local_depth; }
+
+    BlockID get_overflow() const { return this->overflow; }
+
+    void set_overflow(BlockID overflow) { this->overflow = overflow; }
+
+    bool add(const NormalizedKey &key, Handle handle);  // false if there's no room for it
+
+    void find(const NormalizedKey &key, Handles &handles) const;  // append the handles of entries with key
+
+    bool del(const NormalizedKey &key, Handle handle);  // false if there's no such entry
+
+    bool relocate(const NormalizedKey &key, Handle from, Handle to);  // ditto
+
+    void get_entries(KeyHandles &entries) const;
+
+    bool is_empty() const { return this->entries.empty(); }
+
+protected:
+    HeapFile &file;
+    BlockID id;
+    uint local_depth;
+    BlockID overflow;
+    std::string entries;
+
+    u_long find_entry(const NormalizedKey &key, Handle handle) const;  // offset of the entry (npos if not there)
+
+    static std::string marshal_entry(const NormalizedKey &key, Handle handle);
+};
+
+/**
+ * @class HashIndex - disk-based extendible hashing index (equality lookups only)
+ *
+ * Block 1 of the index file holds the global depth, the head of the free list, and the ids of the blocks the
+ * directory is kept in. The directory has 2^global_depth slots, each the id of the first block of a bucket: slot i
+ * is for the keys whose hash ends in the bits of i, and a bucket of local depth d is in every slot ending in the
+ * same d bits. A bucket that fills up is split on its next hash bit, doubling the directory first if the bucket's
+ * local depth is already the global depth. When a split can't help--every entry in the bucket has the same key, or
+ * the directory is already as big as it gets--the bucket gets an overflow block instead. Buckets aren't merged when
+ * entries are deleted, but overflow blocks that empty out go on the free list.
+ */
+class HashIndex : public DbIndex {
+public:
+    static const uint MAX_GLOBAL_DEPTH = 19;  // so the ids of the directory blocks fit in block 1
+    static const double DEFAULT_FILL_FACTOR;  // how full create expects buckets to get from the rows already there
+
+    HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~HashIndex() {}
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    virtual void del(Handle handle);
+
+    virtual void del(Handle handle, const ValueDict *row);
+
+    virtual void relocate(Handle from, Handle to);
+
+    // pull out the key values from the ValueDict in order, normalized (freed by caller)
+    virtual NormalizedKey *tkey(const ValueDict *key) const;
+
+    static uint64_t hash(const NormalizedKey &key);
+
+    uint get_global_depth() const { return this->global_depth; }
+
+protected:
+    static const BlockID HEADER = 1;
+    static const uint SLOTS_PER_BLOCK = 1000;  // directory slots kept in each directory block
+
+    bool closed;
+    mutable HeapFile file;  // reading buckets is still a const operation on the index
+    KeyProfile key_profile;
+    uint global_depth;
+    BlockID free_list;  // each free block's overflow is the next one
+    BlockIDs directory;
+    BlockIDs directory_blocks;
+    std::vector<bool> dirty;  // which directory blocks have changed since they were last saved
+
+    void build_key_profile();
+
+    // tkey of row, or of the row in the relation with the given handle if row is nullptr (freed by caller)
+    NormalizedKey *row_key(Handle handle, const ValueDict *row = nullptr);
+
+    uint slot(uint64_t hash) const { return (uint) (hash & ((1ULL << this->global_depth) - 1)); }
+
+    void set_slot(uint slot, BlockID bucket_id);
+
+    void _insert(const NormalizedKey &key, Handle handle);
+
+    bool split(uint slot, uint64_t hash);
+
+    void double_directory();
+
+    BlockID write_chain(const BlockIDs &blocks, uint local_depth, const KeyHandles &entries);
+
+    BlockID allocate();  // take a block off the free list (0 if it's empty)
+
+    void release(BlockID block_id);  // put a block that is no longer in any bucket on the free list
+
+    void load_header();
+
+    void save_header();
+
+    void save_directory();
+
+    friend bool test_hash_index();
+void bench_hash_index();
+};
+
+bool test_hash_index();
+void bench_hash_index();
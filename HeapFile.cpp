@@ -104,16 +104,36 @@ BlockIDs *HeapFile::block_ids() const {
     return vec;
 }
 
+/**
+ * Delete the blocks past the given one.
+ * @param last_block_id
+ */
+void HeapFile::truncate(BlockID last_block_id) {
+    if (last_block_id < 1)
+        last_block_id = 1;  // we always have at least one block
+    for (BlockID block_id = this->last; block_id > last_block_id; block_id--) {
+        Dbt key(&block_id, sizeof(block_id));
+        this->db.del(nullptr, &key, 0);
+    }
+    if (last_block_id < this->last)
+        this->last = last_block_id;
+}
+
 /**
  * Ask BerkDb how many blocks we are currently using in the file.
+ * Since blocks are only ever removed from the end (by truncate), this is the record number of the last
+ * record. (A fast DB->stat won't do: for a recno file it still counts deleted records.)
  * @return number of blocks
  */
 uint32_t HeapFile::get_block_count() {
-    DB_BTREE_STAT *stat;
-    this->db.stat(nullptr, &stat, DB_FAST_STAT);
-    uint32_t bt_ndata = stat->bt_ndata;
-    free(stat);
-    return bt_ndata;
+    Dbc *cursor;
+    this->db.cursor(nullptr, &cursor, 0);
+    Dbt key, data;
+    uint32_t count = 0;
+    if (cursor->get(&key, &data, DB_LAST) == 0)
+        count = *(db_recno_t *) key.get_data();
+    cursor->close();
+    return count;
 }
 
 /**
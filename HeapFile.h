@@ -49,6 +49,12 @@ public:
 
     virtual BlockIDs *block_ids() const;
 
+    /**
+     * Remove every block after the given one from the end of the file.
+     * @param last_block_id  block id that becomes the final block (must be at least 1)
+     */
+    virtual void truncate(BlockID last_block_id);
+
     /**
      * Get the id of the current final block in the heap file.
      * @return block id of last block
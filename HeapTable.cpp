@@ -3,8 +3,10 @@
  * @author K Lundeen
  * @see Seattle University, CPSC5300
  */
+#include <algorithm>
 #include <cstring>
 #include "HeapTable.h"
+#include "TableRegistry.h"
 
 using namespace std;
 typedef uint16_t u16;
@@ -16,7 +18,10 @@ typedef uint16_t u16;
  * @param column_attributes
  */
 HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes) : DbRelation(
-        table_name, column_names, column_attributes), file(table_name) {
+        table_name, column_names, column_attributes), file(table_name), read_latch(),
+        zones(TableRegistry<ZoneMap>::get(table_name, column_names, column_attributes)),
+        blooms(TableRegistry<BlockBloomFilters>::get(table_name, column_names, column_attributes)),
+        header(TableRegistry<TableHeader>::get(table_name, column_names, column_attributes)) {
 }
 
 /**
@@ -24,7 +29,10 @@ HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttr
  * Is not responsible for metadata storage or validation.
  */
 void HeapTable::create() {
+    zones.clear();
+    blooms.drop();
     file.create();
+    header.create();
 }
 
 /**
@@ -44,6 +52,9 @@ void HeapTable::create_if_not_exists() {
  */
 void HeapTable::drop() {
     file.drop();
+    zones.clear();
+    blooms.drop();
+    header.drop();
 }
 
 /**
@@ -95,9 +106,161 @@ void HeapTable::del(const Handle handle) {
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
     SlottedPage *block = this->file.get(block_id);
+    Dbt *data = block->get(record_id);
+    if (data == nullptr) {
+        delete block;
+        return;  // already deleted, so don't count it twice
+    }
+    delete data;
     block->del(record_id);
     this->file.put(block);
+    if (block->size() == 0)
+        zones.reset(block_id);  // nothing left, so every scan can skip it
     delete block;
+    header.add_rows(-1);
+}
+
+/**
+ * Declare Bloom filters on the given columns and build them for every block already in the table.
+ * @param column_names         columns to filter on
+ * @param false_positive_rate  wanted false-positive rate of each block's filters
+ */
+void HeapTable::create_bloom_filter(const ColumnNames &column_names, double false_positive_rate) {
+    open();
+    blooms.declare(column_names, false_positive_rate);
+    BlockIDs *block_ids = file.block_ids();
+    for (auto const &block_id: *block_ids)
+        rebuild_bloom_filters(block_id);
+    delete block_ids;
+}
+
+/**
+ * Execute: VACUUM <table_name>
+ *
+ * First each block with deleted records is compacted so its record ids are dense again (which renumbers
+ * the records after the first tombstone). Then rows are moved, a block at a time, from the end of the file
+ * into the free space of the earliest blocks with room, and the blocks left empty at the end are truncated
+ * off the file. Zones of the blocks that changed are forgotten and their Bloom filters are rebuilt.
+ *
+ * @param moves  returned by reference: (old handle, new handle) of every row that moved
+ * @return       number of bytes the file shrank by
+ */
+u_long HeapTable::vacuum(HandleMoves &moves) {
+    open();
+    BlockID blocks_before = file.get_last_block_id();
+    map<Handle, Handle> moved_to;  // original handle -> where it is now
+    map<Handle, Handle> moved_from;  // where it is now -> original handle
+    vector<bool> changed(blocks_before + 1, false);
+
+    // squeeze the tombstones out of every block
+    for (BlockID block_id = 1; block_id <= blocks_before; block_id++) {
+        SlottedPage *block = file.get(block_id);
+        vector<pair<RecordID, RecordID> > renumbered;
+        if (block->compact(renumbered)) {
+            file.put(block);
+            changed[block_id] = true;
+            for (auto const &ids: renumbered) {
+                moved_to[Handle(block_id, ids.first)] = Handle(block_id, ids.second);
+                moved_from[Handle(block_id, ids.second)] = Handle(block_id, ids.first);
+            }
+        }
+        delete block;
+    }
+
+    // move rows from the last block into the first blocks with room until the two meet
+    BlockID dest = 1, src = blocks_before;
+    while (dest < src) {
+        // copy out the source rows (fetching another block reuses the buffer they are in)
+        SlottedPage *block = file.get(src);
+        RecordIDs *record_ids = block->ids();
+        vector<pair<RecordID, string> > records;
+        for (auto const &record_id: *record_ids) {
+            Dbt *data = block->get(record_id);
+            records.push_back(make_pair(record_id, string((char *) data->get_data(), data->get_size())));
+            delete data;
+        }
+        delete record_ids;
+        delete block;
+
+        RecordIDs moved;
+        SlottedPage *target = nullptr;
+        bool dirty = false;
+        for (auto const &record: records) {
+            Dbt data((void *) record.second.data(), (u_int32_t) record.second.size());
+            RecordID record_id = 0;
+            while (record_id == 0 && dest < src) {
+                if (target == nullptr)
+                    target = file.get(dest);
+                try {
+                    record_id = target->add(&data);
+                } catch (DbBlockNoRoomError &e) {
+                    if (dirty)
+                        file.put(target);
+                    delete target;
+                    target = nullptr;
+                    dirty = false;
+                    dest++;
+                }
+            }
+            if (record_id == 0)
+                break;  // caught up with src
+            dirty = true;
+            changed[dest] = true;
+            Handle now(src, record.first), original = now;
+            if (moved_from.find(now) != moved_from.end())
+                original = moved_from[now];
+            moved_to[original] = Handle(dest, record_id);
+            moved.push_back(record.first);
+        }
+        if (target != nullptr) {
+            if (dirty)
+                file.put(target);
+            delete target;
+        }
+        if (!moved.empty()) {
+            block = file.get(src);
+            if (moved.size() == records.size())
+                block->clear();
+            else
+                for (auto const &record_id: moved)
+                    block->del(record_id);
+            file.put(block);
+            delete block;
+            changed[src] = true;
+        }
+        if (moved.size() < records.size())
+            break;
+        src--;
+    }
+
+    // cut off the empty blocks at the end
+    BlockID last = max(src, (BlockID) 1);
+    while (last > 1) {
+        SlottedPage *block = file.get(last);
+        bool empty = block->size() == 0;
+        delete block;
+        if (!empty)
+            break;
+        last--;
+    }
+    file.truncate(last);
+    for (BlockID block_id = 1; block_id <= blocks_before; block_id++) {
+        if (!changed[block_id] && block_id <= last)
+            continue;
+        zones.forget(block_id);
+        if (!blooms.empty()) {
+            if (block_id <= last) {
+                rebuild_bloom_filters(block_id);
+            } else {
+                blooms.reset(block_id);  // so they start out empty if the file grows back
+                blooms.save(block_id);
+            }
+        }
+    }
+
+    for (auto const &move: moved_to)
+        moves.push_back(move);
+    return (u_long) (blocks_before - last) * DbBlock::BLOCK_SZ;
 }
 
 /**
@@ -110,20 +273,43 @@ Handles *HeapTable::select() {
 
 /**
  * The select command
+ *
+ * Blocks whose zones show they can't hold a qualifying row are never read. Blocks that are read
+ * have their rows decoded once, both to check the predicates and to fill in the block's zone.
+ *
  * @param where predicates to match
  * @return list of handles of the selected rows
  */
 Handles *HeapTable::select(const ValueDict *where) {
     open();
+    if (where != nullptr)
+        for (auto const &predicate: *where)
+            if (find(this->column_names.begin(), this->column_names.end(), predicate.first) == this->column_names.end())
+                throw DbRelationError("table does not have column named '" + predicate.first + "'");
     Handles *handles = new Handles();
     BlockIDs *block_ids = file.block_ids();
     for (auto const &block_id: *block_ids) {
+        if (!zones.may_match(block_id, where) || !blooms.may_match(block_id, where))
+            continue;
         SlottedPage *block = file.get(block_id);
         RecordIDs *record_ids = block->ids();
-        for (auto const &record_id: *record_ids) {
-            Handle handle(block_id, record_id);
-            if (selected(handle, where))
-                handles->push_back(handle);
+        if (where == nullptr) {
+            for (auto const &record_id: *record_ids)
+                handles->push_back(Handle(block_id, record_id));
+        } else {
+            bool summarize = !zones.is_known(block_id);
+            if (summarize)
+                zones.reset(block_id);
+            for (auto const &record_id: *record_ids) {
+                Dbt *data = block->get(record_id);
+                ValueDict *row = unmarshal(data);
+                delete data;
+                if (summarize)
+                    zones.widen(block_id, row);
+                if (selected(row, where))
+                    handles->push_back(Handle(block_id, record_id));
+                delete row;
+            }
         }
         delete record_ids;
         delete block;
@@ -132,6 +318,24 @@ Handles *HeapTable::select(const ValueDict *where) {
     return handles;
 }
 
+/**
+ * Execute: SELECT COUNT(*) FROM <table_name>
+ *
+ * Comes straight from the table header, which insert and delete keep up to date. A table from before
+ * there were headers is counted the slow way once and the header is started with the answer.
+ *
+ * @return number of rows in the table
+ */
+u_long HeapTable::count() {
+    open();
+    if (!header.is_known()) {
+        Handles *handles = select();
+        header.set_row_count(handles->size());
+        delete handles;
+    }
+    return header.get_row_count();
+}
+
 /**
  * Refine another selection
  *
@@ -165,11 +369,15 @@ ValueDict *HeapTable::project(Handle handle) {
 ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
-    SlottedPage *block = file.get(block_id);
-    Dbt *data = block->get(record_id);
-    ValueDict *row = unmarshal(data);
-    delete data;
-    delete block;
+    ValueDict *row;
+    {
+        std::lock_guard<std::mutex> guard(this->read_latch);
+        SlottedPage *block = file.get(block_id);
+        Dbt *data = block->get(record_id);
+        row = unmarshal(data);
+        delete data;
+        delete block;
+    }
     if (column_names->empty())
         return row;
     ValueDict *result = new ValueDict();
@@ -182,6 +390,38 @@ ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
     return result;
 }
 
+/**
+ * Number of blocks in the heap file.
+ * @return block count
+ */
+BlockID HeapTable::get_block_count() {
+    open();
+    return file.get_last_block_id();
+}
+
+/**
+ * Get all the rows in a block.
+ * @param block_id  block to read
+ * @param handles   returned by reference: handles of the rows
+ * @return          the rows, in the same order as handles
+ */
+ValueDicts *HeapTable::project_block(BlockID block_id, Handles &handles) {
+    std::lock_guard<std::mutex> guard(this->read_latch);
+    open();
+    ValueDicts *rows = new ValueDicts();
+    SlottedPage *block = file.get(block_id);
+    RecordIDs *record_ids = block->ids();
+    for (auto const &record_id: *record_ids) {
+        Dbt *data = block->get(record_id);
+        rows->push_back(unmarshal(data));
+        delete data;
+        handles.push_back(Handle(block_id, record_id));
+    }
+    delete record_ids;
+    delete block;
+    return rows;
+}
+
 /**
  * Check if the given row is acceptable to insert.
  * @param row to be validated
@@ -217,12 +457,19 @@ Handle HeapTable::append(const ValueDict *row) {
         // need a new block
         delete block;
         block = this->file.get_new();
+        zones.reset(block->get_block_id());  // we know everything about a brand new block
         record_id = block->add(data);
     }
     this->file.put(block);
+    zones.widen(block->get_block_id(), row);
+    if (!blooms.empty()) {
+        blooms.add(block->get_block_id(), row);
+        blooms.save(block->get_block_id());
+    }
     delete block;
     delete[] (char *) data->get_data();
     delete data;
+    header.add_rows(1);
     return Handle(this->file.get_last_block_id(), record_id);
 }
 
@@ -323,6 +570,45 @@ bool HeapTable::selected(Handle handle, const ValueDict *where) {
     return is_selected;
 }
 
+/**
+ * See if the given (full) row satisfies the given where clause
+ * @param row    values of every column in the row
+ * @param where  conditions to check
+ * @return       true if conditions met, false otherwise
+ */
+bool HeapTable::selected(const ValueDict *row, const ValueDict *where) const {
+    if (where == nullptr)
+        return true;
+    for (auto const &predicate: *where) {
+        ValueDict::const_iterator column = row->find(predicate.first);
+        if (column == row->end())
+            throw DbRelationError("table does not have column named '" + predicate.first + "'");
+        if (column->second != predicate.second)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Recompute the Bloom filters for a block from the rows in it.
+ * @param block_id  block whose filters are rebuilt
+ */
+void HeapTable::rebuild_bloom_filters(BlockID block_id) {
+    SlottedPage *block = file.get(block_id);
+    RecordIDs *record_ids = block->ids();
+    blooms.reset(block_id);
+    for (auto const &record_id: *record_ids) {
+        Dbt *data = block->get(record_id);
+        ValueDict *row = unmarshal(data);
+        blooms.add(block_id, row);
+        delete row;
+        delete data;
+    }
+    blooms.save(block_id);
+    delete record_ids;
+    delete block;
+}
+
 /**
  * Test helper. Sets the row's a and b values.
  * @param row to set
@@ -431,7 +717,142 @@ bool test_heap_storage() {
             return false;
     }
     cout << "del ok" << endl;
-    table.drop();
     delete handles;
+
+    // filtered scans (the first one fills in the zone maps, the later ones use them)
+    for (int pass = 0; pass < 2; pass++) {
+        ValueDict where;
+        where["a"] = Value(500);
+        handles = table.select(&where);
+        if (handles->size() != 1 || !test_compare(table, (*handles)[0], 500, b))
+            return assertion_failure("select where a = 500", handles->size());
+        delete handles;
+        where["a"] = Value(5000);
+        handles = table.select(&where);
+        if (!handles->empty())
+            return assertion_failure("select where a = 5000", handles->size());
+        delete handles;
+    }
+    test_set_row(row, 5000, b);
+    table.insert(&row);
+    ValueDict where;
+    where["a"] = Value(5000);
+    where["b"] = Value(b);
+    handles = table.select(&where);
+    if (handles->size() != 1 || !test_compare(table, (*handles)[0], 5000, b))
+        return assertion_failure("select after insert into summarized block", handles->size());
+    delete handles;
+
+    // a table dropped and created again under the same name with other columns doesn't get the old zones
+    HeapTable before("_test_schema_cpp", ColumnNames(1, "a"), ColumnAttributes(1, ColumnAttribute::INT));
+    before.create();
+    ValueDict small_row;
+    small_row["a"] = Value(12);
+    before.insert(&small_row);
+    handles = before.select(&small_row);  // (summarizes the block)
+    delete handles;
+    before.drop();
+    HeapTable after("_test_schema_cpp", ColumnNames(1, "a"), ColumnAttributes(1, ColumnAttribute::TEXT));
+    after.create();
+    small_row["a"] = Value("twelve");
+    after.insert(&small_row);
+    handles = after.select(&small_row);
+    u_long found = handles->size();
+    delete handles;
+    after.drop();
+    if (found != 1)
+        return assertion_failure("select after the table was created again", found);
+    cout << "zone map ok" << endl;
+
+    table.create_bloom_filter(ColumnNames(1, "a"), 0.01);
+    test_set_row(row, 7777, b);
+    table.insert(&row);
+    const int bloom_keys[] = {500, 5000, 7777, 4999, -2};
+    const u_long bloom_expected[] = {1, 1, 1, 0, 0};
+    for (int k = 0; k < 5; k++) {
+        ValueDict bloom_where;
+        bloom_where["a"] = Value(bloom_keys[k]);
+        handles = table.select(&bloom_where);
+        if (handles->size() != bloom_expected[k])
+            return assertion_failure("select with bloom filter", bloom_keys[k], handles->size());
+        delete handles;
+    }
+    HeapTable filtered("_test_schema_cpp", ColumnNames(1, "a"), ColumnAttributes(1, ColumnAttribute::INT));
+    filtered.create();
+    filtered.create_bloom_filter(ColumnNames(1, "a"), 0.01);
+    filtered.drop();
+    ColumnNames new_names;
+    new_names.push_back("x");
+    new_names.push_back("y");
+    ColumnAttributes new_attributes;
+    new_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    new_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable refiltered("_test_schema_cpp", new_names, new_attributes);
+    refiltered.create();
+    try {
+        refiltered.create_bloom_filter(ColumnNames(1, "x"), 0.01);
+    } catch (DbRelationError &e) {
+        refiltered.drop();
+        return assertion_failure(string("bloom filter after the table was created again: ") + e.what());
+    }
+    refiltered.drop();
+    cout << "bloom filter ok" << endl;
+
+    // delete two thirds of the rows, then vacuum: everything left should still be there, in a third the blocks
+    handles = table.select();
+    u_long kept = 0;
+    for (auto const &handle: *handles) {
+        ValueDict *result = table.project(handle);
+        if ((*result)["a"].n % 3 != 0)
+            table.del(handle);
+        else
+            kept++;
+        delete result;
+    }
+    delete handles;
+    BlockID blocks_before = table.get_block_count();
+    HandleMoves moves;
+    u_long reclaimed = table.vacuum(moves);
+    BlockID blocks_after = table.get_block_count();
+    if (blocks_after > blocks_before / 3 + 1 || reclaimed != (blocks_before - blocks_after) * DbBlock::BLOCK_SZ)
+        return assertion_failure("vacuum blocks", blocks_before, blocks_after);
+    for (auto const &move: moves)
+        if (move.second.first > blocks_after)
+            return assertion_failure("vacuum moved a row past the end", move.second.first);
+    handles = table.select();
+    if (handles->size() != kept)
+        return assertion_failure("rows after vacuum", kept, handles->size());
+    for (auto const &handle: *handles) {
+        ValueDict *result = table.project(handle);
+        int a = (*result)["a"].n;
+        delete result;
+        if (a % 3 != 0 || !test_compare(table, handle, a, b))
+            return assertion_failure("row after vacuum", a);
+    }
+    delete handles;
+    for (int k = 0; k < 5; k++) {
+        ValueDict bloom_where;
+        bloom_where["a"] = Value(bloom_keys[k]);
+        handles = table.select(&bloom_where);
+        if (handles->size() != (bloom_keys[k] % 3 == 0 ? bloom_expected[k] : 0))
+            return assertion_failure("select after vacuum", bloom_keys[k], handles->size());
+        delete handles;
+    }
+    test_set_row(row, 3, b);
+    table.insert(&row);
+    cout << "vacuum ok" << endl;
+
+    if (table.count() != kept + 1)
+        return assertion_failure("count", kept + 1, table.count());
+    handles = table.select();
+    Handle gone = handles->front();
+    delete handles;
+    table.del(gone);
+    table.del(gone);  // deleting it again mustn't count twice
+    if (table.count() != kept)
+        return assertion_failure("count after delete", kept, table.count());
+    cout << "count ok" << endl;
+
+    table.drop();
     return true;
 }
@@ -7,9 +7,13 @@
  */
 #pragma once
 
+#include <mutex>
 #include "storage_engine.h"
 #include "SlottedPage.h"
 #include "HeapFile.h"
+#include "ZoneMap.h"
+#include "BloomFilter.h"
+#include "TableHeader.h"
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
@@ -51,14 +55,28 @@ public:
 
     virtual Handles* select(Handles *current_selection, const ValueDict* where);
 
+    virtual u_long count();
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
     using DbRelation::project;
 
+    virtual void create_bloom_filter(const ColumnNames &column_names, double false_positive_rate);
+
+    virtual BlockID get_block_count();
+
+    virtual ValueDicts *project_block(BlockID block_id, Handles &handles);
+
+    virtual u_long vacuum(HandleMoves &moves);
+
 protected:
     HeapFile file;
+    std::mutex read_latch;  // the file reads every block into one buffer, so threads reading rows take turns
+    ZoneMap &zones;
+    BlockBloomFilters &blooms;
+    TableHeader &header;
 
     virtual ValueDict *validate(const ValueDict *row) const;
 
@@ -69,6 +87,10 @@ protected:
     virtual ValueDict *unmarshal(Dbt *data) const;
 
     virtual bool selected(Handle handle, const ValueDict *where);
+
+    virtual bool selected(const ValueDict *row, const ValueDict *where) const;
+
+    virtual void rebuild_bloom_filters(BlockID block_id);
 };
 
 bool test_heap_storage();
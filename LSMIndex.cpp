@@ -0,0 +1,999 @@
+/**
+ * @file LSMIndex.cpp - implementation of LSMIndex and LSMRun
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <set>
+#include "LSMIndex.h"
+#include "HashIndex.h"
+
+const double LSMRun::FALSE_POSITIVE_RATE = 0.01;
+
+static const u_long HANDLE_SIZE = sizeof(BlockID) + sizeof(RecordID);
+
+// The handle, whether it's live, and then the key's length and bytes.
+static void marshal_entry(const LSMEntry &entry, std::string &bytes) {
+    const NormalizedKey &key = entry.first.first;
+    if (key.size() > LSMRun::CAPACITY / 2)
+        throw DbRelationError("index key too big for an LSM run");
+    uint8_t live = entry.second ? 1 : 0;
+    uint16_t size = (uint16_t) key.size();
+    bytes.append((char *) &entry.first.second.first, sizeof(BlockID));
+    bytes.append((char *) &entry.first.second.second, sizeof(RecordID));
+    bytes.append((char *) &live, sizeof(uint8_t));
+    bytes.append((char *) &size, sizeof(uint16_t));
+    bytes += key;
+}
+
+// The entry at offset in bytes (moving offset past it).
+static LSMEntry unmarshal_entry(const char *bytes, u_long &offset) {
+    Handle handle(*(BlockID *) (bytes + offset), *(RecordID *) (bytes + offset + sizeof(BlockID)));
+    bool live = bytes[offset + HANDLE_SIZE] != 0;
+    uint16_t size = *(uint16_t *) (bytes + offset + HANDLE_SIZE + sizeof(uint8_t));
+    u_long start = offset + HANDLE_SIZE + sizeof(uint8_t) + sizeof(uint16_t);
+    offset = start + size;
+    return LSMEntry(KeyHandle(NormalizedKey(bytes + start, size), handle), live);
+}
+
+
+/**********
+ * LSMRun *
+ **********/
+
+LSMRun::LSMRun(Identifier name, uint id, uint level) : id(id), level(level), file(name + "-" + std::to_string(id)),
+                                                       latch(), is_open(false), entry_count(0), data_blocks(0),
+                                                       fence_blocks(0), bloom_blocks(0), fences(), bloom(),
+                                                       pending() {
+}
+
+LSMRun::~LSMRun() {
+    if (is_open)
+        file.close();
+}
+
+// Create the run's file, with a Bloom filter big enough for the given number of entries.
+void LSMRun::begin(u_long expected_entries) {
+    file.create();
+    is_open = true;
+    double bits_per_key = BloomFilter::bits_per_key(FALSE_POSITIVE_RATE);
+    uint num_bits = (uint) std::max(64.0, std::ceil(expected_entries * bits_per_key));
+    bloom = BloomFilter(num_bits, BloomFilter::optimal_hashes(bits_per_key));
+}
+
+// Add the next entry (which must come after all the ones before it).
+void LSMRun::append(const LSMEntry &entry) {
+    std::string bytes;
+    marshal_entry(entry, bytes);
+    if (pending.size() + bytes.size() > CAPACITY) {
+        add_block(pending);
+        data_blocks++;
+        pending.clear();
+    }
+    if (pending.empty())
+        fences.push_back(entry.first.first);
+    pending += bytes;
+    bloom.add_hash(HashIndex::hash(entry.first.first));
+    entry_count++;
+}
+
+// Write out the last data block and then the fences and the Bloom filter.
+void LSMRun::finish() {
+    if (!pending.empty()) {
+        add_block(pending);
+        data_blocks++;
+        pending.clear();
+    }
+    if (data_blocks == 0)
+        return;  // nothing in it after all
+    std::string bytes;
+    for (auto const &fence: fences) {
+        uint16_t size = (uint16_t) fence.size();
+        bytes.append((char *) &size, sizeof(uint16_t));
+        bytes += fence;
+    }
+    fence_blocks = write_bytes(bytes);
+    const std::vector<uint8_t> &bits = bloom.get_bytes();
+    bloom_blocks = write_bytes(std::string(bits.begin(), bits.end()));
+}
+
+// Id, level, entry count, the number of each kind of block, and the Bloom filter's size and number of hashes.
+std::string LSMRun::marshal() const {
+    uint32_t fields[] = {id, level, (uint32_t) entry_count, data_blocks, fence_blocks, bloom_blocks,
+                         bloom.get_num_bits(), bloom.get_num_hashes()};
+    return std::string((char *) fields, sizeof(fields));
+}
+
+LSMRun *LSMRun::unmarshal(Identifier name, const char *bytes) {
+    const uint32_t *fields = (const uint32_t *) bytes;
+    LSMRun *run = new LSMRun(name, fields[0], fields[1]);
+    run->entry_count = fields[2];
+    run->data_blocks = fields[3];
+    run->fence_blocks = fields[4];
+    run->bloom_blocks = fields[5];
+    run->file.open();
+    run->is_open = true;
+    std::string fence_bytes = run->read_bytes(run->data_blocks + 1, run->fence_blocks);
+    for (u_long offset = 0; offset < fence_bytes.size();) {
+        uint16_t size = *(uint16_t *) (fence_bytes.data() + offset);
+        run->fences.push_back(fence_bytes.substr(offset + sizeof(uint16_t), size));
+        offset += sizeof(uint16_t) + size;
+    }
+    std::string bloom_bytes = run->read_bytes(run->data_blocks + run->fence_blocks + 1, run->bloom_blocks);
+    run->bloom = BloomFilter(bloom_bytes.data(), fields[6] / 8, fields[7]);
+    return run;
+}
+
+void LSMRun::drop() {
+    file.drop();
+    is_open = false;
+}
+
+bool LSMRun::may_contain(const NormalizedKey &key) const {
+    return bloom.may_contain_hash(HashIndex::hash(key));
+}
+
+// The key's entries start in the last block whose first key is before it (or the first block) and may run on
+// through the blocks that start with it.
+void LSMRun::find(const NormalizedKey &key, LSMEntries &entries) const {
+    if (fences.empty())
+        return;
+    auto after = std::lower_bound(fences.begin(), fences.end(), key);
+    BlockID start = after == fences.begin() ? 1 : (BlockID) (after - fences.begin());
+    for (BlockID block_id = start; block_id <= data_blocks; block_id++) {
+        if (block_id > start && fences[block_id - 1] > key)
+            break;
+        scan_block(block_id, &key, entries);
+    }
+}
+
+void LSMRun::get_block(BlockID block_id, LSMEntries &entries) const {
+    scan_block(block_id, nullptr, entries);
+}
+
+void LSMRun::scan_block(BlockID block_id, const NormalizedKey *key, LSMEntries &entries) const {
+    std::string bytes;
+    {
+        std::lock_guard<std::mutex> guard(this->latch);
+        SlottedPage *page = file.get(block_id);
+        Dbt *dbt = page->get(1);
+        bytes.assign((char *) dbt->get_data(), dbt->get_size());
+        delete dbt;
+        delete page;
+    }
+    const char *data = bytes.data();
+    for (u_long offset = 0; offset < bytes.size();) {
+        if (key != nullptr) {
+            uint16_t size = *(uint16_t *) (data + offset + HANDLE_SIZE + sizeof(uint8_t));
+            const char *start = data + offset + HANDLE_SIZE + sizeof(uint8_t) + sizeof(uint16_t);
+            if (size != key->size() || memcmp(start, key->data(), size) != 0) {
+                offset = start - data + size;
+                continue;
+            }
+        }
+        entries.push_back(unmarshal_entry(data, offset));
+    }
+}
+
+// Put bytes in a block of its own at the end of the file (block 1, which the file starts with, for the first data
+// block).
+void LSMRun::add_block(const std::string &bytes) {
+    std::lock_guard<std::mutex> guard(this->latch);
+    SlottedPage *page = data_blocks == 0 ? file.get(1) : file.get_new();
+    Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+    page->add(&dbt);
+    file.put(page);
+    delete page;
+}
+
+BlockID LSMRun::write_bytes(const std::string &bytes) {
+    BlockID count = 0;
+    for (u_long offset = 0; offset < bytes.size(); offset += CAPACITY) {
+        add_block(bytes.substr(offset, CAPACITY));
+        count++;
+    }
+    return count;
+}
+
+std::string LSMRun::read_bytes(BlockID first, BlockID count) {
+    std::string bytes;
+    for (BlockID block_id = first; block_id < first + count; block_id++) {
+        SlottedPage *page = file.get(block_id);
+        Dbt *dbt = page->get(1);
+        bytes.append((char *) dbt->get_data(), dbt->get_size());
+        delete dbt;
+        delete page;
+    }
+    return bytes;
+}
+
+
+/************
+ * LSMIndex *
+ ************/
+
+LSMIndex::LSMIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique), latch(), closed(true),
+          manifest(relation.get_table_name() + "-" + name), log(relation.get_table_name() + "-" + name + "-log"),
+          key_profile(), memtable(), runs(), next_run_id(1), compactor(), compaction_latch(), work(), progress(),
+          stopping(false), pending(false), compacting(false), level0_runs(0) {
+    build_key_profile();
+}
+
+LSMIndex::~LSMIndex() {
+    stop_compactor();
+    for (auto const &run: runs)
+        delete run;
+}
+
+// Create the index with the entries of the rows already in the table in one run, at the level it fits in.
+void LSMIndex::create() {
+    manifest.create();
+    log.create();
+    closed = false;
+    try {
+        KeyHandles entries;
+        BlockID block_count = relation.get_block_count();
+        for (BlockID block_id = 1; block_id <= block_count; block_id++) {
+            Handles handles;
+            ValueDicts *rows = project_block(block_id, handles);
+            for (uint i = 0; i < rows->size(); i++) {
+                NormalizedKey *key = this->tkey((*rows)[i]);
+                entries.push_back(KeyHandle(*key, handles[i]));
+                delete key;
+                delete (*rows)[i];
+            }
+            delete rows;
+        }
+        std::sort(entries.begin(), entries.end());
+        for (u_long i = 1; this->unique && i < entries.size(); i++)
+            if (entries[i].first == entries[i - 1].first)
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+        if (!entries.empty()) {
+            uint level = 1;
+            while (entries.size() > level_capacity(level))
+                level++;
+            LSMRun *run = new_run(level);
+            runs.push_back(run);
+            run->begin(entries.size());
+            for (auto const &entry: entries)
+                run->append(LSMEntry(entry, true));
+            run->finish();
+        }
+        save_manifest();
+        start_compactor();
+    } catch (...) {
+        drop();
+        throw;
+    }
+}
+
+// Drop the index.
+void LSMIndex::drop() {
+    stop_compactor();
+    for (auto const &run: runs) {
+        run->drop();
+        delete run;
+    }
+    runs.clear();
+    memtable.clear();
+    manifest.drop();
+    log.drop();
+    closed = true;
+}
+
+// Open existing index. Enables: lookup, insert, delete, relocate.
+void LSMIndex::open() {
+    if (closed) {
+        manifest.open();
+        log.open();
+        load_manifest();
+        replay_log();
+        closed = false;
+        start_compactor();
+    }
+}
+
+// Closes the index, flushing the memtable first. Disables: lookup, insert, delete, relocate.
+void LSMIndex::close() {
+    if (!closed) {
+        stop_compactor();
+        {
+            BTreeLatch::Exclusive exclusive(this->latch);
+            flush();
+        }
+        for (auto const &run: runs)
+            delete run;
+        runs.clear();
+        manifest.close();
+        log.close();
+        closed = true;
+    }
+}
+
+// Find all the rows whose columns are equal to key.
+Handles *LSMIndex::lookup(ValueDict *key_dict) const {
+    NormalizedKey *key = this->tkey(key_dict);
+    Handles *handles = new Handles;
+    {
+        BTreeLatch::Shared shared(this->latch);
+        find(*key, *handles);
+    }
+    delete key;
+    return handles;
+}
+
+// The memtable and then each run, newest first: the first entry seen for a handle says whether it's there.
+void LSMIndex::find(const NormalizedKey &key, Handles &handles) const {
+    std::map<Handle, bool> newest;
+    for (auto it = memtable.lower_bound(KeyHandle(key, Handle(0, 0))); it != memtable.end() && it->first.first == key;
+         it++)
+        newest.insert(std::make_pair(it->first.second, it->second));
+    LSMEntries entries;
+    for (auto const &run: runs) {
+        if (!run->may_contain(key))
+            continue;
+        entries.clear();
+        run->find(key, entries);
+        for (auto const &entry: entries)
+            newest.insert(std::make_pair(entry.first.second, entry.second));
+    }
+    for (auto const &entry: newest)
+        if (entry.second)
+            handles.push_back(entry.first);
+}
+
+// Whether any row has the key: the same newest-first order as find, but stopping at the first live entry (a
+// tombstone only settles its own handle, hiding older entries for it further down).
+bool LSMIndex::has_live(const NormalizedKey &key) const {
+    std::set<Handle> settled;
+    for (auto it = memtable.lower_bound(KeyHandle(key, Handle(0, 0))); it != memtable.end() && it->first.first == key;
+         it++) {
+        if (it->second)
+            return true;
+        settled.insert(it->first.second);
+    }
+    LSMEntries entries;
+    for (auto const &run: runs) {
+        if (!run->may_contain(key))
+            continue;
+        entries.clear();
+        run->find(key, entries);
+        for (auto const &entry: entries) {
+            if (settled.count(entry.first.second))
+                continue;
+            if (entry.second)
+                return true;
+            settled.insert(entry.first.second);
+        }
+    }
+    return false;
+}
+
+// Insert a row with the given handle. Row must exist in relation already.
+void LSMIndex::insert(Handle handle) {
+    insert(handle, nullptr);
+}
+
+// Insert a row with the given handle and values (or, with row of nullptr, the values it has in the relation).
+void LSMIndex::insert(Handle handle, const ValueDict *row) {
+    open();
+    NormalizedKey *key = row_key(handle, row);
+    try {
+        stall();
+        BTreeLatch::Exclusive exclusive(this->latch);
+        if (this->unique && has_live(*key))
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        change(*key, handle, true);
+    } catch (...) {
+        delete key;
+        throw;
+    }
+    delete key;
+}
+
+// Delete the index entry for the row with the given handle. Row must still be in relation.
+void LSMIndex::del(Handle handle) {
+    del(handle, nullptr);
+}
+
+// Delete the index entry for the row with the given handle and values (or, with row of nullptr, the values it has
+// in the relation): a tombstone for it.
+void LSMIndex::del(Handle handle, const ValueDict *row) {
+    open();
+    NormalizedKey *key = row_key(handle, row);
+    try {
+        stall();
+        BTreeLatch::Exclusive exclusive(this->latch);
+        change(*key, handle, false);
+    } catch (...) {
+        delete key;
+        throw;
+    }
+    delete key;
+}
+
+// The row that used to be at from is now at to: a tombstone for the old entry and a new one.
+void LSMIndex::relocate(Handle from, Handle to) {
+    open();
+    NormalizedKey *key = row_key(to);
+    try {
+        stall();
+        BTreeLatch::Exclusive exclusive(this->latch);
+        change(*key, from, false);
+        change(*key, to, true);
+    } catch (...) {
+        delete key;
+        throw;
+    }
+    delete key;
+}
+
+NormalizedKey *LSMIndex::tkey(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns) {
+        auto column = key->find(column_name);
+        if (column == key->end())
+            throw DbRelationError("missing key column '" + column_name + "'");
+        key_value.push_back(column->second);
+    }
+    return new NormalizedKey(normalize_key(key_value, key_profile));
+}
+
+void LSMIndex::settle() {
+    open();
+    {
+        BTreeLatch::Exclusive exclusive(this->latch);
+        flush();
+    }
+    std::unique_lock<std::mutex> lock(this->compaction_latch);
+    progress.wait(lock, [this] { return !pending && !compacting; });
+}
+
+uint LSMIndex::get_run_count(uint level) const {
+    BTreeLatch::Shared shared(this->latch);
+    uint count = 0;
+    for (auto const &run: runs)
+        if (run->get_level() == level)
+            count++;
+    return count;
+}
+
+u_long LSMIndex::level_capacity(uint level) {
+    u_long capacity = MEMTABLE_ENTRIES * LEVEL0_RUNS * 2;
+    for (uint i = 1; i < level; i++)
+        capacity *= FANOUT;
+    return capacity;
+}
+
+// Figure out the data types of each key component and encode them in key_profile.
+void LSMIndex::build_key_profile() {
+    std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+}
+
+// The key of the given row, or of the row with the given handle, read from the relation (freed by caller).
+NormalizedKey *LSMIndex::row_key(Handle handle, const ValueDict *row) {
+    if (row != nullptr)
+        return this->tkey(row);
+    ValueDict *projected = relation.project(handle);
+    NormalizedKey *key = this->tkey(projected);
+    delete projected;
+    return key;
+}
+
+// Put the change in the memtable and append it to the log, flushing the memtable if it's full.
+void LSMIndex::change(const NormalizedKey &key, Handle handle, bool live) {
+    LSMEntry entry(KeyHandle(key, handle), live);
+    std::string bytes;
+    marshal_entry(entry, bytes);
+    Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+    SlottedPage *page = log.get(log.get_last_block_id());
+    try {
+        page->add(&dbt);
+    } catch (DbBlockNoRoomError &e) {
+        delete page;
+        page = log.get_new();
+        page->add(&dbt);
+    }
+    log.put(page);
+    delete page;
+    memtable[entry.first] = live;
+    if (memtable.size() >= MEMTABLE_ENTRIES)
+        flush();
+}
+
+// Write the memtable out as the newest run at level 0 and start over with an empty one (and an empty log).
+void LSMIndex::flush() {
+    if (memtable.empty())
+        return;
+    LSMRun *run = new_run(0);
+    try {
+        run->begin(memtable.size());
+        for (auto const &entry: memtable)
+            run->append(LSMEntry(entry.first, entry.second));
+        run->finish();
+    } catch (...) {
+        run->drop();
+        delete run;
+        throw;
+    }
+    runs.insert(runs.begin(), run);
+    save_manifest();
+    memtable.clear();
+    clear_log();
+    runs_changed();
+}
+
+// A run for the given level with the next id (which is saved right away, so that it's never used again even if the
+// run never makes it into the manifest).
+LSMRun *LSMIndex::new_run(uint level) {
+    LSMRun *run = new LSMRun(relation.get_table_name() + "-" + name, next_run_id++, level);
+    save_manifest();
+    return run;
+}
+
+// Block 1: the next run id, then each run's statistics.
+void LSMIndex::save_manifest() {
+    SlottedPage *page = manifest.get(1);
+    page->clear();
+    Dbt dbt(&next_run_id, sizeof(next_run_id));
+    page->add(&dbt);
+    for (auto const &run: runs) {
+        std::string bytes = run->marshal();
+        Dbt run_dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+        page->add(&run_dbt);
+    }
+    manifest.put(page);
+    delete page;
+}
+
+void LSMIndex::load_manifest() {
+    SlottedPage *page = manifest.get(1);
+    RecordIDs *ids = page->ids();
+    for (auto const &record_id: *ids) {
+        Dbt *dbt = page->get(record_id);
+        if (record_id == 1)
+            next_run_id = *(uint32_t *) dbt->get_data();
+        else
+            runs.push_back(LSMRun::unmarshal(relation.get_table_name() + "-" + name, (char *) dbt->get_data()));
+        delete dbt;
+    }
+    delete ids;
+    delete page;
+    std::lock_guard<std::mutex> guard(this->compaction_latch);
+    level0_runs = 0;
+    for (auto const &run: runs)
+        if (run->get_level() == 0)
+            level0_runs++;
+}
+
+void LSMIndex::clear_log() {
+    log.truncate(1);
+    SlottedPage *page = log.get(1);
+    page->clear();
+    log.put(page);
+    delete page;
+}
+
+// Put the changes in the log (the ones made since the memtable was last flushed) back into the memtable.
+void LSMIndex::replay_log() {
+    memtable.clear();
+    for (BlockID block_id = 1; block_id <= log.get_last_block_id(); block_id++) {
+        SlottedPage *page = log.get(block_id);
+        RecordIDs *ids = page->ids();
+        for (auto const &record_id: *ids) {
+            Dbt *dbt = page->get(record_id);
+            u_long offset = 0;
+            LSMEntry entry = unmarshal_entry((char *) dbt->get_data(), offset);
+            memtable[entry.first] = entry.second;
+            delete dbt;
+        }
+        delete ids;
+        delete page;
+    }
+}
+
+// Wait, if level 0 has gotten so many runs that lookups are slowing down, until compaction catches up.
+void LSMIndex::stall() {
+    std::unique_lock<std::mutex> lock(this->compaction_latch);
+    progress.wait(lock, [this] { return level0_runs < STALL_RUNS || !compactor.joinable() || stopping; });
+}
+
+void LSMIndex::start_compactor() {
+    stopping = false;
+    pending = true;  // in case there's compacting left over from before
+    compactor = std::thread(&LSMIndex::compact_loop, this);
+}
+
+// Stop the compactor (abandoning any merge it's in the middle of) and wait for it to finish.
+void LSMIndex::stop_compactor() {
+    if (!compactor.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(this->compaction_latch);
+        stopping = true;
+    }
+    work.notify_all();
+    progress.notify_all();
+    compactor.join();
+    stopping = false;
+}
+
+// The compactor thread: compact whenever there may be something to compact, until it's stopped.
+void LSMIndex::compact_loop() {
+    std::unique_lock<std::mutex> lock(this->compaction_latch);
+    while (true) {
+        work.wait(lock, [this] { return stopping || pending; });
+        if (stopping)
+            break;
+        pending = false;
+        compacting = true;
+        lock.unlock();
+        bool compacted = compact_step();
+        lock.lock();
+        compacting = false;
+        if (compacted)
+            pending = true;  // there may be more
+        progress.notify_all();
+    }
+    compacting = false;
+    progress.notify_all();
+}
+
+void LSMIndex::runs_changed() {
+    std::lock_guard<std::mutex> guard(this->compaction_latch);
+    level0_runs = 0;
+    for (auto const &run: runs)
+        if (run->get_level() == 0)
+            level0_runs++;
+    pending = true;
+    work.notify_all();
+    progress.notify_all();
+}
+
+// One compaction, if there's one to do: merge the inputs into a new run (without holding the latch, since the
+// inputs don't change and aren't dropped by anyone else) and then swap it in for them. Returns false if there was
+// nothing to do (or it was stopped partway).
+bool LSMIndex::compact_step() {
+    std::vector<LSMRun *> inputs;
+    uint level;
+    bool bottom;
+    LSMRun *output;
+    {
+        BTreeLatch::Exclusive exclusive(this->latch);
+        if (!pick(inputs, level, bottom))
+            return false;
+        output = new_run(level);
+    }
+    bool merged;
+    try {
+        merged = merge(inputs, output, bottom);
+    } catch (...) {
+        merged = false;
+    }
+    if (!merged) {
+        output->drop();
+        delete output;
+        return false;
+    }
+    {
+        BTreeLatch::Exclusive exclusive(this->latch);
+        std::vector<LSMRun *> kept;
+        for (auto const &run: runs)
+            if (std::find(inputs.begin(), inputs.end(), run) == inputs.end())
+                kept.push_back(run);
+        runs.clear();
+        bool placed = output->get_data_blocks() == 0;  // (nothing but tombstones, all dropped)
+        for (auto const &run: kept) {
+            if (!placed && run->get_level() > level) {
+                runs.push_back(output);
+                placed = true;
+            }
+            runs.push_back(run);
+        }
+        if (!placed)
+            runs.push_back(output);
+        save_manifest();
+        runs_changed();
+    }
+    if (output->get_data_blocks() == 0) {
+        output->drop();
+        delete output;
+    }
+    for (auto const &run: inputs) {
+        run->drop();
+        delete run;
+    }
+    return true;
+}
+
+// What to compact next (with the latch held): all of level 0 and level 1 once level 0 has enough runs, otherwise
+// the first level whose run is over capacity and the one after it. Bottom is whether there are no runs below the
+// output's level, so tombstones can go.
+bool LSMIndex::pick(std::vector<LSMRun *> &inputs, uint &level, bool &bottom) const {
+    inputs.clear();
+    uint deepest = 0;
+    for (auto const &run: runs)
+        deepest = std::max(deepest, run->get_level());
+    uint count0 = 0;
+    for (auto const &run: runs)
+        if (run->get_level() == 0)
+            count0++;
+    if (count0 >= LEVEL0_RUNS) {
+        level = 1;
+    } else {
+        level = 0;
+        for (auto const &run: runs)
+            if (run->get_level() > 0 && run->get_entry_count() > level_capacity(run->get_level())) {
+                level = run->get_level() + 1;
+                break;
+            }
+        if (level == 0)
+            return false;
+    }
+    for (auto const &run: runs)
+        if (run->get_level() == level - 1 || run->get_level() == level)
+            inputs.push_back(run);  // (newest first, as they are in runs)
+    bottom = deepest <= level;
+    return true;
+}
+
+namespace {
+    // where a merge is in one of its input runs
+    struct LSMCursor {
+        LSMRun *run;
+        BlockID block_id;
+        LSMEntries entries;
+        u_long pos;
+    };
+
+    bool next_entry(LSMCursor &cursor, LSMEntry &entry) {
+        while (cursor.pos == cursor.entries.size()) {
+            if (cursor.block_id > cursor.run->get_data_blocks())
+                return false;
+            cursor.entries.clear();
+            cursor.run->get_block(cursor.block_id++, cursor.entries);
+            cursor.pos = 0;
+        }
+        entry = cursor.entries[cursor.pos++];
+        return true;
+    }
+}
+
+// Merge the inputs (newest first) into output, a block of each input at a time, keeping only the newest entry for
+// each (key, handle). Returns false if the compactor was stopped before it finished.
+bool LSMIndex::merge(const std::vector<LSMRun *> &inputs, LSMRun *output, bool bottom) {
+    typedef std::pair<LSMEntry, uint> Head;  // least unmerged entry of an input and which input it's from
+    auto later = [](const Head &a, const Head &b) {
+        return a.first.first != b.first.first ? a.first.first > b.first.first : a.second > b.second;
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+    std::vector<LSMCursor> cursors;
+    u_long expected = 0;
+    for (auto const &run: inputs) {
+        LSMCursor cursor = {run, 1, LSMEntries(), 0};
+        cursors.push_back(cursor);
+        expected += run->get_entry_count();
+    }
+    for (uint i = 0; i < cursors.size(); i++) {
+        LSMEntry entry;
+        if (next_entry(cursors[i], entry))
+            heads.push(Head(entry, i));
+    }
+    output->begin(expected);
+    bool first = true;
+    KeyHandle last;
+    u_long merged = 0;
+    while (!heads.empty()) {
+        if (++merged % 1024 == 0 && stopping)
+            return false;
+        Head head = heads.top();
+        heads.pop();
+        LSMEntry following;
+        if (next_entry(cursors[head.second], following))
+            heads.push(Head(following, head.second));
+        if (!first && head.first.first == last)
+            continue;  // an older entry for the same (key, handle)
+        first = false;
+        last = head.first.first;
+        if (bottom && !head.first.second)
+            continue;  // a tombstone with nothing below for it to hide
+        output->append(head.first);
+    }
+    output->finish();
+    return true;
+}
+
+// The shape compaction keeps the runs in: no more than LEVEL0_RUNS at level 0 (once it has caught up), then at most
+// one run at each level after that, in order, none over its level's capacity. Returns the number of entries in
+// all of them, or -1 after saying what's wrong.
+static long check_lsm_levels(const std::vector<LSMRun *> &runs) {
+    long entries = 0;
+    uint level0_runs = 0, last_level = 0;
+    for (auto const &run: runs) {
+        if (run->get_level() == 0 && last_level == 0) {
+            level0_runs++;
+        } else if (run->get_level() <= last_level || run->get_entry_count() > LSMIndex::level_capacity(run->get_level())) {
+            std::cout << "lsm run at level " << run->get_level() << " (after " << last_level << ") has "
+                      << run->get_entry_count() << " entries" << std::endl;
+            return -1;
+        }
+        last_level = run->get_level();
+        entries += run->get_entry_count();
+    }
+    if (level0_runs >= LSMIndex::LEVEL0_RUNS) {
+        std::cout << "lsm compaction left " << level0_runs << " runs at level 0" << std::endl;
+        return -1;
+    }
+    return entries;
+}
+
+// Look up key a and see whether it finds just the given handle (or nothing, if found is false).
+static bool lsm_lookup(const LSMIndex &index, int a, Handle handle, bool found) {
+    ValueDict key;
+    key["a"] = Value(a);
+    Handles *handles = index.lookup(&key);
+    bool ok = found ? handles->size() == 1 && handles->front() == handle : handles->empty();
+    delete handles;
+    if (!ok)
+        std::cout << "lsm lookup of " << a << " failed" << std::endl;
+    return ok;
+}
+
+bool test_lsm_index() {
+    // the index is given each row, so its handles needn't be real rows
+    HeapTable table("__test_lsm_index", ColumnNames(1, "a"), ColumnAttributes(1, ColumnAttribute(ColumnAttribute::INT)));
+    table.create();
+    LSMIndex index(table, "lsm_a", ColumnNames(1, "a"), false);
+    index.create();
+    auto handle = [](int a) { return Handle((BlockID) (a / 100 + 1), (RecordID) (a % 100 + 1)); };
+    auto insert = [&index, &handle](int from, int to) {  // keys from up to (but not including) to
+        for (int a = from; a < to; a++) {
+            ValueDict row;
+            row["a"] = Value(a);
+            index.insert(handle(a), &row);
+        }
+    };
+    const int N = (int) (LSMIndex::MEMTABLE_ENTRIES * LSMIndex::LEVEL0_RUNS);
+
+    // LEVEL0_RUNS flushes are merged into one run at level 1
+    insert(0, N);
+    index.settle();
+    if (check_lsm_levels(index.runs) != N || index.get_run_count(0) != 0 || index.get_run_count(1) != 1) {
+        std::cout << "lsm level 0 wasn't compacted into level 1" << std::endl;
+        return false;
+    }
+    ValueDict wrong_column;
+    wrong_column["b"] = Value(1);
+    try {
+        delete index.lookup(&wrong_column);
+        std::cout << "lsm lookup without the key column didn't fail" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+
+    // tombstones in newer runs hide the entries below them, and once level 0 fills up again, the merge into the
+    // bottom level keeps only the newest entry for each row and drops the tombstones
+    for (int a = 0; a < N; a += 2) {
+        ValueDict row;
+        row["a"] = Value(a);
+        index.del(handle(a), &row);
+    }
+    index.settle();
+    if (index.get_run_count(0) != 2 || !lsm_lookup(index, 2, handle(2), false) || !lsm_lookup(index, 3, handle(3), true)) {
+        std::cout << "lsm tombstones didn't hide older entries" << std::endl;
+        return false;
+    }
+    insert(N, N + N / 2);
+    index.settle();
+    if (check_lsm_levels(index.runs) != N || index.get_run_count(0) != 0 || index.get_run_count(1) != 1 ||
+        !lsm_lookup(index, 2, handle(2), false) || !lsm_lookup(index, N, handle(N), true)) {
+        std::cout << "lsm merge into the bottom level didn't drop tombstones" << std::endl;
+        return false;
+    }
+
+    // a level that outgrows its capacity is merged into the next one down
+    const int M = 2 * N;
+    insert(N + N / 2, N + N / 2 + M);
+    index.settle();
+    if (check_lsm_levels(index.runs) != N + M || index.get_run_count(1) != 0 || index.get_run_count(2) != 1 ||
+        !lsm_lookup(index, N + M, handle(N + M), true)) {
+        std::cout << "lsm level 1 wasn't merged into level 2" << std::endl;
+        return false;
+    }
+
+    // changes wait while level 0 has STALL_RUNS runs and go on once the compactor has merged them
+    index.stop_compactor();
+    const int FIRST = N + N / 2 + M, STALLED = FIRST + (int) (LSMIndex::STALL_RUNS * LSMIndex::MEMTABLE_ENTRIES);
+    insert(FIRST, STALLED);  // (no compactor, so no waiting)
+    std::atomic<bool> release(false), done(false);
+    index.compactor = std::thread([&release] {  // a stand-in that never compacts anything
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    std::thread changer([&insert, &done, STALLED] {
+        insert(STALLED, STALLED + 1);
+        done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    bool stalled = !done && index.get_run_count(0) == LSMIndex::STALL_RUNS;
+    {
+        std::lock_guard<std::mutex> guard(index.compaction_latch);
+        release = true;
+        index.compactor.join();
+        index.start_compactor();
+    }
+    changer.join();
+    index.settle();
+    if (!stalled || check_lsm_levels(index.runs) != N + M + STALLED + 1 - FIRST ||
+        !lsm_lookup(index, STALLED, handle(STALLED), true)) {
+        std::cout << "lsm stall failed" << (stalled ? "" : ": changes didn't wait") << std::endl;
+        return false;
+    }
+
+    // the runs are the same when read back from the manifest
+    std::vector<std::pair<uint, u_long> > shape;
+    for (auto const &run: index.runs)
+        shape.push_back(std::make_pair(run->get_level(), run->get_entry_count()));
+    index.close();
+    LSMIndex reopened(table, "lsm_a", ColumnNames(1, "a"), false);
+    reopened.open();
+    reopened.settle();
+    std::vector<std::pair<uint, u_long> > reopened_shape;
+    for (auto const &run: reopened.runs)
+        reopened_shape.push_back(std::make_pair(run->get_level(), run->get_entry_count()));
+    if (reopened_shape != shape || !lsm_lookup(reopened, 7, handle(7), true)) {
+        std::cout << "lsm runs changed when reopened" << std::endl;
+        return false;
+    }
+    reopened.drop();
+
+    // a unique index refuses a key that has a live entry, in the memtable or in a run, but takes it again once each
+    // of its entries is hidden by a tombstone, whether that's in the memtable or in a newer run
+    LSMIndex unique_index(table, "lsm_unique", ColumnNames(1, "a"), true);
+    unique_index.create();
+    auto unique_insert = [&unique_index](int a, Handle row_handle) {
+        ValueDict row;
+        row["a"] = Value(a);
+        try {
+            unique_index.insert(row_handle, &row);
+            return true;
+        } catch (DbRelationError &e) {
+            return false;
+        }
+    };
+    auto unique_del = [&unique_index](int a, Handle row_handle) {
+        ValueDict row;
+        row["a"] = Value(a);
+        unique_index.del(row_handle, &row);
+    };
+    bool ok = unique_insert(1, handle(1)) && !unique_insert(1, handle(2));  // (live in the memtable)
+    unique_index.settle();
+    ok = ok && !unique_insert(1, handle(3));  // (live in a run)
+    unique_del(1, handle(1));
+    ok = ok && unique_insert(1, handle(4));  // (tombstone in the memtable, live entry in a run)
+    unique_index.settle();
+    unique_del(1, handle(4));
+    unique_index.settle();
+    ok = ok && unique_insert(1, handle(5)) && !unique_insert(1, handle(6));  // (tombstone in a newer run)
+    if (!ok || !lsm_lookup(unique_index, 1, handle(5), true)) {
+        std::cout << "lsm unique index took or refused the wrong keys" << std::endl;
+        return false;
+    }
+    unique_index.drop();
+    table.drop();
+    return true;
+}
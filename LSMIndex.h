@@ -0,0 +1,215 @@
+/**
+ * @file LSMIndex.h - LSMIndex, a log-structured merge index, and LSMRun, one of its sorted runs
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include "BTreeNode.h"
+#include "BloomFilter.h"
+
+typedef std::pair<KeyHandle, bool> LSMEntry;  // an entry and whether it is live (false for a deletion's tombstone)
+typedef std::vector<LSMEntry> LSMEntries;
+
+/**
+ * @class LSMRun - an immutable run of LSMIndex entries in (key, handle) order, in a file of its own
+ *
+ * The data blocks come first, each with one record of entries packed one after another: the handle, whether the
+ * entry is live, and the key's length and bytes. After them come the fence blocks, with the first key of each
+ * data block, and the Bloom filter of all the keys in the run (the tombstones' keys, too, since a tombstone has to
+ * be found to hide the older entry it deletes). The fences and the filter are read in when the run is opened, so a
+ * probe reads only the data blocks the key could be in, and only if the filter says it might be there at all.
+ */
+class LSMRun {
+public:
+    static const u_long CAPACITY = DbBlock::BLOCK_SZ - 16;  // bytes that fit in a block as its one record
+    static const double FALSE_POSITIVE_RATE;  // what the Bloom filter is sized for
+
+    LSMRun(Identifier name, uint id, uint level);
+
+    virtual ~LSMRun();
+
+    LSMRun(const LSMRun &other) = delete;
+
+    LSMRun(LSMRun &&temp) = delete;
+
+    LSMRun &operator=(const LSMRun &other) = delete;
+
+    LSMRun &operator=(LSMRun &&temp) = delete;
+
+    // writing a new run: begin, append each entry in order, then finish
+    void begin(u_long expected_entries);
+
+    void append(const LSMEntry &entry);
+
+    void finish();
+
+    // how the index's manifest keeps track of the run
+    std::string marshal() const;
+
+    static LSMRun *unmarshal(Identifier name, const char *bytes);  // and open it (freed by caller)
+
+    void drop();
+
+    bool may_contain(const NormalizedKey &key) const;
+
+    void find(const NormalizedKey &key, LSMEntries &entries) const;  // append the entries with the given key
+
+    void get_block(BlockID block_id, LSMEntries &entries) const;  // append the entries of a data block
+
+    uint get_id() const { return this->id; }
+
+    uint get_level() const { return this->level; }
+
+    u_long get_entry_count() const { return this->entry_count; }
+
+    BlockID get_data_blocks() const { return this->data_blocks; }
+
+protected:
+    uint id;
+    uint level;
+    mutable HeapFile file;
+    mutable std::mutex latch;  // the file reads each block into the same buffer
+    bool is_open;
+    u_long entry_count;
+    BlockID data_blocks;
+    BlockID fence_blocks;
+    BlockID bloom_blocks;
+    NormalizedKeys fences;
+    BloomFilter bloom;
+    std::string pending;  // while writing, the entries of the data block being filled
+
+    void scan_block(BlockID block_id, const NormalizedKey *key, LSMEntries &entries) const;  // key of nullptr: all
+
+    void add_block(const std::string &bytes);
+
+    BlockID write_bytes(const std::string &bytes);  // in as many blocks as it takes, returning how many
+
+    std::string read_bytes(BlockID first, BlockID count);
+};
+
+/**
+ * @class LSMIndex - log-structured merge index (equality lookups only), for tables that are written more than read
+ *
+ * Changes go into the memtable, an in-memory map from (key, handle) to whether the entry is live, and are appended
+ * to the log file so they can be replayed if the index is reopened before they are flushed. When the memtable fills
+ * up it is written out as a new run at level 0. A background thread compacts the runs: once level 0 has
+ * LEVEL0_RUNS runs they are all merged with the run at level 1, and when the run at level i (there is at most one
+ * for each level after 0) outgrows its capacity it is merged into level i + 1. A merge keeps just the newest entry
+ * for each (key, handle), and drops tombstones when there is nothing older below for them to hide. A lookup checks
+ * the memtable and then each run from newest to oldest, the first entry for a handle deciding whether it's there.
+ * In a unique index every insert first looks for a live entry with its key, under the exclusive latch: it reads the
+ * memtable and the runs whose Bloom filters may have the key in that same order, but stops at the first live entry
+ * it finds. So an insert of a new key still reads the blocks of each run that gives a false positive, which inserts
+ * into a non-unique index never do.
+ * Block 1 of the manifest file has the next run id and each run's statistics, newest first.
+ */
+class LSMIndex : public DbIndex {
+    friend bool test_lsm_index();
+
+public:
+    static const u_long MEMTABLE_ENTRIES = 4096;  // entries the memtable holds before it is flushed into a run
+    static const uint LEVEL0_RUNS = 4;  // flushed runs at level 0 that get compacted together into level 1
+    static const uint STALL_RUNS = 12;  // runs at level 0 past which changes wait for compaction to catch up
+    static const uint FANOUT = 10;  // how many times bigger each level after 1 can get than the one before
+
+    LSMIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~LSMIndex();
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    virtual void del(Handle handle);
+
+    virtual void del(Handle handle, const ValueDict *row);
+
+    virtual void relocate(Handle from, Handle to);
+
+    // pull out the key values from the ValueDict in order, normalized (freed by caller)
+    virtual NormalizedKey *tkey(const ValueDict *key) const;
+
+    // flush the memtable and wait until the background compaction has nothing left to do
+    void settle();
+
+    uint get_run_count(uint level) const;
+
+    static u_long level_capacity(uint level);  // entries the run at a level (1 or more) can have before it's merged
+
+protected:
+    typedef std::map<KeyHandle, bool> Memtable;
+
+    mutable BTreeLatch latch;  // shared for lookups, exclusive for changes to the memtable or the list of runs
+    bool closed;
+    HeapFile manifest;
+    HeapFile log;
+    KeyProfile key_profile;
+    Memtable memtable;
+    std::vector<LSMRun *> runs;  // newest first: level 0 from newest to oldest, then levels 1, 2, ...
+    uint next_run_id;
+
+    std::thread compactor;
+    std::mutex compaction_latch;  // for the rest of these (and taken after latch, never before)
+    std::condition_variable work;  // there may be something to compact, or it's time to stop
+    std::condition_variable progress;  // a compaction finished (or there was nothing to do)
+    std::atomic<bool> stopping;
+    bool pending;
+    bool compacting;
+    uint level0_runs;
+
+    void build_key_profile();
+
+    // tkey of row, or of the row in the relation with the given handle if row is nullptr (freed by caller)
+    NormalizedKey *row_key(Handle handle, const ValueDict *row = nullptr);
+
+    void find(const NormalizedKey &key, Handles &handles) const;  // (with the latch held)
+
+    bool has_live(const NormalizedKey &key) const;  // (ditto)
+
+    void change(const NormalizedKey &key, Handle handle, bool live);  // (with the latch held exclusively)
+
+    void flush();  // (ditto)
+
+    LSMRun *new_run(uint level);  // (ditto)
+
+    void save_manifest();
+
+    void load_manifest();
+
+    void clear_log();
+
+    void replay_log();
+
+    void stall();
+
+    void start_compactor();
+
+    void stop_compactor();
+
+    void compact_loop();
+
+    void runs_changed();  // (with the latch held exclusively) let the compactor and stalled changes know
+
+    bool compact_step();
+
+    bool pick(std::vector<LSMRun *> &inputs, uint &level, bool &bottom) const;
+
+    bool merge(const std::vector<LSMRun *> &inputs, LSMRun *output, bool bottom);
+};
+
+bool test_lsm_index();
@@ -0,0 +1,670 @@
+/**
+ * @file LearnedIndex.cpp - implementation of LearnedIndex
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include "LearnedIndex.h"
+#include "btree.h"
+
+static const u_long ENTRY_SIZE = sizeof(int32_t) + sizeof(BlockID) + sizeof(RecordID);
+
+// The key and then the handle.
+static void marshal_entry(const LearnedEntry &entry, std::string &bytes) {
+    bytes.append((char *) &entry.first, sizeof(int32_t));
+    bytes.append((char *) &entry.second.first, sizeof(BlockID));
+    bytes.append((char *) &entry.second.second, sizeof(RecordID));
+}
+
+static LearnedEntry unmarshal_entry(const char *bytes) {
+    return LearnedEntry(*(int32_t *) bytes, Handle(*(BlockID *) (bytes + sizeof(int32_t)),
+                                                   *(RecordID *) (bytes + sizeof(int32_t) + sizeof(BlockID))));
+}
+
+LearnedIndex::LearnedIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique), latch(), closed(true),
+          file(relation.get_table_name() + "-" + name), delta_file(relation.get_table_name() + "-" + name + "-delta"),
+          keys(), handles(), segments(), delta() {
+}
+
+// Create the index by bulk loading the rows already in the table.
+void LearnedIndex::create() {
+    bool is_int = false;
+    const ColumnNames &column_names = relation.get_column_names();
+    ColumnAttributes column_attributes = relation.get_column_attributes();
+    for (uint i = 0; key_columns.size() == 1 && i < column_names.size(); i++)
+        if (column_names[i] == key_columns[0])
+            is_int = column_attributes[i].get_data_type() == ColumnAttribute::INT;
+    if (!is_int)
+        throw DbRelationError("a learned index needs a single INT key column");
+    file.create();
+    delta_file.create();
+    closed = false;
+    try {
+        LearnedEntries entries;
+        BlockID block_count = relation.get_block_count();
+        for (BlockID block_id = 1; block_id <= block_count; block_id++) {
+            Handles block_handles;
+            ValueDicts *rows = project_block(block_id, block_handles);
+            for (uint i = 0; i < rows->size(); i++) {
+                entries.push_back(LearnedEntry(key_of((*rows)[i], key_columns[0]), block_handles[i]));
+                delete (*rows)[i];
+            }
+            delete rows;
+        }
+        std::sort(entries.begin(), entries.end());
+        for (u_long i = 1; this->unique && i < entries.size(); i++)
+            if (entries[i].first == entries[i - 1].first)
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+        load(entries);
+        save();
+    } catch (...) {
+        drop();
+        throw;
+    }
+}
+
+// Drop the index.
+void LearnedIndex::drop() {
+    file.drop();
+    delta_file.drop();
+    load(LearnedEntries());
+    delta.clear();
+    closed = true;
+}
+
+// Open existing index: read in the array, train the model on it, and put the delta back together. Enables: lookup,
+// range, insert, delete, relocate.
+void LearnedIndex::open() {
+    if (closed) {
+        file.open();
+        delta_file.open();
+        read();
+        replay_delta_file();
+        closed = false;
+    }
+}
+
+// Closes the index (the delta is already in the delta file). Disables: lookup, range, insert, delete, relocate.
+void LearnedIndex::close() {
+    if (!closed) {
+        file.close();
+        delta_file.close();
+        load(LearnedEntries());
+        delta.clear();
+        closed = true;
+    }
+}
+
+// Find all the rows whose key column is equal to key.
+Handles *LearnedIndex::lookup(ValueDict *key_dict) const {
+    int32_t key = key_of(key_dict, key_columns[0]);
+    Handles *found = new Handles;
+    BTreeLatch::Shared shared(this->latch);
+    find(key, key, *found);
+    return found;
+}
+
+// Find all the rows whose key column is between min_key and max_key (inclusive), in key order.
+Handles *LearnedIndex::range(ValueDict *min_key, ValueDict *max_key) const {
+    int32_t min = min_key == nullptr ? std::numeric_limits<int32_t>::min() : key_of(min_key, key_columns[0]);
+    int32_t max = max_key == nullptr ? std::numeric_limits<int32_t>::max() : key_of(max_key, key_columns[0]);
+    Handles *found = new Handles;
+    BTreeLatch::Shared shared(this->latch);
+    if (min <= max)
+        find(min, max, *found);
+    return found;
+}
+
+// Insert a row with the given handle. Row must exist in relation already.
+void LearnedIndex::insert(Handle handle) {
+    insert(handle, nullptr);
+}
+
+// Insert a row with the given handle and values (or, with row of nullptr, the values it has in the relation).
+void LearnedIndex::insert(Handle handle, const ValueDict *row) {
+    open();
+    int32_t key = row_key(handle, row);
+    BTreeLatch::Exclusive exclusive(this->latch);
+    if (this->unique) {
+        Handles found;
+        find(key, key, found);
+        if (!found.empty())
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+    }
+    change(key, handle, true);
+}
+
+// Delete the index entry for the row with the given handle. Row must still be in relation.
+void LearnedIndex::del(Handle handle) {
+    del(handle, nullptr);
+}
+
+// Delete the index entry for the row with the given handle and values (or, with row of nullptr, the values it has
+// in the relation).
+void LearnedIndex::del(Handle handle, const ValueDict *row) {
+    open();
+    int32_t key = row_key(handle, row);
+    BTreeLatch::Exclusive exclusive(this->latch);
+    change(key, handle, false);
+}
+
+// The row that used to be at from is now at to.
+void LearnedIndex::relocate(Handle from, Handle to) {
+    open();
+    int32_t key = row_key(to);
+    BTreeLatch::Exclusive exclusive(this->latch);
+    change(key, from, false);
+    change(key, to, true);
+}
+
+void LearnedIndex::rebuild() {
+    open();
+    BTreeLatch::Exclusive exclusive(this->latch);
+    merge();
+}
+
+u_long LearnedIndex::get_memory_bytes() const {
+    BTreeLatch::Shared shared(this->latch);
+    const u_long node_links = 4 * sizeof(void *);  // a map's node has its parent, children, and color, too
+    return keys.capacity() * sizeof(int32_t) + handles.capacity() * sizeof(Handle)
+           + segments.capacity() * sizeof(Segment) + delta.size() * (sizeof(Delta::value_type) + node_links);
+}
+
+// Greedily make each segment as long as it can be: a segment starts at a key (and that key's first position) and
+// keeps the range of slopes that put every key after it so far within MAX_ERROR of its first position, taking in
+// keys until that range would be empty, and then takes the middle of the range.
+void LearnedIndex::train(const std::vector<int32_t> &keys, Segments &segments) {
+    segments.clear();
+    u_long i = 0, n = keys.size();
+    while (i < n) {
+        int32_t first_key = keys[i];
+        u_long first = i;
+        double low = -std::numeric_limits<double>::infinity(), high = std::numeric_limits<double>::infinity();
+        while (i < n && keys[i] == first_key)
+            i++;
+        while (i < n) {
+            double dx = (double) keys[i] - first_key, dy = (double) (i - first);
+            double new_low = std::max(low, (dy - MAX_ERROR) / dx), new_high = std::min(high, (dy + MAX_ERROR) / dx);
+            if (new_low > new_high)
+                break;
+            low = new_low;
+            high = new_high;
+            int32_t key = keys[i];
+            while (i < n && keys[i] == key)
+                i++;
+        }
+        double slope = std::isinf(low) ? 0.0 : (low + high) / 2;
+        segments.push_back(Segment(first_key, (uint32_t) first, slope));
+    }
+}
+
+// The last segment starting at or before key (or the first segment, for a key before them all).
+double LearnedIndex::predict(const Segments &segments, int32_t key) {
+    auto segment = std::upper_bound(segments.begin(), segments.end(), key,
+                                    [](int32_t k, const Segment &s) { return k < s.first_key; });
+    if (segment != segments.begin())
+        segment--;
+    return segment->first + segment->slope * ((double) key - segment->first_key);
+}
+
+// The key column's value in the given row, or in the row with the given handle, read from the relation.
+int32_t LearnedIndex::row_key(Handle handle, const ValueDict *row) {
+    if (row != nullptr)
+        return key_of(row, key_columns[0]);
+    ValueDict *projected = relation.project(handle);
+    int32_t key = key_of(projected, key_columns[0]);
+    delete projected;
+    return key;
+}
+
+int32_t LearnedIndex::key_of(const ValueDict *key_dict, const Identifier &column_name) {
+    auto column = key_dict->find(column_name);
+    if (column == key_dict->end())
+        throw DbRelationError("column '" + column_name + "' is not in the key");
+    return column->second.n;
+}
+
+// The segment's prediction, and then a binary search of the entries within MAX_ERROR of it. A key that isn't in
+// the array can be off by more than that (it's between two keys the model was trained on, or past the segment's
+// last one), so if the answer is at either edge of the window it's checked against the entry just outside.
+u_long LearnedIndex::lower_bound(int32_t key) const {
+    u_long n = keys.size();
+    if (n == 0)
+        return 0;
+    double predicted = std::min(std::max(predict(segments, key), 0.0), (double) n);
+    u_long low = (u_long) predicted > MAX_ERROR ? (u_long) predicted - MAX_ERROR : 0;
+    u_long high = std::min((u_long) std::ceil(predicted) + MAX_ERROR + 1, n);
+    auto begin = keys.begin();
+    u_long position = std::lower_bound(begin + low, begin + high, key) - begin;
+    if (position == high && high < n && keys[high] < key)
+        position = std::lower_bound(begin + high, keys.end(), key) - begin;
+    else if (position == low && low > 0 && keys[low - 1] >= key)
+        position = std::lower_bound(begin, begin + low, key) - begin;
+    return position;
+}
+
+bool LearnedIndex::contains(const LearnedEntry &entry) const {
+    u_long first = lower_bound(entry.first), last = first;
+    while (last < keys.size() && keys[last] == entry.first)
+        last++;
+    return std::binary_search(handles.begin() + first, handles.begin() + last, entry.second);
+}
+
+// The array's entries in the key range, less the ones the delta removes, merged with the ones the delta adds.
+void LearnedIndex::find(int32_t min_key, int32_t max_key, Handles &found) const {
+    auto change = delta.lower_bound(LearnedEntry(min_key, Handle(0, 0)));
+    for (u_long position = lower_bound(min_key); position < keys.size() && keys[position] <= max_key; position++) {
+        LearnedEntry entry(keys[position], handles[position]);
+        for (; change != delta.end() && change->first < entry; change++)
+            if (change->second)
+                found.push_back(change->first.second);
+        if (change != delta.end() && change->first == entry) {
+            change++;  // an entry in the array is only ever in the delta to be removed
+            continue;
+        }
+        found.push_back(entry.second);
+    }
+    for (; change != delta.end() && change->first.first <= max_key; change++)
+        if (change->second)
+            found.push_back(change->first.second);
+}
+
+// Append the change to the delta file and make it in the delta, merging the delta into the array once it's full.
+void LearnedIndex::change(int32_t key, Handle handle, bool live) {
+    LearnedEntry entry(key, handle);
+    std::string bytes;
+    marshal_entry(entry, bytes);
+    bytes.push_back(live ? 1 : 0);
+    Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+    SlottedPage *page = delta_file.get(delta_file.get_last_block_id());
+    try {
+        page->add(&dbt);
+    } catch (DbBlockNoRoomError &e) {
+        delete page;
+        page = delta_file.get_new();
+        page->add(&dbt);
+    }
+    delta_file.put(page);
+    delete page;
+    apply(entry, live);
+    if (delta.size() >= DELTA_ENTRIES)
+        merge();
+}
+
+// Whether the entry should be in the index: the delta only has it if that's not what the array says (so replaying
+// a change that's already been merged does nothing).
+void LearnedIndex::apply(const LearnedEntry &entry, bool live) {
+    if (contains(entry) == live)
+        delta.erase(entry);
+    else
+        delta[entry] = live;
+}
+
+void LearnedIndex::merge() {
+    LearnedEntries entries;
+    entries.reserve(keys.size() + delta.size());
+    auto change = delta.begin();
+    for (u_long position = 0; position < keys.size(); position++) {
+        LearnedEntry entry(keys[position], handles[position]);
+        for (; change != delta.end() && change->first < entry; change++)
+            if (change->second)
+                entries.push_back(change->first);
+        if (change != delta.end() && change->first == entry) {
+            change++;
+            continue;
+        }
+        entries.push_back(entry);
+    }
+    for (; change != delta.end(); change++)
+        if (change->second)
+            entries.push_back(change->first);
+    load(entries);
+    save();
+    delta.clear();
+}
+
+void LearnedIndex::load(const LearnedEntries &entries) {
+    std::vector<int32_t> new_keys;
+    Handles new_handles;
+    new_keys.reserve(entries.size());
+    new_handles.reserve(entries.size());
+    for (auto const &entry: entries) {
+        new_keys.push_back(entry.first);
+        new_handles.push_back(entry.second);
+    }
+    keys.swap(new_keys);
+    handles.swap(new_handles);
+    train(keys, segments);
+}
+
+// The array's entries packed into one record per block, from block 1 on.
+void LearnedIndex::save() {
+    file.truncate(1);
+    SlottedPage *page = file.get(1);
+    page->clear();
+    const u_long per_block = CAPACITY / ENTRY_SIZE;
+    for (u_long start = 0; start < keys.size(); start += per_block) {
+        std::string bytes;
+        for (u_long position = start; position < std::min(start + per_block, (u_long) keys.size()); position++)
+            marshal_entry(LearnedEntry(keys[position], handles[position]), bytes);
+        if (start > 0) {
+            file.put(page);
+            delete page;
+            page = file.get_new();
+        }
+        Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+        page->add(&dbt);
+    }
+    file.put(page);
+    delete page;
+    clear_delta_file();
+}
+
+void LearnedIndex::read() {
+    LearnedEntries entries;
+    for (BlockID block_id = 1; block_id <= file.get_last_block_id(); block_id++) {
+        SlottedPage *page = file.get(block_id);
+        RecordIDs *ids = page->ids();
+        for (auto const &record_id: *ids) {
+            Dbt *dbt = page->get(record_id);
+            for (u_long offset = 0; offset < dbt->get_size(); offset += ENTRY_SIZE)
+                entries.push_back(unmarshal_entry((char *) dbt->get_data() + offset));
+            delete dbt;
+        }
+        delete ids;
+        delete page;
+    }
+    load(entries);
+}
+
+void LearnedIndex::clear_delta_file() {
+    delta_file.truncate(1);
+    SlottedPage *page = delta_file.get(1);
+    page->clear();
+    delta_file.put(page);
+    delete page;
+}
+
+// Put the changes in the delta file (the ones made since the array was last written) back into the delta.
+void LearnedIndex::replay_delta_file() {
+    delta.clear();
+    for (BlockID block_id = 1; block_id <= delta_file.get_last_block_id(); block_id++) {
+        SlottedPage *page = delta_file.get(block_id);
+        RecordIDs *ids = page->ids();
+        for (auto const &record_id: *ids) {
+            Dbt *dbt = page->get(record_id);
+            const char *bytes = (char *) dbt->get_data();
+            apply(unmarshal_entry(bytes), bytes[ENTRY_SIZE] != 0);
+            delete dbt;
+        }
+        delete ids;
+        delete page;
+    }
+}
+
+// Train a model of keys and check it: every key's first position is within MAX_ERROR of where the model puts it,
+// and every segment but the last covers more than MAX_ERROR positions (as taking keys at a slope of 0 always can).
+// Returns how many segments it took, or 0 if the model is wrong.
+static u_long check_learned_model(const std::vector<int32_t> &keys, const char *what) {
+    LearnedIndex::Segments segments;
+    LearnedIndex::train(keys, segments);
+    for (u_long position = 0; position < keys.size(); position++) {
+        if (position > 0 && keys[position] == keys[position - 1])
+            continue;
+        double predicted = LearnedIndex::predict(segments, keys[position]);
+        if (std::fabs(predicted - (double) position) > LearnedIndex::MAX_ERROR + 1e-6) {
+            std::cout << "learned model of " << what << " keys put " << keys[position] << " at " << predicted
+                      << " instead of " << position << std::endl;
+            return 0;
+        }
+    }
+    for (u_long i = 0; i + 1 < segments.size(); i++)
+        if (segments[i + 1].first - segments[i].first <= LearnedIndex::MAX_ERROR) {
+            std::cout << "learned model of " << what << " keys has a segment of "
+                      << segments[i + 1].first - segments[i].first << " positions" << std::endl;
+            return 0;
+        }
+    return segments.size();
+}
+
+bool test_learned_index() {
+    // a steady step fits one segment however many keys there are, and each change of step takes one more
+    std::vector<int32_t> keys;
+    for (int32_t i = 0; i < 100000; i++)
+        keys.push_back(i * 3);
+    u_long segment_count = check_learned_model(keys, "steady");
+    if (segment_count != 1) {
+        std::cout << "learned model of steady keys has " << segment_count << " segments" << std::endl;
+        return false;
+    }
+    keys.clear();
+    int32_t key = 0;
+    for (int32_t step: {1, 1000, 7, 50})
+        for (int i = 0; i < 25000; i++, key += step)
+            keys.push_back(key);
+    segment_count = check_learned_model(keys, "stepped");
+    if (segment_count != 4) {
+        std::cout << "learned model of four steps has " << segment_count << " segments" << std::endl;
+        return false;
+    }
+
+    // skewed keys (growing quadratically, repeated at the start) and random keys with many repeats take more
+    // segments, but still keep every key within the bound
+    keys.clear();
+    for (int64_t i = 0; i < 100000; i++)
+        keys.push_back((int32_t) (i * i / 8));
+    segment_count = check_learned_model(keys, "skewed");
+    if (segment_count < 2) {
+        std::cout << "learned model of skewed keys has " << segment_count << " segments" << std::endl;
+        return false;
+    }
+    keys.clear();
+    std::mt19937 random(5300);
+    for (int i = 0; i < 100000; i++)
+        keys.push_back((int32_t) (random() % 50000));
+    std::sort(keys.begin(), keys.end());
+    segment_count = check_learned_model(keys, "random");
+    if (segment_count < 2) {
+        std::cout << "learned model of random keys has " << segment_count << " segments" << std::endl;
+        return false;
+    }
+
+    // an index on skewed keys finds every key in it by searching only the window around its prediction, and a key
+    // that isn't in it (at either end of each gap between keys) still where it would go, even past a run of repeats
+    // longer than the window or between segments
+    auto check_search = [](const LearnedIndex &index, const char *when) {
+        const std::vector<int32_t> &keys = index.keys;
+        for (u_long position = 0; position < keys.size(); position++) {
+            int32_t key = keys[position];
+            if (position > 0 && keys[position - 1] == key)
+                continue;
+            double predicted = LearnedIndex::predict(index.segments, key);
+            if (std::fabs(predicted - (double) position) > LearnedIndex::MAX_ERROR + 1e-6 ||
+                index.lower_bound(key) != position) {
+                std::cout << "learned index search " << when << " left the window for " << key << ": predicted "
+                          << predicted << ", at " << position << std::endl;
+                return false;
+            }
+            u_long next = std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+            if ((next == keys.size() || keys[next] > key + 1) && index.lower_bound(key + 1) != next) {
+                std::cout << "learned index search " << when << " misplaced " << key + 1 << std::endl;
+                return false;
+            }
+            if (next < keys.size() && keys[next] - 1 > key && index.lower_bound(keys[next] - 1) != next) {
+                std::cout << "learned index search " << when << " misplaced " << keys[next] - 1 << std::endl;
+                return false;
+            }
+        }
+        return true;
+    };
+    const int N = 10000, REPEATS = 100;
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_learned_index", column_names, column_attributes);
+    table.create();
+    Handles rows;
+    for (int64_t i = 0; i < N; i++) {
+        ValueDict row;
+        row["id"] = Value((int32_t) (i * i / 8));
+        row["b"] = Value("b");
+        rows.push_back(table.insert(&row));
+    }
+    for (int i = 0; i < REPEATS; i++) {
+        ValueDict row;
+        row["id"] = Value((int32_t) ((N - 1L) * (N - 1L) / 8));
+        row["b"] = Value("b");
+        table.insert(&row);
+    }
+    ColumnNames id_column, b_column;
+    id_column.push_back("id");
+    b_column.push_back("b");
+    LearnedIndex index(table, "learned_id", id_column, false);
+    index.create();
+    if (index.get_entry_count() != N + REPEATS || index.get_segment_count() < 2 ||
+        !check_search(index, "after create"))
+        return false;
+    try {
+        LearnedIndex text_index(table, "learned_b", b_column, false);
+        text_index.create();
+        std::cout << "learned index allowed a TEXT key" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+
+    // changes wait in the delta (which survives a reopen) and are seen by lookups, until rebuild merges them into
+    // the array and retrains the model
+    auto has = [&index](int32_t id, Handle handle) {
+        ValueDict lookup;
+        lookup["id"] = Value(id);
+        Handles *handles = index.lookup(&lookup);
+        bool found = std::find(handles->begin(), handles->end(), handle) != handles->end();
+        delete handles;
+        return found;
+    };
+    const int INSERTS = 100, DELETES = 10;
+    std::vector<std::pair<int32_t, Handle>> inserted, deleted;
+    for (int i = 0; i < INSERTS; i++) {
+        ValueDict row;
+        row["id"] = Value(20000000 + i * 3);
+        row["b"] = Value("new");
+        Handle handle = table.insert(&row);
+        index.insert(handle, &row);
+        inserted.push_back(std::make_pair(row["id"].n, handle));
+    }
+    for (int i = 0; i < DELETES; i++) {
+        Handle handle = rows[i * 997];
+        ValueDict *row = table.project(handle);
+        index.del(handle, row);
+        deleted.push_back(std::make_pair((*row)["id"].n, handle));
+        delete row;
+        table.del(handle);
+    }
+    index.close();
+    index.open();
+    if (index.get_delta_count() != INSERTS + DELETES || index.get_entry_count() != N + REPEATS) {
+        std::cout << "learned index delta has " << index.get_delta_count() << " changes and the array "
+                  << index.get_entry_count() << " entries after reopening" << std::endl;
+        return false;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (auto const &entry: inserted)
+            if (!has(entry.first, entry.second)) {
+                std::cout << "learned index lost insert of " << entry.first << " in pass " << pass << std::endl;
+                return false;
+            }
+        for (auto const &entry: deleted)
+            if (has(entry.first, entry.second)) {
+                std::cout << "learned index kept deleted " << entry.first << " in pass " << pass << std::endl;
+                return false;
+            }
+        if (pass == 0)
+            index.rebuild();
+    }
+    if (index.get_delta_count() != 0 || index.get_entry_count() != N + REPEATS + INSERTS - DELETES ||
+        check_learned_model(index.keys, "rebuilt") != index.get_segment_count() ||
+        !check_search(index, "after rebuild")) {
+        std::cout << "learned index rebuild didn't merge its delta: " << index.get_delta_count() << " changes left, "
+                  << index.get_entry_count() << " entries" << std::endl;
+        return false;
+    }
+
+    // and a delta that fills up is merged without being asked
+    for (u_long i = 0; i < LearnedIndex::DELTA_ENTRIES; i++) {
+        ValueDict row;
+        row["id"] = Value((int32_t) (30000000 + i));
+        row["b"] = Value("newer");
+        index.insert(table.insert(&row), &row);
+    }
+    if (index.get_delta_count() != 0 ||
+        index.get_entry_count() != N + REPEATS + INSERTS - DELETES + LearnedIndex::DELTA_ENTRIES ||
+        !check_search(index, "after a full delta")) {
+        std::cout << "learned index didn't merge a full delta: " << index.get_delta_count() << " changes left"
+                  << std::endl;
+        return false;
+    }
+    index.drop();
+    table.drop();
+    return true;
+}
+
+/**
+ * Time point lookups on a learned index against a B+tree on 500k near-sequential INT keys (a steady step with a
+ * little jitter), and compare what each takes: the learned index's memory and the B+tree's nodes.
+ */
+void bench_learned_index() {
+    const int N = 500000, LOOKUPS = 200000;
+    auto key_at = [](int i) { return 1000000 + i * 5 + i % 3; };
+    ColumnNames column_names;
+    column_names.push_back("a");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__bench_learned_index", column_names, column_attributes);
+    table.create();
+    for (int i = 0; i < N; i++) {
+        ValueDict row;
+        row["a"] = Value(key_at(i));
+        table.insert(&row);
+    }
+    BTreeIndex btree(table, "bench_btree", column_names, true);
+    LearnedIndex learned(table, "bench_learned", column_names, true);
+    btree.create();
+    learned.create();
+    for (DbIndex *index: {(DbIndex *) &btree, (DbIndex *) &learned}) {
+        double us = 0.0;
+        u_long found = 0;
+        for (int pass = 0; pass < 2; pass++) {  // (the first pass just warms up the B+tree's node cache)
+            auto start = std::chrono::steady_clock::now();
+            found = 0;
+            for (int i = 0; i < LOOKUPS; i++) {
+                ValueDict key;
+                key["a"] = Value(key_at((int) ((i * 104729L) % N)));
+                Handles *handles = index->lookup(&key);
+                found += handles->size();
+                delete handles;
+            }
+            us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+        std::cout << "  " << (index == &btree ? "btree:   " : "learned: ") << us / LOOKUPS << " us/lookup (" << found
+                  << " found)" << std::endl;
+    }
+    BTreeIndexStats stats = btree.get_stats();
+    std::cout << "  btree: height " << stats.height << ", " << stats.nodes << " nodes ("
+              << stats.nodes * DbBlock::BLOCK_SZ << " bytes)" << std::endl;
+    std::cout << "  learned: " << learned.get_segment_count() << " segments ("
+              << learned.get_segment_count() * sizeof(LearnedIndex::Segment) << " bytes of model), "
+              << learned.get_memory_bytes() << " bytes in memory" << std::endl;
+    btree.drop();
+    learned.drop();
+    table.drop();
+}
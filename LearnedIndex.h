@@ -0,0 +1,133 @@
+/**
+ * @file LearnedIndex.h - LearnedIndex, an index over a sorted array of INT keys that predicts where a key is
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include "BTreeNode.h"
+
+typedef std::pair<int32_t, Handle> LearnedEntry;
+typedef std::vector<LearnedEntry> LearnedEntries;
+
+/**
+ * @class LearnedIndex - read-optimized index for a single INT column, best for keys that grow steadily (ids,
+ * timestamps)
+ *
+ * The entries are kept in memory as a sorted array of keys (and a parallel array of handles), and instead of a
+ * tree above them there is a piecewise linear model of where each key's first entry is: each segment is a line
+ * through the keys from its first key up to the next segment's, within MAX_ERROR positions of the truth for every
+ * key it covers. A lookup picks the segment, predicts a position, and binary searches just the 2 * MAX_ERROR + 1
+ * entries around it. Keys that increase by a steady step need a single segment however many of them there are.
+ *
+ * The array is only rebuilt as a whole: when the index is created (or with rebuild), and when the delta, the
+ * in-memory buffer of inserts and deletes made since, gets to DELTA_ENTRIES changes. The delta file has a record for
+ * each change since the last rebuild so the delta can be put back together when the index is reopened; the
+ * array itself is in the index file, packed into as many blocks as it takes, and the model is retrained from it.
+ */
+class LearnedIndex : public DbIndex {
+public:
+    static const u_long MAX_ERROR = 16;  // how far (in entries) a prediction can be from the key's first entry
+    static const u_long DELTA_ENTRIES = 1024;  // changes buffered before they're merged into the array
+    static const u_long CAPACITY = DbBlock::BLOCK_SZ - 16;  // bytes of entries that fit in a block as its one record
+
+    /**
+     * @class Segment - one piece of the model: position = first + slope * (key - first_key)
+     */
+    struct Segment {
+        int32_t first_key;
+        uint32_t first;
+        double slope;
+
+        Segment(int32_t first_key, uint32_t first, double slope) : first_key(first_key), first(first), slope(slope) {}
+    };
+
+    typedef std::vector<Segment> Segments;
+
+    LearnedIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~LearnedIndex() {}
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key) const;
+
+    virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void insert(Handle handle, const ValueDict *row);
+
+    virtual void del(Handle handle);
+
+    virtual void del(Handle handle, const ValueDict *row);
+
+    virtual void relocate(Handle from, Handle to);
+
+    // merge the delta into the array, write it out, and retrain the model
+    void rebuild();
+
+    u_long get_entry_count() const { return this->keys.size(); }
+
+    u_long get_segment_count() const { return this->segments.size(); }
+
+    u_long get_delta_count() const { return this->delta.size(); }
+
+    u_long get_memory_bytes() const;  // of the array, the model, and the delta
+
+    // the segments covering the given sorted keys (the position of each being its index in keys)
+    static void train(const std::vector<int32_t> &keys, Segments &segments);
+
+    // where the segments put key's first entry (segments must not be empty)
+    static double predict(const Segments &segments, int32_t key);
+
+protected:
+    typedef std::map<LearnedEntry, bool> Delta;  // true for an entry to add, false for one in the array to remove
+
+    mutable BTreeLatch latch;  // shared for lookups, exclusive for changes
+    bool closed;
+    HeapFile file;
+    HeapFile delta_file;
+    std::vector<int32_t> keys;  // sorted, each key's entries in handle order
+    Handles handles;  // the handle of the entry at the same position in keys
+    Segments segments;  // in first_key order
+    Delta delta;
+
+    int32_t row_key(Handle handle, const ValueDict *row = nullptr);  // of row, or else of the row in the relation
+
+    static int32_t key_of(const ValueDict *key_dict, const Identifier &column_name);
+
+    u_long lower_bound(int32_t key) const;  // position of the first entry with a key of at least key
+
+    bool contains(const LearnedEntry &entry) const;  // in the array
+
+    void find(int32_t min_key, int32_t max_key, Handles &found) const;  // (with the latch held)
+
+    void change(int32_t key, Handle handle, bool live);  // (with the latch held exclusively)
+
+    void apply(const LearnedEntry &entry, bool live);  // (ditto) to the delta
+
+    void merge();  // (ditto) the delta into the array
+
+    void load(const LearnedEntries &entries);  // replace the array and retrain the model
+
+    void save();  // write the array out and clear the delta file
+
+    void read();
+
+    void clear_delta_file();
+
+    void replay_delta_file();
+
+    friend bool test_learned_index();
+};
+
+bool test_learned_index();
+void bench_learned_index();
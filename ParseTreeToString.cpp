@@ -136,7 +136,10 @@ string ParseTreeToString::expression(const Expr *expr) {
             ret += to_string(expr->ival);
             break;
         case kExprFunctionRef:
-            ret += string(expr->name) + "?" + expr->expr->name;
+            ret += string(expr->name == NULL ? "?" : expr->name) + "(";
+            if (expr->expr != NULL)
+                ret += expression(expr->expr);
+            ret += ")";
             break;
         case kExprOperator:
             ret += operator_expression(expr);
@@ -3,8 +3,10 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2021"
  */
+#include <strings.h>
 #include "SQLExec.h"
 #include "EvalPlan.h"
+#include "btree.h"
 
 using namespace std;
 using namespace hsql;
@@ -12,6 +14,7 @@ using namespace hsql;
 // define static data
 Tables *SQLExec::tables = nullptr;
 Indices *SQLExec::indices = nullptr;
+Statistics *SQLExec::statistics = nullptr;
 
 // make query result be printable
 ostream &operator<<(ostream &out, const QueryResult &qres) {
@@ -60,12 +63,20 @@ QueryResult::~QueryResult() {
 }
 
 
-QueryResult *SQLExec::execute(const SQLStatement *statement) {
-    // initialize _tables table, if not yet present
+void SQLExec::initialize() {
     if (SQLExec::tables == nullptr) {
         SQLExec::tables = new Tables();
         SQLExec::indices = new Indices();
+        SQLExec::statistics = new Statistics();
     }
+}
+
+void SQLExec::shutdown() {
+    Indices::close_all();
+}
+
+QueryResult *SQLExec::execute(const SQLStatement *statement) {
+    initialize();
 
     try {
         switch (statement->type()) {
@@ -89,6 +100,33 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) {
     }
 }
 
+QueryResult *SQLExec::execute(const ExtendedStatement *statement) {
+    initialize();
+
+    try {
+        switch (statement->type) {
+            case ExtendedStatement::kAddBloomFilter:
+                return add_bloom_filter(statement);
+            case ExtendedStatement::kCreateIndex:
+                return create_index(statement);
+            case ExtendedStatement::kAnalyze:
+                return analyze(statement);
+            case ExtendedStatement::kVacuum:
+                return vacuum(statement);
+            case ExtendedStatement::kReindex:
+                return reindex(statement);
+            case ExtendedStatement::kShowIndexStats:
+                return show_index_stats(statement);
+            default:
+                return new QueryResult("not implemented");
+        }
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
 ValueDict* SQLExec::get_where_conjunction(const hsql::Expr *expr, const ColumnNames *col_names) {
     if(expr->type != kExprOperator)
         throw DbRelationError("Operator is not supported");
@@ -124,6 +162,22 @@ ValueDict* SQLExec::get_where_conjunction(const hsql::Expr *expr, const ColumnNa
     return rows;
 }
 
+DbIndexes SQLExec::get_lookup_indices(Identifier table_name) {
+    DbIndexes ret;
+    for (auto const &index_name: SQLExec::indices->get_index_names(table_name)) {
+        DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+        index.open();  // (if this is the first use of it since we started)
+        ret.push_back(&index);
+    }
+    return ret;
+}
+
+ColumnStatisticsList SQLExec::get_lookup_statistics(Identifier table_name, const DbIndexes &indexes) {
+    if (indexes.size() < 2)
+        return ColumnStatisticsList();  // nothing to choose between, so don't bother reading them
+    return SQLExec::statistics->get_statistics(table_name);
+}
+
 
 QueryResult *SQLExec::insert(const InsertStatement *statement) {
     Identifier tbn = statement->tableName;
@@ -164,9 +218,25 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
     
     Handle insert_handle = table.insert(&row);
     IndexNames idxn = SQLExec::indices->get_index_names(tbn);
-    for(Identifier name : idxn){
-        DbIndex& index = SQLExec::indices->get_index(tbn, name);
-        index.insert(insert_handle);
+    size_t indexed = 0;
+    try {
+        for (Identifier name : idxn) {
+            DbIndex& index = SQLExec::indices->get_index(tbn, name);
+            if (index.matches(&row))  // (a partial index only has the rows its predicate matches)
+                index.insert(insert_handle, &row);  // (the row's values are in hand, so no need to read it back)
+            indexed++;
+        }
+    } catch (...) {
+        // e.g., a duplicate key in a unique index, so take the row back out
+        try {
+            for (size_t i = 0; i < indexed; i++) {
+                DbIndex &index = SQLExec::indices->get_index(tbn, idxn[i]);
+                if (index.matches(&row))
+                    index.del(insert_handle, &row);
+            }
+            table.del(insert_handle);
+        } catch (...) {}
+        throw;
     }
     
     return new QueryResult("Successfully inserted 1 row into " + tbn + " and " + to_string(idxn.size()) + " indices");
@@ -201,7 +271,8 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
     }
     
     // pipeline results, which is a handle iterator
-    EvalPlan *optimized = plan->optimize();
+    DbIndexes indexes = get_lookup_indices(table_name);
+    EvalPlan *optimized = plan->optimize(indexes, get_lookup_statistics(table_name, indexes));
     EvalPipeline pipeline = optimized->pipeline();
     Handles *handles = pipeline.second;
     
@@ -210,13 +281,17 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
     size_t index_size = index_names.size();
     size_t handle_size = handles->size();
     
-    // delete from indices
-    for (auto const& handle : *handles) {
-        for (auto const& index : index_names) {
-            DbIndex &index_handle = indices->get_index(table_name, index);
-            index_handle.del(handle);
+    // delete from indices, reading each row once for all of them
+    if (index_size > 0) {
+        for (auto const& handle : *handles) {
+            ValueDict *row = table.project(handle);
+            for (auto const& index : index_names) {
+                DbIndex &index_handle = indices->get_index(table_name, index);
+                if (index_handle.matches(row))
+                    index_handle.del(handle, row);
+            }
+            delete row;
         }
-        table.del(handle);
     }
     
     // delete from table
@@ -248,6 +323,35 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
     if(statement->whereClause != nullptr)
         plan = new EvalPlan(get_where_conjunction(statement->whereClause, &cns), plan);
     
+    // COUNT(*) is the one aggregate we know (and COUNT(<column>) is the same thing since there are no NULLs)
+    const Expr *first = statement->selectList->front();
+    if (first->type == kExprFunctionRef && first->name != nullptr && strcasecmp(first->name, "count") == 0) {
+        if (statement->selectList->size() != 1)
+            throw SQLExecError("can't mix COUNT with other columns without GROUP BY");
+        if (first->expr != nullptr && first->expr->type == kExprColumnRef
+            && find(cns.begin(), cns.end(), first->expr->name) == cns.end())
+            throw DbRelationError("unknown column '" + string(first->expr->name) + "'");
+        u_long n;
+        if (statement->whereClause == nullptr) {
+            n = table.count();  // kept by the table, so no scan
+        } else {
+            DbIndexes indexes = get_lookup_indices(table_name);
+            EvalPlan *optimized = plan->optimize(indexes, get_lookup_statistics(table_name, indexes));
+            EvalPipeline pipeline = optimized->pipeline();
+            n = pipeline.second->size();
+            delete pipeline.second;
+        }
+        ColumnNames *column_names = new ColumnNames;
+        ColumnAttributes *column_attributes = new ColumnAttributes;
+        column_names->push_back("count");
+        column_attributes->push_back(ColumnAttribute(ColumnAttribute::INT));
+        ValueDicts *rows = new ValueDicts;
+        ValueDict *row = new ValueDict;
+        (*row)["count"] = Value((int32_t) n);
+        rows->push_back(row);
+        return new QueryResult(column_names, column_attributes, rows, "successfully returned 1 rows");
+    }
+
     ColumnNames* column_names = new ColumnNames;
     ColumnAttributes * column_attributes = new ColumnAttributes;
         
@@ -273,7 +377,8 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
     }
     
     //optimize the plan and evaluate the optimized plan
-    EvalPlan *optimized = plan->optimize();
+    DbIndexes indexes = get_lookup_indices(table_name);
+    EvalPlan *optimized = plan->optimize(indexes, get_lookup_statistics(table_name, indexes));
     ValueDicts *rows = optimized->evaluate();
     size_t n = rows->size();
     
@@ -362,33 +467,69 @@ QueryResult *SQLExec::create_table(const CreateStatement *statement) {
     return new QueryResult("created " + table_name);
 }
 
+// CREATE INDEX (duplicate keys are allowed; see CREATE UNIQUE INDEX for the other kind)
 QueryResult *SQLExec::create_index(const CreateStatement *statement) {
-    Identifier index_name = statement->indexName;
-    Identifier table_name = statement->tableName;
+    ColumnNames column_names;
+    for (auto const &col_name: *statement->indexColumns)
+        column_names.push_back(col_name);
+    return create_index(statement->tableName, statement->indexName, statement->indexType, column_names, false);
+}
+
+// CREATE UNIQUE INDEX, or CREATE INDEX ... INCLUDE, or CREATE INDEX ... WHERE
+QueryResult *SQLExec::create_index(const ExtendedStatement *statement) {
+    return create_index(statement->table_name, statement->index_name, statement->index_type, statement->column_names,
+                        statement->unique, statement->include_names, statement->predicate);
+}
 
+QueryResult *SQLExec::create_index(Identifier table_name, Identifier index_name, string index_type,
+                                   const ColumnNames &column_names, bool unique, const ColumnNames &include_names,
+                                   const ValueDict &predicate) {
     // get underlying relation
     DbRelation &table = SQLExec::tables->get_table(table_name);
 
     // check that given columns exist in table
     const ColumnNames &table_columns = table.get_column_names();
-    for (auto const &col_name: *statement->indexColumns)
+    for (auto const &col_name: column_names)
+        if (find(table_columns.begin(), table_columns.end(), col_name) == table_columns.end())
+            throw SQLExecError(string("Column '") + col_name + "' does not exist in " + table_name);
+    for (auto const &col_name: include_names) {
         if (find(table_columns.begin(), table_columns.end(), col_name) == table_columns.end())
             throw SQLExecError(string("Column '") + col_name + "' does not exist in " + table_name);
+        if (find(column_names.begin(), column_names.end(), col_name) != column_names.end())
+            throw SQLExecError(string("Column '") + col_name + "' is already a key column of " + index_name);
+    }
+    if (!include_names.empty() && index_type != "BTREE")
+        throw SQLExecError("only BTREE indices can INCLUDE columns");
+    for (auto const &term: predicate) {
+        auto column = find(table_columns.begin(), table_columns.end(), term.first);
+        if (column == table_columns.end())
+            throw SQLExecError(string("Column '") + term.first + "' does not exist in " + table_name);
+        ColumnAttributes column_attributes = table.get_column_attributes();
+        if (column_attributes[column - table_columns.begin()].get_data_type() != term.second.data_type)
+            throw SQLExecError(string("Column '") + term.first + "' can't be compared with that value");
+    }
 
     // insert a row for every column in index into _indices
     ValueDict row;
     row["table_name"] = Value(table_name);
     row["index_name"] = Value(index_name);
-    row["index_type"] = Value(statement->indexType);
-    row["is_unique"] = Value(string(statement->indexType) == "BTREE"); // assume HASH is non-unique --
+    row["index_type"] = Value(index_type);
+    row["is_unique"] = Value(unique);
+    row["predicate"] = Value(ExtendedStatement::predicate_to_string(predicate));
     int seq = 0;
     Handles i_handles;
     try {
-        for (auto const &col_name: *statement->indexColumns) {
+        for (auto const &col_name: column_names) {
             row["seq_in_index"] = Value(++seq);
             row["column_name"] = Value(col_name);
             i_handles.push_back(SQLExec::indices->insert(&row));
         }
+        seq = 0;
+        for (auto const &col_name: include_names) {
+            row["seq_in_index"] = Value(--seq);  // included columns count down from -1
+            row["column_name"] = Value(col_name);
+            i_handles.push_back(SQLExec::indices->insert(&row));
+        }
 
         DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
         index.create();
@@ -418,7 +559,7 @@ QueryResult *SQLExec::drop(const DropStatement *statement) {
 
 QueryResult *SQLExec::drop_table(const DropStatement *statement) {
     Identifier table_name = statement->name;
-    if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME)
+    if (Tables::is_schema_table(table_name))
         throw SQLExecError("cannot drop a schema table");
 
     ValueDict where;
@@ -444,6 +585,9 @@ QueryResult *SQLExec::drop_table(const DropStatement *statement) {
         columns.del(handle);
     delete handles;
 
+    // remove from _statistics
+    SQLExec::statistics->drop_statistics(table_name);
+
     // remove table
     table.drop();
 
@@ -510,6 +654,9 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) {
     column_names->push_back("is_unique");
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
 
+    column_names->push_back("predicate");
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+
     ValueDict where;
     where["table_name"] = Value(string(statement->tableName));
     Handles *handles = SQLExec::indices->select(&where);
@@ -532,18 +679,18 @@ QueryResult *SQLExec::show_tables() {
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
 
     Handles *handles = SQLExec::tables->select();
-    u_long n = handles->size() - 3;
 
     ValueDicts *rows = new ValueDicts;
     for (auto const &handle: *handles) {
         ValueDict *row = SQLExec::tables->project(handle, column_names);
         Identifier table_name = row->at("table_name").s;
-        if (table_name != Tables::TABLE_NAME && table_name != Columns::TABLE_NAME && table_name != Indices::TABLE_NAME)
+        if (!Tables::is_schema_table(table_name))
             rows->push_back(row);
         else
             delete row;
     }
     delete handles;
+    u_long n = rows->size();
     return new QueryResult(column_names, column_attributes, rows, "successfully returned " + to_string(n) + " rows");
 }
 
@@ -572,3 +719,156 @@ QueryResult *SQLExec::show_columns(const ShowStatement *statement) {
     return new QueryResult(column_names, column_attributes, rows, "successfully returned " + to_string(n) + " rows");
 }
 
+// ALTER TABLE ... ADD BLOOM FILTER ...
+QueryResult *SQLExec::add_bloom_filter(const ExtendedStatement *statement) {
+    Identifier table_name = statement->table_name;
+    if (Tables::is_schema_table(table_name))
+        throw SQLExecError("cannot alter a schema table");
+
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    table.create_bloom_filter(statement->column_names, statement->false_positive_rate);
+    return new QueryResult("created bloom filter on " + table_name);
+}
+
+// ANALYZE ...
+QueryResult *SQLExec::analyze(const ExtendedStatement *statement) {
+    Identifier table_name = statement->table_name;
+    if (Tables::is_schema_table(table_name))
+        throw SQLExecError("cannot analyze a schema table");
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    BlockID blocks_read;
+    ColumnStatisticsList statistics = SQLExec::statistics->analyze(table, statement->full, blocks_read);
+
+    ColumnNames *column_names = new ColumnNames;
+    ColumnAttributes *column_attributes = new ColumnAttributes;
+    column_names->push_back("column_name");
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_names->push_back("ndv");
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_names->push_back("histogram");
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_names->push_back("mcv");
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+
+    ValueDicts *rows = new ValueDicts;
+    for (auto const &stats: statistics) {
+        ValueDict *row = new ValueDict;
+        (*row)["column_name"] = Value(stats.column_name);
+        (*row)["ndv"] = Value((int32_t) stats.ndv);
+        (*row)["histogram"] = Value(stats.histogram_to_string());
+        (*row)["mcv"] = Value(stats.mcv_to_string());
+        rows->push_back(row);
+    }
+    u_long row_count = statistics.empty() ? 0 : statistics[0].row_count;
+    BlockID blocks = statistics.empty() ? 0 : statistics[0].analyzed_blocks;
+    return new QueryResult(column_names, column_attributes, rows,
+                           "analyzed " + table_name + ": " + to_string(row_count) + " rows, read " +
+                           to_string(blocks_read) + " of " + to_string(blocks) + " blocks");
+}
+
+// VACUUM ...
+QueryResult *SQLExec::vacuum(const ExtendedStatement *statement) {
+    Identifier table_name = statement->table_name;
+    if (Tables::is_schema_table(table_name))
+        throw SQLExecError("cannot vacuum a schema table");
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    BlockID blocks_before = table.get_block_count();
+    HandleMoves moves;
+    u_long reclaimed = table.vacuum(moves);
+    BlockID blocks_after = table.get_block_count();
+
+    // point the index entries at the rows' new homes
+    IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+    for (auto const &index_name: index_names) {
+        DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+        for (auto const &move: moves) {
+            if (!index.get_predicate().empty()) {  // a partial index only has some of the rows
+                ValueDict *row = table.project(move.second);
+                bool matches = index.matches(row);
+                delete row;
+                if (!matches)
+                    continue;
+            }
+            index.relocate(move.first, move.second);
+        }
+    }
+
+    return new QueryResult("vacuumed " + table_name + ": moved " + to_string(moves.size()) + " rows, " +
+                           to_string(blocks_before) + " blocks before, " + to_string(blocks_after) + " after, " +
+                           to_string(reclaimed) + " bytes reclaimed");
+}
+
+// REINDEX ...: rebuild the table's BTREE indices from scratch (packed to the fill factor again), all from one scan
+QueryResult *SQLExec::reindex(const ExtendedStatement *statement) {
+    Identifier table_name = statement->table_name;
+    if (Tables::is_schema_table(table_name))
+        throw SQLExecError("cannot reindex a schema table");
+    SQLExec::tables->get_table(table_name).open();  // (throws if there is no such table)
+    std::vector<BTreeIndex *> btrees;
+    for (auto const &index_name: SQLExec::indices->get_index_names(table_name)) {
+        BTreeIndex *btree = dynamic_cast<BTreeIndex *>(&SQLExec::indices->get_index(table_name, index_name));
+        if (btree != nullptr)
+            btrees.push_back(btree);
+    }
+    if (btrees.empty())
+        return new QueryResult(table_name + " has no BTREE indices to reindex");
+    for (auto const &btree: btrees) {
+        try {
+            btree->open();
+        } catch (DbRelationError &e) {
+            // (in an old format -- it's being rebuilt anyway)
+        }
+        btree->drop();
+    }
+    BTreeIndex::create_all(btrees);
+    return new QueryResult("reindexed " + to_string(btrees.size()) + " indices on " + table_name);
+}
+
+// SHOW INDEX STATS FROM ...: the BTREE indices' shape and counters, a row (or a JSON line in the message) apiece
+QueryResult *SQLExec::show_index_stats(const ExtendedStatement *statement) {
+    Identifier table_name = statement->table_name;
+    std::vector<BTreeIndexStats> all_stats;
+    for (auto const &index_name: SQLExec::indices->get_index_names(table_name)) {
+        BTreeIndex *btree = dynamic_cast<BTreeIndex *>(&SQLExec::indices->get_index(table_name, index_name));
+        if (btree != nullptr) {
+            btree->open();
+            all_stats.push_back(btree->get_stats());
+        }
+    }
+    if (statement->json) {
+        string message;
+        for (auto const &stats: all_stats)
+            message += stats.to_json() + "\n";
+        return new QueryResult(message + "successfully returned " + to_string(all_stats.size()) + " indices");
+    }
+
+    ColumnNames *column_names = new ColumnNames;
+    ColumnAttributes *column_attributes = new ColumnAttributes;
+    column_names->push_back("index_name");
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    const char *counts[] = {"height", "nodes", "leaves", "fill_percent", "key_bytes", "lookups", "scans", "splits",
+                            "merges", "cache_hits", "cache_misses"};
+    for (auto const &count: counts) {
+        column_names->push_back(count);
+        column_attributes->push_back(ColumnAttribute(ColumnAttribute::INT));
+    }
+    ValueDicts *rows = new ValueDicts;
+    for (auto const &stats: all_stats) {
+        ValueDict *row = new ValueDict;
+        (*row)["index_name"] = Value(stats.index_name);
+        (*row)["height"] = Value((int32_t) stats.height);
+        (*row)["nodes"] = Value((int32_t) stats.nodes);
+        (*row)["leaves"] = Value((int32_t) stats.leaves);
+        (*row)["fill_percent"] = Value((int32_t) (stats.average_fill * 100 + 0.5));
+        (*row)["key_bytes"] = Value((int32_t) stats.key_bytes);
+        (*row)["lookups"] = Value((int32_t) stats.lookups);
+        (*row)["scans"] = Value((int32_t) stats.scans);
+        (*row)["splits"] = Value((int32_t) stats.splits);
+        (*row)["merges"] = Value((int32_t) stats.merges);
+        (*row)["cache_hits"] = Value((int32_t) stats.cache_hits);
+        (*row)["cache_misses"] = Value((int32_t) stats.cache_misses);
+        rows->push_back(row);
+    }
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + to_string(rows->size()) + " rows");
+}
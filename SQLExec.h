@@ -9,6 +9,7 @@
 #include <string>
 #include "SQLParser.h"
 #include "schema_tables.h"
+#include "ExtendedSQL.h"
 
 /**
  * @class SQLExecError - exception for SQLExec methods
@@ -64,10 +65,27 @@ public:
      */
     static QueryResult *execute(const hsql::SQLStatement *statement);
 
+    /**
+     * Execute one of the statements the Hyrise parser doesn't know about.
+     * @param statement   the parsed extended statement
+     * @returns           the query result (freed by caller)
+     */
+    static QueryResult *execute(const ExtendedStatement *statement);
+
+    /**
+     * Close every index that has been opened, waiting for any background work on them to finish. Call this
+     * before exiting.
+     */
+    static void shutdown();
+
 protected:
-    // the one place in the system that holds the _tables table and _indices table
+    // the one place in the system that holds the _tables, _indices, and _statistics tables
     static Tables *tables;
     static Indices *indices;
+    static Statistics *statistics;
+
+    // initialize _tables, _indices, and _statistics tables, if not yet present
+    static void initialize();
 
     // recursive decent into the AST
     static QueryResult *create(const hsql::CreateStatement *statement);
@@ -76,6 +94,13 @@ protected:
 
     static QueryResult *create_index(const hsql::CreateStatement *statement);
 
+    static QueryResult *create_index(const ExtendedStatement *statement);
+
+    static QueryResult *create_index(Identifier table_name, Identifier index_name, std::string index_type,
+                                     const ColumnNames &column_names, bool unique,
+                                     const ColumnNames &include_names = ColumnNames(),
+                                     const ValueDict &predicate = ValueDict());
+
     static QueryResult *drop(const hsql::DropStatement *statement);
 
     static QueryResult *drop_table(const hsql::DropStatement *statement);
@@ -95,9 +120,25 @@ protected:
     static QueryResult *del(const hsql::DeleteStatement *statement);
 
     static QueryResult *select(const hsql::SelectStatement *statement);
+
+    static QueryResult *add_bloom_filter(const ExtendedStatement *statement);
+
+    static QueryResult *analyze(const ExtendedStatement *statement);
+
+    static QueryResult *vacuum(const ExtendedStatement *statement);
+
+    static QueryResult *reindex(const ExtendedStatement *statement);
+
+    static QueryResult *show_index_stats(const ExtendedStatement *statement);
     
     static ValueDict *get_where_conjunction(const hsql::Expr *expr, const ColumnNames *col_names);
 
+    // the indices on the table the planner can look rows up in
+    static DbIndexes get_lookup_indices(Identifier table_name);
+
+    // what ANALYZE found out about the table, if the planner has more than one of those indices to choose from
+    static ColumnStatisticsList get_lookup_statistics(Identifier table_name, const DbIndexes &indexes);
+
     /**
      * Pull out column name and attributes from AST's column definition clause
      * @param col                AST column definition
@@ -134,6 +134,30 @@ u16 SlottedPage::size() const {
     return count;
 }
 
+/**
+ * Drop the tombstones from the header. The data itself is already packed (del() slides it), so this just
+ * shifts the live headers down.
+ * @param renumbered  (old id, new id) of the records that got a new id
+ * @return            true if anything changed
+ */
+bool SlottedPage::compact(vector<pair<RecordID, RecordID> > &renumbered) {
+    u16 size, loc;
+    RecordID new_id = 0;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        get_header(size, loc, record_id);
+        if (loc == 0)
+            continue;
+        if (++new_id != record_id) {
+            put_header(new_id, size, loc);
+            renumbered.push_back(make_pair(record_id, new_id));
+        }
+    }
+    if (new_id == this->num_records)
+        return false;
+    this->num_records = new_id;
+    put_header();
+    return true;
+}
 
 /**
  * Get the size and offset for given id. For id of zero, it is the block header.
@@ -352,6 +376,17 @@ bool test_slotted_page() {
     if (get_dbt != nullptr)
         return assertion_failure("get of deleted record was not null");
 
+    // test compact (record 2 becomes record 1)
+    vector<pair<RecordID, RecordID> > renumbered;
+    if (!slot.compact(renumbered) || renumbered.size() != 1 || renumbered[0] != make_pair((RecordID) 2, (RecordID) 1))
+        return assertion_failure("compact after del");
+    get_dbt = slot.get(1);
+    expected = string(rec2, sizeof(rec2));
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (expected != actual || slot.size() != 1 || slot.compact(renumbered))
+        return assertion_failure("get 1 back after compact " + actual);
+
     // try adding something too big
     rec2_dbt = Dbt(nullptr, DbBlock::BLOCK_SZ - 10); // too big, but only because we have a record in there
     try {
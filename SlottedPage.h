@@ -49,6 +49,13 @@ public:
 
     virtual u_int16_t unused_bytes() const;
 
+    /**
+     * Renumber the records so there are no tombstones left. Records keep their order and get ids 1, 2, 3, ...
+     * @param renumbered  returned by reference: (old id, new id) of every record whose id changed
+     * @returns           true if there were any tombstones
+     */
+    virtual bool compact(std::vector<std::pair<RecordID, RecordID> > &renumbered);
+
 
 protected:
     uint16_t num_records;
@@ -0,0 +1,138 @@
+/**
+ * @file TableHeader.cpp - implementation of TableHeader
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include "TableHeader.h"
+
+using namespace std;
+
+/**
+ * Constructor
+ * @param table_name
+ * @param column_names       (unused)
+ * @param column_attributes  (unused)
+ */
+TableHeader::TableHeader(const Identifier &table_name, const ColumnNames &column_names,
+                         const ColumnAttributes &column_attributes) : table_name(table_name),
+                                                                      file(new HeapFile(table_name + ".header")),
+                                                                      loaded(false), known(false), row_count(0) {
+}
+
+TableHeader::~TableHeader() {
+    delete this->file;
+}
+
+/**
+ * Start over with no rows.
+ */
+void TableHeader::create() {
+    drop_file();
+    this->file->create();
+    this->loaded = true;
+    this->known = true;
+    this->row_count = 0;
+    save();
+}
+
+/**
+ * Remove the header file.
+ */
+void TableHeader::drop() {
+    drop_file();
+    this->loaded = true;
+    this->known = false;
+    this->row_count = 0;
+}
+
+/**
+ * Is there a header with a count in it?
+ * @return true if the row count is known
+ */
+bool TableHeader::is_known() {
+    load();
+    return this->known;
+}
+
+/**
+ * Number of rows.
+ * @return the row count
+ */
+u_long TableHeader::get_row_count() {
+    load();
+    return this->row_count;
+}
+
+/**
+ * Set the number of rows (after counting them).
+ * @param row_count
+ */
+void TableHeader::set_row_count(u_long row_count) {
+    load();
+    if (!this->known) {
+        drop_file();
+        this->file->create();
+        this->known = true;
+    }
+    this->row_count = row_count;
+    save();
+}
+
+/**
+ * Keep the count in step with an insert or delete.
+ * @param delta
+ */
+void TableHeader::add_rows(long delta) {
+    load();
+    if (!this->known)
+        return;
+    this->row_count = (long) this->row_count + delta < 0 ? 0 : this->row_count + delta;
+    save();
+}
+
+// Read the count from the file, if there is one.
+void TableHeader::load() {
+    if (this->loaded)
+        return;
+    this->loaded = true;
+    try {
+        this->file->open();
+    } catch (DbException &e) {
+        // no header file (table is older than headers), so we don't know
+        delete this->file;
+        this->file = new HeapFile(this->table_name + ".header");
+        return;
+    }
+    SlottedPage *page = this->file->get(1);
+    Dbt *dbt = page->get(ROW_COUNT);
+    this->row_count = (u_long) *(uint64_t *) dbt->get_data();
+    this->known = true;
+    delete dbt;
+    delete page;
+}
+
+// Write the count to the file.
+void TableHeader::save() {
+    uint64_t n = this->row_count;
+    Dbt dbt(&n, sizeof(n));
+    SlottedPage *page = this->file->get(1);
+    RecordIDs *record_ids = page->ids();
+    if (record_ids->empty())
+        page->add(&dbt);
+    else
+        page->put(ROW_COUNT, dbt);
+    delete record_ids;
+    this->file->put(page);
+    delete page;
+}
+
+// Remove the file if it is there (a dropped HeapFile can't be reused, so start a new one).
+void TableHeader::drop_file() {
+    try {
+        this->file->drop();
+    } catch (DbException &e) {
+        // wasn't there
+    }
+    delete this->file;
+    this->file = new HeapFile(this->table_name + ".header");
+}
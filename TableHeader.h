@@ -0,0 +1,89 @@
+/**
+ * @file TableHeader.h - small persistent header kept alongside a heap table.
+ * TableHeader
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include "storage_engine.h"
+#include "HeapFile.h"
+
+/**
+ * @class TableHeader - facts about a heap table that have to be cheap to get at, kept in the side file
+ * "<table>.header". For now that is just the number of rows, which insert and delete keep up to date.
+ *
+ * Block 1 of the file has one record per field. Tables created before headers existed have no file; their
+ * count is unknown until someone counts the rows and calls set_row_count().
+ *
+ * The count is cached in memory after the first read, so there is one header per table, in TableRegistry; if
+ * each HeapTable object had its own, one could go on handing out a count the others had since changed.
+ */
+class TableHeader {
+public:
+    TableHeader(const Identifier &table_name, const ColumnNames &column_names,
+                const ColumnAttributes &column_attributes);
+
+    virtual ~TableHeader();
+
+    TableHeader(const TableHeader &other) = delete;
+
+    TableHeader(TableHeader &&temp) = delete;
+
+    TableHeader &operator=(const TableHeader &other) = delete;
+
+    TableHeader &operator=(TableHeader &&temp) = delete;
+
+    /**
+     * The header doesn't depend on the table's columns, so there is nothing to do when they change.
+     */
+    void set_schema(const ColumnNames &column_names, const ColumnAttributes &column_attributes) {}
+
+    /**
+     * Start a header for a brand new (empty) table.
+     */
+    void create();
+
+    /**
+     * Remove the header file.
+     */
+    void drop();
+
+    /**
+     * Do we know the row count?
+     */
+    bool is_known();
+
+    /**
+     * Number of rows in the table (only meaningful if is_known()).
+     */
+    u_long get_row_count();
+
+    /**
+     * Record the number of rows, creating the header file if need be.
+     * @param row_count  number of rows in the table
+     */
+    void set_row_count(u_long row_count);
+
+    /**
+     * Adjust a known row count (does nothing if it is unknown).
+     * @param delta  rows inserted (positive) or deleted (negative)
+     */
+    void add_rows(long delta);
+
+protected:
+    static const RecordID ROW_COUNT = 1;
+
+    Identifier table_name;
+    HeapFile *file;
+    bool loaded;
+    bool known;
+    u_long row_count;
+
+    void load();
+
+    void save();
+
+    void drop_file();
+};
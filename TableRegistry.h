@@ -0,0 +1,48 @@
+/**
+ * @file TableRegistry.h - the side structures of a heap table, one per table however many HeapTable objects it has
+ * TableRegistry
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include <map>
+#include <memory>
+#include "storage_engine.h"
+
+/**
+ * @class TableRegistry - the T of each table, by table name
+ *
+ * A table can have several HeapTable objects at once (the one in Tables' cache, one made just to create or drop it,
+ * ...), and what they keep about the table outside the heap file has to be the same for all of them. So
+ * they get it from here: T is made with T(table_name, column_names, column_attributes) the first time the table is
+ * asked for, and each later request passes the columns along to T::set_schema, since the table may have been
+ * dropped and created again under the same name with other columns. The entries are freed when the program exits.
+ */
+template<class T>
+class TableRegistry {
+public:
+    /**
+     * Get the table's T, making it if there isn't one yet.
+     * @param table_name         table whose T is wanted
+     * @param column_names       columns of the table, in order
+     * @param column_attributes  corresponding attributes
+     * @returns                  the T (owned by the registry)
+     */
+    static T &get(const Identifier &table_name, const ColumnNames &column_names,
+                  const ColumnAttributes &column_attributes) {
+        std::unique_ptr<T> &entry = entries()[table_name];
+        if (entry)
+            entry->set_schema(column_names, column_attributes);
+        else
+            entry.reset(new T(table_name, column_names, column_attributes));
+        return *entry;
+    }
+
+private:
+    static std::map<Identifier, std::unique_ptr<T> > &entries() {
+        static std::map<Identifier, std::unique_ptr<T> > the_entries;
+        return the_entries;
+    }
+};
@@ -0,0 +1,146 @@
+/**
+ * @file ZoneMap.cpp - implementation of ZoneMap
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#include "ZoneMap.h"
+
+using namespace std;
+
+/**
+ * Constructor
+ * @param table_name         (unused)
+ * @param column_names       columns of the table, in order
+ * @param column_attributes  corresponding attributes
+ */
+ZoneMap::ZoneMap(const Identifier &, const ColumnNames &column_names, const ColumnAttributes &column_attributes)
+        : column_names(), data_types(), zones() {
+    set_schema(column_names, column_attributes);
+}
+
+/**
+ * Take on the table's columns. If they aren't the ones the zones were summarized for (the table was dropped and
+ * created again with others), every zone goes back to unknown, since widen() gives values the column's type.
+ * @param column_names
+ * @param column_attributes
+ */
+void ZoneMap::set_schema(const ColumnNames &column_names, const ColumnAttributes &column_attributes) {
+    std::vector<ColumnAttribute::DataType> types;
+    for (auto const &ca: column_attributes)
+        types.push_back(ColumnAttribute(ca).get_data_type());
+    if (column_names == this->column_names && types == this->data_types)
+        return;
+    this->column_names = column_names;
+    this->data_types = types;
+    this->zones.clear();
+}
+
+/**
+ * Forget every block's zone.
+ */
+void ZoneMap::clear() {
+    this->zones.clear();
+}
+
+/**
+ * Start summarizing a block from scratch.
+ * @param block_id
+ */
+void ZoneMap::reset(BlockID block_id) {
+    Zone &z = zone(block_id);
+    z.known = true;
+    z.empty = true;
+    z.min.clear();
+    z.max.clear();
+}
+
+/**
+ * Mark a block's zone as unknown.
+ * @param block_id
+ */
+void ZoneMap::forget(BlockID block_id) {
+    if (block_id < this->zones.size())
+        this->zones[block_id] = Zone();
+}
+
+/**
+ * Widen a known zone to include the given row.
+ * @param block_id
+ * @param row
+ */
+void ZoneMap::widen(BlockID block_id, const ValueDict *row) {
+    if (!is_known(block_id))
+        return;
+    Zone &z = zone(block_id);
+    for (uint i = 0; i < this->column_names.size(); i++) {
+        ValueDict::const_iterator column = row->find(this->column_names[i]);
+        if (column == row->end()) {  // can't summarize a partial row, so give up on this block
+            forget(block_id);
+            return;
+        }
+        Value value = column->second;
+        value.data_type = this->data_types[i];  // stored as the column's type no matter how it was given
+        value = summarize(value);
+        if (z.empty) {
+            z.min.push_back(value);
+            z.max.push_back(value);
+        } else {
+            if (value < z.min[i])
+                z.min[i] = value;
+            if (z.max[i] < value)
+                z.max[i] = value;
+        }
+    }
+    z.empty = false;
+}
+
+/**
+ * Has every row in the block been summarized?
+ * @param block_id
+ * @return true if the zone is known
+ */
+bool ZoneMap::is_known(BlockID block_id) const {
+    return block_id < this->zones.size() && this->zones[block_id].known;
+}
+
+/**
+ * Check if the block could possibly hold a row matching the equality conjunction.
+ * @param block_id
+ * @param where
+ * @return false if it can be skipped
+ */
+bool ZoneMap::may_match(BlockID block_id, const ValueDict *where) const {
+    if (where == nullptr || !is_known(block_id))
+        return true;
+    const Zone &z = this->zones[block_id];
+    if (z.empty)
+        return false;
+    for (auto const &predicate: *where) {
+        for (uint i = 0; i < this->column_names.size(); i++) {
+            if (this->column_names[i] != predicate.first)
+                continue;
+            if (predicate.second.data_type != this->data_types[i])
+                break;  // leave it to the row-by-row comparison
+            Value value = summarize(predicate.second);
+            if (value < z.min[i] || z.max[i] < value)
+                return false;
+            break;
+        }
+    }
+    return true;
+}
+
+// Get (and grow to) the zone for the given block.
+ZoneMap::Zone &ZoneMap::zone(BlockID block_id) {
+    if (block_id >= this->zones.size())
+        this->zones.resize(block_id + 1);
+    return this->zones[block_id];
+}
+
+// The part of a value that goes into a zone. TEXT values are cut down to their prefix which preserves
+// ordering: if a <= b then prefix(a) <= prefix(b).
+Value ZoneMap::summarize(const Value &value) {
+    if (value.data_type == ColumnAttribute::TEXT && value.s.length() > TEXT_PREFIX)
+        return Value(value.s.substr(0, TEXT_PREFIX));
+    return value;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file ZoneMap.h - per-block min/max summaries used to skip blocks during a scan.
+ * ZoneMap
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2021"
+ */
+#pragma once
+
+#include "storage_engine.h"
+
+/**
+ * @class ZoneMap - lightweight side structure holding, for each block of a heap file, the minimum and
+ * maximum value of every INT and BOOLEAN column and of a fixed-length prefix of every TEXT column.
+ *
+ * A zone is either unknown (we have never summarized every row in the block) or known. A known zone is
+ * always a superset of what is really in the block: appends widen it, deletes leave it alone (except
+ * that a block that becomes empty is known to hold nothing). That means may_match() can only
+ * answer "definitely not here" or "maybe", which is all a scan needs to skip a block.
+ *
+ * Zone maps are kept in memory only, one per table in TableRegistry, so they cannot go stale when two
+ * HeapTable objects write to the same file. They are rebuilt lazily as filtered scans read blocks whose
+ * zones are still unknown.
+ */
+class ZoneMap {
+public:
+    /**
+     * Number of leading characters of a TEXT column that are summarized.
+     */
+    static const uint TEXT_PREFIX = 8;
+
+    // (the table name is only for TableRegistry: nothing is kept on disk)
+    ZoneMap(const Identifier &table_name, const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual ~ZoneMap() {}
+
+    ZoneMap(const ZoneMap &other) = delete;
+
+    ZoneMap(ZoneMap &&temp) = delete;
+
+    ZoneMap &operator=(const ZoneMap &other) = delete;
+
+    ZoneMap &operator=(ZoneMap &&temp) = delete;
+
+    /**
+     * Make sure the zones are for the table's current columns, forgetting every block if they aren't.
+     * @param column_names       columns of the table, in order
+     * @param column_attributes  corresponding attributes
+     */
+    void set_schema(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    /**
+     * Forget everything about every block.
+     */
+    void clear();
+
+    /**
+     * Start summarizing a block from scratch: the zone becomes known and empty and must then be
+     * widened by every row in the block.
+     * @param block_id  block to reset
+     */
+    void reset(BlockID block_id);
+
+    /**
+     * Mark a block's zone as unknown.
+     * @param block_id  block to forget
+     */
+    void forget(BlockID block_id);
+
+    /**
+     * Widen a block's zone (if known) to include the given row.
+     * @param block_id  block the row lives in
+     * @param row       full row (all columns present)
+     */
+    void widen(BlockID block_id, const ValueDict *row);
+
+    /**
+     * Is the zone for the given block known?
+     * @param block_id  block to check
+     * @returns         true if every row of the block has been summarized
+     */
+    bool is_known(BlockID block_id) const;
+
+    /**
+     * Could any row in the block satisfy the given equality conjunction?
+     * @param block_id  block to check
+     * @param where     column/value pairs that must all be equal
+     * @returns         false only if the block definitely holds no qualifying row
+     */
+    bool may_match(BlockID block_id, const ValueDict *where) const;
+
+protected:
+    struct Zone {
+        bool known;
+        bool empty;
+        std::vector<Value> min;
+        std::vector<Value> max;
+
+        Zone() : known(false), empty(true), min(), max() {}
+    };
+
+    ColumnNames column_names;
+    std::vector<ColumnAttribute::DataType> data_types;
+    std::vector<Zone> zones;  // indexed by BlockID
+
+    Zone &zone(BlockID block_id);
+
+    static Value summarize(const Value &value);
+};
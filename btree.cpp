@@ -3,48 +3,511 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2021"
  */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <thread>
 #include "btree.h"
 
-BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
-                                                                                                              name,
-                                                                                                              key_columns,
-                                                                                                              unique),
+const double BTreeIndex::DEFAULT_FILL_FACTOR = 0.9;
+const u_long BTreeSorter::SAMPLE_STRIDE;
+
+BTreeCursor::BTreeCursor(const BTreeIndex &index, const NormalizedKey *min_key, const NormalizedKey *max_key)
+        : index(index), from(min_key == nullptr ? nullptr : new NormalizedKey(*min_key)), from_inclusive(true),
+          max_key(max_key == nullptr ? nullptr : new NormalizedKey(*max_key)), entries(), pos(0), next_leaf(0),
+          version(0), done(false) {
+    load(true);
+}
+
+BTreeCursor::~BTreeCursor() {
+    delete from;
+    delete max_key;
+}
+
+// Next entry in range, moving along the leaf chain as needed.
+bool BTreeCursor::next(KeyHandle &entry) {
+    while (!done && pos == entries.size()) {
+        if (next_leaf == 0)
+            done = true;
+        else
+            load(false);
+    }
+    if (done)
+        return false;
+    // (just the key columns are compared, so entries with included columns past them are in, too)
+    if (max_key != nullptr && entries[pos].first.compare(0, max_key->size(), *max_key) > 0) {
+        done = true;
+        return false;
+    }
+    entry = entries[pos++];
+    return true;
+}
+
+bool BTreeCursor::next(Handle &handle) {
+    KeyHandle entry;
+    if (!next(entry))
+        return false;
+    handle = entry.second;
+    return true;
+}
+
+// Copy out the entries of the next leaf (or, descending, the leaf where from would be) from where we left off.
+void BTreeCursor::load(bool descend) {
+    {
+        BTreeLatch::Shared shared(index.latch);
+        BTreeLeaf *leaf;
+        if (descend || version != index.version)
+            leaf = index.find_leaf(from);
+        else
+            leaf = dynamic_cast<BTreeLeaf *>(index.cache.get(next_leaf, true));
+        BTreeLatch::Shared leaf_shared(leaf->get_latch());
+        const Postings &key_map = leaf->get_key_map();
+        auto it = from == nullptr ? key_map.begin() :
+                  from_inclusive ? key_map.lower_bound(*from) : key_map.upper_bound(*from);
+        entries.clear();
+        for (; it != key_map.end(); it++) {
+            Handles *handles = leaf->get_handles(it->second);
+            for (auto const &handle: *handles)
+                entries.push_back(std::make_pair(it->first, handle));
+            delete handles;
+        }
+        pos = 0;
+        next_leaf = leaf->get_next_leaf();
+        version = index.version;
+    }
+    if (!entries.empty()) {
+        delete from;
+        from = new NormalizedKey(entries.back().first);
+        from_inclusive = false;
+    }
+    index.trim();
+}
+
+BTreeSorter::BTreeSorter(Identifier name, const KeyProfile &key_profile, u_long run_size, std::mutex *io_latch)
+        : file(name), key_profile(key_profile), run_size(run_size), io_latch(io_latch), entries(), runs() {
+}
+
+BTreeSorter::~BTreeSorter() {
+    if (!runs.empty())
+        file.drop();
+}
+
+void BTreeSorter::add(const NormalizedKey &key, Handle handle) {
+    entries.push_back(KeyHandle(key, handle));
+    if (entries.size() >= run_size)
+        spill();
+}
+
+// If any runs were spilled, spill the rest, too, otherwise just sort them.
+void BTreeSorter::finish() {
+    if (runs.empty())
+        std::sort(entries.begin(), entries.end());
+    else if (!entries.empty())
+        spill();
+}
+
+void BTreeSorter::sample(Samples &samples) const {
+    for (auto const &run: runs)
+        samples.insert(samples.end(), run.fences.begin(), run.fences.end());
+    for (u_long i = 0; i < entries.size(); i += SAMPLE_STRIDE)
+        samples.push_back(std::make_pair(entries[i].first, std::min(SAMPLE_STRIDE, entries.size() - i)));
+}
+
+std::unique_lock<std::mutex> BTreeSorter::hold_io() const {
+    if (io_latch == nullptr)
+        return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(*io_latch);
+}
+
+// Sort the entries in memory and write them out as a new run at the end of the scratch file.
+void BTreeSorter::spill() {
+    std::sort(entries.begin(), entries.end());
+    std::unique_lock<std::mutex> io = hold_io();
+    if (runs.empty())
+        file.create();  // its first block is never used
+    Run run;
+    run.first_block = 0;
+    BTreeSortBlock *block = nullptr;
+    for (auto const &entry: entries) {
+        if (block == nullptr || !block->add(entry)) {
+            if (block != nullptr) {
+                block->save();
+                delete block;
+            }
+            block = new BTreeSortBlock(file, 0, key_profile, true);
+            if (run.first_block == 0)
+                run.first_block = block->get_id();
+            block->add(entry);
+            run.fences.push_back(std::make_pair(entry.first, 0));
+        }
+        run.fences.back().second++;
+    }
+    block->save();
+    run.last_block = block->get_id();
+    delete block;
+    runs.push_back(run);
+    entries.clear();
+}
+
+BTreeMerge::BTreeMerge(const std::vector<BTreeSorter *> &sorters, const NormalizedKey *from, const NormalizedKey *to)
+        : to(to), sources(), heads() {
+    KeyHandle least(from == nullptr ? NormalizedKey() : *from, Handle(0, 0));  // (comes before any with from's key)
+    for (auto const &sorter: sorters) {
+        for (uint run = 0; run < sorter->runs.size(); run++) {
+            // the last block that starts before from, since from's entries may begin at the end of it
+            const BTreeSorter::Samples &fences = sorter->runs[run].fences;
+            BlockID skip = 0;
+            while (skip + 1 < fences.size() && fences[skip + 1].first < least.first)
+                skip++;
+            Source source = {sorter, (int) run, sorter->runs[run].first_block + skip, KeyHandles(), 0, 0};
+            sources.push_back(source);
+        }
+        if (!sorter->entries.empty()) {
+            auto begin = std::lower_bound(sorter->entries.begin(), sorter->entries.end(), least);
+            auto end = to == nullptr ? sorter->entries.end() :
+                       std::lower_bound(begin, sorter->entries.end(), KeyHandle(*to, Handle(0, 0)));
+            Source source = {sorter, -1, 0, KeyHandles(), (u_long) (begin - sorter->entries.begin()),
+                             (u_long) (end - sorter->entries.begin())};
+            sources.push_back(source);
+        }
+    }
+    for (uint source = 0; source < sources.size(); source++) {
+        KeyHandle entry;
+        while (next_in(sources[source], entry)) {
+            if (entry < least)
+                continue;  // (before the range, in the block it starts in)
+            heads.push(Head(entry, source));
+            break;
+        }
+    }
+}
+
+bool BTreeMerge::next(KeyHandle &entry) {
+    if (heads.empty())
+        return false;
+    entry = heads.top().first;
+    uint source = heads.top().second;
+    heads.pop();
+    KeyHandle following;
+    if (next_in(sources[source], following))
+        heads.push(Head(following, source));
+    return true;
+}
+
+// Next entry of a source before the to key, reading in the next block of a spilled run when the last one runs out.
+bool BTreeMerge::next_in(Source &source, KeyHandle &entry) {
+    if (source.run < 0) {
+        if (source.pos == source.end)
+            return false;
+        entry = source.sorter->entries[source.pos++];
+        return true;
+    }
+    if (source.pos == source.block.size()) {
+        if (source.next_block > source.sorter->runs[source.run].last_block)
+            return false;
+        std::unique_lock<std::mutex> io = source.sorter->hold_io();
+        BTreeSortBlock block(source.sorter->file, source.next_block++, source.sorter->key_profile, false);
+        source.block.clear();
+        block.get_entries(source.block);
+        source.pos = 0;
+    }
+    entry = source.block[source.pos++];
+    if (to != nullptr && !(entry.first < *to)) {
+        source.next_block = source.sorter->runs[source.run].last_block + 1;  // nothing more of the run is in range
+        source.pos = source.block.size();
+        return false;
+    }
+    return true;
+}
+
+BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+                       ColumnNames include_columns) : DbIndex(relation, name, key_columns, unique, include_columns),
+                                                                                                      latch(),
+                                                                                                      version(0),
                                                                                                       closed(true),
                                                                                                       stat(nullptr),
-                                                                                                      root(nullptr),
                                                                                                       file(relation.get_table_name() +
                                                                                                            "-" + name),
-                                                                                                      key_profile() {
-    if (!unique)
-        throw DbRelationError("BTree index must have unique key");
+                                                                                                      key_profile(),
+                                                                                                      cache(file,
+                                                                                                            key_profile),
+                                                                                                      fill_factor(
+                                                                                                              DEFAULT_FILL_FACTOR),
+                                                                                                      sort_run_size(
+                                                                                                              DEFAULT_SORT_RUN_SIZE),
+                                                                                                      build_threads(0),
+                                                                                                      lookups(0),
+                                                                                                      scans(0),
+                                                                                                      splits(0),
+                                                                                                      merges(0) {
     build_key_profile();
 }
 
 BTreeIndex::~BTreeIndex() {
     delete stat;
-    delete root;
 }
 
-// Create the index.
+// Create the index, loading it with the rows already in the table.
 void BTreeIndex::create() {
-    file.create();
-    stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
-    root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
-    closed = false;
-    Handles *table_rows = relation.select();
+    create_all(std::vector<BTreeIndex *>(1, this));
+}
+
+void BTreeIndex::create_all(const std::vector<BTreeIndex *> &indices) {
+    uint created = 0;
     try {
-        for (auto const &row: *table_rows)
-            insert(row);
+        for (auto const &index: indices) {
+            index->file.create();
+            created++;
+            index->stat = new BTreeStat(index->file, STAT, STAT + 1, index->key_profile);
+            index->closed = false;
+        }
+        bulk_load(indices);
     } catch (...) {
-        drop();
+        for (uint i = 0; i < created; i++)
+            indices[i]->drop();
         throw;
     }
-    delete table_rows;
+}
+
+// Key every row in one scan of the table and sort the entries for each index. The table is split into block ranges,
+// one per thread, and each thread keys and sorts the rows of its own range (only reading the blocks in is one at a
+// time). Then each index's entries are split by key into ranges, one per thread again, and each thread merges its
+// range of keys out of all the sorted block ranges and packs it into leaves (only reading and writing blocks is one at
+// a time). Last, the leaves are chained together in order and the levels above are built on them.
+void BTreeIndex::bulk_load(const std::vector<BTreeIndex *> &indices) {
+    DbRelation &relation = indices.front()->relation;
+    BlockID block_count = relation.get_block_count();
+    BlockID threads = indices.front()->build_threads;  // (no more than there are blocks)
+    if (threads == 0)
+        threads = std::min(std::min(std::thread::hardware_concurrency(), (uint) MAX_BUILD_THREADS),
+                           block_count / MIN_BUILD_BLOCKS);
+    threads = std::max(std::min(threads, block_count), (BlockID) 1);
+
+    std::mutex io_latch;  // the scratch files and the index files are read and written through one buffer apiece
+    std::vector<std::vector<BTreeSorter *> > sorters(indices.size());  // by index, then by thread
+    for (uint i = 0; i < indices.size(); i++) {
+        BTreeIndex *index = indices[i];
+        for (uint thread = 0; thread < threads; thread++)
+            sorters[i].push_back(new BTreeSorter(relation.get_table_name() + "-" + index->name + "-sort" +
+                                                 (thread == 0 ? "" : std::to_string(thread)), index->key_profile,
+                                                 std::max(index->sort_run_size / threads, (u_long) 1), &io_latch));
+    }
+    std::vector<std::exception_ptr> failures(threads);
+    auto scan = [&](uint thread) {
+        try {
+            BlockID last = block_count * (thread + 1) / threads;
+            for (BlockID block_id = block_count * thread / threads + 1; block_id <= last; block_id++) {
+                Handles handles;
+                ValueDicts *rows = relation.project_block(block_id, handles);  // (the relation takes turns itself)
+                for (uint r = 0; r < rows->size(); r++) {
+                    for (uint i = 0; i < indices.size(); i++) {
+                        if (!indices[i]->matches((*rows)[r]))
+                            continue;
+                        NormalizedKey *key = indices[i]->entry_key((*rows)[r]);
+                        sorters[i][thread]->add(*key, handles[r]);
+                        delete key;
+                    }
+                    delete (*rows)[r];
+                }
+                delete rows;
+            }
+            for (uint i = 0; i < indices.size(); i++)
+                sorters[i][thread]->finish();
+        } catch (...) {
+            failures[thread] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (uint thread = 1; thread < threads; thread++)
+        workers.push_back(std::thread(scan, thread));
+    scan(0);
+    for (auto &worker: workers)
+        worker.join();
+
+    try {
+        for (auto const &failure: failures)
+            if (failure)
+                std::rethrow_exception(failure);
+
+        // each index's entries split by key into a range per thread, each merged and packed into leaves on its own
+        for (uint i = 0; i < indices.size(); i++) {
+            BTreeSorter::Samples samples;
+            for (auto const &sorter: sorters[i])
+                sorter->sample(samples);
+            std::vector<NormalizedKey> splits = indices[i]->splitters(samples, threads);
+            std::vector<LeafRange> ranges(splits.size() + 1);
+            std::vector<std::exception_ptr> range_failures(ranges.size());
+            auto load_range = [&](uint range) {
+                try {
+                    BTreeMerge sorted(sorters[i], range == 0 ? nullptr : &splits[range - 1],
+                                      range == splits.size() ? nullptr : &splits[range]);
+                    indices[i]->load_leaves(sorted, ranges[range], io_latch);
+                } catch (...) {
+                    range_failures[range] = std::current_exception();
+                }
+            };
+            workers.clear();
+            for (uint range = 1; range < ranges.size(); range++)
+                workers.push_back(std::thread(load_range, range));
+            load_range(0);
+            for (auto &worker: workers)
+                worker.join();
+            try {
+                for (auto const &failure: range_failures)
+                    if (failure)
+                        std::rethrow_exception(failure);
+                indices[i]->load(ranges);
+            } catch (...) {
+                for (auto const &range: ranges)
+                    delete range.last;
+                throw;
+            }
+        }
+    } catch (...) {
+        for (auto const &index_sorters: sorters)
+            for (auto const &sorter: index_sorters)
+                delete sorter;
+        throw;
+    }
+    for (auto const &index_sorters: sorters)
+        for (auto const &sorter: index_sorters)
+            delete sorter;
+}
+
+// Taking the samples in key order, a splitter wherever another 1/ranges of the entries have gone by. A splitter is
+// cut down to just the key columns, so that all of a key's entries end up in the same range (and a range that would
+// start with the same key as the one before it is left out).
+std::vector<NormalizedKey> BTreeIndex::splitters(BTreeSorter::Samples &samples, uint ranges) const {
+    std::sort(samples.begin(), samples.end());
+    u_long total = 0;
+    for (auto const &sample: samples)
+        total += sample.second;
+    std::vector<NormalizedKey> splits;
+    u_long seen = 0;
+    for (auto const &sample: samples) {
+        if (splits.size() + 1 == ranges)
+            break;
+        if (seen >= total * (splits.size() + 1) / ranges) {
+            NormalizedKey split = sample.first.substr(0, normalized_size(sample.first, key_profile,
+                                                                         (uint) key_columns.size()));
+            if (seen > 0 && (splits.empty() || splits.back() < split))
+                splits.push_back(split);
+        }
+        seen += sample.second;
+    }
+    return splits;
+}
+
+// Pack the sorted entries in order into leaves filled to fill_factor, one key (with all of its handles) at a time. A
+// separator only needs enough of the leaf's first key to tell it from the key before it.
+void BTreeIndex::load_leaves(BTreeMerge &sorted, LeafRange &range, std::mutex &io_latch) {
+    u_long max_bytes = (u_long) (this->fill_factor * DbBlock::BLOCK_SZ);
+    range.last = nullptr;
+    KeyHandle entry;
+    bool more = sorted.next(entry);
+    while (more) {
+        NormalizedKey key = entry.first;
+        Handles handles;
+        do {
+            handles.push_back(entry.second);
+            more = sorted.next(entry);
+        } while (more && entry.first == key);
+        u_long key_size = normalized_size(key, key_profile, (uint) key_columns.size());  // less any included columns
+        if (this->unique && (handles.size() > 1 || (range.last != nullptr &&
+                                                    range.last_key.compare(0, key_size, key, 0, key_size) == 0)))
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        std::unique_lock<std::mutex> io(io_latch, std::defer_lock);
+        if (handles.size() > 1)
+            io.lock();  // (a long posting is written out to overflow blocks)
+        if (range.last == nullptr) {
+            if (!io.owns_lock())
+                io.lock();
+            range.last = new BTreeLeaf(file, 0, key_profile, true);
+            range.leaves.push_back(std::make_pair(NormalizedKey(), range.last->get_id()));
+            range.first_key = key;
+        } else if (!range.last->append(&key, handles, stat, max_bytes)) {
+            if (!io.owns_lock())
+                io.lock();
+            auto *next = new BTreeLeaf(file, 0, key_profile, true);
+            range.last->set_next_leaf(next->get_id());
+            range.last->save();
+            delete range.last;
+            range.last = next;
+            range.leaves.push_back(std::make_pair(shortest_separator(range.last_key, key), range.last->get_id()));
+        } else {
+            range.last_key = key;
+            continue;
+        }
+        range.last->append(&key, handles, stat, max_bytes);  // always goes into an empty leaf
+        range.last_key = key;
+    }
+}
+
+// Build the tree bottom-up: chain each range's leaves to the next range's, then pack separators between the leaves
+// into the level above, and so on up to the root.
+void BTreeIndex::load(std::vector<LeafRange> &ranges) {
+    u_long max_bytes = (u_long) (this->fill_factor * DbBlock::BLOCK_SZ);
+    std::vector<std::pair<NormalizedKey, BlockID> > level;  // separator and block of each node in the level just built
+    LeafRange *before = nullptr;
+    for (auto &range: ranges) {
+        if (range.last == nullptr)
+            continue;  // (no keys in it)
+        if (before != nullptr) {
+            before->last->set_next_leaf(range.leaves.front().second);
+            before->last->save();
+            delete before->last;
+            before->last = nullptr;
+            range.leaves.front().first = shortest_separator(before->last_key, range.first_key);
+        }
+        level.insert(level.end(), range.leaves.begin(), range.leaves.end());
+        before = &range;
+    }
+    if (before == nullptr) {
+        auto *leaf = new BTreeLeaf(file, 0, key_profile, true);  // an empty tree is just an empty leaf
+        level.push_back(std::make_pair(NormalizedKey(), leaf->get_id()));
+        leaf->save();
+        delete leaf;
+    } else {
+        before->last->save();
+        delete before->last;
+        before->last = nullptr;
+    }
+
+    // interior levels until there's just the root
+    uint height = 1;
+    while (level.size() > 1) {
+        std::vector<std::pair<NormalizedKey, BlockID> > above;
+        BTreeInterior *interior = nullptr;
+        for (auto const &child: level) {
+            if (interior != nullptr && interior->append(&child.first, child.second, max_bytes))
+                continue;
+            if (interior != nullptr) {
+                interior->save();
+                delete interior;
+            }
+            interior = new BTreeInterior(file, 0, key_profile, true);
+            interior->set_first(child.second);
+            above.push_back(std::make_pair(child.first, interior->get_id()));
+        }
+        interior->save();
+        delete interior;
+        level.swap(above);
+        height++;
+    }
+    stat->set_root_id(level.front().second);
+    stat->set_height(height);
+    stat->save();
 }
 
 // Drop the index.
 void BTreeIndex::drop() {
+    cache.clear();
     file.drop();
+    delete stat;
+    stat = nullptr;
+    closed = true;
 }
 
 // Open existing index. Enables: lookup, range, insert, delete, update.
@@ -52,22 +515,17 @@ void BTreeIndex::open() {
     if (closed) {
         file.open();
         stat = new BTreeStat(file, STAT, key_profile);
-        if (stat->get_height() == 1)
-            root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
-        else
-            root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-        closed = true;
+        closed = false;
     }
 }
 
 // Closes the index. Disables: lookup, range, insert, delete, update.
 void BTreeIndex::close() {
     if (!closed) {
+        cache.clear();
         file.close();
         delete stat;
         stat = nullptr;
-        delete root;
-        root = nullptr;
         closed = true;
     }
 }
@@ -75,93 +533,416 @@ void BTreeIndex::close() {
 // Find all the rows whose columns are equal to key. Assumes key is a dictionary whose keys are the column
 // names in the index. Returns a list of row handles.
 Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
-    // FIXME
-    return this->_lookup(this->root, stat->get_height(), this->tkey(key_dict));
+    if (!include_columns.empty())
+        return range(key_dict, key_dict);  // a key's entries differ in their included columns
+    this->lookups++;
+    NormalizedKey *key = this->tkey(key_dict);
+    Handles *handles;
+    {
+        BTreeLatch::Shared shared(this->latch);
+        handles = this->_lookup(get_root(), stat->get_height(), key);
+    }
+    delete key;
+    trim();
+    return handles;
 }
 
-Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const KeyValue *key) const {
-    /*************
-     Recursive lookup
-     *************/
-    Handles *handles = new Handles;
-    // base case: a leaf node
+// Recursive lookup: down one level at a time to the leaf where key would be.
+Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const NormalizedKey *key) const {
     if (height == 1) {
-        //std::cout << "debug: leaf node, heigt: " << height << std::endl;
-
-        //return [handle] if handle is not None else []
         auto *leaf = dynamic_cast<BTreeLeaf *>(node);
-        try {
-            Handle handle = leaf->find_eq(key);
-            handles->push_back(handle);
-            return handles;
-        } catch (...) {
-            return handles;
-        }
+        BTreeLatch::Shared shared(leaf->get_latch());
+        return leaf->find_eq(key);
+    }
+    auto *interior = dynamic_cast<BTreeInterior *>(node);
+    if (height == 2)
+        return cache.find_eq(interior->get_child_id(interior->find_index(key)), key);
+    return _lookup(interior->find(key, height), height - 1, key);
+}
 
-    }else{
-        //std::cout << "debug: interior node, heigt: " << height << std::endl;
+// Find the rows for each of keys. The keys are looked up in key order, keeping the path down to the last leaf's
+// parent: the next key only goes back up as far as the lowest node whose range it is still in, and all the keys
+// that fall in the same leaf are looked for in it together, reading its block once. Returns a list of row handles
+// for each key, in the order of keys.
+HandleLists *BTreeIndex::lookup_many(const ValueDicts &keys) const {
+    if (!include_columns.empty())
+        return DbIndex::lookup_many(keys);  // (each lookup is a range anyway)
+    this->lookups += keys.size();
+    std::vector<std::pair<NormalizedKey, u_long> > probes;  // each key and where its handles go in the result
+    probes.reserve(keys.size());
+    for (u_long i = 0; i < keys.size(); i++) {
+        NormalizedKey *key = this->tkey(keys[i]);
+        probes.push_back(std::make_pair(*key, i));
+        delete key;
+    }
+    std::sort(probes.begin(), probes.end());
+    HandleLists *ret = new HandleLists(keys.size(), nullptr);
+    {
+        BTreeLatch::Shared shared(this->latch);
+        uint height = stat->get_height();
+        // the interior nodes from the root down, each with the bound its keys are less than (nullptr for none)
+        std::vector<std::pair<BTreeInterior *, const NormalizedKey *> > path;
+        u_long next = 0;
+        while (next < probes.size()) {
+            const NormalizedKey &key = probes[next].first;
+            BlockID leaf_id = stat->get_root_id();
+            const NormalizedKey *bound = nullptr;
+            if (height > 1) {
+                while (path.size() > 1 && path.back().second != nullptr && key >= *path.back().second)
+                    path.pop_back();
+                if (path.empty())
+                    path.push_back(std::make_pair(dynamic_cast<BTreeInterior *>(get_root()), bound));
+                while (true) {
+                    BTreeInterior *interior = path.back().first;
+                    uint index = interior->find_index(&key);
+                    bound = interior->get_bound(index);
+                    if (bound == nullptr)
+                        bound = path.back().second;
+                    if (path.size() == height - 1) {
+                        leaf_id = interior->get_child_id(index);
+                        break;
+                    }
+                    auto *child = dynamic_cast<BTreeInterior *>(interior->get_child(index, height - path.size() + 1));
+                    path.push_back(std::make_pair(child, bound));
+                }
+            }
+            std::vector<const NormalizedKey *> in_leaf;
+            u_long first = next;
+            while (next < probes.size() && (bound == nullptr || probes[next].first < *bound))
+                in_leaf.push_back(&probes[next++].first);
+            HandleLists found;
+            cache.find_eq(leaf_id, in_leaf, found);
+            for (u_long i = 0; i < found.size(); i++)
+                (*ret)[probes[first + i].second] = found[i];
+        }
+    }
+    trim();
+    return ret;
+}
 
-        // recursive case: go down one level
-        auto *interior = dynamic_cast<BTreeInterior *>(node);
-        return _lookup(interior->find(key, height), height - 1, key);
+// Values of the given key and included columns for each row with the given key, from the index's entries.
+ValueDicts *BTreeIndex::lookup_values(ValueDict *key_dict, const ColumnNames *column_names) const {
+    std::vector<uint> which;  // where each column is in an entry's key
+    ColumnNames entry_columns = key_columns;
+    entry_columns.insert(entry_columns.end(), include_columns.begin(), include_columns.end());
+    for (auto const &column_name: *column_names) {
+        auto at = std::find(entry_columns.begin(), entry_columns.end(), column_name);
+        if (at == entry_columns.end())
+            throw DbRelationError("column '" + column_name + "' is not in index " + name);
+        which.push_back((uint) (at - entry_columns.begin()));
     }
+    this->lookups++;
+    NormalizedKey *key = this->tkey(key_dict);
+    BTreeCursor cursor(*this, key, key);
+    delete key;
+    ValueDicts *ret = new ValueDicts();
+    KeyHandle entry;
+    while (cursor.next(entry)) {
+        KeyValue *values = denormalize_key(entry.first, key_profile);
+        ValueDict *row = new ValueDict();
+        for (uint i = 0; i < which.size(); i++)
+            (*row)[(*column_names)[i]] = (*values)[which[i]];
+        delete values;
+        ret->push_back(row);
+    }
+    return ret;
 }
 
+// Find all the rows whose keys are between min_key and max_key (inclusive), in key order. Either end
+// can be nullptr for an open end.
 Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key) const {
-    throw DbRelationError("Don't know how to do a range query on Btree index yet");
-    // FIXME
+    Handles *handles = new Handles;
+    IndexCursor *cursor = range_cursor(min_key, max_key);
+    Handle handle;
+    while (cursor->next(handle))
+        handles->push_back(handle);
+    delete cursor;
+    return handles;
+}
+
+// Start a cursor at the leaf where min_key would be (or the leftmost leaf).
+IndexCursor *BTreeIndex::range_cursor(ValueDict *min_key, ValueDict *max_key) const {
+    this->scans++;
+    NormalizedKey *tmin = min_key == nullptr ? nullptr : this->tkey(min_key);
+    NormalizedKey *tmax = max_key == nullptr ? nullptr : this->tkey(max_key);
+    IndexCursor *cursor = new BTreeCursor(*this, tmin, tmax);
+    delete tmin;
+    delete tmax;
+    return cursor;
+}
+
+// Descend to the leaf where key would be (the leftmost leaf for nullptr).
+BTreeLeaf *BTreeIndex::find_leaf(const NormalizedKey *key) const {
+    BTreeNode *node = get_root();
+    for (uint height = stat->get_height(); height > 1; height--)
+        node = dynamic_cast<BTreeInterior *>(node)->find(key, height);
+    return dynamic_cast<BTreeLeaf *>(node);
+}
+
+// The entry key of the given row, or of the row with the given handle, read from the relation (freed by caller).
+NormalizedKey *BTreeIndex::row_key(Handle handle, const ValueDict *row) {
+    if (row != nullptr)
+        return this->entry_key(row);
+    ValueDict *projected = relation.project(handle);
+    NormalizedKey *key = this->entry_key(projected);
+    delete projected;
+    return key;
+}
+
+// Is there an entry whose key starts with prefix? (With the latch held.)
+bool BTreeIndex::has_prefix(const NormalizedKey &prefix) const {
+    BTreeLeaf *leaf = find_leaf(&prefix);
+    while (true) {
+        const Postings &key_map = leaf->get_key_map();
+        auto it = key_map.lower_bound(prefix);
+        if (it != key_map.end())
+            return it->first.compare(0, prefix.size(), prefix) == 0;
+        if (leaf->get_next_leaf() == 0)
+            return false;
+        leaf = dynamic_cast<BTreeLeaf *>(cache.get(leaf->get_next_leaf(), true));
+    }
+}
+
+// Trim the cache, if no one else is using the index just now (if they are, a later operation will).
+void BTreeIndex::trim() const {
+    if (this->latch.try_lock()) {
+        cache.trim();
+        this->latch.unlock();
+    }
 }
 
 // Insert a row with the given handle. Row must exist in relation already.
 void BTreeIndex::insert(Handle handle) {
+    insert(handle, nullptr);
+}
+
+// Insert a row with the given handle and values (or, with row of nullptr, the values it has in the relation).
+void BTreeIndex::insert(Handle handle, const ValueDict *row) {
     open();
-    ValueDict *key = relation.project(handle);
-    KeyValue *tkey = this->tkey(key);
-    Insertion insertion = _insert(root, stat->get_height(), tkey, handle);
-    if (!BTreeNode::insertion_is_none(insertion)) {
-        auto *new_root = new BTreeInterior(file, 0, key_profile, true);
-        new_root->set_first(root->get_id());
-        new_root->insert(&insertion.second, insertion.first);
-        new_root->save();
-        stat->set_root_id(new_root->get_id());
-        stat->set_height(stat->get_height() + 1);
-        stat->save();
-        delete root;
-        root = new_root;
-        std::cout << "new root: " << *new_root << std::endl;
+    NormalizedKey *tkey = row_key(handle, row);
+    // with included columns, rows with the same key can have entries in different leaves, so uniqueness is
+    // checked with the whole tree latched
+    bool prefix_unique = this->unique && !include_columns.empty();
+    if (!prefix_unique) {
+        try {
+            // usually there's room in the leaf
+            BTreeLatch::Shared shared(this->latch);
+            BTreeLeaf *leaf = find_leaf(tkey);
+            BTreeLatch::Exclusive exclusive(leaf->get_latch());
+            if (leaf->insert_in_place(tkey, handle, this->unique)) {
+                delete tkey;
+                return;
+            }
+        } catch (...) {
+            delete tkey;
+            throw;
+        }
+    }
+    BTreeLatch::Exclusive exclusive(this->latch);
+    this->version++;
+    try {
+        u_long key_size = normalized_size(*tkey, key_profile, (uint) key_columns.size());
+        if (prefix_unique && has_prefix(tkey->substr(0, key_size)))
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        Insertion insertion = _insert(get_root(), stat->get_height(), tkey, handle);
+        if (!BTreeNode::insertion_is_none(insertion)) {
+            BTreeInterior *new_root = cache.new_interior(stat->allocate());
+            new_root->set_first(stat->get_root_id());
+            new_root->insert(&insertion.second, insertion.first, stat);
+            new_root->save();
+            stat->set_root_id(new_root->get_id());
+            stat->set_height(stat->get_height() + 1);
+            stat->save();
+            this->splits++;
+        }
+    } catch (...) {
+        cache.clear();  // a node may have been changed in memory but not saved
+        delete tkey;
+        throw;
     }
-    delete key;
     delete tkey;
+    cache.trim();
 }
 
 // Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
-Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle) {
+Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const NormalizedKey *key, Handle handle) {
     if (height == 1) {
         auto *leaf = dynamic_cast<BTreeLeaf *>(node);
-        return leaf->insert(key, handle);
+        return leaf->insert(key, handle, stat, this->unique);
     } else {
         auto *interior = dynamic_cast<BTreeInterior *>(node);
-		//Insertion insertion = _insert(interior->find(key, height), height - 1, key, handle);
-		auto* found = interior->find(key, height);
-		Insertion insertion = _insert(found, height - 1, key, handle);
-		delete found;
-        if (!BTreeNode::insertion_is_none(insertion))
-            insertion = interior->insert(&insertion.second, insertion.first);
+        Insertion insertion = _insert(interior->find(key, height), height - 1, key, handle);
+        if (!BTreeNode::insertion_is_none(insertion)) {
+            this->splits++;  // the child split
+            insertion = interior->insert(&insertion.second, insertion.first, stat);
+        }
         return insertion;
     }
 }
 
+// Delete the index entry for the row with the given handle. Row must still be in relation.
 void BTreeIndex::del(Handle handle) {
-    // throw DbRelationError("Don't know how to delete from a BTree index yet");
-    // FIXME
-    return;
+    del(handle, nullptr);
 }
 
-KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
-    KeyValue *key_value = new KeyValue();
+// Delete the index entry for the row with the given handle and values (or, with row of nullptr, the values it has
+// in the relation).
+void BTreeIndex::del(Handle handle, const ValueDict *row) {
+    open();
+    NormalizedKey *key = row_key(handle, row);
+    {
+        // usually it just comes out of the leaf
+        BTreeLatch::Shared shared(this->latch);
+        BTreeLeaf *leaf = find_leaf(key);
+        BTreeLatch::Exclusive exclusive(leaf->get_latch());
+        if (leaf->del_in_place(key, handle, stat->get_height() == 1)) {
+            delete key;
+            return;
+        }
+    }
+    BTreeLatch::Exclusive exclusive(this->latch);
+    this->version++;
+    try {
+        _del(get_root(), stat->get_height(), key, handle);
+    } catch (...) {
+        cache.clear();  // a node may have been changed in memory but not saved
+        delete key;
+        throw;
+    }
+    delete key;
+
+    // an interior root left with a single child is replaced by that child
+    while (stat->get_height() > 1 && dynamic_cast<BTreeInterior *>(get_root())->is_empty()) {
+        BlockID old_root = stat->get_root_id();
+        stat->set_root_id(dynamic_cast<BTreeInterior *>(get_root())->get_child_id(0));
+        stat->set_height(stat->get_height() - 1);
+        cache.forget(old_root);
+        stat->release(old_root);  // saves stat, too
+    }
+    cache.trim();
+}
+
+// Recursive delete. Returns true if node is left so empty that its parent should rebalance it.
+bool BTreeIndex::_del(BTreeNode *node, uint height, const NormalizedKey *key, Handle handle) {
+    if (height == 1) {
+        auto *leaf = dynamic_cast<BTreeLeaf *>(node);
+        return leaf->del(key, handle, stat) && leaf->underflows();
+    }
+    auto *interior = dynamic_cast<BTreeInterior *>(node);
+    uint index = interior->find_index(key);
+    bool underflow = _del(interior->get_child(index, height), height - 1, key, handle);
+    if (!underflow)
+        return false;
+    if (interior->rebalance(index, height, stat))
+        this->merges++;
+    return interior->underflows();
+}
+
+// The row that used to be at from is now at to: find its entry (by the row's key) and repoint it.
+void BTreeIndex::relocate(Handle from, Handle to) {
+    open();
+    NormalizedKey *key = row_key(to);
+    {
+        BTreeLatch::Shared shared(this->latch);
+        BTreeLeaf *leaf = find_leaf(key);
+        BTreeLatch::Exclusive exclusive(leaf->get_latch());
+        if (leaf->relocate_in_place(key, from, to)) {
+            delete key;
+            return;
+        }
+    }
+    BTreeLatch::Exclusive exclusive(this->latch);
+    this->version++;
+    try {
+        find_leaf(key)->relocate(key, from, to, stat);
+    } catch (...) {
+        cache.clear();  // a node may have been changed in memory but not saved
+        delete key;
+        throw;
+    }
+    delete key;
+    cache.trim();
+}
+
+NormalizedKey *BTreeIndex::tkey(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const &column_name: key_columns) {
+        auto column = key->find(column_name);
+        if (column == key->end())
+            throw DbRelationError("missing key column '" + column_name + "'");
+        key_value.push_back(column->second);
+    }
+    return new NormalizedKey(normalize_key(key_value, key_profile));
+}
+
+// The key columns and then the included ones, normalized: what the index keeps for the row.
+NormalizedKey *BTreeIndex::entry_key(const ValueDict *row) const {
+    KeyValue key_value;
     for (auto const &column_name: key_columns)
-        key_value->push_back(key->find(column_name)->second);
-    return key_value;
+        key_value.push_back(row->find(column_name)->second);
+    for (auto const &column_name: include_columns)
+        key_value.push_back(row->find(column_name)->second);
+    return new NormalizedKey(normalize_key(key_value, key_profile));
+}
+
+// The gauges by walking the tree a level at a time, and a snapshot of the counters (from before the walk, which goes
+// through the cache, too).
+BTreeIndexStats BTreeIndex::get_stats() const {
+    BTreeIndexStats stats;
+    stats.table_name = relation.get_table_name();
+    stats.index_name = name;
+    stats.lookups = this->lookups;
+    stats.scans = this->scans;
+    stats.cache_hits = cache.get_hits();
+    stats.cache_misses = cache.get_misses();
+    u_long used_bytes = 0;
+    {
+        BTreeLatch::Shared shared(this->latch);
+        stats.splits = this->splits;
+        stats.merges = this->merges;
+        stats.height = stat->get_height();
+        std::vector<BlockID> level(1, stat->get_root_id());
+        for (uint height = stats.height; height > 0; height--) {
+            std::vector<BlockID> below;
+            for (auto const &block_id: level) {
+                BTreeNode *node = cache.get(block_id, height == 1);
+                stats.nodes++;
+                if (height == 1) {
+                    auto *leaf = dynamic_cast<BTreeLeaf *>(node);
+                    BTreeLatch::Shared leaf_shared(leaf->get_latch());  // (changes in place only take that)
+                    used_bytes += leaf->get_used_bytes();
+                    for (auto const &entry: leaf->get_key_map())
+                        stats.key_bytes += entry.first.size();
+                    stats.leaves++;
+                } else {
+                    auto *interior = dynamic_cast<BTreeInterior *>(node);
+                    used_bytes += interior->get_used_bytes();
+                    for (uint i = 0; i < interior->get_child_count(); i++)
+                        below.push_back(interior->get_child_id(i));
+                }
+            }
+            level.swap(below);
+        }
+    }
+    trim();
+    stats.average_fill = (double) used_bytes / stats.nodes / DbBlock::BLOCK_SZ;
+    return stats;
+}
+
+BTreeIndexStats::BTreeIndexStats() : table_name(), index_name(), height(0), nodes(0), leaves(0), average_fill(0.0),
+                                     key_bytes(0), lookups(0), scans(0), splits(0), merges(0), cache_hits(0),
+                                     cache_misses(0) {
+}
+
+// (Identifiers don't need any escaping.)
+std::string BTreeIndexStats::to_json() const {
+    std::stringstream out;
+    out << "{\"table\": \"" << table_name << "\", \"index\": \"" << index_name << "\", \"height\": " << height
+        << ", \"nodes\": " << nodes << ", \"leaves\": " << leaves << ", \"average_fill\": " << average_fill
+        << ", \"key_bytes\": " << key_bytes << ", \"lookups\": " << lookups << ", \"scans\": " << scans
+        << ", \"splits\": " << splits << ", \"merges\": " << merges << ", \"cache_hits\": " << cache_hits
+        << ", \"cache_misses\": " << cache_misses << "}";
+    return out.str();
 }
 
 // Figure out the data types of each key component and encode them in key_profile, a list of int/str classes.
@@ -175,8 +956,12 @@ void BTreeIndex::build_key_profile() {
     }
     for (auto const &column_name: key_columns)
         key_profile.push_back(types_by_colname[column_name]);
+    for (auto const &column_name: include_columns)
+        key_profile.push_back(types_by_colname[column_name]);
 }
 
+static bool test_btree_concurrency();
+
 bool test_btree() {
     ColumnNames column_names;
     column_names.push_back("a");
@@ -233,6 +1018,15 @@ bool test_btree() {
         return false;
     }
     delete handles;
+    ValueDict wrong_column;
+    wrong_column["b"] = 99;
+    try {
+        delete index.lookup(&wrong_column);
+        std::cout << "lookup without the key column didn't fail" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
 
     for (uint j = 0; j < 10; j++)
         for (int i = 0; i < 1000; i++) {
@@ -249,28 +1043,45 @@ bool test_btree() {
             delete result;
         }
 
-    /*****************************************************
-    // test delete
-    ValueDict row;
-    row["a"] = 44;
-    row["b"] = 44;
-    auto thandle = table.insert(&row);
-    index.insert(thandle);
-    lookup["a"] = 44;
+    // test lookup_many: out of order, with repeats and keys that aren't there, back in the order asked
+    ValueDicts probes;
+    for (int i = 0; i < 3000; i++) {
+        ValueDict *probe = new ValueDict();
+        (*probe)["a"] = Value((i * 7919) % 1300);
+        probes.push_back(probe);
+    }
+    HandleLists *found = index.lookup_many(probes);
+    for (uint i = 0; i < probes.size(); i++) {
+        handles = index.lookup(probes[i]);
+        if (found->size() != probes.size() || *(*found)[i] != *handles) {
+            std::cout << "lookup_many failed: " << probes[i]->at("a").n << std::endl;
+            return false;
+        }
+        delete handles;
+    }
+    for (auto const &probe: probes)
+        delete probe;
+    for (auto const &probe_handles: *found)
+        delete probe_handles;
+    delete found;
+
+    // test insert and del with the row's values given rather than read back from the table
+    row1["a"] = 5000;
+    row1["b"] = 7;
+    Handle given = table.insert(&row1);
+    index.insert(given, &row1);
+    lookup["a"] = 5000;
     handles = index.lookup(&lookup);
-    thandle = handles->back();
-    delete handles;
-    result = table.project(thandle);
-    if (*result != row) {
-        std::cout << "44 lookup failed" << std::endl;
+    if (handles->size() != 1 || handles->front() != given) {
+        std::cout << "insert with row failed" << std::endl;
         return false;
     }
-    delete result;
-    index.del(thandle);
-    table.del(thandle);
+    delete handles;
+    index.del(given, &row1);
+    table.del(given);
     handles = index.lookup(&lookup);
-    if (handles->size() != 0) {
-        std::cout << "delete failed" << std::endl;
+    if (!handles->empty()) {
+        std::cout << "del with row failed" << std::endl;
         return false;
     }
     delete handles;
@@ -300,10 +1111,58 @@ bool test_btree() {
     delete handles;
     handles = table.select();
     u_long count_t = handles->size();
+    delete handles;
     if (count_i != count_t) {
         std::cout << "full range failed: " << count_i << std::endl;
         return false;
     }
+
+    // test a range with only a lower bound, a cursor at a time
+    minkey["a"] = 1000;
+    IndexCursor *cursor = index.range_cursor(&minkey, nullptr);
+    Handle thandle;
+    int expect = 1000;
+    while (cursor->next(thandle)) {
+        result = table.project(thandle);
+        if (result->at("a") != Value(expect++)) {
+            std::cout << "open-ended range failed: " << expect - 1 << std::endl;
+            return false;
+        }
+        delete result;
+    }
+    delete cursor;
+    if (expect != 1100) {
+        std::cout << "open-ended range stopped early: " << expect << std::endl;
+        return false;
+    }
+
+    // test delete
+    ValueDict row;
+    row["a"] = 44;
+    row["b"] = 44;
+    thandle = table.insert(&row);
+    index.insert(thandle);
+    lookup["a"] = 44;
+    handles = index.lookup(&lookup);
+    thandle = handles->back();
+    delete handles;
+    result = table.project(thandle);
+    if (*result != row) {
+        std::cout << "44 lookup failed" << std::endl;
+        return false;
+    }
+    delete result;
+    index.del(thandle);
+    table.del(thandle);
+    handles = index.lookup(&lookup);
+    if (handles->size() != 0) {
+        std::cout << "delete failed" << std::endl;
+        return false;
+    }
+    delete handles;
+
+    handles = table.select();
+    count_t = handles->size();
     for (u_long i = 0; i < count_t; i++)
         index.del((*handles)[i]);
     delete handles;
@@ -314,10 +1173,700 @@ bool test_btree() {
         std::cout << "delete everything failed: " << count_i << std::endl;
         return false;
     }
-     *****************************************************/
 
+    // put it all back (into the freed blocks) and take out every other row, which has the leaves borrowing
+    // from and merging with their neighbors
+    handles = table.select();
+    for (auto const &handle: *handles)
+        index.insert(handle);
+    for (u_long i = 0; i < count_t; i += 2)
+        index.del((*handles)[i]);
+    for (u_long i = 0; i < count_t; i++) {
+        result = table.project((*handles)[i]);
+        lookup["a"] = result->at("a");
+        delete result;
+        Handles *found = index.lookup(&lookup);
+        if (found->size() != (i % 2 == 0 ? 0U : 1U)) {
+            std::cout << "lookup after partial delete failed: " << lookup["a"].n << std::endl;
+            return false;
+        }
+        delete found;
+    }
+    delete handles;
+    handles = index.range(nullptr, nullptr);
+    if (handles->size() != count_t / 2) {
+        std::cout << "range after partial delete failed: " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    BTreeIndexStats stats = index.get_stats();
+    if (stats.splits == 0 || stats.merges == 0 || stats.height < 2 || stats.leaves >= stats.nodes ||
+        stats.key_bytes != count_t / 2 * 4 || stats.lookups < count_t || stats.average_fill <= 0.0 ||
+        stats.average_fill > 1.0 || stats.cache_hits == 0) {
+        std::cout << "stats are off: " << stats.to_json() << std::endl;
+        return false;
+    }
+    index.drop();
+
+    // test a composite key, with negative numbers in its first column (so b descends as a ascends)
+    column_names.clear();
+    column_names.push_back("b");
+    column_names.push_back("a");
+    BTreeIndex composite(table, "compositeindex", column_names, true);
+    composite.create();
+    column_names.clear();
+    column_names.push_back("a");
+    minkey.clear();
+    maxkey.clear();
+    minkey["b"] = -20;
+    minkey["a"] = 0;
+    maxkey["b"] = -10;
+    maxkey["a"] = 0;  // so b = -10 itself is past the end
+    handles = composite.range(&minkey, &maxkey);
+    results = table.project(handles);
+    for (int i = 0; i < 10; i++) {
+        if (results->size() != 10 || results->at(i)->at("a") != Value(120 - i)) {
+            std::cout << "composite range failed: " << i << ", " << results->size() << std::endl;
+            return false;
+        }
+    }
+    delete handles;
+    for (auto vd: *results)
+        delete vd;
+    delete results;
+    composite.drop();
+    table.drop();
+
+    // test a non-unique index (each key has enough rows to spill into overflow blocks)
+    HeapTable dups("__test_btree_dups", table.get_column_names(), table.get_column_attributes());
+    dups.create();
+    BTreeIndex dup_index(dups, "dupindex", column_names, false);
+    dup_index.create();
+    Handles dup_handles;
+    for (int i = 0; i < 3000; i++) {
+        ValueDict row;
+        row["a"] = Value(i % 7);
+        row["b"] = Value(i);
+        dup_handles.push_back(dups.insert(&row));
+        dup_index.insert(dup_handles.back());
+    }
+    for (int i = 0; i < 3000; i += 3)
+        dup_index.del(dup_handles[i]);  // out of the middle of the lists
+    for (int k = 0; k < 7; k++) {
+        lookup["a"] = k;
+        handles = dup_index.lookup(&lookup);
+        u_long expected = 0;
+        for (int i = 0; i < 3000; i++)
+            if (i % 7 == k && i % 3 != 0)
+                expected++;
+        if (handles->size() != expected) {
+            std::cout << "non-unique lookup failed: " << k << ", " << handles->size() << std::endl;
+            return false;
+        }
+        for (auto const &handle: *handles) {
+            result = dups.project(handle);
+            if (result->at("a") != Value(k) || result->at("b").n % 3 == 0) {
+                std::cout << "non-unique lookup found the wrong row: " << k << std::endl;
+                return false;
+            }
+            delete result;
+        }
+        delete handles;
+    }
+    minkey["a"] = 2;
+    maxkey["a"] = 3;
+    handles = dup_index.range(&minkey, &maxkey);
+    count_i = handles->size();
+    delete handles;
+    if (count_i != 572) {
+        std::cout << "non-unique range failed: " << count_i << std::endl;
+        return false;
+    }
+    dup_index.drop();
+
+    // bulk load from the rows now in the table, spilling sorted runs and packing nodes half full
+    BTreeIndex bulk_index(dups, "bulkindex", column_names, false);
+    bulk_index.set_sort_run_size(500);
+    bulk_index.set_fill_factor(0.5);
+    bulk_index.create();
+    handles = bulk_index.range(&minkey, &maxkey);
+    count_i = handles->size();
+    delete handles;
+    if (count_i != 858) {
+        std::cout << "bulk load range failed: " << count_i << std::endl;
+        return false;
+    }
+    for (auto const &handle: dup_handles)
+        bulk_index.del(handle);
+    handles = bulk_index.range(nullptr, nullptr);
+    count_i = handles->size();
+    delete handles;
+    if (count_i != 0) {
+        std::cout << "bulk load delete failed: " << count_i << std::endl;
+        return false;
+    }
+    bulk_index.drop();
+    BTreeIndex bulk_unique(dups, "bulkunique", column_names, true);
+    bulk_unique.set_sort_run_size(500);
+    try {
+        bulk_unique.create();
+        std::cout << "bulk load allowed duplicates in a unique index" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+
+    // two indices loaded from one scan of the table, split among threads that each spill sorted runs of their own,
+    // and then merged and packed into leaves a range of keys per thread (a's ranges starting partway into blocks)
+    ColumnNames b_column_names;
+    b_column_names.push_back("b");
+    BTreeIndex parallel_a(dups, "parallela", column_names, false, b_column_names);
+    BTreeIndex parallel_b(dups, "parallelb", b_column_names, true);
+    parallel_a.set_build_threads(4);
+    parallel_a.set_sort_run_size(2800);
+    parallel_b.set_sort_run_size(500);
+    parallel_b.set_fill_factor(0.5);
+    std::vector<BTreeIndex *> parallel;
+    parallel.push_back(&parallel_a);
+    parallel.push_back(&parallel_b);
+    BTreeIndex::create_all(parallel);
+    handles = parallel_a.range(&minkey, &maxkey);
+    count_i = handles->size();
+    delete handles;
+    handles = parallel_a.range(nullptr, nullptr);
+    bool in_order = handles->size() == 3000;
+    for (uint i = 0, last = 0; in_order && i < handles->size(); i++) {
+        result = dups.project((*handles)[i]);
+        uint a_b = (uint) (result->at("a").n * 3000 + result->at("b").n);
+        in_order = i == 0 || a_b > last;
+        last = a_b;
+        delete result;
+    }
+    delete handles;
+    handles = parallel_b.range(nullptr, nullptr);
+    in_order = in_order && handles->size() == 3000;
+    for (uint i = 0; in_order && i < handles->size(); i++) {
+        result = dups.project((*handles)[i]);
+        in_order = result->at("b").n == (int32_t) i;
+        delete result;
+    }
+    delete handles;
+    for (int i = 0; in_order && i < 3000; i++) {
+        lookup.clear();
+        lookup["b"] = i;
+        handles = parallel_b.lookup(&lookup);
+        in_order = handles->size() == 1;
+        delete handles;
+    }
+    if (count_i != 858 || !in_order) {
+        std::cout << "parallel bulk load failed: " << count_i << std::endl;
+        return false;
+    }
+    BTreeIndex parallel_unique(dups, "parallelunique", column_names, true);
+    parallel_unique.set_build_threads(4);
+    try {
+        parallel_unique.create();
+        std::cout << "parallel bulk load allowed duplicates in a unique index" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    parallel_a.drop();
+    parallel_b.drop();
+    dups.drop();
+
+    // text keys that share a long prefix, so leaves keep it once and separators are cut short
+    ColumnNames text_column_names;
+    text_column_names.push_back("s");
+    ColumnAttributes text_column_attributes;
+    text_column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable texts("__test_btree_texts", text_column_names, text_column_attributes);
+    texts.create();
+    BTreeIndex text_index(texts, "textindex", text_column_names, true);
+    text_index.create();
+    for (int i = 0; i < 2000; i++) {
+        ValueDict row;
+        row["s"] = Value("customer-account-" + std::to_string(10000 + i * 7 % 2000));
+        text_index.insert(texts.insert(&row));
+    }
+    for (int i = 0; i < 2000; i++) {
+        lookup.clear();
+        lookup["s"] = Value("customer-account-" + std::to_string(10000 + i));
+        handles = text_index.lookup(&lookup);
+        count_i = handles->size();
+        delete handles;
+        if (count_i != 1) {
+            std::cout << "text lookup failed: " << i << std::endl;
+            return false;
+        }
+    }
+    minkey.clear();
+    maxkey.clear();
+    minkey["s"] = Value("customer-account-10500");
+    maxkey["s"] = Value("customer-account-106");  // before customer-account-10600
+    handles = text_index.range(&minkey, &maxkey);
+    count_i = handles->size();
+    delete handles;
+    if (count_i != 100) {
+        std::cout << "text range failed: " << count_i << std::endl;
+        return false;
+    }
+    text_index.drop();
+    texts.drop();
+
+    // covering index: the included column comes back from the index itself
+    ColumnNames cover_column_names;
+    cover_column_names.push_back("a");
+    cover_column_names.push_back("b");
+    cover_column_names.push_back("c");
+    ColumnAttributes cover_column_attributes;
+    cover_column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    cover_column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    cover_column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable covered("__test_btree_covered", cover_column_names, cover_column_attributes);
+    covered.create();
+    for (int i = 0; i < 1000; i++) {
+        ValueDict row;
+        row["a"] = Value(i % 100);
+        row["b"] = Value("value-" + std::to_string(i));
+        row["c"] = Value(i);
+        covered.insert(&row);
+    }
+    ColumnNames a_column, b_column, c_column;
+    a_column.push_back("a");
+    b_column.push_back("b");
+    c_column.push_back("c");
+    BTreeIndex cover_index(covered, "coverindex", a_column, false, b_column);
+    cover_index.create();
+    if (cover_index.covers(cover_column_names) || !cover_index.covers(b_column)) {
+        std::cout << "covering index claims to cover a column it doesn't have" << std::endl;
+        return false;
+    }
+    row.clear();
+    row["a"] = Value(42);
+    row["b"] = Value("value-1042");
+    row["c"] = Value(1042);
+    cover_index.insert(covered.insert(&row));
+    lookup.clear();
+    lookup["a"] = Value(42);
+    handles = cover_index.lookup(&lookup);
+    count_i = handles->size();
+    delete handles;
+    ValueDicts *values = cover_index.lookup_values(&lookup, &b_column);
+    bool values_ok = values->size() == 11;
+    for (auto const &value: *values) {
+        int n = std::stoi(value->at("b").s.substr(6));
+        if (n % 100 != 42 || value->find("c") != value->end())
+            values_ok = false;
+        delete value;
+    }
+    delete values;
+    if (count_i != 11 || !values_ok) {
+        std::cout << "covering lookup failed: " << count_i << std::endl;
+        return false;
+    }
+    BTreeIndex cover_unique(covered, "coverunique", c_column, true, b_column);
+    cover_unique.create();
+    try {
+        row["b"] = Value("another");
+        cover_unique.insert(covered.insert(&row));
+        std::cout << "unique covering index allowed a duplicate key" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    BTreeIndex cover_unique_a(covered, "coveruniquea", a_column, true, c_column);
+    try {
+        cover_unique_a.create();
+        std::cout << "bulk load allowed duplicates in a unique covering index" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    cover_unique.drop();
+    cover_index.drop();
+
+    // partial index: only the rows matching its predicate, so a is unique among them though not in the table
+    ValueDict predicate;
+    predicate["b"] = Value("value-7");
+    BTreeIndex partial_index(covered, "partialindex", a_column, true);
+    partial_index.set_predicate(predicate);
+    partial_index.create();
+    handles = partial_index.range(nullptr, nullptr);
+    count_i = handles->size();
+    delete handles;
+    lookup.clear();
+    lookup["b"] = Value("value-7");
+    lookup["c"] = Value(7);
+    if (count_i != 1 || !partial_index.implied_by(&lookup) || partial_index.implied_by(&row)) {
+        std::cout << "partial index has the wrong rows: " << count_i << std::endl;
+        return false;
+    }
+    partial_index.drop();
+
+    // an index file written in another format is refused until it is rebuilt
+    BTreeIndex old_index(covered, "oldindex", a_column, false);
+    old_index.create();
+    old_index.close();
+    HeapFile old_file(covered.get_table_name() + "-oldindex");
+    old_file.open();
+    SlottedPage *stat_block = old_file.get(1);  // (the stat block)
+    BlockID old_version = 1;
+    stat_block->put(BTreeStat::VERSION, Dbt(&old_version, sizeof(old_version)));
+    old_file.put(stat_block);
+    delete stat_block;
+    old_file.close();
+    try {
+        old_index.open();
+        std::cout << "opened an index file in an old format" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    old_index.drop();
+    covered.drop();
+
+    // long keys sharing a long prefix take no more nodes than the same keys without it, whether inserted a row at a
+    // time (separators cut short on splits) or bulk loaded (prefix stored once per block)
+    const int PREFIXED = 10000;
+    ColumnNames key_column_names;
+    key_column_names.push_back("long_key");
+    key_column_names.push_back("short_key");
+    ColumnAttributes key_column_attributes;
+    key_column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    key_column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable prefixed("__test_btree_prefixed", key_column_names, key_column_attributes);
+    prefixed.create();
+    BTreeIndex long_inserted(prefixed, "longinserted", ColumnNames(1, "long_key"), true);
+    BTreeIndex short_inserted(prefixed, "shortinserted", ColumnNames(1, "short_key"), true);
+    long_inserted.create();
+    short_inserted.create();
+    for (int i = 0; i < PREFIXED; i++) {
+        std::string number = std::to_string((i * 7919L) % PREFIXED);
+        number.insert(0, 8 - number.size(), '0');
+        row.clear();
+        row["long_key"] = Value("customer-account-number-" + number);
+        row["short_key"] = Value(number);
+        Handle handle = prefixed.insert(&row);
+        long_inserted.insert(handle, &row);
+        short_inserted.insert(handle, &row);
+    }
+    BTreeIndex long_bulk(prefixed, "longbulk", ColumnNames(1, "long_key"), true);
+    BTreeIndex short_bulk(prefixed, "shortbulk", ColumnNames(1, "short_key"), true);
+    long_bulk.create();
+    short_bulk.create();
+    BTreeIndexStats long_stats = long_inserted.get_stats(), short_stats = short_inserted.get_stats();
+    BTreeIndexStats long_bulk_stats = long_bulk.get_stats(), short_bulk_stats = short_bulk.get_stats();
+    if (long_stats.height != short_stats.height || long_stats.nodes > short_stats.nodes + 2 ||
+        long_bulk_stats.height != short_bulk_stats.height || long_bulk_stats.nodes > short_bulk_stats.nodes + 2) {
+        std::cout << "long prefixed keys took more room: height " << long_stats.height << "/" << short_stats.height
+                  << ", " << long_stats.nodes << "/" << short_stats.nodes << " nodes inserted, height "
+                  << long_bulk_stats.height << "/" << short_bulk_stats.height << ", " << long_bulk_stats.nodes << "/"
+                  << short_bulk_stats.nodes << " nodes bulk loaded" << std::endl;
+        return false;
+    }
+    long_inserted.drop();
+    short_inserted.drop();
+    long_bulk.drop();
+    short_bulk.drop();
+    prefixed.drop();
+    return test_btree_concurrency();
+}
+
+// Writer threads add (and then take out) the odd keys while reader threads look up and scan the even ones that
+// are there throughout; afterwards, everything must be where it should be. Other writers do the same to a second
+// index on the table, so that both indices read rows from it at once.
+static bool test_btree_concurrency() {
+    const int EVENS = 2000, THREADS = 4;
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_btree_threads", column_names, column_attributes);
+    table.create();
+    column_names.pop_back();
+    BTreeIndex index(table, "threadindex", column_names, true);
+    index.create();
+    ColumnNames b_column_names;
+    b_column_names.push_back("b");
+    BTreeIndex index_b(table, "threadindexb", b_column_names, false);
+    index_b.create();
+    Handles odd_handles;
+    for (int i = 0; i < 2 * EVENS; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(-i);
+        Handle handle = table.insert(&row);
+        if (i % 2 == 0) {
+            index.insert(handle);
+            index_b.insert(handle);
+        } else {
+            odd_handles.push_back(handle);  // the table isn't thread-safe, so these rows go in beforehand
+        }
+    }
+
+    int phase;
+    std::atomic<bool> writing(true);
+    std::atomic<int> failures(0);
+    auto read = [&](int seed) {
+        u_long scanned = phase == 0 ? EVENS : 2 * EVENS;  // only ever goes up in phase 0, and down in phase 1
+        for (int i = seed; writing; i += 7) {
+            ValueDict key;
+            key["a"] = Value(2 * (i % EVENS));
+            Handles *handles = index.lookup(&key);
+            if (handles->size() != 1)
+                failures++;
+            delete handles;
+            if (i % 5 == 0) {
+                handles = index.range(nullptr, nullptr);
+                if (phase == 0 ? handles->size() < scanned : handles->size() > scanned)
+                    failures++;
+                if (handles->size() < (u_long) EVENS || handles->size() > (u_long) 2 * EVENS)
+                    failures++;
+                scanned = handles->size();
+                delete handles;
+            }
+        }
+    };
+    for (phase = 0; phase < 2; phase++) {
+        writing = true;
+        std::vector<std::thread> writers, readers;
+        for (int t = 0; t < THREADS; t++)
+            readers.push_back(std::thread(read, t));
+        for (int t = 0; t < 2 * THREADS; t++)
+            writers.push_back(std::thread([&, t]() {
+                BTreeIndex &written = t < THREADS ? index : index_b;
+                for (u_long i = t % THREADS; i < odd_handles.size(); i += THREADS) {
+                    if (phase == 0)
+                        written.insert(odd_handles[i]);
+                    else
+                        written.del(odd_handles[i]);
+                }
+            }));
+        for (auto &writer: writers)
+            writer.join();
+        writing = false;
+        for (auto &reader: readers)
+            reader.join();
+        if (failures > 0) {
+            std::cout << "concurrent lookups failed: " << failures << " times in phase " << phase << std::endl;
+            return false;
+        }
+
+        // every key is found, and a full scan has them all in order
+        for (int i = 0; i < 2 * EVENS; i++) {
+            ValueDict key;
+            key["a"] = Value(i);
+            Handles *handles = index.lookup(&key);
+            u_long expected = i % 2 == 0 || phase == 0 ? 1 : 0;
+            bool ok = handles->size() == expected;
+            if (ok && expected == 1) {
+                ValueDict *row = table.project(handles->front());
+                ok = row->at("a") == Value(i);
+                delete row;
+            }
+            delete handles;
+            key.clear();
+            key["b"] = Value(-i);
+            handles = index_b.lookup(&key);
+            ok = ok && handles->size() == expected;
+            delete handles;
+            if (!ok) {
+                std::cout << "lookup after concurrent changes failed: " << i << " in phase " << phase << std::endl;
+                return false;
+            }
+        }
+        Handles *handles = index.range(nullptr, nullptr);
+        int last = -1;
+        for (auto const &handle: *handles) {
+            ValueDict *row = table.project(handle);
+            int a = row->at("a").n;
+            delete row;
+            if (a <= last || (phase == 1 && a % 2 != 0)) {
+                std::cout << "scan after concurrent changes out of order: " << a << " in phase " << phase << std::endl;
+                return false;
+            }
+            last = a;
+        }
+        u_long count = handles->size();
+        delete handles;
+        if (count != (phase == 0 ? 2 * EVENS : EVENS)) {
+            std::cout << "scan after concurrent changes failed: " << count << " in phase " << phase << std::endl;
+            return false;
+        }
+    }
     index.drop();
+    index_b.drop();
     table.drop();
     return true;
 }
 
+/**
+ * Time 100k probes of a unique index on 200k rows with lookup_many against one lookup per probe, first with the
+ * probes in random order, then sorted.
+ */
+void bench_lookup_many() {
+    const int N = 200000, PROBES = 100000;
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__bench_lookup_many", column_names, column_attributes);
+    table.create();
+    for (int i = 0; i < N; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value("customer-" + std::to_string(i));
+        table.insert(&row);
+    }
+    BTreeIndex index(table, "bench_lookup_many", ColumnNames(1, "a"), true);
+    index.create();
+    std::mt19937 random(42);
+    for (bool sorted: {false, true}) {
+        std::vector<int> values;
+        for (int i = 0; i < PROBES; i++)
+            values.push_back((int) (random() % N));
+        if (sorted)
+            std::sort(values.begin(), values.end());
+        ValueDicts probes;
+        for (int value: values)
+            probes.push_back(new ValueDict{{"a", Value(value)}});
+
+        auto start = std::chrono::steady_clock::now();
+        u_long found_one = 0;
+        for (auto const &probe: probes) {
+            Handles *handles = index.lookup(probe);
+            found_one += handles->size();
+            delete handles;
+        }
+        double one_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        HandleLists *lists = index.lookup_many(probes);
+        u_long found_many = 0;
+        for (auto const &handles: *lists) {
+            found_many += handles->size();
+            delete handles;
+        }
+        delete lists;
+        double many_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "  " << (sorted ? "sorted" : "random") << " probes: " << PROBES << " lookups " << one_ms
+                  << " ms, lookup_many " << many_ms << " ms (found " << found_one << "/" << found_many << ")"
+                  << std::endl;
+        for (auto const &probe: probes)
+            delete probe;
+    }
+    index.drop();
+    table.drop();
+}
+
+/**
+ * Build indices on 40k long TEXT keys that share a 24-byte prefix ("customer-account-number-00001234"), and on the
+ * same numbers without it ("00001234"), one inserted a row at a time (in scattered order) and one bulk loaded.
+ * With separator truncation and prefix compression the long keys should cost about what the short ones do.
+ */
+void bench_btree_keys() {
+    const int N = 40000;
+    ColumnNames column_names;
+    column_names.push_back("long_key");
+    column_names.push_back("short_key");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__bench_btree_keys", column_names, column_attributes);
+    table.create();
+    BTreeIndex long_inserted(table, "long_inserted", ColumnNames(1, "long_key"), true);
+    BTreeIndex short_inserted(table, "short_inserted", ColumnNames(1, "short_key"), true);
+    long_inserted.create();
+    short_inserted.create();
+    for (int i = 0; i < N; i++) {
+        std::string number = std::to_string((i * 7919L) % N);
+        number.insert(0, 8 - number.size(), '0');
+        ValueDict row;
+        row["long_key"] = Value(std::string("customer-account-number-") + number);
+        row["short_key"] = Value(number);
+        Handle handle = table.insert(&row);
+        long_inserted.insert(handle, &row);
+        short_inserted.insert(handle, &row);
+    }
+    BTreeIndex long_bulk(table, "long_bulk", ColumnNames(1, "long_key"), true);
+    BTreeIndex short_bulk(table, "short_bulk", ColumnNames(1, "short_key"), true);
+    long_bulk.create();
+    short_bulk.create();
+    for (BTreeIndex *index: {&long_inserted, &short_inserted, &long_bulk, &short_bulk}) {
+        BTreeIndexStats stats = index->get_stats();
+        std::cout << "  " << stats.index_name << ": height " << stats.height << ", " << stats.nodes << " nodes ("
+                  << stats.leaves << " leaves), " << (int) (100 * stats.average_fill) << "% full" << std::endl;
+        index->drop();
+    }
+    table.drop();
+}
+
+/**
+ * Time index builds on a 300k-row table with 1, 2, 4, and 8 build threads: a unique index on an INT and one on a
+ * TEXT column created one after the other, and the two created from one scan. Also times just reading every row of
+ * the table, which the build threads can only do one at a time (the table reads each block into one buffer), so no
+ * build can take less than that however many cores there are.
+ */
+void bench_btree_build() {
+    const int N = 300000;
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__bench_btree_build", column_names, column_attributes);
+    table.create();
+    for (int i = 0; i < N; i++) {
+        ValueDict row;
+        row["a"] = Value((int) ((i * 7919L) % N));
+        row["b"] = Value("customer-" + std::to_string((i * 104729L) % N));
+        table.insert(&row);
+    }
+    auto since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    std::cout << "  " << std::thread::hardware_concurrency() << " cores, " << table.get_block_count() << " blocks"
+              << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    u_long rows = 0;
+    for (BlockID block_id = 1; block_id <= table.get_block_count(); block_id++) {
+        Handles handles;
+        ValueDicts *block_rows = table.project_block(block_id, handles);
+        rows += block_rows->size();
+        for (auto const &row: *block_rows)
+            delete row;
+        delete block_rows;
+    }
+    std::cout << "  reading the table alone: " << since(start) << " ms (" << rows << " rows)" << std::endl;
+
+    for (uint threads: {1U, 2U, 4U, 8U}) {
+        BTreeIndex index_a(table, "bench_build_a", ColumnNames(1, "a"), true);
+        BTreeIndex index_b(table, "bench_build_b", ColumnNames(1, "b"), true);
+        index_a.set_build_threads(threads);
+        index_b.set_build_threads(threads);
+        start = std::chrono::steady_clock::now();
+        index_a.create();
+        double a_ms = since(start);
+        start = std::chrono::steady_clock::now();
+        index_b.create();
+        double b_ms = since(start);
+        index_a.drop();
+        index_b.drop();
+        start = std::chrono::steady_clock::now();
+        BTreeIndex::create_all({&index_a, &index_b});
+        double both_ms = since(start);
+        std::cout << "  " << threads << " threads: a " << a_ms << " ms, b " << b_ms << " ms, both from one scan "
+                  << both_ms << " ms" << std::endl;
+        index_a.drop();
+        index_b.drop();
+    }
+    table.drop();
+}
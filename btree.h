@@ -6,16 +6,199 @@
  */
 #pragma once
 
+#include <queue>
 #include "BTreeNode.h"
 
+class BTreeIndex;
+
+/**
+ * @class BTreeCursor - range scan over a BTreeIndex
+ *
+ * Holds a copy of the current leaf's entries in range and follows the leaf chain one leaf at a time
+ * as they run out, stopping at the first key past the upper bound. It doesn't hold on to any node (or latch)
+ * between calls, so the cache is free to evict them. If the tree has been restructured since the last leaf was
+ * copied, the next leaf may no longer be, so it goes back down from the root to where it left off instead.
+ */
+class BTreeCursor : public IndexCursor {
+public:
+    BTreeCursor(const BTreeIndex &index, const NormalizedKey *min_key, const NormalizedKey *max_key);
+
+    virtual ~BTreeCursor();
+
+    BTreeCursor(const BTreeCursor &other) = delete;
+
+    BTreeCursor(BTreeCursor &&temp) = delete;
+
+    BTreeCursor &operator=(const BTreeCursor &other) = delete;
+
+    BTreeCursor &operator=(BTreeCursor &&temp) = delete;
+
+    virtual bool next(Handle &handle);
+
+    bool next(KeyHandle &entry);
+
+protected:
+    const BTreeIndex &index;
+    NormalizedKey *from;  // where the entries still to come start (nullptr for the beginning)
+    bool from_inclusive;  // whether they include from itself (only until the first entries are copied)
+    NormalizedKey *max_key;  // nullptr if there is no upper bound
+    KeyHandles entries;
+    uint pos;
+    BlockID next_leaf;
+    u_long version;  // the index's version when next_leaf was read
+    bool done;
+
+    void load(bool descend);
+};
+
+/**
+ * @class BTreeSorter - puts the (key, handle) entries for bulk loading a BTreeIndex into order
+ *
+ * Entries are sorted in memory a run at a time. If there turn out to be more than one run's worth, each run
+ * is spilled to a scratch file as it fills, remembering the first key of each of its blocks, and BTreeMerge
+ * reads the runs back a block at a time. Sorters filled by threads side by side can share an io_latch, held
+ * around each read and write of the scratch file (the files read and write through one buffer, like the
+ * relation does), so that only the sorting happens in parallel.
+ */
+class BTreeSorter {
+public:
+    typedef std::vector<std::pair<NormalizedKey, u_long> > Samples;  // keys, each with the entries it stands for
+    static const u_long SAMPLE_STRIDE = 64;  // entries sorted in memory per sample (a spilled block is one sample)
+
+    BTreeSorter(Identifier name, const KeyProfile &key_profile, u_long run_size, std::mutex *io_latch = nullptr);
+
+    virtual ~BTreeSorter();
+
+    BTreeSorter(const BTreeSorter &other) = delete;
+
+    BTreeSorter(BTreeSorter &&temp) = delete;
+
+    BTreeSorter &operator=(const BTreeSorter &other) = delete;
+
+    BTreeSorter &operator=(BTreeSorter &&temp) = delete;
+
+    void add(const NormalizedKey &key, Handle handle);
+
+    void finish();  // done adding (before any BTreeMerge reads them back)
+
+    // keys from all through the sorted entries, in order within each run, appended to samples
+    void sample(Samples &samples) const;
+
+protected:
+    // a spilled run: its blocks in the scratch file and the first key and number of entries of each
+    struct Run {
+        BlockID first_block;
+        BlockID last_block;
+        Samples fences;
+    };
+
+    HeapFile file;
+    const KeyProfile &key_profile;
+    u_long run_size;
+    std::mutex *io_latch;
+    KeyHandles entries;
+    std::vector<Run> runs;
+
+    std::unique_lock<std::mutex> hold_io() const;  // the io_latch, if there is one
+
+    void spill();
+
+    friend class BTreeMerge;
+};
+
+/**
+ * @class BTreeMerge - the entries of several finished BTreeSorters with keys in a given range, merged back into one
+ * (key, handle) order
+ *
+ * Each spilled run of each sorter (and each sorter's entries still in memory) is merged directly, starting from the
+ * block whose fence says the range might begin there, so merges of different ranges can go on side by side.
+ */
+class BTreeMerge {
+public:
+    // from the from key (or the first, if nullptr) up to, but not including, the to key (or through the last)
+    BTreeMerge(const std::vector<BTreeSorter *> &sorters, const NormalizedKey *from = nullptr,
+               const NormalizedKey *to = nullptr);
+
+    virtual ~BTreeMerge() {}
+
+    BTreeMerge(const BTreeMerge &other) = delete;
+
+    BTreeMerge(BTreeMerge &&temp) = delete;
+
+    BTreeMerge &operator=(const BTreeMerge &other) = delete;
+
+    BTreeMerge &operator=(BTreeMerge &&temp) = delete;
+
+    bool next(KeyHandle &entry);
+
+protected:
+    // where the merge is in a spilled run (or, with run of -1, in the entries the sorter still has in memory)
+    struct Source {
+        BTreeSorter *sorter;
+        int run;
+        BlockID next_block;
+        KeyHandles block;  // the entries of the run's block read last
+        u_long pos;
+        u_long end;  // (of the entries in memory in range)
+    };
+    typedef std::pair<KeyHandle, uint> Head;  // least unmerged entry of a source and which source it's from
+
+    const NormalizedKey *to;
+    std::vector<Source> sources;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+
+    bool next_in(Source &source, KeyHandle &entry);
+};
+
+/**
+ * @class BTreeIndexStats - the shape of a BTreeIndex now, and what it has done since it was constructed
+ *
+ * The counters are kept in memory as the index is used (they start over each time the index is loaded); the
+ * gauges come from walking the whole tree when the stats are asked for.
+ */
+struct BTreeIndexStats {
+    Identifier table_name;
+    Identifier index_name;
+    // gauges
+    uint height;
+    u_long nodes;  // interior nodes and leaves (not counting posting list overflow blocks or free blocks)
+    u_long leaves;
+    double average_fill;  // of a node's block, from 0 to 1
+    u_long key_bytes;  // of the distinct keys in the leaves, normalized
+    // counters
+    u_long lookups;  // descents to one leaf for a key (lookup, lookup_many, lookup_values)
+    u_long scans;  // range cursors (a lookup in an index with included columns is one of these instead)
+    u_long splits;  // nodes split in two, the root included
+    u_long merges;  // nodes merged into a neighbor
+    u_long cache_hits;  // nodes found already decoded in the index's node cache
+    u_long cache_misses;  // nodes whose block had to be read
+
+    BTreeIndexStats();
+
+    std::string to_json() const;  // one JSON object, for tools
+};
+
 class BTreeIndex : public DbIndex {
 public:
-    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+    static const double DEFAULT_FILL_FACTOR;  // how full create packs each node, leaving room for later inserts
+    static const u_long DEFAULT_SORT_RUN_SIZE = 100000;  // entries create sorts in memory before spilling to disk
+    static const uint MAX_BUILD_THREADS = 8;  // most threads create splits the scan and sort of the table among
+    static const BlockID MIN_BUILD_BLOCKS = 8;  // fewest blocks of the table worth a thread of their own
+
+    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+               ColumnNames include_columns = ColumnNames());
 
     virtual ~BTreeIndex();
 
     virtual void create();
 
+    /**
+     * Create several indices on the same table (none of them created yet), loading them all from one scan of it.
+     * The settings of the first one (build threads) decide how the table is scanned.
+     * @param indices  on the same relation
+     */
+    static void create_all(const std::vector<BTreeIndex *> &indices);
+
     virtual void drop();
 
     virtual void open();
@@ -24,28 +207,105 @@ public:
 
     virtual Handles *lookup(ValueDict *key) const;
 
+    virtual HandleLists *lookup_many(const ValueDicts &keys) const;
+
+    virtual ValueDicts *lookup_values(ValueDict *key, const ColumnNames *column_names) const;
+
     virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
 
+    virtual IndexCursor *range_cursor(ValueDict *min_key, ValueDict *max_key) const;
+
     virtual void insert(Handle handle);
 
+    virtual void insert(Handle handle, const ValueDict *row);
+
     virtual void del(Handle handle);
 
-    virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
+    virtual void del(Handle handle, const ValueDict *row);
+
+    virtual void relocate(Handle from, Handle to);
+
+    // pull out the key values from the ValueDict in order, normalized (freed by caller)
+    virtual NormalizedKey *tkey(const ValueDict *key) const;
+
+    // the key the index keeps for a row: tkey followed by any included columns (freed by caller)
+    virtual NormalizedKey *entry_key(const ValueDict *row) const;
+
+    void set_fill_factor(double fill_factor) { this->fill_factor = fill_factor; }
+
+    void set_sort_run_size(u_long sort_run_size) { this->sort_run_size = sort_run_size; }
+
+    BTreeIndexStats get_stats() const;
+
+    // threads for create to scan and sort the table with (0, the default, for one per core up to MAX_BUILD_THREADS)
+    void set_build_threads(uint build_threads) { this->build_threads = build_threads; }
 
 protected:
     static const BlockID STAT = 1;
+    // Concurrency: a reader-writer latch over the whole tree, plus a latch on each leaf. Lookups, range scans, and
+    // changes that only touch one leaf hold this latch shared and the leaf's latch as well (shared to read it,
+    // exclusively to change it); readers always take both, nothing is read unlatched and validated afterwards.
+    // Since nothing above the leaves changes under a shared latch, the descent to the leaf doesn't latch anything
+    // else. A change that turns out to need more (a split, a merge, an overflow block) backs out and starts over
+    // holding this latch exclusively, which is also when the cache is trimmed and version goes up.
+    mutable BTreeLatch latch;
+    u_long version;  // number of times the latch has been held exclusively (by anything that may restructure)
     bool closed;
     BTreeStat *stat;
-    BTreeNode *root;
-    HeapFile file;
-    KeyProfile key_profile;
+    mutable HeapFile file;  // reading blocks (e.g., for a range scan) is still a const operation on the index
+    KeyProfile key_profile;  // of the key columns and then the included ones
+    mutable BTreeNodeCache cache;  // so is decoding them
+    double fill_factor;
+    u_long sort_run_size;
+    uint build_threads;
+    mutable std::atomic<u_long> lookups;  // for BTreeIndexStats
+    mutable std::atomic<u_long> scans;
+    u_long splits;  // (changed only with the latch held exclusively)
+    u_long merges;
 
     void build_key_profile();
 
-    Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key) const;
+    // the leaves packed with one range of keys, in order (the last one not saved yet, since it is linked to the
+    // first leaf of the next range)
+    struct LeafRange {
+        std::vector<std::pair<NormalizedKey, BlockID> > leaves;  // separator (none for the first) and block of each
+        NormalizedKey first_key;
+        NormalizedKey last_key;
+        BTreeLeaf *last;
+    };
+
+    static void bulk_load(const std::vector<BTreeIndex *> &indices);
+
+    // keys that split the sampled entries into ranges of about the same size (no more than ranges of them)
+    std::vector<NormalizedKey> splitters(BTreeSorter::Samples &samples, uint ranges) const;
+
+    // pack sorted entries into leaves (reading and writing blocks only with io_latch held)
+    void load_leaves(BTreeMerge &sorted, LeafRange &range, std::mutex &io_latch);
+
+    void load(std::vector<LeafRange> &ranges);  // link the ranges' leaves and build the levels above, up to the root
+
+    BTreeNode *get_root() const { return cache.get(stat->get_root_id(), stat->get_height() == 1); }
+
+    BTreeLeaf *find_leaf(const NormalizedKey *key) const;  // (with the latch held)
+
+    // entry_key of row, or of the row in the relation with the given handle if row is nullptr (freed by caller)
+    NormalizedKey *row_key(Handle handle, const ValueDict *row = nullptr);
+
+    bool has_prefix(const NormalizedKey &prefix) const;  // (with the latch held)
+
+    void trim() const;
+
+    Handles *_lookup(BTreeNode *node, uint height, const NormalizedKey *key) const;
+
+    Insertion _insert(BTreeNode *node, uint height, const NormalizedKey *key, Handle handle);
+
+    bool _del(BTreeNode *node, uint height, const NormalizedKey *key, Handle handle);
 
-    Insertion _insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle);
+    friend class BTreeCursor;
 };
 
 bool test_btree();
+void bench_lookup_many();
+void bench_btree_keys();
+void bench_btree_build();
 
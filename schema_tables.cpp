@@ -3,22 +3,42 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2021"
  */
+#include <random>
 #include "schema_tables.h"
 #include "ParseTreeToString.h"
 #include "btree.h"
+#include "HashIndex.h"
+#include "BitmapIndex.h"
+#include "LSMIndex.h"
+#include "LearnedIndex.h"
+#include "ARTIndex.h"
+#include "ExtendedSQL.h"
 
 
+// Does SELECT * FROM <table> WHERE table_name = <table_name> find anything?
+static bool has_rows_for(DbRelation &table, Identifier table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = table.select(&where);
+    bool found = !handles->empty();
+    delete handles;
+    return found;
+}
+
 void initialize_schema_tables() {
     Tables tables;
     tables.create_if_not_exists();
-    tables.close();
     Columns columns;
     columns.create_if_not_exists();
-    columns.close();
     Indices indices;
     indices.create_if_not_exists();
     indices.close();
-
+    Statistics statistics;
+    statistics.create_if_not_exists();
+    statistics.close();
+    Statistics::add_to_schema(tables, columns);
+    columns.close();
+    tables.close();
 }
 
 // Not terribly useful since the parser weeds most of these out
@@ -165,6 +185,12 @@ DbRelation &Tables::get_table(Identifier table_name) {
 }
 
 
+bool Tables::is_schema_table(Identifier table_name) {
+    return table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME ||
+           table_name == Indices::TABLE_NAME || table_name == Statistics::TABLE_NAME;
+}
+
+
 /*
  * ****************************
  * Columns class implementation
@@ -220,16 +246,20 @@ void Columns::create() {
     insert(&row);
     row["column_name"] = Value("index_name");
     insert(&row);
+    row["data_type"] = Value("INT");  // same order as Indices::COLUMN_NAMES
+    row["column_name"] = Value("seq_in_index");
+    insert(&row);
+    row["data_type"] = Value("TEXT");
     row["column_name"] = Value("column_name");
     insert(&row);
     row["column_name"] = Value("index_type");
     insert(&row);
-    row["column_name"] = Value("seq_in_index");
-    row["data_type"] = Value("INT");
-    insert(&row);
     row["column_name"] = Value("is_unique");
     row["data_type"] = Value("BOOLEAN");
     insert(&row);
+    row["column_name"] = Value("predicate");
+    row["data_type"] = Value("TEXT");
+    insert(&row);
 }
 
 // Manually check that (table_name, column_name) is unique.
@@ -275,6 +305,7 @@ ColumnNames &Indices::COLUMN_NAMES() {
         cn.push_back("column_name");
         cn.push_back("index_type");
         cn.push_back("is_unique");
+        cn.push_back("predicate");
     }
     return cn;
 }
@@ -293,6 +324,8 @@ ColumnAttributes &Indices::COLUMN_ATTRIBUTES() {
         cas.push_back(ca);  // index_type
         ca.set_data_type(ColumnAttribute::BOOLEAN);
         cas.push_back(ca);  // is_unique
+        ca.set_data_type(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // predicate
     }
     return cas;
 }
@@ -313,7 +346,7 @@ Handle Indices::insert(const ValueDict *row) {
     ValueDict where;
     where["table_name"] = row->at("table_name");
     where["index_name"] = row->at("index_name");
-    if (row->at("seq_in_index").n > 1)
+    if (row->at("seq_in_index").n != 1)
         where["column_name"] = row->at("column_name");  // check for duplicate columns on the same index
     Handles *handles = select(&where);
     bool unique = handles->empty();
@@ -340,55 +373,55 @@ void Indices::del(Handle handle) {
     HeapTable::del(handle);
 }
 
+// Close every cached index.
+void Indices::close_all() {
+    for (auto const &entry: Indices::index_cache) {
+        entry.second->close();
+        delete entry.second;
+    }
+    Indices::index_cache.clear();
+}
+
 // Return a list of column names and column attributes for given table.
-void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
-                          bool &is_unique) {
+void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names,
+                          Identifier &index_type, bool &is_unique, ColumnNames &include_names,
+                          ValueDict &predicate) {
     // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     ValueDict where;
     where["table_name"] = table_name;
     where["index_name"] = index_name;
     Handles *handles = select(&where);
 
-    Identifier colnames[DbIndex::MAX_COMPOSITE];
-    uint size = 0;
+    Identifier colnames[DbIndex::MAX_COMPOSITE], includes[DbIndex::MAX_COMPOSITE];
+    uint size = 0, include_size = 0;
     for (auto const &handle: *handles) {
         ValueDict *row = project(handle);
 
         Identifier column_name = (*row)["column_name"].s;
-        uint which = (uint) (*row)["seq_in_index"].n;
-        colnames[which - 1] = column_name;  // seq_in_index is 1-based
-        if (which > size)
-            size = which;
+        int seq = (*row)["seq_in_index"].n;
+        if (seq > 0) {
+            uint which = (uint) seq;
+            colnames[which - 1] = column_name;  // seq_in_index is 1-based
+            if (which > size)
+                size = which;
+        } else {
+            uint which = (uint) -seq;
+            includes[which - 1] = column_name;  // and -1-based for included columns
+            if (which > include_size)
+                include_size = which;
+        }
         is_unique = (*row)["is_unique"].n != 0;
-        is_hash = (*row)["index_type"].s == "HASH";
+        index_type = (*row)["index_type"].s;
+        predicate = ExtendedStatement::predicate_from_string((*row)["predicate"].s);
         delete row;
     }
     for (uint i = 0; i < size; i++)
         column_names.push_back(colnames[i]);
+    for (uint i = 0; i < include_size; i++)
+        include_names.push_back(includes[i]);
     delete handles;
 }
 
-// FIXME - use this for now until we have BTreeIndex and HashIndex
-class DummyIndex : public DbIndex {
-public:
-    DummyIndex(DbRelation &rel, Identifier idx, ColumnNames key, bool unq) : DbIndex(rel, idx, key, unq) {}
-
-    void create() {}
-
-    void drop() {}
-
-    void open() {}
-
-    void close() {}
-
-    Handles *lookup(ValueDict *key_values) const { return nullptr; }
-
-    void insert(Handle handle) {}
-
-    void del(Handle handle) {}
-};
-
-
 // Return a table for given table_name.
 DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     // if they are asking about an index we've once constructed, then just return that one
@@ -396,17 +429,28 @@ DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
         return *Indices::index_cache[cache_key];
 
-    // otherwise assume it is a DummyIndex (for now)
-    ColumnNames column_names;
-    bool is_hash, is_unique;
-    get_columns(table_name, index_name, column_names, is_hash, is_unique);
+    // otherwise construct it from what _indices says about it
+    ColumnNames column_names, include_names;
+    Identifier index_type;
+    bool is_unique;
+    ValueDict predicate;
+    get_columns(table_name, index_name, column_names, index_type, is_unique, include_names, predicate);
     DbRelation &table = Tables::get_table(table_name);
     DbIndex *index;
-    if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
+    if (index_type == "HASH") {
+        index = new HashIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "BITMAP") {
+        index = new BitmapIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "LSM") {
+        index = new LSMIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "LEARNED") {
+        index = new LearnedIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "ART") {
+        index = new ARTIndex(table, index_name, column_names, is_unique);
     } else {
-        index = new BTreeIndex(table, index_name, column_names, is_unique);
+        index = new BTreeIndex(table, index_name, column_names, is_unique, include_names);
     }
+    index->set_predicate(predicate);
     Indices::index_cache[cache_key] = index;
     return *index;
 }
@@ -426,3 +470,203 @@ IndexNames Indices::get_index_names(Identifier table_name) {
     return ret;
 }
 
+
+
+/*
+ * *******************************
+ * Statistics class implementation
+ * *******************************
+ */
+const Identifier Statistics::TABLE_NAME = "_statistics";
+
+// get the column name for _statistics column
+ColumnNames &Statistics::COLUMN_NAMES() {
+    static ColumnNames cn;
+    if (cn.empty()) {
+        cn.push_back("table_name");
+        cn.push_back("column_name");
+        cn.push_back("row_count");
+        cn.push_back("analyzed_blocks");
+        cn.push_back("tail_rows");
+        cn.push_back("ndv");
+        cn.push_back("histogram");
+        cn.push_back("mcv");
+        cn.push_back("hll");
+    }
+    return cn;
+}
+
+// get the column attribute for _statistics column
+ColumnAttributes &Statistics::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes cas;
+    if (cas.empty()) {
+        ColumnAttribute ca(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // table_name
+        cas.push_back(ca);  // column_name
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // row_count
+        cas.push_back(ca);  // analyzed_blocks
+        cas.push_back(ca);  // tail_rows
+        cas.push_back(ca);  // ndv
+        ca.set_data_type(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // histogram
+        cas.push_back(ca);  // mcv
+        cas.push_back(ca);  // hll
+    }
+    return cas;
+}
+
+// ctor - we have a fixed table structure
+Statistics::Statistics() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+}
+
+// Add _statistics to _tables and _columns unless it is there already.
+void Statistics::add_to_schema(Tables &tables, Columns &columns) {
+    if (!has_rows_for(tables, Statistics::TABLE_NAME)) {
+        ValueDict row;
+        row["table_name"] = Value(Statistics::TABLE_NAME);
+        tables.insert(&row);
+    }
+    if (!has_rows_for(columns, Statistics::TABLE_NAME)) {
+        ColumnNames &column_names = Statistics::COLUMN_NAMES();
+        ColumnAttributes &column_attributes = Statistics::COLUMN_ATTRIBUTES();
+        ValueDict row;
+        row["table_name"] = Value(Statistics::TABLE_NAME);
+        for (uint i = 0; i < column_names.size(); i++) {
+            row["column_name"] = Value(column_names[i]);
+            row["data_type"] = Value(column_attributes[i].get_data_type() == ColumnAttribute::INT ? "INT" : "TEXT");
+            columns.insert(&row);
+        }
+    }
+}
+
+// SELECT * FROM _statistics WHERE table_name = <table_name>, in the table's column order
+ColumnStatisticsList Statistics::get_statistics(Identifier table_name) {
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    Tables::get_columns(table_name, column_names, column_attributes);
+
+    std::map<Identifier, ValueDict *> rows;
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = select(&where);
+    for (auto const &handle: *handles) {
+        ValueDict *row = project(handle);
+        rows[row->at("column_name").s] = row;
+    }
+    delete handles;
+
+    ColumnStatisticsList ret;
+    for (uint i = 0; i < column_names.size(); i++) {
+        if (rows.find(column_names[i]) == rows.end())
+            continue;
+        ValueDict *row = rows[column_names[i]];
+        ColumnStatistics stats;
+        stats.column_name = column_names[i];
+        stats.data_type = column_attributes[i].get_data_type();
+        stats.row_count = (u_long) row->at("row_count").n;
+        stats.analyzed_blocks = (BlockID) row->at("analyzed_blocks").n;
+        stats.tail_rows = (u_long) row->at("tail_rows").n;
+        stats.ndv = (u_long) row->at("ndv").n;
+        stats.histogram_from_string(row->at("histogram").s);
+        stats.mcv_from_string(row->at("mcv").s);
+        stats.hll = HyperLogLog::from_string(row->at("hll").s);
+        ret.push_back(stats);
+    }
+    for (auto const &entry: rows)
+        delete entry.second;
+    return ret;
+}
+
+// Read the blocks added since the last ANALYZE (or all of them), sampling if there are too many to read.
+ColumnStatisticsList Statistics::analyze(DbRelation &table, bool full, BlockID &blocks_read) {
+    Identifier table_name = table.get_table_name();
+    const ColumnNames &column_names = table.get_column_names();
+    ColumnAttributes column_attributes = table.get_column_attributes();
+    BlockID blocks = table.get_block_count();
+
+    ColumnStatisticsList statistics = get_statistics(table_name);
+    bool incremental = !full && statistics.size() == column_names.size() && statistics[0].analyzed_blocks > 0
+                       && statistics[0].analyzed_blocks <= blocks;
+    if (!incremental) {
+        statistics.clear();
+        for (uint i = 0; i < column_names.size(); i++) {
+            ColumnStatistics stats;
+            stats.column_name = column_names[i];
+            stats.data_type = column_attributes[i].get_data_type();
+            statistics.push_back(stats);
+        }
+    }
+    BlockID first = incremental ? statistics[0].analyzed_blocks : 1;
+    u_long base_rows = incremental ? statistics[0].row_count - statistics[0].tail_rows : 0;
+
+    // always read the last block (so we know exactly how many rows it has), plus a random sample of the rest
+    BlockIDs others;
+    for (BlockID block_id = first; block_id < blocks; block_id++)
+        others.push_back(block_id);
+    u_long other_blocks = others.size();
+    if (others.size() > SAMPLE_BLOCKS - 1) {
+        std::mt19937 random(blocks);
+        for (uint i = 0; i < SAMPLE_BLOCKS - 1; i++)
+            std::swap(others[i], others[i + random() % (others.size() - i)]);
+        others.resize(SAMPLE_BLOCKS - 1);
+    }
+    others.push_back(blocks);
+    blocks_read = (BlockID) others.size();
+
+    std::vector<ColumnSample> samples(column_names.size());
+    u_long tail_rows = 0, other_rows = 0;
+    for (auto const &block_id: others) {
+        Handles handles;
+        ValueDicts *rows = table.project_block(block_id, handles);
+        if (block_id == blocks)
+            tail_rows = rows->size();
+        else
+            other_rows += rows->size();
+        for (auto const &row: *rows) {
+            for (uint i = 0; i < column_names.size(); i++) {
+                Value value = row->at(column_names[i]);
+                value.data_type = statistics[i].data_type;
+                samples[i].add(value);
+            }
+            delete row;
+        }
+        delete rows;
+    }
+
+    double scale = others.size() > 1 ? (double) other_blocks / (double) (others.size() - 1) : 1.0;
+    u_long sampled_rows = tail_rows + (u_long) llround((double) other_rows * scale);
+    double row_scale = tail_rows + other_rows > 0 ? (double) sampled_rows / (double) (tail_rows + other_rows) : 1.0;
+    for (uint i = 0; i < column_names.size(); i++)
+        statistics[i].refresh(samples[i], row_scale, base_rows, sampled_rows, tail_rows, blocks);
+    put_statistics(table_name, statistics);
+    return statistics;
+}
+
+// DELETE FROM _statistics WHERE table_name = <table_name>
+void Statistics::drop_statistics(Identifier table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = select(&where);
+    for (auto const &handle: *handles)
+        del(handle);
+    delete handles;
+}
+
+// Replace all the rows for the table.
+void Statistics::put_statistics(Identifier table_name, const ColumnStatisticsList &statistics) {
+    drop_statistics(table_name);
+    for (auto const &stats: statistics) {
+        ValueDict row;
+        row["table_name"] = Value(table_name);
+        row["column_name"] = Value(stats.column_name);
+        row["row_count"] = Value((int32_t) stats.row_count);
+        row["analyzed_blocks"] = Value((int32_t) stats.analyzed_blocks);
+        row["tail_rows"] = Value((int32_t) stats.tail_rows);
+        row["ndv"] = Value((int32_t) stats.ndv);
+        row["histogram"] = Value(stats.histogram_to_string());
+        row["mcv"] = Value(stats.mcv_to_string());
+        row["hll"] = Value(stats.hll.to_string());
+        insert(&row);
+    }
+}
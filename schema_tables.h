@@ -2,12 +2,15 @@
  * @file schema_tables.h - schema table classes:
  * 		Columns
  * 		Tables
+ * 		Indices
+ * 		Statistics
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2021"
  */
 #pragma once
 
 #include "heap_storage.h"
+#include "ColumnStatistics.h"
 
 /**
  * Initialize access to the schema tables.
@@ -60,6 +63,13 @@ public:
      */
     static DbRelation &get_table(Identifier table_name);
 
+    /**
+     * Is this one of the schema tables (_tables, _columns, _indices, _statistics)?
+     * @param table_name  table to check
+     * @returns           true if it is
+     */
+    static bool is_schema_table(Identifier table_name);
+
 protected:
     // hard-coded columns for _tables table
     static ColumnNames &COLUMN_NAMES();
@@ -122,12 +132,16 @@ public:
      * @param index_name      name of index (unique by table)
      * @param column_names    returned by reference: list of column names
      *                        in search key in order
-     * @param is_hash         returned by reference: set to False if the
-     *                        requested index is a btree index
+     * @param index_type      returned by reference: BTREE, HASH, or BITMAP
      * @param is_unique       search key for this index is a key for the relation
+     * @param include_names   returned by reference: list of the non-key columns the index also keeps, in order
+     *                        (their seq_in_index is -1, -2, ...)
+     * @param predicate       returned by reference: the column values a row has to have to be in a partial index
+     *                        (empty for an index of every row)
      */
-    virtual void get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
-                             bool &is_unique);
+    virtual void get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names,
+                             Identifier &index_type,
+                             bool &is_unique, ColumnNames &include_names, ValueDict &predicate);
 
     /**
      * Get the instantiated DbIndex for the given index.
@@ -144,6 +158,12 @@ public:
      */
     virtual IndexNames get_index_names(Identifier table_name);
 
+    /**
+     * Close and forget every index get_index() has handed out (an LSM index's compactor is stopped, and any run
+     * it is partway through writing is abandoned and dropped).
+     */
+    static void close_all();
+
     // overrides
     virtual Handle insert(const ValueDict *row);
 
@@ -158,3 +178,65 @@ private:
     static std::map<std::pair<Identifier, Identifier>, DbIndex *> index_cache;
 };
 
+
+
+/**
+ * @class Statistics - The singleton table that stores what ANALYZE found out about each column of each
+ * table (one row per column; see ColumnStatistics).
+ */
+class Statistics : public HeapTable {
+public:
+    /**
+     * Name of the statistics table ("_statistics")
+     */
+    static const Identifier TABLE_NAME;
+
+    /**
+     * Most blocks read by one ANALYZE -- beyond this, blocks are sampled.
+     */
+    static const uint SAMPLE_BLOCKS = 100;
+
+    // ctor/dtor
+    Statistics();
+
+    virtual ~Statistics() {}
+
+    /**
+     * Describe _statistics in _tables and _columns if it isn't there yet. Done whenever the database is
+     * opened, since one made before ANALYZE existed doesn't have it.
+     * @param tables   the _tables table
+     * @param columns  the _columns table
+     */
+    static void add_to_schema(Tables &tables, Columns &columns);
+
+    /**
+     * Get the statistics for every analyzed column of a table.
+     * @param table_name  table to get statistics for
+     * @returns           statistics in column order (empty if the table has never been analyzed)
+     */
+    virtual ColumnStatisticsList get_statistics(Identifier table_name);
+
+    /**
+     * Execute: ANALYZE <table> [FULL]
+     * Unless full is set and as long as the table hasn't shrunk since it was last analyzed, only reads
+     * the blocks added since then (and the last block analyzed then, since it may have grown).
+     * @param table        table to analyze
+     * @param full         throw away the old statistics and start over
+     * @param blocks_read  returned by reference: number of blocks read
+     * @returns            the new statistics
+     */
+    virtual ColumnStatisticsList analyze(DbRelation &table, bool full, BlockID &blocks_read);
+
+    /**
+     * Forget everything known about a table.
+     * @param table_name  table being dropped
+     */
+    virtual void drop_statistics(Identifier table_name);
+
+protected:
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+
+    virtual void put_statistics(Identifier table_name, const ColumnStatisticsList &statistics);
+};
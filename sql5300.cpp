@@ -6,11 +6,19 @@
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 #include "db_cxx.h"
 #include "SQLParser.h"
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
 #include "btree.h"
+#include "HashIndex.h"
+#include "BitmapIndex.h"
+#include "LSMIndex.h"
+#include "LearnedIndex.h"
+#include "ARTIndex.h"
+#include "EvalPlan.h"
 
 using namespace std;
 using namespace hsql;
@@ -20,6 +28,11 @@ using namespace hsql;
  */
 void initialize_environment(char *envHome);
 
+/*
+ * run the benchmarks, or just the one named
+ */
+void run_benchmarks(const string &name);
+
 
 /**
  * Main entry point of the sql5300 program
@@ -46,6 +59,39 @@ int main(int argc, char *argv[]) {
         if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
             cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+            cout << "test_hash_index: " << (test_hash_index() ? "ok" : "failed") << endl;
+            cout << "test_bitmap_index: " << (test_bitmap_index() ? "ok" : "failed") << endl;
+            cout << "test_lsm_index: " << (test_lsm_index() ? "ok" : "failed") << endl;
+            cout << "test_learned_index: " << (test_learned_index() ? "ok" : "failed") << endl;
+            cout << "test_art_index: " << (test_art_index() ? "ok" : "failed") << endl;
+            cout << "test_column_statistics: " << (test_column_statistics() ? "ok" : "failed") << endl;
+            cout << "test_eval_plan: " << (test_eval_plan() ? "ok" : "failed") << endl;
+            continue;
+        }
+        if (query == "bench" || query.compare(0, 6, "bench ") == 0) {
+            run_benchmarks(query.size() > 6 ? query.substr(6) : "");
+            continue;
+        }
+
+        // our own statements the Hyrise parser doesn't know about
+        ExtendedStatement *extended = nullptr;
+        try {
+            extended = ExtendedStatement::parse(query);
+        } catch (ExtendedSQLError &e) {
+            cout << "invalid SQL: " << query << endl;
+            cout << e.what() << endl;
+            continue;
+        }
+        if (extended != nullptr) {
+            try {
+                cout << extended->to_string() << endl;
+                QueryResult *result = SQLExec::execute(extended);
+                cout << *result << endl;
+                delete result;
+            } catch (SQLExecError &e) {
+                cout << "Error: " << e.what() << endl;
+            }
+            delete extended;
             continue;
         }
 
@@ -69,6 +115,7 @@ int main(int argc, char *argv[]) {
         }
         delete parse;
     }
+    SQLExec::shutdown();  // (lets background work on the indices finish first)
     return EXIT_SUCCESS;
 }
 
@@ -81,7 +128,10 @@ void initialize_environment(char *envHome) {
     env->set_message_stream(&cout);
     env->set_error_stream(&cerr);
     try {
-        env->open(envHome, DB_CREATE | DB_INIT_MPOOL, 0);
+        // DB_THREAD since LSM compactors and index builds use the environment from threads of their own (each of
+        // their Db handles is only ever used by one thread at a time, under its owner's latch, so those aren't
+        // opened free-threaded)
+        env->open(envHome, DB_CREATE | DB_INIT_MPOOL | DB_THREAD, 0);
     } catch (DbException &exc) {
         cerr << "(sql5300: " << exc.what() << ")" << endl;
         exit(1);
@@ -89,3 +139,23 @@ void initialize_environment(char *envHome) {
     _DB_ENV = env;
     initialize_schema_tables();
 }
+
+void run_benchmarks(const string &name) {
+    const vector<pair<string, void (*)()>> benchmarks = {
+            {"hash_index", bench_hash_index},
+            {"lookup_many", bench_lookup_many},
+            {"btree_keys", bench_btree_keys},
+            {"btree_build", bench_btree_build},
+            {"learned_index", bench_learned_index},
+    };
+    bool any = false;
+    for (auto const &benchmark: benchmarks) {
+        if (!name.empty() && name != benchmark.first)
+            continue;
+        cout << "bench_" << benchmark.first << ":" << endl;
+        benchmark.second();
+        any = true;
+    }
+    if (!any)
+        cout << "no benchmark named " << name << endl;
+}
@@ -9,9 +9,9 @@
 bool Value::operator==(const Value &other) const {
     if (this->data_type != other.data_type)
         return false;
-    if (this->data_type == ColumnAttribute::INT)
-        return this->n == other.n;
-    return this->s == other.s;
+    if (this->data_type == ColumnAttribute::TEXT)
+        return this->s == other.s;
+    return this->n == other.n;
 }
 
 bool Value::operator!=(const Value &other) const {
@@ -64,6 +64,14 @@ ColumnAttributes *DbRelation::get_column_attributes(const ColumnNames &select_co
     return ret;
 }
 
+// Counts the handles of a full select (storage engines that know their row count do better).
+u_long DbRelation::count() {
+    Handles *handles = select();
+    u_long ret = handles->size();
+    delete handles;
+    return ret;
+}
+
 // Just pulls out the column names from a ValueDict and passes that to the usual form of project().
 ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
     ColumnNames t;
@@ -98,3 +106,69 @@ ValueDicts *DbRelation::project(Handles *handles, const ValueDict *where) {
         ret->push_back(project(handle, &t));
     return ret;
 }
+
+bool DbIndex::covers(const ColumnNames &column_names) const {
+    for (auto const &column_name: column_names)
+        if (std::find(key_columns.begin(), key_columns.end(), column_name) == key_columns.end() &&
+            std::find(include_columns.begin(), include_columns.end(), column_name) == include_columns.end())
+            return false;
+    return true;
+}
+
+bool DbIndex::matches(const ValueDict *row) const {
+    for (auto const &term: predicate) {
+        auto value = row->find(term.first);
+        if (value == row->end() || value->second != term.second)
+            return false;
+    }
+    return true;
+}
+
+// A conjunction of equalities implies the predicate just when it would match it as a row.
+bool DbIndex::implied_by(const ValueDict *conjunction) const {
+    return matches(conjunction);
+}
+
+ValueDicts *DbIndex::project_block(BlockID block_id, Handles &handles) const {
+    ValueDicts *rows = relation.project_block(block_id, handles);
+    if (predicate.empty())
+        return rows;
+    uint kept = 0;
+    for (uint i = 0; i < rows->size(); i++) {
+        if (matches((*rows)[i])) {
+            (*rows)[kept] = (*rows)[i];
+            handles[kept++] = handles[i];
+        } else {
+            delete (*rows)[i];
+        }
+    }
+    rows->resize(kept);
+    handles.resize(kept);
+    return rows;
+}
+
+// One lookup after another. Indices that can share work between the lookups do better than this.
+HandleLists *DbIndex::lookup_many(const ValueDicts &keys) const {
+    HandleLists *ret = new HandleLists();
+    for (auto const &key: keys)
+        ret->push_back(lookup(key));
+    return ret;
+}
+
+// Without any included columns, all an index can give back are the key columns, which are the same as key_values
+// for every record it finds.
+ValueDicts *DbIndex::lookup_values(ValueDict *key_values, const ColumnNames *column_names) const {
+    for (auto const &column_name: *column_names)
+        if (std::find(key_columns.begin(), key_columns.end(), column_name) == key_columns.end())
+            throw DbRelationError("column '" + column_name + "' is not in index " + name);
+    Handles *handles = lookup(key_values);
+    ValueDicts *ret = new ValueDicts();
+    for (uint i = 0; i < handles->size(); i++) {
+        ValueDict *row = new ValueDict();
+        for (auto const &column_name: *column_names)
+            (*row)[column_name] = key_values->at(column_name);
+        ret->push_back(row);
+    }
+    delete handles;
+    return ret;
+}
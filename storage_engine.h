@@ -242,7 +242,7 @@ public:
 
     Value(int32_t n) : n(n) { data_type = ColumnAttribute::INT; }
 
-    Value(std::string s) : s(s) { data_type = ColumnAttribute::TEXT; }
+    Value(std::string s) : n(0), s(s) { data_type = ColumnAttribute::TEXT; }
 
     bool operator==(const Value &other) const;
 
@@ -261,6 +261,8 @@ typedef std::pair<BlockID, RecordID> Handle;
 typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict *> ValueDicts;
+typedef std::vector<Handles *> HandleLists;  // the handles found by each of several lookups
+typedef std::vector<std::pair<Handle, Handle> > HandleMoves;  // (old handle, new handle) of rows that moved
 
 
 /**
@@ -374,6 +376,12 @@ public:
      */
     virtual Handles *select(Handles *current_selection, const ValueDict *where) = 0;
 
+    /**
+     * Execute: SELECT COUNT(*) FROM <table_name>
+     * @returns  number of rows in the relation
+     */
+    virtual u_long count();
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -399,6 +407,45 @@ public:
      */
     virtual ValueDict *project(Handle handle, const ValueDict *column_names);
 
+    /**
+     * Keep a Bloom filter per block on each of the given columns so that scans looking for
+     * a particular value can skip most blocks without reading them.
+     * @param column_names         columns to filter on
+     * @param false_positive_rate  wanted chance that a block without the value is read anyway
+     */
+    virtual void create_bloom_filter(const ColumnNames &column_names, double false_positive_rate) {
+        throw DbRelationError("bloom filters not supported");
+    }
+
+    /**
+     * Number of blocks in the relation's file (they are numbered 1 through this).
+     * @returns  block count
+     */
+    virtual BlockID get_block_count() {
+        throw DbRelationError("block access not supported");
+    }
+
+    /**
+     * Get every row in one block, decoding each just once (SELECT * restricted to the block).
+     * @param block_id  block to read
+     * @param handles   returned by reference: handle of each row, in the same order as the rows
+     * @returns         the rows (freed by caller)
+     */
+    virtual ValueDicts *project_block(BlockID block_id, Handles &handles) {
+        throw DbRelationError("block access not supported");
+    }
+
+    /**
+     * Execute: VACUUM <table_name>
+     * Compact the rows into as few blocks as possible and give back the emptied blocks. Rows may move, so
+     * the caller must fix up any indices with the returned moves.
+     * @param moves  returned by reference: old and new handle of every row that moved
+     * @returns      number of bytes the relation's file shrank by
+     */
+    virtual u_long vacuum(HandleMoves &moves) {
+        throw DbRelationError("vacuum not supported");
+    }
+
     // additional versions of project for multiple rows
     virtual ValueDicts *project(Handles *handles);
 
@@ -446,6 +493,32 @@ protected:
 };
 
 
+/**
+ * @class IndexCursor - hands out the entries of an index scan one at a time, in key order
+ */
+class IndexCursor {
+public:
+    IndexCursor() {}
+
+    virtual ~IndexCursor() {}
+
+    IndexCursor(const IndexCursor &other) = delete;
+
+    IndexCursor(IndexCursor &&temp) = delete;
+
+    IndexCursor &operator=(const IndexCursor &other) = delete;
+
+    IndexCursor &operator=(IndexCursor &&temp) = delete;
+
+    /**
+     * Get the next entry of the scan.
+     * @param handle  returned by reference: handle of the next record
+     * @returns       false (leaving handle alone) once the scan is finished
+     */
+    virtual bool next(Handle &handle) = 0;
+};
+
+
 class DbIndex {
 public:
     /**
@@ -454,10 +527,10 @@ public:
     static const uint MAX_COMPOSITE = 32U;
 
     // ctor/dtor
-    DbIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : relation(relation),
-                                                                                           name(name),
-                                                                                           key_columns(key_columns),
-                                                                                           unique(unique) {}
+    DbIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+            ColumnNames include_columns = ColumnNames()) : relation(relation), name(name), key_columns(key_columns),
+                                                           include_columns(include_columns), unique(unique),
+                                                           predicate() {}
 
     virtual ~DbIndex() {}
 
@@ -488,16 +561,41 @@ public:
      */
     virtual Handles *lookup(ValueDict *key_values) const = 0;
 
+    /**
+     * Lookup each of several search keys.
+     * @param keys  dictionaries of values for the search keys (duplicates and keys not in the index are fine)
+     * @returns     list of DbFile handles for records with each key, in the same order as keys (freed by caller)
+     */
+    virtual HandleLists *lookup_many(const ValueDicts &keys) const;
+
+    /**
+     * Lookup a specific search key and get column values right out of the index, without going to the relation.
+     * @param key_values    dictionary of values for the search key
+     * @param column_names  which columns to get (all of them must be covered by the index)
+     * @returns             the given columns of each record with key_values (freed by caller)
+     */
+    virtual ValueDicts *lookup_values(ValueDict *key_values, const ColumnNames *column_names) const;
+
     /**
      * Lookup a range of search keys.
-     * @param min_key  dictionary of min (inclusive) search key
-     * @param max_key  dictionary of max (inclusive) search key
-     * @returns        list of DbFile handles for records in range
+     * @param min_key  dictionary of min (inclusive) search key, nullptr to start at the beginning
+     * @param max_key  dictionary of max (inclusive) search key, nullptr to go to the end
+     * @returns        list of DbFile handles for records in range (freed by caller)
      */
     virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const {
         throw DbRelationError("range index query not supported");
     }
 
+    /**
+     * Start a scan of a range of search keys, in key order, without gathering up all the handles first.
+     * @param min_key  dictionary of min (inclusive) search key, nullptr to start at the beginning
+     * @param max_key  dictionary of max (inclusive) search key, nullptr to go to the end
+     * @returns        cursor over the handles of records in range (freed by caller)
+     */
+    virtual IndexCursor *range_cursor(ValueDict *min_key, ValueDict *max_key) const {
+        throw DbRelationError("range index query not supported");
+    }
+
     /**
      * Insert the index entry for the given record.
      * @param record  handle (into relation) to the record to insert
@@ -505,6 +603,22 @@ public:
      */
     virtual void insert(Handle record) = 0;
 
+    /**
+     * Insert the index entry for the given record, whose values the caller already has.
+     * @param record  handle (into relation) to the record to insert
+     * @param row     the record's values (all of its columns), so the index needn't read it back from the relation
+     */
+    virtual void insert(Handle record, const ValueDict *row) { insert(record); }
+
+    /**
+     * Point the index entry for a record at the place the record has moved to.
+     * @param from  handle the record used to have (no longer in the relation)
+     * @param to    handle the record has now (must be in the relation)
+     */
+    virtual void relocate(Handle from, Handle to) {
+        throw DbRelationError("index relocation not supported");
+    }
+
     /**
      * Delete the index entry for the given record.
      * @param record  handle (into relation) to the record to remove
@@ -512,11 +626,65 @@ public:
      */
     virtual void del(Handle record) = 0;
 
+    /**
+     * Delete the index entry for the given record, whose values the caller already has.
+     * @param record  handle (into relation) to the record to remove
+     * @param row     the record's values (all of its columns), so the index needn't read it back from the relation
+     */
+    virtual void del(Handle record, const ValueDict *row) { del(record); }
+
+    DbRelation &get_relation() const { return this->relation; }
+
+    const ColumnNames &get_key_columns() const { return this->key_columns; }
+
+    const ColumnNames &get_include_columns() const { return this->include_columns; }
+
+    /**
+     * Can lookup_values get these columns?
+     * @param column_names  the columns
+     * @returns             true if each is a key column or an included column
+     */
+    bool covers(const ColumnNames &column_names) const;
+
+    /**
+     * The equality conjunction a row has to satisfy to be in the index, for a partial index (empty for an index of
+     * every row). Whoever inserts into, deletes from, or relocates in the index checks matches first.
+     */
+    const ValueDict &get_predicate() const { return this->predicate; }
+
+    void set_predicate(const ValueDict &predicate) { this->predicate = predicate; }
+
+    /**
+     * Does the row belong in the index?
+     * @param row  the record's values (at least the columns of the predicate)
+     * @returns    true if it satisfies the predicate
+     */
+    bool matches(const ValueDict *row) const;
+
+    /**
+     * Can a lookup for the rows satisfying the conjunction use the index? Only if every row that does is in it.
+     * @param conjunction  equality conjunction of a query
+     * @returns            true if the conjunction fixes each column of the predicate to the same value
+     */
+    bool implied_by(const ValueDict *conjunction) const;
+
 protected:
     DbRelation &relation;
     Identifier name;
     ColumnNames key_columns;
+    ColumnNames include_columns;  // non-key columns kept in the index, too, for lookup_values
     bool unique;
+    ValueDict predicate;
+
+    /**
+     * Get the rows in one block of the relation that belong in the index (see DbRelation::project_block).
+     * @param block_id  block to read
+     * @param handles   returned by reference: handle of each row, in the same order as the rows
+     * @returns         the rows that match the predicate (freed by caller)
+     */
+    ValueDicts *project_block(BlockID block_id, Handles &handles) const;
 };
 
+typedef std::vector<DbIndex *> DbIndexes;
+
 